@@ -35,34 +35,12 @@ void ExampleInRingBuffer::processRequest(const xentest_req& req)
 	rsp.seq = req.seq;
 	rsp.status = 0;
 
-	// process commands
+	// process commands: the protocol calls the command handler
 
-	switch(req.id)
+	if (!mProtocol.dispatch(*this, req, rsp))
 	{
-		case XENTEST_CMD1:
-
-			// process CMD1: req.op.command1
-
-		break;
-
-		case XENTEST_CMD2:
-
-			// process CMD2: req.op.command2
-
-		break;
-
-		case XENTEST_CMD3:
-
-			// process CMD3: req.op.command3
-
-		break;
-
-		default:
-
-			// set error status
-			rsp.status = 1;
-
-		break;
+		// set error status
+		rsp.status = 1;
 	}
 
 	// send response
@@ -70,6 +48,24 @@ void ExampleInRingBuffer::processRequest(const xentest_req& req)
 }
 //! [processRequest]
 
+void ExampleInRingBuffer::onCommand1(const xentest_command1_req& cmd,
+									 xentest_rsp& rsp)
+{
+	// process CMD1
+}
+
+void ExampleInRingBuffer::onCommand2(const xentest_command2_req& cmd,
+									 xentest_rsp& rsp)
+{
+	// process CMD2
+}
+
+void ExampleInRingBuffer::onCommand3(const xentest_command3_req& cmd,
+									 xentest_rsp& rsp)
+{
+	// process CMD3
+}
+
 //! [onBind]
 void ExampleFrontendHandler::onBind()
 {
@@ -81,8 +77,8 @@ void ExampleFrontendHandler::onBind()
 	// get out ring buffer grant table reference
 	uint32_t ref = getXenStore().readInt(getXsFrontendPath() +
 										 "/path/to/out/ref");
-	// create out ring buffer
-	mOutRingBuffer.reset(new ExampleOutRingBuffer(getDomId(), port, ref));
+	// create out ring buffer or reuse the one kept on the frontend restart
+	mOutRingBuffer = createRingBuffer<ExampleOutRingBuffer>(port, ref);
 	// add ring buffer
 	addRingBuffer(mOutRingBuffer);
 
@@ -93,8 +89,8 @@ void ExampleFrontendHandler::onBind()
 	ref = getXenStore().readInt(getXsFrontendPath() +
 								"/path/to/in/ref");
 	// create in ring buffer
-	RingBufferPtr outRingBuffer(
-			new ExampleOutRingBuffer(getDomId(), port, ref));
+	RingBufferPtr outRingBuffer =
+			createRingBuffer<ExampleOutRingBuffer>(port, ref);
 	// add ring buffer
 	addRingBuffer(outRingBuffer);
 }
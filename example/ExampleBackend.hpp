@@ -26,6 +26,7 @@
 #include <xen/be/BackendBase.hpp>
 #include <xen/be/FrontendHandlerBase.hpp>
 #include <xen/be/RingBufferBase.hpp>
+#include <xen/be/RingProtocol.hpp>
 
 #include "tests/testProtocol.h"
 
@@ -53,6 +54,7 @@ public:
 		XenBackend::RingBufferInBase<xen_test_back_ring, xen_test_sring,
 									 xentest_req, xentest_rsp>
 									(domId, port, ref),
+		mProtocol(getMetrics()),
 		mLog("InRingBuffer")
 	{
 		LOG(mLog, DEBUG) << "Create out ring buffer, dom id: " << domId;
@@ -61,9 +63,30 @@ public:
 
 private:
 
+	//! [ExampleProtocol]
+	typedef decltype(xentest_req::op) xentest_op;
+
+	// Command handlers
+	void onCommand1(const xentest_command1_req& cmd, xentest_rsp& rsp);
+	void onCommand2(const xentest_command2_req& cmd, xentest_rsp& rsp);
+	void onCommand3(const xentest_command3_req& cmd, xentest_rsp& rsp);
+
+	// Commands of the protocol
+	typedef XENBE_RING_PROTOCOL(xen_test_sring,
+		&xentest_req::id, &xentest_req::op,
+		XENBE_RING_COMMAND(XENTEST_CMD1, &xentest_op::command1,
+						   &ExampleInRingBuffer::onCommand1),
+		XENBE_RING_COMMAND(XENTEST_CMD2, &xentest_op::command2,
+						   &ExampleInRingBuffer::onCommand2),
+		XENBE_RING_COMMAND(XENTEST_CMD3, &xentest_op::command3,
+						   &ExampleInRingBuffer::onCommand3)) Protocol;
+	//! [ExampleProtocol]
+
 	// Override receiving requests
 	virtual void processRequest(const xentest_req& req) override;
 
+	Protocol mProtocol;
+
 	// XenBackend::Log can be used by backend
 	XenBackend::Log mLog;
 };
@@ -0,0 +1,136 @@
+/*
+ *  Asynchronous log backend
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_ASYNCLOG_HPP_
+#define XENBE_ASYNCLOG_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <unistd.h>
+
+#include "Exception.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by AsyncLog.
+ * @ingroup log
+ ******************************************************************************/
+class AsyncLogException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Asynchronous backend of LOG() and DLOG().
+ *
+ * When started, the log lines are not written by the logging thread. The
+ * formatted line is moved into the bounded multi-producer queue and the
+ * writer thread writes queued lines in batches with one writev() call. The
+ * logging thread doesn't take locks and doesn't wait for I/O, so a burst of
+ * logs doesn't stall ring buffer threads.
+ *
+ * If the queue is full:
+ * - in OverflowMode::Block mode the logging thread waits for the free slot,
+ * so no line is lost;
+ * - in OverflowMode::Drop mode the line is dropped and counted, so memory
+ * used by the log is bounded and logging never waits. The writer reports the
+ * number of dropped lines into the log.
+ *
+ * Lines of one thread are written in order. The output stream set by
+ * Log::setStreamBuffer() is not used while the backend is running. The
+ * number of written lines, batches and dropped lines are available in the
+ * "log" metrics group.
+ *
+ * @ingroup log
+ ******************************************************************************/
+class AsyncLog
+{
+public:
+
+	/**
+	 * Behavior when the queue is full
+	 */
+	enum class OverflowMode
+	{
+		Block, Drop
+	};
+
+	static const size_t cDefaultCapacity = 8192;
+	static const size_t cMaxBatch = 64;
+
+	/**
+	 * Starts the writer thread
+	 * @param[in] fd       file descriptor to write the log
+	 * @param[in] capacity max number of queued lines, rounded up to the
+	 *                     power of two
+	 * @param[in] mode     behavior when the queue is full
+	 */
+	static void start(int fd = STDOUT_FILENO,
+					  size_t capacity = cDefaultCapacity,
+					  OverflowMode mode = OverflowMode::Block);
+
+	/**
+	 * Writes queued lines and stops the writer thread. Log lines are written
+	 * synchronously afterwards.
+	 */
+	static void stop();
+
+	/**
+	 * Returns <i>true</i> if the writer thread is running
+	 */
+	static bool isRunning()
+	{
+		return sQueue.load(std::memory_order_acquire) != nullptr;
+	}
+
+	/**
+	 * Queues the line. The line content is taken.
+	 * @param[in] line formatted line
+	 * @return <i>false</i> if the backend is not running
+	 */
+	static bool push(std::string& line);
+
+	/**
+	 * Waits until the lines queued before are written
+	 */
+	static void flush();
+
+	/**
+	 * Returns number of dropped lines
+	 */
+	static uint64_t getNumDropped();
+
+private:
+
+	struct Queue;
+
+	static std::atomic<Queue*> sQueue;
+	static std::atomic<size_t> sNumProducers;
+
+	static void run(Queue* queue);
+	static size_t writeBatch(Queue* queue);
+};
+
+}
+
+#endif /* XENBE_ASYNCLOG_HPP_ */
@@ -24,16 +24,25 @@
 #define XENBE_BACKENDBASE_HPP_
 
 #include <atomic>
-#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "Exception.hpp"
+#include "FrontendDiscovery.hpp"
 #include "FrontendHandlerBase.hpp"
+#include "FrontendRegistry.hpp"
+#include "MetricsServer.hpp"
+#include "Reactor.hpp"
+#include "Scheduler.hpp"
 #include "XenStore.hpp"
 #include "XenStat.hpp"
 #include "Log.hpp"
+#include "Utils.hpp"
 
 namespace XenBackend {
 
@@ -77,9 +86,38 @@ class BackendException : public Exception
  *
  * @snippet ExampleBackend.cpp onNewFrontend
  *
+ * Frontends are discovered incrementally: FrontendDiscovery keeps the sorted
+ * snapshot of domains and devices, each Xen store event rescans only the
+ * changed directory and the difference is processed as one batch. Released
+ * domains are detected with \@releaseDomain watch and the list of existing
+ * domains, without reading backend entries.
+ *
  * The client may change the new frontend detection algorithm. For this
  * reason it may override getNewFrontend() method.
  *
+ * Creating and deleting frontends may take time: onNewFrontend() usually reads
+ * Xen store and stopping a frontend joins its threads. If numWorkers is set,
+ * onNewFrontend() and deleting the frontend are done on a bounded pool of
+ * worker threads, so different frontends are brought up and torn down
+ * concurrently. Operations for the same frontend are kept in order. In this
+ * case onNewFrontend() may be called from different threads at the same time.
+ *
+ * If numShards is set, the backend runs the reactor thread per shard. Each
+ * domain is assigned to the shard by its id (domId % numShards) and all its
+ * frontend handlers are handled in the shard reactor thread: ring buffer
+ * indications, Xen store callbacks and timers posted to the reactor (see
+ * FrontendHandlerBase::setReactor()). The domain may be moved to another shard
+ * with moveDomain(). rebalance() collects the load of the shards and domains
+ * since the previous call and passes it to onRebalance(), which may move a
+ * hotspot domain away from the loaded shard.
+ *
+ * The scheduler set with setScheduler() is passed to all frontend handlers,
+ * so requests of all frontends are processed with fair sharing and rate
+ * limits (see Scheduler).
+ *
+ * enableMetricsServer() exports metrics of ring buffers, frontends, reactors,
+ * Xen store and grant table over the unix socket (see MetricsServer).
+ *
  * When the backend instance is created, it should be started by calling start()
  * method. The backend will process frontends till stop() method is called.
  *
@@ -90,12 +128,39 @@ class BackendException : public Exception
 class BackendBase
 {
 public:
+
+	/**
+	 * Load of the shard since the previous rebalance.
+	 */
+	struct ShardLoad
+	{
+		/**
+		 * Shard index
+		 */
+		size_t shard;
+
+		/**
+		 * Number of events and tasks handled by the shard reactor
+		 */
+		uint64_t numEvents;
+
+		/**
+		 * Number of ring buffer indications per domain of the shard
+		 */
+		std::unordered_map<domid_t, uint64_t> domains;
+	};
+
 	/**
 	 * @param[in] name       optional backend name
 	 * @param[in] deviceName device name
-	 * @param[in] domId      domain id
+	 * @param[in] numWorkers number of threads which create and delete
+	 * frontends. If 0, frontends are created and deleted one by one on the
+	 * Xen store watch thread.
+	 * @param[in] numShards  number of reactor threads which handle frontends.
+	 * If 0, each frontend handler uses private threads.
 	 */
-	BackendBase(const std::string& name, const std::string& deviceName);
+	BackendBase(const std::string& name, const std::string& deviceName,
+				size_t numWorkers = 0, size_t numShards = 0);
 	virtual ~BackendBase();
 
 	/**
@@ -113,6 +178,49 @@ public:
 	 */
 	void waitForFinish();
 
+	/**
+	 * Hands all frontends over to the new backend process (see LiveUpgrade).
+	 * The frontends are not closed. The backend should be deleted after the
+	 * handover.
+	 * @param[in] socket unix socket connected to the new backend process
+	 */
+	void handover(int socket);
+
+	/**
+	 * Sets the scheduler for frontend handlers added after this call
+	 * @param[in] scheduler scheduler
+	 */
+	void setScheduler(SchedulerPtr scheduler);
+
+	/**
+	 * Starts serving metrics over the unix socket
+	 * @param[in] path unix socket path
+	 */
+	void enableMetricsServer(const std::string& path);
+
+	/**
+	 * Returns number of shards
+	 */
+	size_t getNumShards() const { return mShards.size(); }
+
+	/**
+	 * Returns the shard of the domain
+	 * @param[in] domId domain id
+	 */
+	size_t getShard(domid_t domId);
+
+	/**
+	 * Moves frontends of the domain to the shard
+	 * @param[in] domId domain id
+	 * @param[in] shard shard index
+	 */
+	void moveDomain(domid_t domId, size_t shard);
+
+	/**
+	 * Collects the shard load and calls onRebalance()
+	 */
+	void rebalance();
+
 	/**
 	 * Returns backend device name
 	 */
@@ -143,18 +251,67 @@ protected:
 	 */
 	void addFrontendHandler(FrontendHandlerPtr frontendHandler);
 
+	/**
+	 * Returns snapshot of the frontend handlers
+	 */
+	std::vector<FrontendHandlerPtr> getFrontendHandlers() const;
+
+	/**
+	 * Is called with the batch of frontend changes after they are processed:
+	 * onNewFrontend() is scheduled for added frontends and handlers of removed
+	 * frontends are deleted.
+	 * @param[in] changes changes
+	 */
+	virtual void onFrontendsChanged(const FrontendChanges& changes);
+
+	/**
+	 * Is called by rebalance() with the load of each shard. The client may
+	 * move loaded domains with moveDomain().
+	 * @param[in] loads shard loads
+	 */
+	virtual void onRebalance(const std::vector<ShardLoad>& loads);
+
+	/**
+	 * Returns snapshot of discovered frontends
+	 */
+	FrontendSnapshot getFrontendSnapshot() const
+	{
+		return mDiscovery.getSnapshot();
+	}
+
 private:
 
+	const std::string cIntroduceDomainPath = "@introduceDomain";
+	const std::string cReleaseDomainPath = "@releaseDomain";
+
 	domid_t mDomId;
 	std::string mDeviceName;
 	std::string mFrontendsPath;
-	std::list<domid_t> mDomainList;
-	std::list<FrontendHandlerPtr> mFrontendHandlers;
+	typedef FrontendRegistry<FrontendHandlerBase> Registry;
+
+	Registry mFrontendHandlers;
+	FrontendDiscovery mDiscovery;
+	std::mutex mMutex;
+	std::unordered_set<uint32_t> mNewFrontends;
+	WorkerPool mWorkerPool;
+	std::vector<ReactorPtr> mShards;
+	SchedulerPtr mScheduler;
+	std::unordered_map<domid_t, size_t> mDomainShards;
+	std::vector<uint64_t> mShardEvents;
+	std::unordered_map<domid_t, uint64_t> mDomainEvents;
+	std::unique_ptr<MetricsServer> mMetricsServer;
 
 	Log mLog;
 
 	void domainListChanged(const std::string& path);
+	void domainReleased(const std::string& path);
 	void deviceListChanged(const std::string& path, domid_t domId);
+	void deviceChanged(const std::string& path, domid_t domId,
+					   uint16_t devId);
+	void processChanges(const FrontendChanges& changes);
+	void scheduleFrontend(domid_t domId, uint16_t devId);
+	void createFrontend(domid_t domId, uint16_t devId);
+	void deleteFrontend(domid_t domId, uint16_t devId);
 	void frontendPathChanged(const std::string& path, domid_t domId,
 							 uint16_t devId);
 	FrontendHandlerPtr getFrontendHandler(domid_t domId, uint16_t devId);
@@ -0,0 +1,470 @@
+/*
+ *  Structured binary log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_BINARYLOG_HPP_
+#define XENBE_BINARYLOG_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Exception.hpp"
+#include "Log.hpp"
+
+/**
+ * @def BLOG(instance, level, format, ...)
+ * Logs the structured log line: <i>{}</i> in the format are replaced by the
+ * arguments. If the binary log is selected for the log instance and the
+ * binary log is opened, only the site id and the argument values are written
+ * to the binary log. Otherwise the line is formatted and logged as LOG()
+ * does. Supported arguments are integers, enums, floating point numbers,
+ * strings and pointers.
+ * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i>
+ * @param[in] level    log level
+ * @param[in] format   format string literal
+ * @ingroup log
+ */
+#define BLOG(instance, level, format, ...) \
+	do \
+	{ \
+		if (static_cast<int>(XenBackend::LogLevel::log ## level) > 0 && \
+			static_cast<int>(XenBackend::LogLevel::log ## level) <= \
+			XENBE_MAX_LOG_LEVEL && \
+			XenBackend::LogLine::isEnabled( \
+				instance, XenBackend::LogLevel::log ## level)) \
+		{ \
+			static const XenBackend::BinaryLogSite sBinaryLogSite( \
+				format, \
+				decltype(XenBackend::getBinaryLogSignature( \
+					__VA_ARGS__))::get(), \
+				__FILENAME__, __LINE__, XenBackend::LogLevel::log ## level); \
+			XenBackend::BinaryLog::write(instance, sBinaryLogSite, \
+										 ##__VA_ARGS__); \
+		} \
+	} \
+	while (0)
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by BinaryLog.
+ * @ingroup log
+ ******************************************************************************/
+class BinaryLogException : public Exception
+{
+	using Exception::Exception;
+};
+
+/// @cond HIDDEN_SYMBOLS
+
+/*
+ * Serialization of the argument type: the type code and the value bytes.
+ * Integers are written as 64-bit values, strings are prefixed with 32-bit
+ * length.
+ */
+template<typename T, typename Enable = void>
+struct BinaryLogArg;
+
+template<typename T>
+struct BinaryLogArg<T, typename std::enable_if<
+	(std::is_integral<T>::value && std::is_signed<T>::value) ||
+	std::is_enum<T>::value>::type>
+{
+	static const char cType = 'i';
+
+	static size_t getSize(T) { return sizeof(int64_t); }
+
+	static void put(uint8_t*& data, T value)
+	{
+		int64_t converted = static_cast<int64_t>(value);
+
+		memcpy(data, &converted, sizeof(converted));
+		data += sizeof(converted);
+	}
+};
+
+template<typename T>
+struct BinaryLogArg<T, typename std::enable_if<
+	std::is_integral<T>::value && std::is_unsigned<T>::value>::type>
+{
+	static const char cType = 'u';
+
+	static size_t getSize(T) { return sizeof(uint64_t); }
+
+	static void put(uint8_t*& data, T value)
+	{
+		uint64_t converted = value;
+
+		memcpy(data, &converted, sizeof(converted));
+		data += sizeof(converted);
+	}
+};
+
+template<typename T>
+struct BinaryLogArg<T, typename std::enable_if<
+	std::is_floating_point<T>::value>::type>
+{
+	static const char cType = 'd';
+
+	static size_t getSize(T) { return sizeof(double); }
+
+	static void put(uint8_t*& data, T value)
+	{
+		double converted = value;
+
+		memcpy(data, &converted, sizeof(converted));
+		data += sizeof(converted);
+	}
+};
+
+template<typename T>
+struct BinaryLogArg<T*, typename std::enable_if<
+	!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+	static const char cType = 'p';
+
+	static size_t getSize(T*) { return sizeof(uint64_t); }
+
+	static void put(uint8_t*& data, T* value)
+	{
+		uint64_t converted = reinterpret_cast<uintptr_t>(value);
+
+		memcpy(data, &converted, sizeof(converted));
+		data += sizeof(converted);
+	}
+};
+
+struct BinaryLogStringArg
+{
+	static const char cType = 's';
+
+	static size_t getSize(const char* value)
+	{
+		return sizeof(uint32_t) + (value ? strlen(value) : 0);
+	}
+
+	static size_t getSize(const std::string& value)
+	{
+		return sizeof(uint32_t) + value.length();
+	}
+
+	static void put(uint8_t*& data, const char* value)
+	{
+		put(data, value, value ? strlen(value) : 0);
+	}
+
+	static void put(uint8_t*& data, const std::string& value)
+	{
+		put(data, value.data(), value.length());
+	}
+
+	static void put(uint8_t*& data, const char* value, size_t length)
+	{
+		uint32_t size = length;
+
+		memcpy(data, &size, sizeof(size));
+		data += sizeof(size);
+
+		memcpy(data, value, length);
+		data += length;
+	}
+};
+
+template<>
+struct BinaryLogArg<char*> : public BinaryLogStringArg {};
+
+template<>
+struct BinaryLogArg<const char*> : public BinaryLogStringArg {};
+
+template<>
+struct BinaryLogArg<std::string> : public BinaryLogStringArg {};
+
+template<typename... Args>
+struct BinaryLogSignature
+{
+	static const char* get()
+	{
+		static const char sTypes[] =
+		{
+			BinaryLogArg<typename std::decay<Args>::type>::cType..., '\0'
+		};
+
+		return sTypes;
+	}
+};
+
+/*
+ * Is used in decltype only to get the signature of the BLOG() arguments
+ */
+template<typename... Args>
+BinaryLogSignature<Args...> getBinaryLogSignature(const Args&...);
+
+/// @endcond
+
+/***************************************************************************//**
+ * Source location, format and argument types of the BLOG() statement. Is
+ * created once per statement and gets the unique id.
+ * @ingroup log
+ ******************************************************************************/
+struct BinaryLogSite
+{
+	/**
+	 * @param[in] format format string
+	 * @param[in] types  argument type codes
+	 * @param[in] file   source file name
+	 * @param[in] line   source line
+	 * @param[in] level  log level
+	 */
+	BinaryLogSite(const char* format, const char* types, const char* file,
+				  int line, LogLevel level);
+	BinaryLogSite(const BinaryLogSite&) = delete;
+	BinaryLogSite& operator=(BinaryLogSite const&) = delete;
+
+	const char* format;
+	const char* types;
+	const char* file;
+	int line;
+	LogLevel level;
+	uint32_t id;
+
+	/**
+	 * Generation of the binary log file which has the site definition
+	 */
+	mutable std::atomic<uint64_t> generation;
+};
+
+/***************************************************************************//**
+ * Decoded binary log record.
+ * @ingroup log
+ ******************************************************************************/
+struct BinaryLogEntry
+{
+	/**
+	 * Real time in nanoseconds
+	 */
+	uint64_t timestamp;
+
+	/**
+	 * Id of the thread which wrote the record
+	 */
+	uint32_t threadId;
+
+	LogLevel level;
+	std::string file;
+	int line;
+
+	/**
+	 * Formatted message
+	 */
+	std::string message;
+};
+
+/***************************************************************************//**
+ * Structured binary log.
+ *
+ * BLOG() statement registers its format string and argument types once, when
+ * it is executed first time. Then each call writes only the site id, the
+ * timestamp and raw argument values, so formatting is not done at runtime.
+ * The site definition is written to the log file before the first record of
+ * the site, so the file is self-describing and is decoded offline by
+ * read() or by the xenbe-logdecode tool.
+ *
+ * The binary log is selected per log instance with Log::setBinary() or with
+ * <i>name:level:binary</i> item of Log::setLogMask(). LOG() statements of
+ * such instances are still logged as text.
+ *
+ * Records are collected in the per-thread buffer and written to the file
+ * with one write() call when the buffer is full, on flush() and on close().
+ *
+ * @ingroup log
+ ******************************************************************************/
+class BinaryLog
+{
+public:
+
+	static const size_t cBufferSize = 64 * 1024;
+	static const uint32_t cVersion = 1;
+
+	/**
+	 * Opens the binary log file
+	 * @param[in] path file path
+	 */
+	static void open(const std::string& path);
+
+	/**
+	 * Writes buffered records and closes the binary log file
+	 */
+	static void close();
+
+	/**
+	 * Returns <i>true</i> if the binary log file is opened
+	 */
+	static bool isOpen() { return sFd.load(std::memory_order_relaxed) >= 0; }
+
+	/**
+	 * Writes buffered records of all threads
+	 */
+	static void flush();
+
+	/**
+	 * Writes the record or logs the formatted line if the binary log is not
+	 * selected for the instance
+	 * @param[in] log  log instance
+	 * @param[in] site BLOG() site
+	 * @param[in] args arguments
+	 */
+	template<typename... Args>
+	static void write(const Log& log, const BinaryLogSite& site,
+					  const Args&... args)
+	{
+		if (!log.isBinary() || !writeRecord(site, args...))
+		{
+			formatText(LogLine().get(log, site.file, site.line, site.level),
+					   site.format, args...);
+		}
+	}
+
+	/**
+	 * Logs the formatted line
+	 * @param[in] name log name
+	 * @param[in] site BLOG() site
+	 * @param[in] args arguments
+	 */
+	template<typename... Args>
+	static void write(const char* name, const BinaryLogSite& site,
+					  const Args&... args)
+	{
+		formatText(LogLine().get(name, site.file, site.line, site.level),
+				   site.format, args...);
+	}
+
+	/**
+	 * Reads and formats records of the binary log file sorted by time
+	 * @param[in] path file path
+	 */
+	static std::vector<BinaryLogEntry> read(const std::string& path);
+
+	/**
+	 * Prints entries in the text log format
+	 * @param[in] entries entries
+	 * @param[in] stream  output stream
+	 */
+	static void print(const std::vector<BinaryLogEntry>& entries,
+					  std::ostream& stream);
+
+private:
+
+	struct Buffer;
+	struct Registry;
+
+	static std::atomic<int> sFd;
+
+	static Registry& getRegistry();
+	static Buffer& getBuffer();
+
+	template<typename... Args>
+	static bool writeRecord(const BinaryLogSite& site, const Args&... args)
+	{
+		size_t sizes[] = { 0, BinaryLogArg<
+			typename std::decay<Args>::type>::getSize(args)... };
+		size_t size = 0;
+
+		for(auto argSize : sizes)
+		{
+			size += argSize;
+		}
+
+		auto data = beginRecord(site, size);
+
+		if (!data)
+		{
+			return false;
+		}
+
+		int dummy[] = { 0, (BinaryLogArg<
+			typename std::decay<Args>::type>::put(data, args), 0)... };
+
+		(void)dummy;
+
+		endRecord();
+
+		return true;
+	}
+
+	static uint8_t* beginRecord(const BinaryLogSite& site, size_t size);
+	static void endRecord();
+
+	static void formatText(std::ostream& stream, const char* format)
+	{
+		stream << format;
+	}
+
+	template<typename T, typename... Args>
+	static void formatText(std::ostream& stream, const char* format,
+						   const T& value, const Args&... args)
+	{
+		auto pos = strstr(format, "{}");
+
+		if (!pos)
+		{
+			stream << format;
+
+			return;
+		}
+
+		stream.write(format, pos - format);
+
+		formatValue(stream, value);
+
+		formatText(stream, pos + 2, args...);
+	}
+
+	// characters are integers in the binary log, so they are printed as
+	// numbers in the text log as well
+
+	template<typename T>
+	static void formatValue(std::ostream& stream, const T& value)
+	{
+		stream << value;
+	}
+
+	static void formatValue(std::ostream& stream, char value)
+	{
+		stream << static_cast<int>(value);
+	}
+
+	static void formatValue(std::ostream& stream, signed char value)
+	{
+		stream << static_cast<int>(value);
+	}
+
+	static void formatValue(std::ostream& stream, unsigned char value)
+	{
+		stream << static_cast<unsigned>(value);
+	}
+};
+
+}
+
+#endif /* XENBE_BINARYLOG_HPP_ */
@@ -0,0 +1,159 @@
+/*
+ *  Callback monitor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_CALLBACKMONITOR_HPP_
+#define XENBE_CALLBACKMONITOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace XenBackend {
+
+/**
+ * Thread which dispatches the callback.
+ * @ingroup backend
+ */
+enum class CallbackSource
+{
+	EventChannel, XenStoreWatch, AsyncContext, Timer, ReactorTask
+};
+
+/***************************************************************************//**
+ * Callback which has exceeded the slow callback threshold.
+ * @ingroup backend
+ ******************************************************************************/
+struct SlowCallback
+{
+	CallbackSource source;
+
+	/**
+	 * Event channel port or -1
+	 */
+	int port;
+
+	/**
+	 * Watch path or empty
+	 */
+	std::string path;
+
+	/**
+	 * Time from the event being ready to the callback start
+	 */
+	std::chrono::nanoseconds lag;
+
+	/**
+	 * Time the callback has run
+	 */
+	std::chrono::nanoseconds duration;
+};
+
+/***************************************************************************//**
+ * Measures callbacks dispatched by XenEvtchn, XenStore, AsyncContext,
+ * TimerWheel and Reactor threads.
+ *
+ * For each callback the dispatch lag and the duration are recorded. The lag
+ * is the time from the event being ready to the callback start: from the
+ * poll wake up for event channels and watches, from AsyncContext::call() for
+ * async calls, from the expiration time for timers and from the post time or
+ * the deadline for reactor tasks. Event channels handled by the reactor
+ * take the wake up of the reactor, so the lag includes callbacks run before
+ * in the same batch of events. Both are recorded in
+ * nanoseconds into the <i>lag</i> and <i>duration</i> histograms of the
+ * source in the "callbacks" metrics group.
+ *
+ * If the slow callback hook is set, it is called by the dispatching thread
+ * after each callback which lag or duration exceeds the threshold. The hook
+ * should not block as it delays next events of the thread and should not
+ * throw.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class CallbackMonitor
+{
+public:
+
+	typedef std::function<void(const SlowCallback&)> SlowCallbackHook;
+
+	/**
+	 * Sets the hook called on slow callbacks
+	 * @param[in] hook      hook, nullptr removes the hook
+	 * @param[in] threshold max lag or duration of the callback
+	 */
+	static void setSlowCallbackHook(SlowCallbackHook hook,
+									std::chrono::nanoseconds threshold);
+
+	/**
+	 * Returns the source name used in metrics
+	 * @param[in] source callback source
+	 */
+	static const char* getSourceName(CallbackSource source);
+
+	/**
+	 * Measures one callback from the construction to the destruction
+	 */
+	class Scope
+	{
+	public:
+
+		/**
+		 * @param[in] source    callback source
+		 * @param[in] readyTime time of the event, LatencyTracker::getTime()
+		 *                      clock
+		 * @param[in] port      event channel port
+		 */
+		Scope(CallbackSource source, int64_t readyTime, int port = -1);
+
+		/**
+		 * @param[in] source    callback source
+		 * @param[in] readyTime time of the event, LatencyTracker::getTime()
+		 *                      clock
+		 * @param[in] path      watch path, is referenced until destruction
+		 */
+		Scope(CallbackSource source, int64_t readyTime,
+			  const std::string& path);
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(Scope const&) = delete;
+		~Scope();
+
+	private:
+
+		CallbackSource mSource;
+		int64_t mReadyTime;
+		int64_t mStartTime;
+		int mPort;
+		const std::string* mPath;
+	};
+
+private:
+
+	// 0 if the hook is not set
+	static std::atomic<int64_t> sThreshold;
+
+	static void record(CallbackSource source, int port,
+					   const std::string* path, int64_t lag, int64_t duration);
+};
+
+}
+
+#endif /* XENBE_CALLBACKMONITOR_HPP_ */
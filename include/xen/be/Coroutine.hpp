@@ -0,0 +1,614 @@
+/*
+ *  C++20 coroutine API
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_COROUTINE_HPP_
+#define XENBE_COROUTINE_HPP_
+
+#if !defined(__cpp_impl_coroutine)
+#error "Coroutine.hpp requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Log.hpp"
+#include "Reactor.hpp"
+#include "RingBufferBase.hpp"
+#include "XenStore.hpp"
+#include "XenStoreClient.hpp"
+
+namespace XenBackend {
+
+template<typename T = void>
+class CoTask;
+
+/// @cond HIDDEN_SYMBOLS
+namespace CoDetail {
+
+struct PromiseBase
+{
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+	bool detached = false;
+
+	// resumes the awaiting coroutine or destroys the detached one
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(
+				std::coroutine_handle<Promise> handle) noexcept
+		{
+			auto& promise = handle.promise();
+
+			if (promise.continuation)
+			{
+				return promise.continuation;
+			}
+
+			if (promise.detached)
+			{
+				promise.logException();
+
+				handle.destroy();
+			}
+
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception() { exception = std::current_exception(); }
+
+	void rethrow()
+	{
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+	}
+
+	void logException()
+	{
+		try
+		{
+			rethrow();
+		}
+		catch(const std::exception& e)
+		{
+			LOG("Coroutine", ERROR) << e.what();
+		}
+		catch(...)
+		{
+			LOG("Coroutine", ERROR) << "Unknown exception";
+		}
+	}
+};
+
+template<typename T>
+struct Promise : public PromiseBase
+{
+	std::optional<T> value;
+
+	CoTask<T> get_return_object();
+
+	void return_value(T result) { value = std::move(result); }
+
+	T getResult()
+	{
+		rethrow();
+
+		return std::move(*value);
+	}
+};
+
+template<>
+struct Promise<void> : public PromiseBase
+{
+	CoTask<void> get_return_object();
+
+	void return_void() {}
+
+	void getResult() { rethrow(); }
+};
+
+}
+/// @endcond
+
+/***************************************************************************//**
+ * Coroutine returning the value of type T.
+ *
+ * The coroutine starts when it is awaited and resumes the awaiting coroutine
+ * when it is completed. An exception thrown by the coroutine is rethrown to
+ * the awaiting one. The top level coroutine is started with detach(): it
+ * owns itself and is destroyed when completed, its exception is logged.
+ *
+ * Coroutines don't have threads: they run on the thread which resumes them.
+ * Awaitables of this API resume coroutines in the reactor thread, so
+ * coroutines of one reactor don't need locking.
+ *
+ * Arguments are copied to the coroutine frame but lambda captures are not:
+ * captures of a lambda coroutine are valid only while the lambda object
+ * exists, which usually ends before the first suspension.
+ *
+ * @code
+ * CoTask<int> getState(CoXenStore& store, std::string path)
+ * {
+ *     co_return std::stoi(co_await store.read(path));
+ * }
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+template<typename T>
+class CoTask
+{
+public:
+
+	typedef CoDetail::Promise<T> promise_type;
+
+	explicit CoTask(std::coroutine_handle<promise_type> handle) :
+		mHandle(handle) {}
+
+	CoTask(CoTask&& other) noexcept :
+		mHandle(std::exchange(other.mHandle, nullptr)) {}
+
+	CoTask& operator=(CoTask&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+
+			mHandle = std::exchange(other.mHandle, nullptr);
+		}
+
+		return *this;
+	}
+
+	CoTask(const CoTask&) = delete;
+	CoTask& operator=(CoTask const&) = delete;
+
+	~CoTask() { reset(); }
+
+	/**
+	 * Starts the coroutine which is destroyed when completed
+	 */
+	void detach()
+	{
+		auto handle = std::exchange(mHandle, nullptr);
+
+		handle.promise().detached = true;
+
+		handle.resume();
+	}
+
+	/// @cond HIDDEN_SYMBOLS
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(
+			std::coroutine_handle<> awaiting) noexcept
+	{
+		mHandle.promise().continuation = awaiting;
+
+		return mHandle;
+	}
+
+	T await_resume() { return mHandle.promise().getResult(); }
+	/// @endcond
+
+private:
+
+	std::coroutine_handle<promise_type> mHandle;
+
+	void reset()
+	{
+		if (mHandle)
+		{
+			mHandle.destroy();
+
+			mHandle = nullptr;
+		}
+	}
+};
+
+/// @cond HIDDEN_SYMBOLS
+namespace CoDetail {
+
+template<typename T>
+CoTask<T> Promise<T>::get_return_object()
+{
+	return CoTask<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> Promise<void>::get_return_object()
+{
+	return CoTask<void>(
+			std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}
+/// @endcond
+
+/***************************************************************************//**
+ * Coroutine wrapper of XenStoreClient.
+ *
+ * Requests are sent by the client when awaited, the awaiting coroutine is
+ * resumed in the reactor thread when the reply is received. Failed requests
+ * throw XenStoreException, also the requests which are pending when the
+ * client connection fails. The client may be processed by any thread, for
+ * example by the same reactor:
+ *
+ * @code
+ * reactor->addFd(client.getFd(), [&client] { client.process(); });
+ * @endcode
+ *
+ * Sending doesn't block the reactor: the request which doesn't fit the socket
+ * is queued by the client and written by process() when xenstored reads the
+ * previous ones. The coroutine must not wait for the client future on the
+ * reactor thread, it should await the request instead.
+ *
+ * The awaiting coroutine should not be destroyed until the reply is
+ * received.
+ * @ingroup xen
+ ******************************************************************************/
+class CoXenStore
+{
+public:
+
+	/// @cond HIDDEN_SYMBOLS
+	class AwaiterBase
+	{
+	public:
+
+		bool await_ready() const noexcept { return false; }
+
+	protected:
+
+		AwaiterBase(ReactorPtr reactor, std::string message) :
+			mReactor(reactor), mMessage(std::move(message)), mError(0) {}
+
+		ReactorPtr mReactor;
+		std::string mMessage;
+		int mError;
+		std::coroutine_handle<> mHandle;
+
+		void complete(int error)
+		{
+			auto handle = mHandle;
+
+			mError = error;
+
+			mReactor->post([handle] { handle.resume(); });
+		}
+
+		void check()
+		{
+			if (mError)
+			{
+				throw XenStoreException(mMessage, mError);
+			}
+		}
+	};
+
+	template<typename T>
+	class ValueAwaiter : public AwaiterBase
+	{
+	public:
+
+		typedef std::function<void(ValueAwaiter*)> Start;
+
+		ValueAwaiter(ReactorPtr reactor, std::string message, Start start) :
+			AwaiterBase(reactor, std::move(message)), mStart(start) {}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			mHandle = handle;
+
+			mStart(this);
+		}
+
+		T await_resume()
+		{
+			check();
+
+			return std::move(mValue);
+		}
+
+		void complete(int error, const T& value)
+		{
+			mValue = value;
+
+			AwaiterBase::complete(error);
+		}
+
+	private:
+
+		Start mStart;
+		T mValue;
+	};
+
+	class DoneAwaiter : public AwaiterBase
+	{
+	public:
+
+		typedef std::function<void(DoneAwaiter*)> Start;
+
+		DoneAwaiter(ReactorPtr reactor, std::string message, Start start) :
+			AwaiterBase(reactor, std::move(message)), mStart(start) {}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			mHandle = handle;
+
+			mStart(this);
+		}
+
+		void await_resume() { check(); }
+
+		void complete(int error) { AwaiterBase::complete(error); }
+
+	private:
+
+		Start mStart;
+	};
+	/// @endcond
+
+	/**
+	 * @param client  Xen Store client
+	 * @param reactor reactor to resume coroutines
+	 */
+	CoXenStore(XenStoreClient& client, ReactorPtr reactor) :
+		mClient(client), mReactor(reactor) {}
+
+	/**
+	 * Reads XS entry
+	 * @param path path to the entry
+	 * @return awaitable of the entry value
+	 */
+	ValueAwaiter<std::string> read(const std::string& path)
+	{
+		return ValueAwaiter<std::string>(mReactor, "Can't read from: " + path,
+			[this, path](ValueAwaiter<std::string>* awaiter)
+			{
+				mClient.read(path, [awaiter](int error,
+											 const std::string& value)
+							 { awaiter->complete(error, value); });
+			});
+	}
+
+	/**
+	 * Writes XS entry
+	 * @param path  path to the entry
+	 * @param value value to write
+	 * @return awaitable of the request completion
+	 */
+	DoneAwaiter write(const std::string& path, const std::string& value)
+	{
+		return DoneAwaiter(mReactor, "Can't write value to " + path,
+			[this, path, value](DoneAwaiter* awaiter)
+			{
+				mClient.write(path, value, [awaiter](int error)
+							  { awaiter->complete(error); });
+			});
+	}
+
+	/**
+	 * Removes XS entry
+	 * @param path path to the entry
+	 * @return awaitable of the request completion
+	 */
+	DoneAwaiter remove(const std::string& path)
+	{
+		return DoneAwaiter(mReactor, "Can't remove path " + path,
+			[this, path](DoneAwaiter* awaiter)
+			{
+				mClient.remove(path, [awaiter](int error)
+							   { awaiter->complete(error); });
+			});
+	}
+
+	/**
+	 * Reads XS directory
+	 * @param path path to the directory
+	 * @return awaitable of the directory items
+	 */
+	ValueAwaiter<std::vector<std::string>> readDirectory(
+			const std::string& path)
+	{
+		return ValueAwaiter<std::vector<std::string>>(mReactor,
+			"Can't read directory: " + path,
+			[this, path](ValueAwaiter<std::vector<std::string>>* awaiter)
+			{
+				mClient.readDirectory(path,
+					[awaiter](int error, const std::vector<std::string>& items)
+					{ awaiter->complete(error, items); });
+			});
+	}
+
+private:
+
+	XenStoreClient& mClient;
+	ReactorPtr mReactor;
+};
+
+/***************************************************************************//**
+ * Input ring buffer handled by coroutines.
+ *
+ * Requests are awaited with nextRequest() instead of overriding
+ * processRequest(). serve() runs the loop which awaits requests and starts
+ * the handler coroutine for each of them: the value returned by co_return is
+ * sent with sendResponse(). Handlers run concurrently, so requests are
+ * pipelined: responses are sent in the completion order.
+ *
+ * @code
+ * ringBuffer->start(reactor);
+ * ringBuffer->serve([&store](Req req) -> CoTask<Rsp>
+ * {
+ *     Rsp rsp {};
+ *
+ *     rsp.value = std::stoi(co_await store.read(getPath(req)));
+ *
+ *     co_return rsp;
+ * });
+ * @endcode
+ *
+ * The ring buffer should be started with the reactor the coroutines are
+ * resumed by, so requests and replies are handled by one thread. The
+ * coroutine awaiting the request is destroyed with the ring buffer; the
+ * response of the handler completed after that is dropped.
+ * @ingroup backend
+ ******************************************************************************/
+template<typename Ring, typename Page, typename Req, typename Rsp>
+class CoRingBufferIn : public RingBufferInBase<Ring, Page, Req, Rsp>
+{
+public:
+
+	/**
+	 * Handler of the request. Takes the request by value as the coroutine
+	 * outlives the ring slot.
+	 */
+	typedef std::function<CoTask<Rsp>(Req req)> Handler;
+
+	/// @cond HIDDEN_SYMBOLS
+	class RequestAwaiter
+	{
+	public:
+
+		explicit RequestAwaiter(CoRingBufferIn& ring) : mRing(ring) {}
+
+		bool await_ready() const noexcept { return !mRing.mRequests.empty(); }
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			mRing.mWaiting = handle;
+		}
+
+		Req await_resume()
+		{
+			auto req = mRing.mRequests.front();
+
+			mRing.mRequests.pop_front();
+
+			return req;
+		}
+
+	private:
+
+		CoRingBufferIn& mRing;
+	};
+	/// @endcond
+
+	/**
+	 * @param[in] domId frontend domain id
+	 * @param[in] port  event channel port number
+	 * @param[in] ref   ring buffer ref number
+	 * @param[in] size  ring buffer size
+	 */
+	CoRingBufferIn(domid_t domId, evtchn_port_t port, grant_ref_t ref,
+				   int size = XC_PAGE_SIZE) :
+		RingBufferInBase<Ring, Page, Req, Rsp>(domId, port, ref, size),
+		mAlive(std::make_shared<bool>(true)) {}
+
+	~CoRingBufferIn()
+	{
+		this->stop();
+
+		if (mWaiting)
+		{
+			mWaiting.destroy();
+		}
+	}
+
+	/**
+	 * Returns awaitable of the next request. Only one coroutine may await
+	 * the request.
+	 */
+	RequestAwaiter nextRequest() { return RequestAwaiter(*this); }
+
+	/**
+	 * Starts handling requests with the handler. Should be called once.
+	 * @param[in] handler request handler
+	 */
+	void serve(Handler handler)
+	{
+		mHandler = handler;
+
+		serveRequests().detach();
+	}
+
+protected:
+
+	void processRequest(const Req& req) override
+	{
+		mRequests.push_back(req);
+
+		if (mWaiting)
+		{
+			std::exchange(mWaiting, nullptr).resume();
+		}
+	}
+
+private:
+
+	std::deque<Req> mRequests;
+	std::coroutine_handle<> mWaiting;
+	Handler mHandler;
+	std::shared_ptr<bool> mAlive;
+
+	CoTask<void> serveRequests()
+	{
+		while (true)
+		{
+			auto req = co_await nextRequest();
+
+			handleRequest(req).detach();
+		}
+	}
+
+	CoTask<void> handleRequest(Req req)
+	{
+		// the handler object keeps captures of the handler coroutine
+
+		std::weak_ptr<bool> alive = mAlive;
+		auto handler = mHandler;
+
+		auto rsp = co_await handler(req);
+
+		if (!alive.expired())
+		{
+			this->sendResponse(rsp);
+		}
+	}
+};
+
+}
+
+#endif /* XENBE_COROUTINE_HPP_ */
@@ -0,0 +1,349 @@
+/*
+ *  Work-stealing executor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_EXECUTOR_HPP_
+#define XENBE_EXECUTOR_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Move-only callable without arguments.
+ *
+ * Callables up to cInlineSize bytes are stored inside the task, so posting
+ * a lambda with a few captures doesn't allocate memory. Bigger callables are
+ * allocated on the heap. Unlike std::function the callable may be move-only.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class ExecutorTask
+{
+public:
+
+	static const size_t cInlineSize = 48;
+
+	ExecutorTask() : mOps(nullptr) {}
+
+	/**
+	 * @param[in] func callable
+	 */
+	template<typename F, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<F>::type, ExecutorTask>::value>::type>
+	ExecutorTask(F&& func) : mOps(nullptr)
+	{
+		typedef typename std::decay<F>::type Func;
+
+		init<Func>(std::forward<F>(func),
+				   std::integral_constant<bool, isInline<Func>()>());
+	}
+
+	ExecutorTask(ExecutorTask&& other) noexcept : mOps(other.mOps)
+	{
+		if (mOps)
+		{
+			mOps->move(mStorage, other.mStorage);
+			other.reset();
+		}
+	}
+
+	ExecutorTask& operator=(ExecutorTask&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+
+			if (other.mOps)
+			{
+				mOps = other.mOps;
+				mOps->move(mStorage, other.mStorage);
+				other.reset();
+			}
+		}
+
+		return *this;
+	}
+
+	ExecutorTask(const ExecutorTask&) = delete;
+	ExecutorTask& operator=(ExecutorTask const&) = delete;
+
+	~ExecutorTask() { reset(); }
+
+	/**
+	 * Returns <i>true</i> if the task has the callable
+	 */
+	explicit operator bool() const { return mOps != nullptr; }
+
+	/**
+	 * Calls the callable
+	 */
+	void operator()() { mOps->call(mStorage); }
+
+	/**
+	 * Destroys the callable
+	 */
+	void reset()
+	{
+		if (mOps)
+		{
+			mOps->destroy(mStorage);
+			mOps = nullptr;
+		}
+	}
+
+private:
+
+	struct Ops
+	{
+		void (*call)(void* storage);
+		void (*move)(void* to, void* from);
+		void (*destroy)(void* storage);
+	};
+
+	template<typename F>
+	static constexpr bool isInline()
+	{
+		return sizeof(F) <= cInlineSize &&
+			   alignof(F) <= alignof(std::max_align_t) &&
+			   std::is_nothrow_move_constructible<F>::value;
+	}
+
+	// the callable is stored in the task
+	template<typename F>
+	struct InlineOps
+	{
+		static void call(void* storage) { (*static_cast<F*>(storage))(); }
+
+		static void move(void* to, void* from)
+		{
+			new (to) F(std::move(*static_cast<F*>(from)));
+		}
+
+		static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+
+		static const Ops* get()
+		{
+			static const Ops sOps = { call, move, destroy };
+
+			return &sOps;
+		}
+	};
+
+	// the pointer to the callable is stored in the task
+	template<typename F>
+	struct HeapOps
+	{
+		static F*& getPtr(void* storage) { return *static_cast<F**>(storage); }
+
+		static void call(void* storage) { (*getPtr(storage))(); }
+
+		static void move(void* to, void* from)
+		{
+			new (to) F*(getPtr(from));
+			getPtr(from) = nullptr;
+		}
+
+		static void destroy(void* storage) { delete getPtr(storage); }
+
+		static const Ops* get()
+		{
+			static const Ops sOps = { call, move, destroy };
+
+			return &sOps;
+		}
+	};
+
+	const Ops* mOps;
+	alignas(std::max_align_t) unsigned char mStorage[cInlineSize];
+
+	template<typename Func, typename F>
+	void init(F&& func, std::true_type)
+	{
+		new (mStorage) Func(std::forward<F>(func));
+
+		mOps = InlineOps<Func>::get();
+	}
+
+	template<typename Func, typename F>
+	void init(F&& func, std::false_type)
+	{
+		new (mStorage) Func*(new Func(std::forward<F>(func)));
+
+		mOps = HeapOps<Func>::get();
+	}
+};
+
+/***************************************************************************//**
+ * Shared pool of worker threads with work stealing.
+ *
+ * Each worker has its own deque of tasks, so workers don't contend on one
+ * queue. A task posted by a worker is put to its own deque, so related tasks
+ * run on the same thread. A task posted by other threads is put to the
+ * workers' deques in turn. The worker takes tasks from the front of its deque
+ * and, when it is empty, steals tasks from the front of other workers'
+ * deques. Tasks don't have any order: use SerialExecutor to run tasks one
+ * after another.
+ *
+ * Exceptions thrown by tasks are logged.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class Executor
+{
+public:
+
+	/**
+	 * @param[in] numWorkers number of worker threads, at least one worker is
+	 *                       created
+	 */
+	explicit Executor(size_t numWorkers);
+	Executor(const Executor&) = delete;
+	Executor& operator=(Executor const&) = delete;
+	~Executor();
+
+	/**
+	 * Returns the executor shared by the library, has one worker per CPU
+	 */
+	static Executor& getDefault();
+
+	/**
+	 * Returns number of worker threads
+	 */
+	size_t getNumWorkers() const { return mWorkers.size(); }
+
+	/**
+	 * Posts the task
+	 * @param[in] task task
+	 * @return <i>false</i> if the executor is stopped and the task is not run
+	 */
+	bool post(ExecutorTask task);
+
+	/**
+	 * Completes posted tasks and stops worker threads. Tasks posted after
+	 * are not run.
+	 */
+	void stop();
+
+	/**
+	 * Runs the task and logs its exception
+	 * @param[in] task task
+	 */
+	static void runTask(ExecutorTask& task);
+
+private:
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<ExecutorTask> tasks;
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<Worker>> mWorkers;
+	std::atomic<size_t> mNextWorker;
+
+	// number of tasks in deques and number of sleeping workers, checked
+	// without the lock to not take it on each post
+	std::atomic<size_t> mNumPending;
+	std::atomic<size_t> mNumSleeping;
+
+	// number of posts which passed the stop check and are not completed
+	std::atomic<size_t> mNumPosting;
+
+	std::atomic<bool> mTerminate;
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+
+	void run(size_t index);
+	bool takeTask(size_t index, ExecutorTask& task);
+	void wakeup();
+};
+
+/***************************************************************************//**
+ * Runs tasks one after another in the posting order on the shared executor.
+ *
+ * The serial executor doesn't have threads: when the first task is posted,
+ * the drain task is posted to the executor. It runs queued tasks and posts
+ * itself again if tasks are left, so many serial executors share few worker
+ * threads fairly.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class SerialExecutor
+{
+public:
+
+	/**
+	 * @param[in] executor executor to run tasks
+	 */
+	explicit SerialExecutor(Executor& executor = Executor::getDefault());
+	SerialExecutor(const SerialExecutor&) = delete;
+	SerialExecutor& operator=(SerialExecutor const&) = delete;
+	~SerialExecutor();
+
+	/**
+	 * Posts the task
+	 * @param[in] task task
+	 */
+	void post(ExecutorTask task);
+
+	/**
+	 * Waits until posted tasks are completed. Tasks posted after are not run.
+	 * If is called by the task of this serial executor, doesn't wait. If the
+	 * executor is stopped, queued tasks are not run.
+	 */
+	void stop();
+
+private:
+
+	static const size_t cMaxBatch = 16;
+
+	struct State
+	{
+		State() : scheduled(false), stopped(false) {}
+
+		std::mutex mutex;
+		std::condition_variable condVar;
+		std::deque<ExecutorTask> tasks;
+		bool scheduled;
+		bool stopped;
+		std::thread::id runningThread;
+	};
+
+	Executor& mExecutor;
+	std::shared_ptr<State> mState;
+
+	static void drain(Executor& executor, std::shared_ptr<State> state);
+	static void cancel(State& state);
+};
+
+}
+
+#endif /* XENBE_EXECUTOR_HPP_ */
@@ -0,0 +1,201 @@
+/*
+ *  Frontend discovery
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_FRONTENDDISCOVERY_HPP_
+#define XENBE_FRONTENDDISCOVERY_HPP_
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+}
+
+namespace XenBackend {
+
+/**
+ * Frontend identifier: domain id and device id
+ */
+typedef std::pair<domid_t, uint16_t> FrontendId;
+
+/***************************************************************************//**
+ * Batch of changes found by FrontendDiscovery.
+ * @ingroup backend
+ ******************************************************************************/
+struct FrontendChanges
+{
+	/**
+	 * Snapshot version after the changes
+	 */
+	uint64_t version;
+
+	/**
+	 * Added frontends, sorted
+	 */
+	std::vector<FrontendId> added;
+
+	/**
+	 * Removed frontends, sorted
+	 */
+	std::vector<FrontendId> removed;
+
+	/**
+	 * Added domains, sorted
+	 */
+	std::vector<domid_t> addedDomains;
+
+	/**
+	 * Removed domains, sorted
+	 */
+	std::vector<domid_t> removedDomains;
+
+	/**
+	 * Returns <i>true</i> if there are no changes
+	 */
+	bool empty() const
+	{
+		return added.empty() && removed.empty() &&
+			   addedDomains.empty() && removedDomains.empty();
+	}
+};
+
+/***************************************************************************//**
+ * Versioned snapshot of frontends.
+ * @ingroup backend
+ ******************************************************************************/
+struct FrontendSnapshot
+{
+	/**
+	 * Snapshot version
+	 */
+	uint64_t version;
+
+	/**
+	 * Frontends, sorted
+	 */
+	std::vector<FrontendId> frontends;
+};
+
+/***************************************************************************//**
+ * Incremental frontend discovery.
+ *
+ * Keeps the sorted snapshot of known domains and their devices. Each update
+ * takes the current content of a Xen store directory, compares it with the
+ * snapshot in linear time and returns the difference as one batch. Single
+ * domains and devices can be added or removed without reading the directory. The
+ * snapshot version is incremented on every update which changes something,
+ * so an unchanged version means nothing has to be done.
+ *
+ * All methods are thread safe.
+ * @ingroup backend
+ ******************************************************************************/
+class FrontendDiscovery
+{
+public:
+
+	FrontendDiscovery();
+
+	/**
+	 * Updates the domain list. New domains are added without devices,
+	 * missing domains are removed together with their devices.
+	 * @param[in] domains all domains which have backend entries
+	 */
+	FrontendChanges updateDomains(std::vector<domid_t> domains);
+
+	/**
+	 * Removes domains which are not in the list. Used when the list of the
+	 * existing domains is known but the backend entries are not read.
+	 * @param[in] domains existing domains
+	 */
+	FrontendChanges retainDomains(std::vector<domid_t> domains);
+
+	/**
+	 * Adds the domain without devices if unknown
+	 * @param[in] domId domain id
+	 */
+	FrontendChanges addDomain(domid_t domId);
+
+	/**
+	 * Removes the domain together with its devices
+	 * @param[in] domId domain id
+	 */
+	FrontendChanges removeDomain(domid_t domId);
+
+	/**
+	 * Updates the device list of the domain. The domain is added if unknown.
+	 * @param[in] domId   domain id
+	 * @param[in] devices all devices of the domain
+	 */
+	FrontendChanges updateDevices(domid_t domId, std::vector<uint16_t> devices);
+
+	/**
+	 * Adds the device if unknown. The domain is added if unknown.
+	 * @param[in] domId domain id
+	 * @param[in] devId device id
+	 */
+	FrontendChanges addDevice(domid_t domId, uint16_t devId);
+
+	/**
+	 * Removes the device, so the next update reports it as added again
+	 * @param[in] domId domain id
+	 * @param[in] devId device id
+	 */
+	FrontendChanges removeDevice(domid_t domId, uint16_t devId);
+
+	/**
+	 * Returns snapshot version
+	 */
+	uint64_t getVersion() const;
+
+	/**
+	 * Returns <i>true</i> if the domain is known
+	 * @param[in] domId domain id
+	 */
+	bool hasDomain(domid_t domId) const;
+
+	/**
+	 * Returns sorted domains
+	 */
+	std::vector<domid_t> getDomains() const;
+
+	/**
+	 * Returns snapshot of frontends
+	 */
+	FrontendSnapshot getSnapshot() const;
+
+private:
+
+	typedef std::map<domid_t, std::vector<uint16_t>> DomainMap;
+
+	mutable std::mutex mMutex;
+	uint64_t mVersion;
+	DomainMap mDomains;
+
+	void eraseDomain(DomainMap::iterator it, FrontendChanges& changes);
+	void diffDomains(std::vector<domid_t>& domains, bool addNew,
+					 FrontendChanges& changes);
+	FrontendChanges commit(FrontendChanges& changes);
+};
+
+}
+
+#endif /* XENBE_FRONTENDDISCOVERY_HPP_ */
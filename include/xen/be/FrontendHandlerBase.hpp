@@ -25,6 +25,7 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 extern "C" {
@@ -32,6 +33,9 @@ extern "C" {
 #include <xen/io/xenbus.h>
 }
 
+#include "LiveUpgrade.hpp"
+#include "Metrics.hpp"
+#include "Reactor.hpp"
 #include "RingBufferBase.hpp"
 #include "XenEvtchn.hpp"
 #include "Exception.hpp"
@@ -114,6 +118,28 @@ class XenStore;
  *
  * @snippet ExampleBackend.cpp onBind
  *
+ * When the connected frontend restarts (goes to XenbusStateInitialising), the
+ * ring buffers are not released but suspended. If the ring buffers are
+ * created with createRingBuffer(), the suspended ring buffer with the same
+ * event channel port and grant table reference is resumed instead of creating
+ * a new one. It saves unmapping and mapping the buffer and rebinding the event
+ * channel on the frontend reconnect. The suspended ring buffers which are not
+ * reused by onBind() are released.
+ *
+ * On live upgrade handover() stops the frontend handler without closing and
+ * returns its state. The frontend handler created by the new backend process
+ * takes the inherited state (see LiveUpgrade) instead of resetting the
+ * backend state: onBind() is called to recreate the ring buffers on the
+ * handed over event channels, then onRestoreState() is called. The client
+ * may save additional descriptors and data in onSaveState().
+ *
+ * If the reactor is set with setReactor(), XenStore callbacks and ring buffer
+ * indications are handled in the reactor thread instead of private threads.
+ * The client may run timers on the same thread with
+ * getReactor()->postDelayed(), so the frontend state used only from the
+ * reactor thread doesn't require locking. BackendBase sets the reactor of
+ * the domain shard (see BackendBase).
+ *
  * @ingroup backend
  ******************************************************************************/
 class FrontendHandlerBase
@@ -160,6 +186,37 @@ public:
 	 */
 	xenbus_state getBackendState() const { return mBackendState; }
 
+	/**
+	 * Sets the reactor which handles the frontend. If the frontend handler is
+	 * started, it is moved to the new reactor: its ring buffers are restarted
+	 * in the new reactor thread.
+	 * @param[in] reactor reactor, nullptr to use private threads
+	 */
+	void setReactor(ReactorPtr reactor);
+
+	/**
+	 * Returns the reactor which handles the frontend
+	 */
+	ReactorPtr getReactor();
+
+	/**
+	 * Sets the scheduler which processes requests of the ring buffers added
+	 * after this call (see Scheduler)
+	 * @param[in] scheduler scheduler
+	 */
+	void setScheduler(SchedulerPtr scheduler);
+
+	/**
+	 * Returns number of indications received by the current ring buffers
+	 */
+	uint64_t getNumEvents();
+
+	/**
+	 * Returns the frontend metrics labeled with the domain id and the device
+	 * id
+	 */
+	MetricsGroup& getMetrics() { return mMetrics; }
+
 	/**
 	 * Starts frontend handling
 	 */
@@ -170,6 +227,13 @@ public:
 	 */
 	void stop();
 
+	/**
+	 * Stops frontend handling without closing and returns the state to be
+	 * handed over to the new backend process. The frontend handler should be
+	 * deleted once the state is sent.
+	 */
+	FrontendState handover();
+
 protected:
 
 	/**
@@ -186,6 +250,18 @@ protected:
 	 */
 	virtual void onClosing();
 
+	/**
+	 * Is called on handover to save additional state of the client.
+	 * @param[out] state frontend state
+	 */
+	virtual void onSaveState(FrontendState& state) {}
+
+	/**
+	 * Is called when the frontend handler continues from the inherited state,
+	 * after onBind() if the backend is connected.
+	 * @param[in] state frontend state
+	 */
+	virtual void onRestoreState(const FrontendState& state) {}
 
 	/**
 	 * Adds new ring buffer to the frontend handler.
@@ -193,6 +269,37 @@ protected:
 	 */
 	void addRingBuffer(RingBufferPtr ringBuffer);
 
+	/**
+	 * Creates the ring buffer or resumes the one suspended on the frontend
+	 * restart if it has the same port and reference.
+	 * The ring buffer should be added with addRingBuffer().
+	 * @param[in] port event channel port number
+	 * @param[in] ref  grant table reference
+	 * @param[in] args additional ring buffer constructor arguments
+	 */
+	template<typename T, typename... Args>
+	std::shared_ptr<T> createRingBuffer(evtchn_port_t port, grant_ref_t ref,
+										Args&&... args)
+	{
+		auto suspended = takeSuspendedRingBuffer(port, ref);
+		auto ringBuffer = std::dynamic_pointer_cast<T>(suspended);
+
+		if (ringBuffer && resumeRingBuffer(ringBuffer))
+		{
+			return ringBuffer;
+		}
+
+		// the suspended ring buffer which is not reused keeps the port bound
+
+		if (suspended)
+		{
+			suspended->stop();
+		}
+
+		return std::make_shared<T>(mDomId, port, ref,
+								   std::forward<Args>(args)...);
+	}
+
 	/**
 	 * Sets backend state.
 	 * @param[in] state new state to set
@@ -263,16 +370,41 @@ private:
 	std::string mXsFrontendPath;
 
 	std::vector<RingBufferPtr> mRingBuffers;
+	std::vector<RingBufferPtr> mSuspendedRingBuffers;
+
+	bool mInherited;
+	bool mHandedOver;
+	FrontendState mInheritedState;
+
+	bool mStarted;
 
 	std::mutex mMutex;
 
+	std::mutex mReactorMutex;
+	ReactorPtr mReactor;
+	SchedulerPtr mScheduler;
+
 	AsyncContext mAsyncContext;
 
 	Log mLog;
 
+	MetricsGroup mMetrics;
+	MetricsCounter& mBackendStateTransitions;
+	MetricsCounter& mFrontendStateTransitions;
+	MetricsCounter& mRingBuffersAdded;
+
 	void initXenStorePathes();
 	void init();
 	void release();
+	void releaseSuspended();
+	RingBufferPtr takeSuspendedRingBuffer(evtchn_port_t port, grant_ref_t ref);
+	bool resumeRingBuffer(RingBufferPtr ringBuffer);
+	void bindRingBuffers();
+	void restart();
+	void restoreState();
+	void moveToReactor(ReactorPtr reactor);
+	void dispatch(Reactor::Callback callback);
+	void flushReactor();
 	void frontendStateChanged();
 	void backendStateChanged();
 	void onFrontendStateChanged(xenbus_state state);
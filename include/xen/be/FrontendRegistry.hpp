@@ -0,0 +1,184 @@
+/*
+ *  Frontend registry
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_FRONTENDREGISTRY_HPP_
+#define XENBE_FRONTENDREGISTRY_HPP_
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+}
+
+#include "Utils.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Registry of frontends served by a backend.
+ *
+ * Frontends are hashed by (domain id, device id), so lookup, insertion and
+ * removal don't depend on the number of frontends. All methods are thread
+ * safe: lookups take the lock shared and may run concurrently, modifications
+ * take it exclusively. Iteration is done over snapshots, which stay valid
+ * while the registry is modified.
+ *
+ * @tparam T frontend handler type
+ * @ingroup backend
+ ******************************************************************************/
+template<typename T>
+class FrontendRegistry
+{
+public:
+
+	typedef std::shared_ptr<T> Ptr;
+
+	/**
+	 * Returns the key which identifies the frontend
+	 * @param[in] domId domain id
+	 * @param[in] devId device id
+	 */
+	static uint32_t getKey(domid_t domId, uint16_t devId)
+	{
+		return (static_cast<uint32_t>(domId) << 16) | devId;
+	}
+
+	/**
+	 * Adds the frontend
+	 * @param[in] domId    domain id
+	 * @param[in] devId    device id
+	 * @param[in] frontend frontend
+	 * @return <i>false</i> if the frontend with same ids already exists
+	 */
+	bool add(domid_t domId, uint16_t devId, Ptr frontend)
+	{
+		std::lock_guard<RWLock> lock(mLock);
+
+		return mFrontends.insert(std::make_pair(getKey(domId, devId),
+												frontend)).second;
+	}
+
+	/**
+	 * Removes the frontend
+	 * @param[in] domId domain id
+	 * @param[in] devId device id
+	 * @return removed frontend or empty pointer if it is not found
+	 */
+	Ptr remove(domid_t domId, uint16_t devId)
+	{
+		std::lock_guard<RWLock> lock(mLock);
+
+		auto it = mFrontends.find(getKey(domId, devId));
+
+		if (it == mFrontends.end())
+		{
+			return Ptr();
+		}
+
+		auto frontend = it->second;
+
+		mFrontends.erase(it);
+
+		return frontend;
+	}
+
+	/**
+	 * Finds the frontend
+	 * @param[in] domId domain id
+	 * @param[in] devId device id
+	 * @return frontend or empty pointer if it is not found
+	 */
+	Ptr find(domid_t domId, uint16_t devId) const
+	{
+		ReadLockGuard lock(mLock);
+
+		auto it = mFrontends.find(getKey(domId, devId));
+
+		if (it == mFrontends.end())
+		{
+			return Ptr();
+		}
+
+		return it->second;
+	}
+
+	/**
+	 * Returns number of frontends
+	 */
+	size_t size() const
+	{
+		ReadLockGuard lock(mLock);
+
+		return mFrontends.size();
+	}
+
+	/**
+	 * Returns snapshot of all frontends
+	 */
+	std::vector<Ptr> getFrontends() const
+	{
+		ReadLockGuard lock(mLock);
+
+		std::vector<Ptr> result;
+
+		result.reserve(mFrontends.size());
+
+		for(auto& frontend : mFrontends)
+		{
+			result.push_back(frontend.second);
+		}
+
+		return result;
+	}
+
+	/**
+	 * Removes all frontends
+	 * @return removed frontends
+	 */
+	std::vector<Ptr> clear()
+	{
+		std::lock_guard<RWLock> lock(mLock);
+
+		std::vector<Ptr> result;
+
+		result.reserve(mFrontends.size());
+
+		for(auto& frontend : mFrontends)
+		{
+			result.push_back(frontend.second);
+		}
+
+		mFrontends.clear();
+
+		return result;
+	}
+
+private:
+
+	mutable RWLock mLock;
+	std::unordered_map<uint32_t, Ptr> mFrontends;
+};
+
+}
+
+#endif /* XENBE_FRONTENDREGISTRY_HPP_ */
@@ -0,0 +1,261 @@
+/*
+ *  Latency histograms
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_HISTOGRAM_HPP_
+#define XENBE_HISTOGRAM_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Percentiles of the histogram.
+ * @ingroup backend
+ ******************************************************************************/
+struct HistogramSnapshot
+{
+	/**
+	 * Number of recorded values
+	 */
+	uint64_t count;
+
+	/**
+	 * Minimal and maximal recorded values
+	 */
+	uint64_t min;
+	uint64_t max;
+
+	/**
+	 * Mean of the recorded values estimated from the buckets
+	 */
+	double mean;
+
+	/**
+	 * 50th, 90th, 99th and 99.9th percentiles
+	 */
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+/***************************************************************************//**
+ * Lock-free log-linear histogram.
+ *
+ * Values are counted in buckets like in HdrHistogram: each power of two range
+ * is split into 32 linear sub-buckets, so the value is reported with about 3%
+ * precision. Values above 2^40 are counted in the last bucket. Recording is
+ * one relaxed atomic increment, reading walks all buckets, so the sum is not
+ * kept and the mean is estimated from the bucket middles.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class LatencyHistogram
+{
+public:
+
+	LatencyHistogram();
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(LatencyHistogram const&) = delete;
+
+	/**
+	 * Records the value
+	 * @param[in] value value
+	 */
+	void record(uint64_t value)
+	{
+		mCounts[getIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Returns number of recorded values
+	 */
+	uint64_t getCount() const;
+
+	/**
+	 * Returns the value below which the given percentage of values falls
+	 * @param[in] percentile percentile from 0 to 100
+	 */
+	uint64_t getPercentile(double percentile) const;
+
+	/**
+	 * Returns the histogram percentiles
+	 */
+	HistogramSnapshot getSnapshot() const;
+
+	/**
+	 * Clears the histogram. Values recorded concurrently may be lost.
+	 */
+	void reset();
+
+private:
+
+	static const int cSubBucketBits = 5;
+	static const uint64_t cSubBuckets = 1 << cSubBucketBits;
+	static const int cMaxBits = 40;
+	static const uint64_t cMaxValue = (1ULL << cMaxBits) - 1;
+	static const size_t cNumBuckets =
+			(cMaxBits - cSubBucketBits + 1) * cSubBuckets;
+
+	std::atomic<uint64_t> mCounts[cNumBuckets];
+
+	static size_t getIndex(uint64_t value)
+	{
+		if (value > cMaxValue)
+		{
+			value = cMaxValue;
+		}
+
+		if (value < cSubBuckets)
+		{
+			return value;
+		}
+
+		int shift = 63 - __builtin_clzll(value) - cSubBucketBits;
+
+		return (shift + 1) * cSubBuckets + (value >> shift) - cSubBuckets;
+	}
+
+	static uint64_t getLowestValue(size_t index);
+	static uint64_t getHighestValue(size_t index);
+};
+
+/***************************************************************************//**
+ * Measures latency between requests and their responses by request type.
+ *
+ * The request start time is stored in a small table indexed by the request
+ * id. When the response with the same id is sent, the time elapsed is
+ * recorded in the histogram of the request type. The table is written by one
+ * request thread and one response thread without locks. If the table is full
+ * the request is not measured and is counted as dropped. Ids cFree and
+ * cRemoved are reserved: such requests are not measured either.
+ *
+ * Latencies are recorded in nanoseconds. Request types should be less than
+ * cMaxTypes, greater types are accounted as cMaxTypes - 1.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class LatencyTracker
+{
+public:
+
+	static const uint32_t cMaxTypes = 64;
+
+	/**
+	 * @param[in] maxPending maximal number of requests waiting for response
+	 */
+	explicit LatencyTracker(size_t maxPending);
+	LatencyTracker(const LatencyTracker&) = delete;
+	LatencyTracker& operator=(LatencyTracker const&) = delete;
+	~LatencyTracker();
+
+	/**
+	 * Returns the current time used as the request start time
+	 */
+	static int64_t getTime()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/**
+	 * Starts measuring the request
+	 * @param[in] id   request id
+	 * @param[in] type request type
+	 */
+	void onRequest(uint64_t id, uint32_t type)
+	{
+		onRequest(id, type, getTime());
+	}
+
+	/**
+	 * Starts measuring the request dequeued at the given time. Allows to read
+	 * the clock once for the batch of requests.
+	 * @param[in] id    request id
+	 * @param[in] type  request type
+	 * @param[in] start time returned by getTime()
+	 */
+	void onRequest(uint64_t id, uint32_t type, int64_t start);
+
+	/**
+	 * Stops measuring the request and records its latency
+	 * @param[in] id request id
+	 */
+	void onResponse(uint64_t id);
+
+	/**
+	 * Returns percentiles of the request type
+	 * @param[in] type request type
+	 */
+	HistogramSnapshot getSnapshot(uint32_t type) const;
+
+	/**
+	 * Returns percentiles of all measured request types
+	 */
+	std::vector<std::pair<uint32_t, HistogramSnapshot>> getSnapshot() const;
+
+	/**
+	 * Returns number of requests not measured because the table was full
+	 */
+	uint64_t getNumDropped() const { return mNumDropped; }
+
+	/**
+	 * Clears the histograms
+	 */
+	void reset();
+
+	/**
+	 * Reserved id of the unused table entry
+	 */
+	static const uint64_t cFree = UINT64_MAX;
+
+	/**
+	 * Reserved id of the entry which response is sent
+	 */
+	static const uint64_t cRemoved = UINT64_MAX - 1;
+
+private:
+
+	struct Pending
+	{
+		std::atomic<uint64_t> id;
+		int64_t start;
+		uint32_t type;
+	};
+
+	std::unique_ptr<Pending[]> mPending;
+	size_t mMask;
+
+	std::atomic<LatencyHistogram*> mHistograms[cMaxTypes];
+	std::atomic<uint64_t> mNumDropped;
+
+	LatencyHistogram& getHistogram(uint32_t type);
+};
+
+typedef std::shared_ptr<LatencyTracker> LatencyTrackerPtr;
+
+}
+
+#endif /* XENBE_HISTOGRAM_HPP_ */
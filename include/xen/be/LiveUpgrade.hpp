@@ -0,0 +1,241 @@
+/*
+ *  Live upgrade
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_LIVEUPGRADE_HPP_
+#define XENBE_LIVEUPGRADE_HPP_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+#include <xen/io/xenbus.h>
+}
+
+#include "Exception.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by LiveUpgrade.
+ * @ingroup backend
+ ******************************************************************************/
+class LiveUpgradeException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * State of the ring buffer handed over to the new backend process.
+ * @ingroup backend
+ ******************************************************************************/
+struct RingBufferState
+{
+	/**
+	 * Remote event channel port
+	 */
+	evtchn_port_t port;
+
+	/**
+	 * Grant table reference
+	 */
+	grant_ref_t ref;
+
+	/**
+	 * Local event channel port
+	 */
+	evtchn_port_t localPort;
+
+	/**
+	 * Event channel file descriptor
+	 */
+	int fd;
+
+	/**
+	 * Private request consumer index of the in ring buffer
+	 */
+	uint32_t reqCons;
+
+	/**
+	 * Private response producer index of the in ring buffer
+	 */
+	uint32_t rspProdPvt;
+};
+
+/***************************************************************************//**
+ * State of the frontend handler handed over to the new backend process.
+ * @ingroup backend
+ ******************************************************************************/
+struct FrontendState
+{
+	/**
+	 * Device name
+	 */
+	std::string devName;
+
+	/**
+	 * Frontend domain id
+	 */
+	domid_t domId;
+
+	/**
+	 * Device id
+	 */
+	uint16_t devId;
+
+	/**
+	 * Backend state
+	 */
+	xenbus_state backendState;
+
+	/**
+	 * Last seen frontend state
+	 */
+	xenbus_state frontendState;
+
+	/**
+	 * Ring buffers
+	 */
+	std::vector<RingBufferState> ringBuffers;
+
+	/**
+	 * Additional file descriptors, for example DMA buffers
+	 */
+	std::vector<int> fds;
+
+	/**
+	 * Opaque data of the frontend handler implementation
+	 */
+	std::string data;
+};
+
+/***************************************************************************//**
+ * Hands the backend state over to the new backend process.
+ *
+ * The old process collects FrontendState of each frontend handler with
+ * FrontendHandlerBase::handover() (or BackendBase::handover() for all of them)
+ * and sends it with send() over the connected unix socket. The event channel
+ * and additional file descriptors are passed with SCM_RIGHTS, so the bindings
+ * survive the old process. Grant references are mapped again by the new
+ * process, which doesn't affect the frontend.
+ *
+ * The new process receives the state with receive() and registers it with
+ * setInherited() before the backend is started. The frontend handlers created
+ * for inherited frontends take their state and continue from it without
+ * changing the backend state, so the frontend doesn't see the upgrade.
+ * clearInherited() closes descriptors which are not taken by any frontend
+ * handler.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class LiveUpgrade
+{
+public:
+
+	/**
+	 * Serializes the state. The descriptors are not serialized but collected
+	 * in the order deserialize() expects them.
+	 * @param[in]  states frontend states
+	 * @param[out] fds    file descriptors to pass
+	 */
+	static std::string serialize(const std::vector<FrontendState>& states,
+								 std::vector<int>& fds);
+
+	/**
+	 * Deserializes the state
+	 * @param[in] data serialized state
+	 * @param[in] fds  passed file descriptors
+	 */
+	static std::vector<FrontendState> deserialize(const std::string& data,
+												  const std::vector<int>& fds);
+
+	/**
+	 * Sends the data and the file descriptors over the unix socket
+	 * @param[in] socket connected unix socket
+	 * @param[in] data   data
+	 * @param[in] fds    file descriptors
+	 */
+	static void sendFds(int socket, const std::string& data,
+						const std::vector<int>& fds);
+
+	/**
+	 * Receives the data and the file descriptors sent by sendFds()
+	 * @param[in]  socket connected unix socket
+	 * @param[out] data   data
+	 * @param[out] fds    received file descriptors
+	 */
+	static void receiveFds(int socket, std::string& data,
+						   std::vector<int>& fds);
+
+	/**
+	 * Sends the frontend states to the new backend process
+	 * @param[in] socket connected unix socket
+	 * @param[in] states frontend states
+	 */
+	static void send(int socket, const std::vector<FrontendState>& states);
+
+	/**
+	 * Receives the frontend states from the old backend process
+	 * @param[in] socket connected unix socket
+	 */
+	static std::vector<FrontendState> receive(int socket);
+
+	/**
+	 * Registers the received states to be taken by the frontend handlers
+	 * @param[in] states frontend states
+	 */
+	static void setInherited(const std::vector<FrontendState>& states);
+
+	/**
+	 * Takes the inherited state of the frontend
+	 * @param[in]  devName device name
+	 * @param[in]  domId   frontend domain id
+	 * @param[in]  devId   device id
+	 * @param[out] state   frontend state
+	 * @return <i>false</i> if there is no inherited state for the frontend
+	 */
+	static bool takeInherited(const std::string& devName, domid_t domId,
+							  uint16_t devId, FrontendState& state);
+
+	/**
+	 * Drops the inherited states which are not taken and closes their
+	 * descriptors
+	 */
+	static void clearInherited();
+
+private:
+
+	typedef std::tuple<std::string, domid_t, uint16_t> Key;
+
+	static const int cVersion = 1;
+	static const size_t cMaxFdsPerMessage = 64;
+
+	static std::mutex sMutex;
+	static std::map<Key, FrontendState> sInherited;
+
+	static void closeFds(const FrontendState& state);
+};
+
+}
+
+#endif /* XENBE_LIVEUPGRADE_HPP_ */
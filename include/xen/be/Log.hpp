@@ -22,7 +22,10 @@
 #define XENBE_LOG_HPP_
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <ctime>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
@@ -31,10 +34,13 @@
 #include <string>
 #include <vector>
 
+#include "AsyncLog.hpp"
+#include "Config.hpp"
+
 /***************************************************************************//**
  * @defgroup log Backend log
  *
- * Special macros are designed to show logs: LOG() and DLOG().
+ * Special macros are designed to show logs: LOG(), DLOG() and RLOG().
  * DLOG is compiled to void in release build (NDEBUG is defined) and can be used
  * in time critical path. These macros returns a string stream object thus basic
  * c++ iostream operators can be used.
@@ -80,17 +86,65 @@
 #define __FILENAME__ (strrchr(__FILE__, '/') ? \
 					  strrchr(__FILE__, '/') + 1 : __FILE__)
 
+/**
+ * @def XENBE_MAX_LOG_LEVEL
+ * Max log level compiled in: 0 - DISABLE, 1 - ERROR, 2 - WARNING, 3 - INFO,
+ * 4 - DEBUG. Log statements above this level are removed by the compiler.
+ * Is set by MAX_LOG_LEVEL cmake option in the generated Config.hpp, which is
+ * installed with the headers. May be defined by the user before including
+ * the header.
+ * @ingroup log
+ */
+
+/// @cond HIDDEN_SYMBOLS
+#define XENBE_LOG_STREAM(instance, level) \
+	XenBackend::LogLine().get(instance, __FILENAME__, __LINE__, \
+							  XenBackend::LogLevel::log ## level)
+/// @endcond
+
 /**
  * @def LOG(instance, level)
- * Displays log with defined level.
+ * Displays log with defined level. The level is checked before the log line
+ * is created, so arguments of the disabled log are not evaluated and it
+ * costs one branch.
  * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i> or
  *                         <i>nullptr</i>
  * @param[in] level    log level
  * @ingroup log
  */
 #define LOG(instance, level) \
-	XenBackend::LogLine().get(instance, __FILENAME__, __LINE__, \
-							  XenBackend::LogLevel::log ## level)
+	!(static_cast<int>(XenBackend::LogLevel::log ## level) > 0 && \
+	  static_cast<int>(XenBackend::LogLevel::log ## level) <= \
+	  XENBE_MAX_LOG_LEVEL && \
+	  XenBackend::LogLine::isEnabled(instance, \
+									 XenBackend::LogLevel::log ## level)) ? \
+	(void) 0 : XenBackend::LogVoid() & XENBE_LOG_STREAM(instance, level)
+
+/**
+ * @def RLOG(instance, level)
+ * Displays log with defined level, limits number of lines per second of this
+ * statement. The limit is set by Log::setRateLimit() or by
+ * <i>name:level:limit=N</i> item of the log mask. Is used in error paths
+ * which may repeat at high rate. When lines are suppressed, the summary is
+ * logged by the first line of the next second. If the statement doesn't
+ * fire again, the summary is logged by the AsyncLog writer thread, by
+ * Log::flushSuppressed() or at the process exit.
+ * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i> or
+ *                         <i>nullptr</i>
+ * @param[in] level    log level
+ * @ingroup log
+ */
+#define RLOG(instance, level) \
+	!(static_cast<int>(XenBackend::LogLevel::log ## level) > 0 && \
+	  static_cast<int>(XenBackend::LogLevel::log ## level) <= \
+	  XENBE_MAX_LOG_LEVEL && \
+	  XenBackend::LogLine::isEnabled(instance, \
+									 XenBackend::LogLevel::log ## level) && \
+	  []() -> XenBackend::LogRateLimiter& \
+	  { static XenBackend::LogRateLimiter sLimiter; return sLimiter; }() \
+	  .check(instance, __FILENAME__, __LINE__, \
+			 XenBackend::LogLevel::log ## level)) ? \
+	(void) 0 : XenBackend::LogVoid() & XENBE_LOG_STREAM(instance, level)
 
 /**
  * @def DLOG(instance, level)
@@ -108,7 +162,7 @@
 #else
 
 #define DLOG(instance, level) \
-	true ? (void) 0 : XenBackend::LogVoid() & LOG(instance, level)
+	true ? (void) 0 : XenBackend::LogVoid() & XENBE_LOG_STREAM(instance, level)
 
 #endif
 
@@ -150,7 +204,8 @@ public:
 	 */
 	Log(const std::string& name, LogLevel level = Log::getLogLevel(),
 		bool fileAndLine = Log::getShowFileAndLine()) :
-		mName(name),  mLevel(level), mFileAndLine(fileAndLine)
+		mName(name),  mLevel(level), mFileAndLine(fileAndLine), mBinary(false),
+		mRateLimit(Log::getDefaultRateLimit()), mHeader(" | " + name + " ")
 	{
 		setLogLevelByMask();
 	}
@@ -217,7 +272,13 @@ public:
 	}
 
 	/**
-	 * Sets log mask
+	 * Sets log mask. The mask is the comma separated list of
+	 * <i>name[:level[:mode]...]</i> items, the name may end with <i>*</i>.
+	 * Modes are:
+	 * - <i>binary</i> selects the structured binary log for BLOG() statements
+	 * of the matched log instances (see BinaryLog);
+	 * - <i>limit=N</i> sets the rate limit of RLOG() statements of the matched
+	 * log instances, 0 is unlimited.
 	 * @param[in] mask log mask
 	 * @return <i>true</i> if log mask is set successfully
 	 */
@@ -229,13 +290,12 @@ public:
 
 		splitMask(items, ',');
 
-		std::vector<std::pair<std::string,
-							  LogLevel>>& logMaskItems = getLogMaskItems();
+		std::vector<MaskItem>& logMaskItems = getLogMaskItems();
 
 		for(auto item : items)
 		{
 			size_t sepPos = 0;
-			LogLevel logLevel = LogLevel::logDEBUG;
+			MaskItem maskItem = { "", LogLevel::logDEBUG, false, false, 0 };
 
 			sepPos = item.find(':');
 
@@ -245,21 +305,97 @@ public:
 			}
 			else
 			{
-				if (!getLogLevelByString(item.substr(sepPos + 1), logLevel))
+				auto strLevel = item.substr(sepPos + 1);
+				auto modePos = strLevel.find(':');
+
+				if (!getLogLevelByString(strLevel.substr(0, modePos),
+										 maskItem.level))
 				{
 					logMaskItems.clear();
 
 					return false;
 				}
+
+				while (modePos != std::string::npos)
+				{
+					auto nextPos = strLevel.find(':', modePos + 1);
+					auto mode = strLevel.substr(modePos + 1,
+												nextPos == std::string::npos ?
+												nextPos : nextPos - modePos - 1);
+
+					if (!setMaskMode(mode, maskItem))
+					{
+						logMaskItems.clear();
+
+						return false;
+					}
+
+					modePos = nextPos;
+				}
 			}
 
-			logMaskItems.push_back(make_pair(item.substr(0, sepPos),
-								   logLevel));
+			maskItem.name = item.substr(0, sepPos);
+
+			logMaskItems.push_back(maskItem);
 		}
 
 		return true;
 	}
 
+	/**
+	 * Selects the structured binary log for BLOG() statements of this
+	 * instance
+	 * @param[in] binary binary flag
+	 */
+	void setBinary(bool binary) { mBinary = binary; }
+
+	/**
+	 * Returns <i>true</i> if BLOG() statements of this instance are written
+	 * to the binary log
+	 */
+	bool isBinary() const { return mBinary; }
+
+	/**
+	 * Gets the default max number of lines per second of each RLOG()
+	 * statement
+	 */
+	static size_t& getDefaultRateLimit()
+	{
+		static size_t sRateLimit = cDefaultRateLimit;
+
+		return sRateLimit;
+	}
+
+	/**
+	 * Sets the default max number of lines per second of each RLOG()
+	 * statement
+	 * @param[in] rateLimit lines per second, 0 is unlimited
+	 */
+	static void setDefaultRateLimit(size_t rateLimit)
+	{
+		getDefaultRateLimit() = rateLimit;
+	}
+
+	/**
+	 * Sets max number of lines per second of each RLOG() statement of this
+	 * instance
+	 * @param[in] rateLimit lines per second, 0 is unlimited
+	 */
+	void setRateLimit(size_t rateLimit) { mRateLimit = rateLimit; }
+
+	/**
+	 * Returns max number of lines per second of each RLOG() statement of
+	 * this instance
+	 */
+	size_t getRateLimit() const { return mRateLimit; }
+
+	/**
+	 * Logs summaries of lines suppressed by RLOG() statements which have not
+	 * fired since. Is called periodically by the AsyncLog writer thread and
+	 * at the process exit.
+	 */
+	static void flushSuppressed();
+
 	/**
 	 * Sets file to write log
 	 * @param[in] fileName file name
@@ -273,13 +409,29 @@ private:
 
 	friend class LogLine;
 
+	static const size_t cDefaultRateLimit = 10;
+
+	struct MaskItem
+	{
+		std::string name;
+		LogLevel level;
+		bool binary;
+		bool hasRateLimit;
+		size_t rateLimit;
+	};
+
 	std::string mName;
 	LogLevel mLevel;
 	bool mFileAndLine;
+	bool mBinary;
+	size_t mRateLimit;
+
+	// the name part of the line header, is built once
+	std::string mHeader;
 
-	static std::vector<std::pair<std::string, LogLevel>>& getLogMaskItems()
+	static std::vector<MaskItem>& getLogMaskItems()
 	{
-		static std::vector<std::pair<std::string, LogLevel>> sMaskItems;
+		static std::vector<MaskItem> sMaskItems;
 
 		return sMaskItems;
 	}
@@ -295,25 +447,61 @@ private:
 	{
 		for(auto item : getLogMaskItems())
 		{
-			if (item.first.back() == '*')
+			if (item.name.back() == '*')
 			{
-				item.first.pop_back();
+				item.name.pop_back();
 
-				if (mName.compare(0, item.first.length(), item.first) == 0)
+				if (mName.compare(0, item.name.length(), item.name) == 0)
 				{
-					mLevel = item.second;
+					setByMaskItem(item);
 				}
 			}
 			else
 			{
-				if (item.first == mName)
+				if (item.name == mName)
 				{
-					mLevel = item.second;
+					setByMaskItem(item);
 				}
 			}
 		}
 	}
 
+	void setByMaskItem(const MaskItem& item)
+	{
+		mLevel = item.level;
+		mBinary = item.binary;
+
+		if (item.hasRateLimit)
+		{
+			mRateLimit = item.rateLimit;
+		}
+	}
+
+	static bool setMaskMode(const std::string& mode, MaskItem& item)
+	{
+		static const std::string cLimit = "limit=";
+
+		if (mode == "binary")
+		{
+			item.binary = true;
+
+			return true;
+		}
+
+		if (mode.compare(0, cLimit.length(), cLimit) == 0 &&
+			mode.length() > cLimit.length() &&
+			mode.find_first_not_of("0123456789", cLimit.length()) ==
+			std::string::npos)
+		{
+			item.hasRateLimit = true;
+			item.rateLimit = std::stoul(mode.substr(cLimit.length()));
+
+			return true;
+		}
+
+		return false;
+	}
+
 	static void splitMask(std::vector<std::string>& splitVector, char delim)
 	{
 		size_t curPos = 0;
@@ -391,18 +579,68 @@ class LogLine
 {
 public:
 
+	static bool isEnabled(const Log& log, LogLevel level)
+	{
+		return level <= log.mLevel;
+	}
+
+	static bool isEnabled(const char*, LogLevel level)
+	{
+		return level <= Log::getLogLevel();
+	}
+
 	virtual ~LogLine()
+	{
+		if (mCurrentLevel <= mSetLevel && mSetLevel > LogLevel::logDISABLE)
+		{
+			mStream << '\n';
+
+			auto line = mStream.str();
+
+			write(line);
+		}
+	}
+
+	// the line is written by the writer thread if AsyncLog is started
+	static void write(std::string& line)
 	{
 		static std::mutex sMutex;
 
-		if (mCurrentLevel <= mSetLevel && mSetLevel > LogLevel::logDISABLE)
+		if (!AsyncLog::push(line))
 		{
 			std::lock_guard<std::mutex> lock(sMutex);
 
-			Log::getOutputStream() << mStream.str() << std::endl;
+			Log::getOutputStream() << line << std::flush;
 		}
 	}
 
+	static std::string getHeader(const Log& log, const char* file, int line)
+	{
+		return log.mFileAndLine ? getFileAndLine(file, line) : log.mHeader;
+	}
+
+	static std::string getHeader(const char* name, const char* file, int line)
+	{
+		return name ? " | " + std::string(name) + " " :
+					  getFileAndLine(file, line);
+	}
+
+	// formats the line without writing it
+	static std::string format(const std::string& header, LogLevel level,
+							  const std::string& message)
+	{
+		LogLine logLine;
+
+		logLine.mCurrentLevel = logLine.mSetLevel = level;
+		logLine.putHeader(header);
+		logLine.mStream << message << '\n';
+
+		// nothing is written by the destructor
+		logLine.mSetLevel = LogLevel::logDISABLE;
+
+		return logLine.mStream.str();
+	}
+
 	std::ostringstream& get(const Log& log, const char* file, int line,
 							LogLevel level = LogLevel::logDEBUG)
 	{
@@ -411,11 +649,11 @@ public:
 
 		if (log.mFileAndLine)
 		{
-			putHeader(std::string(file) + " " + std::to_string(line));
+			putHeader(getFileAndLine(file, line));
 		}
 		else
 		{
-			putHeader(log.mName);
+			putHeader(log.mHeader);
 		}
 
 		return mStream;
@@ -429,11 +667,11 @@ public:
 
 		if (name)
 		{
-			putHeader(name);
+			putHeader(" | " + std::string(name) + " ");
 		}
 		else
 		{
-			putHeader(std::string(file) + " " + std::to_string(line));
+			putHeader(getFileAndLine(file, line));
 		}
 
 		return mStream;
@@ -441,50 +679,310 @@ public:
 
 private:
 
+	static const size_t cMaxAlignment = 64;
+
 	std::ostringstream mStream;
 	LogLevel mCurrentLevel;
 	LogLevel mSetLevel;
 
+	/*
+	 * The header is " | name ": it is aligned to the longest name seen so far
+	 * by the padding written after it.
+	 */
 	void putHeader(const std::string& header)
 	{
-		static size_t sAlignmentLength;
+		static const char cSpaces[cMaxAlignment + 1] =
+			"                                                                ";
+		static std::atomic<size_t> sAlignmentLength(0);
 
 		if (mCurrentLevel <= mSetLevel && mSetLevel > LogLevel::logDISABLE)
 		{
-			if (header.length() > sAlignmentLength)
+			auto length = header.length() < cMaxAlignment ?
+						  header.length() : cMaxAlignment;
+			auto alignment = sAlignmentLength.load(std::memory_order_relaxed);
+
+			while (length > alignment &&
+				   !sAlignmentLength.compare_exchange_weak(alignment, length))
 			{
-				sAlignmentLength = header.length();
 			}
 
-			mStream << nowTime()
-					<< " | " << header << " "
-					<< std::string(sAlignmentLength - header.length(), ' ')
-					<< "| " << levelToString(mCurrentLevel) << " - ";
+			if (length > alignment)
+			{
+				alignment = length;
+			}
+
+			auto& time = getTime();
+
+			mStream.write(time.buffer, time.length);
+			mStream.write(header.data(), header.length());
+			mStream.write(cSpaces, alignment - length);
+			mStream << levelToString(mCurrentLevel);
 		}
 	}
 
-	std::string nowTime()
+	static std::string getFileAndLine(const char* file, int line)
+	{
+		return " | " + std::string(file) + " " + std::to_string(line) + " ";
+	}
+
+	struct TimeCache
 	{
+		time_t second = -1;
+		size_t millisecondPos = 0;
+		size_t length = 0;
+		char buffer[64];
+	};
+
+	/*
+	 * localtime_r() takes the global lock and strftime() is slow, so the
+	 * date and time are formatted once per second for each thread and only
+	 * milliseconds are updated.
+	 */
+	static const TimeCache& getTime()
+	{
+		static thread_local TimeCache sCache;
+
 		auto now = std::chrono::system_clock::now();
 		auto time = std::chrono::system_clock::to_time_t(now);
 		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-					  now.time_since_epoch()) % 1000;
+					  now.time_since_epoch()).count() % 1000;
+
+		if (time != sCache.second)
+		{
+			tm localTime;
+
+			localtime_r(&time, &localTime);
+
+			sCache.millisecondPos = strftime(sCache.buffer,
+											 sizeof(sCache.buffer) - 4,
+											 "%d.%m.%y %X.", &localTime);
+			sCache.length = sCache.millisecondPos + 3;
+			sCache.second = time;
+		}
 
-		std::stringstream ss;
+		auto pos = sCache.buffer + sCache.millisecondPos;
 
-		ss << std::put_time(localtime(&time), "%d.%m.%y %X.")
-		   << std::setfill('0') << std::setw(3) << ms.count();
+		pos[0] = '0' + ms / 100;
+		pos[1] = '0' + ms / 10 % 10;
+		pos[2] = '0' + ms % 10;
 
-		return ss.str();
+		return sCache;
 	}
 
-	std::string levelToString(LogLevel level)
+	static const char* levelToString(LogLevel level)
 	{
-		static const char* buffer[] = {"", "ERR", "WRN", "INF", "DBG"};
+		static const char* buffer[] =
+		{
+			"| - ", "| ERR - ", "| WRN - ", "| INF - ", "| DBG - "
+		};
 
 		return buffer[static_cast<int>(level)];
 	}
 };
+
+/*
+ * State of one RLOG() statement. The check is lock free: the first line of
+ * the new second resets the counter and logs the number of lines suppressed
+ * in the previous seconds.
+ *
+ * The statement which has suppressed lines is also registered in the global
+ * list under the lock, at most once per second, so the summary is logged by
+ * takeSummaries() if the statement doesn't fire again. Limiters are static,
+ * so they outlive the list.
+ */
+class LogRateLimiter
+{
+public:
+
+	constexpr LogRateLimiter() :
+		mSecond(0), mNumLines(0), mNumSuppressed(0), mRegistered(false)
+	{
+	}
+
+	template<typename T>
+	bool check(const T& instance, const char* file, int line, LogLevel level)
+	{
+		auto limit = getRateLimit(instance);
+
+		if (!limit)
+		{
+			return true;
+		}
+
+		auto second = getSecond();
+		auto current = mSecond.load(std::memory_order_relaxed);
+
+		if (second != current &&
+			mSecond.compare_exchange_strong(current, second,
+											std::memory_order_relaxed))
+		{
+			mNumLines.store(0, std::memory_order_relaxed);
+
+			auto suppressed = mNumSuppressed.exchange(
+					0, std::memory_order_relaxed);
+
+			if (suppressed)
+			{
+				LogLine().get(instance, file, line, level)
+					<< "suppressed " << suppressed << " similar messages";
+			}
+		}
+
+		if (mNumLines.fetch_add(1, std::memory_order_relaxed) < limit)
+		{
+			return true;
+		}
+
+		if (mNumSuppressed.fetch_add(1, std::memory_order_relaxed) == 0)
+		{
+			registerSummary(LogLine::getHeader(instance, file, line), level);
+		}
+
+		return false;
+	}
+
+	// returns true if some statements have registered summaries
+	static bool hasSummaries()
+	{
+		return getNumSummaries().load(std::memory_order_relaxed) != 0;
+	}
+
+	// takes registered summaries and returns them formatted, if all is false
+	// the summaries of the statements which may still fire in the current
+	// second are left
+	static std::string takeSummaries(bool all)
+	{
+		std::lock_guard<std::mutex> lock(getMutex());
+
+		auto& summaries = getSummaries();
+		auto second = getSecond();
+		std::string lines;
+
+		for(auto it = summaries.begin(); it != summaries.end();)
+		{
+			auto limiter = it->limiter;
+
+			if (!all &&
+				limiter->mSecond.load(std::memory_order_relaxed) == second)
+			{
+				it++;
+
+				continue;
+			}
+
+			// the next suppressed line registers the statement again
+			limiter->mRegistered.store(false, std::memory_order_relaxed);
+
+			auto suppressed = limiter->mNumSuppressed.exchange(
+					0, std::memory_order_relaxed);
+
+			if (suppressed)
+			{
+				lines += LogLine::format(it->header, it->level,
+										 "suppressed " +
+										 std::to_string(suppressed) +
+										 " similar messages");
+			}
+
+			it = summaries.erase(it);
+		}
+
+		getNumSummaries().store(summaries.size(), std::memory_order_relaxed);
+
+		return lines;
+	}
+
+private:
+
+	// the header is copied: the log instance may be deleted before the
+	// summary is logged
+	struct Summary
+	{
+		LogRateLimiter* limiter;
+		std::string header;
+		LogLevel level;
+	};
+
+	std::atomic<time_t> mSecond;
+	std::atomic<size_t> mNumLines;
+	std::atomic<size_t> mNumSuppressed;
+	std::atomic<bool> mRegistered;
+
+	void registerSummary(const std::string& header, LogLevel level)
+	{
+		static bool sAtExitRegistered = false;
+
+		std::lock_guard<std::mutex> lock(getMutex());
+
+		if (mRegistered.exchange(true, std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		auto& summaries = getSummaries();
+
+		summaries.push_back({ this, header, level });
+
+		getNumSummaries().store(summaries.size(), std::memory_order_relaxed);
+
+		// the list is created before, so it is deleted after the handler
+
+		if (!sAtExitRegistered)
+		{
+			atexit([] { Log::flushSuppressed(); });
+
+			sAtExitRegistered = true;
+		}
+	}
+
+	static std::mutex& getMutex()
+	{
+		static std::mutex sMutex;
+
+		return sMutex;
+	}
+
+	static std::vector<Summary>& getSummaries()
+	{
+		static std::vector<Summary> sSummaries;
+
+		return sSummaries;
+	}
+
+	static std::atomic<size_t>& getNumSummaries()
+	{
+		static std::atomic<size_t> sNumSummaries(0);
+
+		return sNumSummaries;
+	}
+
+	static size_t getRateLimit(const Log& log) { return log.getRateLimit(); }
+
+	static size_t getRateLimit(const char*)
+	{
+		return Log::getDefaultRateLimit();
+	}
+
+	// the coarse clock is read from vDSO without the system call
+	static time_t getSecond()
+	{
+		timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+		return ts.tv_sec + 1;
+	}
+};
+
+inline void Log::flushSuppressed()
+{
+	auto lines = LogRateLimiter::takeSummaries(true);
+
+	if (!lines.empty())
+	{
+		LogLine::write(lines);
+	}
+}
 /// @endcond
 
 }
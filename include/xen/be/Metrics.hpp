@@ -0,0 +1,306 @@
+/*
+ *  Metrics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_METRICS_HPP_
+#define XENBE_METRICS_HPP_
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+}
+
+#include "Histogram.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Counter updated from many threads.
+ *
+ * The counter consists of several slots placed on different cache lines.
+ * Each thread updates the slot selected by its index, so threads don't contend
+ * on the same cache line. The slots are summed on read.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class MetricsCounter
+{
+public:
+
+	MetricsCounter();
+	MetricsCounter(const MetricsCounter&) = delete;
+	MetricsCounter& operator=(MetricsCounter const&) = delete;
+
+	/**
+	 * Increments the counter
+	 * @param[in] value value to add
+	 */
+	void add(uint64_t value = 1)
+	{
+		mSlots[getSlot()].value.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Decrements the gauge. The slot may wrap but the sum is correct.
+	 * @param[in] value value to subtract
+	 */
+	void sub(uint64_t value = 1)
+	{
+		mSlots[getSlot()].value.fetch_sub(value, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Returns the counter value
+	 */
+	uint64_t get() const;
+
+private:
+
+	static const size_t cNumSlots = 8;
+	static const size_t cCacheLineSize = 64;
+
+	// aligned, so the slot doesn't share the cache line with the neighbour
+	// data even if the counter itself starts in the middle of the line
+	struct alignas(cCacheLineSize) Slot
+	{
+		std::atomic<uint64_t> value;
+	};
+
+	Slot mSlots[cNumSlots];
+
+	static size_t getSlot();
+};
+
+/***************************************************************************//**
+ * Percentiles of the histogram in the metrics group.
+ * @ingroup backend
+ ******************************************************************************/
+struct MetricsHistogram
+{
+	/**
+	 * Histogram name
+	 */
+	std::string name;
+
+	/**
+	 * Request type for the latency tracker histograms, -1 otherwise
+	 */
+	int requestType;
+
+	HistogramSnapshot snapshot;
+};
+
+/***************************************************************************//**
+ * Snapshot of the metrics group.
+ * @ingroup backend
+ ******************************************************************************/
+struct MetricsSnapshot
+{
+	/**
+	 * Group type: ring, frontend, gnttab etc.
+	 */
+	std::string type;
+
+	/**
+	 * Name label, empty if not applicable
+	 */
+	std::string name;
+
+	/**
+	 * Domain id label
+	 */
+	domid_t domId;
+
+	/**
+	 * Device id label, -1 if not applicable
+	 */
+	int devId;
+
+	/**
+	 * Event channel port label, -1 if not applicable
+	 */
+	int port;
+
+	/**
+	 * Counter names and values
+	 */
+	std::vector<std::pair<std::string, uint64_t>> values;
+
+	/**
+	 * Gauge names and values
+	 */
+	std::vector<std::pair<std::string, uint64_t>> gauges;
+
+	/**
+	 * Histograms
+	 */
+	std::vector<MetricsHistogram> histograms;
+
+	/**
+	 * Returns value of the counter or the gauge or 0 if there is no such
+	 * counter
+	 * @param[in] name counter name
+	 */
+	uint64_t get(const std::string& name) const;
+};
+
+/***************************************************************************//**
+ * Named counters of one object labeled with domain id, device id and port.
+ *
+ * The group is registered in Metrics when created and unregistered when
+ * deleted, so the owner object exposes its counters while it exists.
+ * Counters should be added when the owner is created and are accessed by
+ * reference afterwards.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class MetricsGroup
+{
+public:
+
+	/**
+	 * @param[in] type  group type
+	 * @param[in] domId domain id label
+	 * @param[in] devId device id label, -1 if not applicable
+	 * @param[in] port  event channel port label, -1 if not applicable
+	 */
+	MetricsGroup(const std::string& type, domid_t domId = 0, int devId = -1,
+				 int port = -1);
+	MetricsGroup(const MetricsGroup&) = delete;
+	MetricsGroup& operator=(MetricsGroup const&) = delete;
+	~MetricsGroup();
+
+	/**
+	 * Adds the counter
+	 * @param[in] name counter name
+	 */
+	MetricsCounter& addCounter(const std::string& name);
+
+	/**
+	 * Adds the gauge: the value which may go up and down
+	 * @param[in] name gauge name
+	 */
+	MetricsCounter& addGauge(const std::string& name);
+
+	/**
+	 * Adds the histogram
+	 * @param[in] name histogram name
+	 */
+	LatencyHistogram& addHistogram(const std::string& name);
+
+	/**
+	 * Adds histograms of the latency tracker, one per request type
+	 * @param[in] name    histogram name
+	 * @param[in] tracker latency tracker
+	 */
+	void addLatencyTracker(const std::string& name, LatencyTrackerPtr tracker);
+
+	/**
+	 * Sets the device id label
+	 * @param[in] devId device id
+	 */
+	void setDevId(int devId);
+
+	/**
+	 * Sets the name label
+	 * @param[in] name name
+	 */
+	void setName(const std::string& name);
+
+	/**
+	 * Returns snapshot of the group
+	 */
+	MetricsSnapshot getSnapshot() const;
+
+private:
+
+	struct Entry
+	{
+		Entry(const std::string& name, bool gauge) :
+			name(name), gauge(gauge) {}
+
+		std::string name;
+		bool gauge;
+		MetricsCounter counter;
+	};
+
+	struct HistogramEntry
+	{
+		explicit HistogramEntry(const std::string& name) : name(name) {}
+
+		std::string name;
+		LatencyHistogram histogram;
+	};
+
+	mutable std::mutex mMutex;
+
+	std::string mType;
+	std::string mName;
+	domid_t mDomId;
+	int mDevId;
+	int mPort;
+
+	std::list<Entry> mCounters;
+	std::list<HistogramEntry> mHistograms;
+	std::list<std::pair<std::string, LatencyTrackerPtr>> mTrackers;
+};
+
+/***************************************************************************//**
+ * Registry of all metrics groups.
+ * @ingroup backend
+ ******************************************************************************/
+class Metrics
+{
+public:
+
+	/**
+	 * Returns snapshots of all existing groups
+	 */
+	static std::vector<MetricsSnapshot> getSnapshot();
+
+	/**
+	 * Returns snapshots of the groups of the type
+	 * @param[in] type group type
+	 */
+	static std::vector<MetricsSnapshot> getSnapshot(const std::string& type);
+
+private:
+
+	friend class MetricsGroup;
+
+	struct Registry
+	{
+		std::mutex mutex;
+		std::list<const MetricsGroup*> groups;
+	};
+
+	static Registry& getRegistry();
+	static void add(const MetricsGroup* group);
+	static void remove(const MetricsGroup* group);
+};
+
+}
+
+#endif /* XENBE_METRICS_HPP_ */
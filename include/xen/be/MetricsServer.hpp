@@ -0,0 +1,137 @@
+/*
+ *  Metrics export server
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_METRICSSERVER_HPP_
+#define XENBE_METRICSSERVER_HPP_
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Exception.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+#include "Reactor.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by MetricsServer.
+ * @ingroup backend
+ ******************************************************************************/
+class MetricsServerException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Serves metrics of all groups over the unix socket.
+ *
+ * The server answers HTTP GET requests, so the metrics may be scraped with
+ * curl --unix-socket or by a Prometheus agent through a socket proxy:
+ * - /metrics returns the Prometheus text format;
+ * - /metrics.json returns the JSON array of group snapshots.
+ *
+ * Counters and gauges are exported as xenbe_<type>_<name> labeled with domain
+ * id, device id, port and name of the group. Histograms are exported as
+ * summaries with 0.5, 0.9, 0.99 and 0.999 quantiles in nanoseconds. The
+ * number of threads of the process is exported as xenbe_process_threads.
+ *
+ * The server runs its own reactor thread and all sockets are non-blocking,
+ * so a slow client doesn't delay the backend. The metrics are read with
+ * relaxed loads: serving a request doesn't stop ring buffers and other data
+ * path threads. The client which doesn't send the request within
+ * cClientTimeout is disconnected.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class MetricsServer
+{
+public:
+
+	static const size_t cMaxClients = 16;
+	static const size_t cMaxRequestSize = 4096;
+	static const std::chrono::milliseconds cClientTimeout;
+
+	/**
+	 * @param[in] path unix socket path. The existing socket file is replaced.
+	 */
+	explicit MetricsServer(const std::string& path);
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(MetricsServer const&) = delete;
+	~MetricsServer();
+
+	/**
+	 * Returns unix socket path
+	 */
+	const std::string& getPath() const { return mPath; }
+
+	/**
+	 * Formats snapshots in the Prometheus text format
+	 * @param[in] snapshots metrics snapshots
+	 */
+	static std::string formatPrometheus(
+			const std::vector<MetricsSnapshot>& snapshots);
+
+	/**
+	 * Formats snapshots as JSON array
+	 * @param[in] snapshots metrics snapshots
+	 */
+	static std::string formatJson(
+			const std::vector<MetricsSnapshot>& snapshots);
+
+	/**
+	 * Returns snapshots of all groups and the process snapshot
+	 */
+	static std::vector<MetricsSnapshot> getSnapshot();
+
+private:
+
+	struct Client
+	{
+		uint64_t id;
+		std::string request;
+		std::string response;
+		size_t sent;
+	};
+
+	std::string mPath;
+	int mFd;
+	uint64_t mLastClientId;
+
+	std::unordered_map<int, Client> mClients;
+
+	Reactor mReactor;
+
+	Log mLog;
+
+	void init();
+	void release();
+	void acceptClient();
+	void readClient(int fd);
+	void writeClient(int fd, uint64_t id);
+	void closeClient(int fd, uint64_t id);
+	std::string getResponse(const std::string& request);
+};
+
+}
+
+#endif /* XENBE_METRICSSERVER_HPP_ */
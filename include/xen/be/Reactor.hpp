@@ -0,0 +1,253 @@
+/*
+ *  Reactor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_REACTOR_HPP_
+#define XENBE_REACTOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "Exception.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+#include "ReactorPoller.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by Reactor.
+ * @ingroup backend
+ ******************************************************************************/
+class ReactorException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Event loop running in one thread.
+ *
+ * The reactor waits for registered file descriptors with epoll and calls
+ * their callbacks, runs posted tasks and delayed tasks. All callbacks and
+ * tasks are called from the reactor thread one by one, so the state used
+ * only by them doesn't require locking.
+ *
+ * removeFd() guarantees that the callback is not called after it returns:
+ * called from another thread, it waits until the reactor thread has removed
+ * the descriptor.
+ *
+ * The wait mechanism is selected at runtime: epoll or io_uring (see
+ * ReactorPoller). If io_uring is not available, epoll is used. File I/O
+ * submitted with submitRead() and submitWrite() completes on the reactor
+ * thread: with io_uring requests are submitted in batch with one system call
+ * per loop, with epoll they are done by the reactor thread in place.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class Reactor
+{
+public:
+
+	typedef std::function<void()> Callback;
+
+	/**
+	 * Callback of the file I/O request
+	 * @param[in] result number of transferred bytes or negative errno
+	 */
+	typedef std::function<void(ssize_t result)> IoCallback;
+
+	/**
+	 * @param name    reactor name used in logs
+	 * @param backend wait mechanism
+	 */
+	explicit Reactor(const std::string& name = "",
+					 ReactorBackend backend = getDefaultBackend());
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(Reactor const&) = delete;
+	~Reactor();
+
+	/**
+	 * Returns backend used by reactors created without explicit backend
+	 */
+	static ReactorBackend getDefaultBackend();
+
+	/**
+	 * Sets backend used by reactors created without explicit backend
+	 * @param[in] backend backend
+	 */
+	static void setDefaultBackend(ReactorBackend backend);
+
+	/**
+	 * Returns backend used by the reactor. Differs from requested one if
+	 * io_uring is not available.
+	 */
+	ReactorBackend getBackend() const { return mPoller->getBackend(); }
+
+	/**
+	 * Starts the reactor thread
+	 */
+	void start();
+
+	/**
+	 * Runs posted tasks and stops the reactor thread. If called from the
+	 * reactor thread, doesn't wait: the thread exits when the callback
+	 * returns. The reactor may be deleted by its own callback.
+	 */
+	void stop();
+
+	/**
+	 * Adds the file descriptor to wait for input
+	 * @param[in] fd       file descriptor
+	 * @param[in] callback callback which is called when the descriptor is
+	 *                     readable
+	 */
+	void addFd(int fd, Callback callback);
+
+	/**
+	 * Removes the file descriptor
+	 * @param[in] fd file descriptor
+	 */
+	void removeFd(int fd);
+
+	/**
+	 * Reads the file at the offset, as preadv() does. The callback is called
+	 * in the reactor thread when the read is completed. Buffers should be
+	 * valid until then. Requests pending when the reactor is stopped are not
+	 * completed.
+	 * @param[in] fd       file descriptor
+	 * @param[in] iov      buffers
+	 * @param[in] iovcnt   number of buffers
+	 * @param[in] offset   file offset
+	 * @param[in] callback callback
+	 */
+	void submitRead(int fd, const iovec* iov, int iovcnt, off_t offset,
+					IoCallback callback);
+
+	/**
+	 * Writes the file at the offset, as pwritev() does. See submitRead().
+	 * @param[in] fd       file descriptor
+	 * @param[in] iov      buffers
+	 * @param[in] iovcnt   number of buffers
+	 * @param[in] offset   file offset
+	 * @param[in] callback callback
+	 */
+	void submitWrite(int fd, const iovec* iov, int iovcnt, off_t offset,
+					 IoCallback callback);
+
+	/**
+	 * Posts the task to be run in the reactor thread
+	 * @param[in] task task
+	 */
+	void post(Callback task);
+
+	/**
+	 * Posts the task to be run in the reactor thread after the delay
+	 * @param[in] delay delay
+	 * @param[in] task  task
+	 */
+	void postDelayed(std::chrono::milliseconds delay, Callback task);
+
+	/**
+	 * Waits until the tasks posted before are completed. Does nothing if
+	 * called from the reactor thread or if the reactor thread is exited.
+	 */
+	void flush();
+
+	/**
+	 * Returns <i>true</i> if called from the reactor thread
+	 */
+	bool isReactorThread() const;
+
+	/**
+	 * Returns number of handled descriptor events and tasks
+	 */
+	uint64_t getNumEvents() const { return mNumEvents; }
+
+	/**
+	 * Returns the time the reactor was woken up with the current events,
+	 * LatencyTracker::getTime() clock. Should be called from the descriptor
+	 * callback to measure its dispatch lag.
+	 */
+	int64_t getReadyTime() const { return mReadyTime; }
+
+private:
+
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	struct Task
+	{
+		// post time or deadline, LatencyTracker::getTime() clock
+		int64_t readyTime;
+		Callback callback;
+	};
+
+	static std::atomic<ReactorBackend> sDefaultBackend;
+
+	std::unique_ptr<ReactorPoller> mPoller;
+
+	bool mTerminate;
+	bool mRunning;
+	// is set if the reactor is deleted by its callback, is shared with the
+	// reactor thread which exits without accessing the deleted reactor
+	std::shared_ptr<bool> mDeleted;
+	std::atomic<uint64_t> mNumEvents;
+	int64_t mReadyTime;
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::thread mThread;
+
+	std::list<Task> mTasks;
+	std::multimap<TimePoint, Callback> mDelayedTasks;
+	std::unordered_map<int, Callback> mCallbacks;
+	std::unordered_map<uint64_t, IoCallback> mIoCallbacks;
+	uint64_t mNextIoId;
+
+	Log mLog;
+
+	MetricsGroup mMetrics;
+	MetricsCounter& mLoops;
+	MetricsCounter& mFdEvents;
+	MetricsCounter& mNumTasks;
+	MetricsCounter& mErrors;
+	MetricsCounter& mIoRequests;
+
+	void init(ReactorBackend backend);
+	void wakeup();
+	void submitIo(ReactorIo::Type type, int fd, const iovec* iov, int iovcnt,
+				  off_t offset, IoCallback callback);
+	void run();
+	int getTimeout();
+	bool runTasks();
+	bool runCallback(Callback& callback);
+	bool runIoCallback(IoCallback& callback, ssize_t result);
+};
+
+typedef std::shared_ptr<Reactor> ReactorPtr;
+
+}
+
+#endif /* XENBE_REACTOR_HPP_ */
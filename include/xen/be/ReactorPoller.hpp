@@ -0,0 +1,284 @@
+/*
+ *  Reactor pollers
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_REACTORPOLLER_HPP_
+#define XENBE_REACTORPOLLER_HPP_
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Mechanism used by Reactor to wait for events.
+ * @ingroup backend
+ ******************************************************************************/
+enum class ReactorBackend
+{
+	Epoll, IoUring
+};
+
+/***************************************************************************//**
+ * File I/O request submitted through the reactor.
+ * @ingroup backend
+ ******************************************************************************/
+struct ReactorIo
+{
+	enum class Type
+	{
+		Read, Write
+	};
+
+	Type type;
+	int fd;
+	const iovec* iov;
+	int iovcnt;
+	off_t offset;
+
+	// identifies the completion
+	uint64_t id;
+};
+
+/***************************************************************************//**
+ * Event returned by ReactorPoller::wait().
+ * @ingroup backend
+ ******************************************************************************/
+struct ReactorEvent
+{
+	enum class Type
+	{
+		Fd, Io
+	};
+
+	Type type;
+
+	// the ready descriptor for Fd events
+	int fd;
+
+	// the request id and the number of transferred bytes or -errno for Io
+	// events
+	uint64_t id;
+	ssize_t result;
+};
+
+/***************************************************************************//**
+ * Interface of the reactor wait mechanism.
+ *
+ * Descriptors are level-triggered: the descriptor is reported by each
+ * wait() while it is readable. addFd(), removeFd(), submit() and wakeup() may
+ * be called from any thread, wait() is called by the reactor thread only.
+ * Events of the removed descriptor may still be returned by the next wait().
+ * @ingroup backend
+ ******************************************************************************/
+class ReactorPoller
+{
+public:
+
+	virtual ~ReactorPoller() {}
+
+	/**
+	 * Returns the backend of the poller
+	 */
+	virtual ReactorBackend getBackend() const = 0;
+
+	/**
+	 * Adds the file descriptor to wait for input
+	 * @param[in] fd file descriptor
+	 */
+	virtual void addFd(int fd) = 0;
+
+	/**
+	 * Removes the file descriptor
+	 * @param[in] fd file descriptor
+	 */
+	virtual void removeFd(int fd) = 0;
+
+	/**
+	 * Queues the file I/O request. Requests are submitted by the next
+	 * wait(), the completion is returned by wait() as well.
+	 * @param[in] io request
+	 */
+	virtual void submit(const ReactorIo& io) = 0;
+
+	/**
+	 * Waits for events
+	 * @param[in]  timeout timeout in milliseconds, -1 waits infinitely
+	 * @param[out] events  occurred events
+	 */
+	virtual void wait(int timeout, std::vector<ReactorEvent>& events) = 0;
+
+	/**
+	 * Breaks the running wait()
+	 */
+	virtual void wakeup() = 0;
+};
+
+/***************************************************************************//**
+ * Reactor poller based on epoll.
+ *
+ * File I/O requests are performed with preadv()/pwritev() by the reactor
+ * thread when wait() is called.
+ * @ingroup backend
+ ******************************************************************************/
+class EpollPoller : public ReactorPoller
+{
+public:
+
+	EpollPoller();
+	EpollPoller(const EpollPoller&) = delete;
+	EpollPoller& operator=(EpollPoller const&) = delete;
+	~EpollPoller();
+
+	ReactorBackend getBackend() const override
+	{
+		return ReactorBackend::Epoll;
+	}
+
+	void addFd(int fd) override;
+	void removeFd(int fd) override;
+	void submit(const ReactorIo& io) override;
+	void wait(int timeout, std::vector<ReactorEvent>& events) override;
+	void wakeup() override;
+
+private:
+
+	static const int cMaxEvents = 64;
+
+	int mEpollFd;
+	int mPipeFds[2];
+
+	std::mutex mMutex;
+	std::vector<ReactorIo> mRequests;
+
+	void init();
+	void release();
+};
+
+/***************************************************************************//**
+ * Reactor poller based on io_uring.
+ *
+ * Each descriptor has a multishot poll request, so it is armed once and not
+ * on each wait. Multishot poll is edge-triggered: descriptors returned by
+ * wait() are checked again with one poll() call by the next wait() to keep
+ * them level-triggered. File I/O requests are put to the submission queue
+ * and submitted together with one io_uring_enter() call which also waits for
+ * completions.
+ *
+ * The submission queue is filled by the reactor thread only: descriptors and
+ * requests added by other threads are queued and put to the submission queue
+ * by the next wait().
+ *
+ * Requires Linux 5.13 or later: the constructor throws ReactorException if
+ * io_uring or multishot poll is not supported.
+ * @ingroup backend
+ ******************************************************************************/
+class IoUringPoller : public ReactorPoller
+{
+public:
+
+	/**
+	 * @param[in] numEntries size of the submission queue
+	 */
+	explicit IoUringPoller(unsigned numEntries = cNumEntries);
+	IoUringPoller(const IoUringPoller&) = delete;
+	IoUringPoller& operator=(IoUringPoller const&) = delete;
+	~IoUringPoller();
+
+	ReactorBackend getBackend() const override
+	{
+		return ReactorBackend::IoUring;
+	}
+
+	void addFd(int fd) override;
+	void removeFd(int fd) override;
+	void submit(const ReactorIo& io) override;
+	void wait(int timeout, std::vector<ReactorEvent>& events) override;
+	void wakeup() override;
+
+private:
+
+	static const unsigned cNumEntries = 256;
+
+	// operation queued by other threads
+	struct Operation
+	{
+		uint8_t opcode;
+		int fd;
+		uint64_t addr;
+		uint32_t len;
+		uint64_t offset;
+		uint32_t flags;
+		uint64_t userData;
+	};
+
+	int mRingFd;
+	int mEventFd;
+
+	void* mSqRing;
+	size_t mSqRingSize;
+	void* mCqRing;
+	size_t mCqRingSize;
+	io_uring_sqe* mSqes;
+	size_t mSqesSize;
+
+	unsigned* mSqHead;
+	unsigned* mSqTail;
+	unsigned mSqMask;
+	unsigned* mSqArray;
+	unsigned mSqLocalTail;
+
+	unsigned* mCqHead;
+	unsigned* mCqTail;
+	unsigned mCqMask;
+	io_uring_cqe* mCqes;
+
+	std::mutex mMutex;
+	std::vector<Operation> mOperations;
+
+	// user data of the poll request of each descriptor
+	std::unordered_map<int, uint64_t> mPolls;
+	uint32_t mNextPoll;
+
+	// descriptors returned by the previous wait
+	std::vector<int> mReadyFds;
+
+	void init(unsigned numEntries);
+	void release();
+	void probe();
+	void armWakeup();
+	io_uring_sqe* getSqe();
+	void putOperation(const Operation& operation);
+	unsigned getNumToSubmit() const;
+	int enter(unsigned minComplete, int timeout);
+	void checkReadyFds(std::vector<ReactorEvent>& events);
+	void reapCompletions(std::vector<ReactorEvent>& events);
+};
+
+}
+
+#endif /* XENBE_REACTORPOLLER_HPP_ */
@@ -21,6 +21,8 @@
 #ifndef XENBE_RINGBUFFERBASE_HPP_
 #define XENBE_RINGBUFFERBASE_HPP_
 
+#include <atomic>
+#include <functional>
 #include <mutex>
 
 extern "C" {
@@ -29,7 +31,13 @@ extern "C" {
 }
 
 #include "XenEvtchn.hpp"
+#include "BinaryLog.hpp"
 #include "Exception.hpp"
+#include "Histogram.hpp"
+#include "LiveUpgrade.hpp"
+#include "Metrics.hpp"
+#include "Scheduler.hpp"
+#include "Trace.hpp"
 #include "XenGnttab.hpp"
 #include "Log.hpp"
 
@@ -48,7 +56,7 @@ class RingBufferException : public Exception
  * Interface to implement custom ring buffer.
  * @ingroup backend
  ******************************************************************************/
-class RingBufferBase
+class RingBufferBase : public Schedulable
 {
 public:
 
@@ -65,11 +73,86 @@ public:
 	 */
 	void start();
 
+	/**
+	 * Sets the scheduler which processes requests of the ring buffer instead
+	 * of the event channel thread. Should be set before the ring buffer is
+	 * started.
+	 * @param[in] scheduler scheduler
+	 */
+	void setScheduler(SchedulerPtr scheduler) { mScheduler = scheduler; }
+
+	/**
+	 * Starts ring buffer handling in the reactor thread.
+	 * @param[in] reactor reactor
+	 */
+	void start(ReactorPtr reactor);
+
 	/**
 	 * Stops ring buffer handling.
 	 */
 	void stop();
 
+	/**
+	 * Returns <i>true</i> if ring buffer handling is started.
+	 */
+	bool isStarted() const { return mEventChannel.isStarted(); }
+
+	/**
+	 * Returns number of received indications.
+	 */
+	uint64_t getNumIndications() const { return mNotificationsReceived.get(); }
+
+	/**
+	 * Returns the ring buffer metrics. The group is labeled with the domain id
+	 * and the port, the device id is set by the frontend handler.
+	 */
+	MetricsGroup& getMetrics() { return mMetrics; }
+
+	/**
+	 * Suspends handling of the frontend notifications. The event channel and
+	 * the mapped buffer are kept, so the ring buffer may be resumed when the
+	 * frontend reconnects with the same port and reference.
+	 */
+	void suspend();
+
+	/**
+	 * Resets the ring indices and resumes handling of the frontend
+	 * notifications. Requests posted while suspended are processed by
+	 * processPending().
+	 * @return <i>false</i> if the shared ring is not in the initial state
+	 */
+	bool resume();
+
+	/**
+	 * Processes requests posted by the frontend without the notification
+	 * being handled, e.g. while the ring buffer was suspended. Is called by
+	 * the frontend handler when the backend is connected.
+	 */
+	void processPending();
+
+	/**
+	 * Returns the state to be handed over to the new backend process.
+	 * The ring buffer should be stopped.
+	 */
+	RingBufferState getState();
+
+	/**
+	 * Restores the state handed over by the old backend process
+	 * @param[in] state ring buffer state
+	 */
+	void setState(const RingBufferState& state);
+
+	/**
+	 * Stops ring buffer handling and keeps the event channel bound when
+	 * the ring buffer is deleted.
+	 */
+	void detach();
+
+	/**
+	 * Returns frontend domain id.
+	 */
+	domid_t getDomId() const { return mDomId; }
+
 	/**
 	 * Returns event channel port.
 	 */
@@ -86,6 +169,13 @@ public:
 	 */
 	void setErrorCallback(ErrorCallback errorCallback);
 
+	/**
+	 * Processes requests within the budget. Is called by the scheduler.
+	 * @param[in,out] budget budget
+	 * @return <i>true</i> if there are pending requests left
+	 */
+	bool processRequests(SchedulerBudget& budget) override;
+
 protected:
 
 	/**
@@ -95,6 +185,34 @@ protected:
 	 */
 	virtual void onReceiveIndication() = 0;
 
+	/**
+	 * Is called by the scheduler to process requests within the budget.
+	 * By default calls onReceiveIndication().
+	 * @param[in,out] budget budget
+	 * @return <i>true</i> if there are pending requests left
+	 */
+	virtual bool onProcessRequests(SchedulerBudget& budget);
+
+	/**
+	 * Is called on resume to reset the ring indices. Indications are not
+	 * handled while this method is called. By default the ring buffer can't
+	 * be resumed and is created again.
+	 * @return <i>false</i> if the shared ring is not in the initial state
+	 */
+	virtual bool onReset() { return false; }
+
+	/**
+	 * Is called to save private ring indices into the handed over state.
+	 * @param[out] state ring buffer state
+	 */
+	virtual void onSaveState(RingBufferState& state) {}
+
+	/**
+	 * Is called to restore private ring indices from the handed over state.
+	 * @param[in] state ring buffer state
+	 */
+	virtual void onRestoreState(const RingBufferState& state) {}
+
 	/**
 	 * Event channel.
 	 */
@@ -107,12 +225,34 @@ protected:
 
 	Log mLog;
 
+	/**
+	 * Ring buffer metrics.
+	 */
+	MetricsGroup mMetrics;
+	MetricsCounter& mRequestsConsumed;
+	MetricsCounter& mResponsesProduced;
+	MetricsCounter& mEventsProduced;
+	MetricsCounter& mNotificationsSent;
+	MetricsCounter& mNotificationsReceived;
+	MetricsCounter& mSpuriousWakeups;
+	MetricsCounter& mRingFull;
+	MetricsCounter& mRingOverflow;
+
 private:
 
+	domid_t mDomId;
 	evtchn_port_t mPort;
 	grant_ref_t mRef;
 
+	SchedulerPtr mScheduler;
+	ErrorCallback mErrorCallback;
+
+	std::mutex mIndicationMutex;
+	bool mSuspended;
+
 	void onIndication();
+	void handleIndication();
+	void startScheduling();
 };
 
 /***************************************************************************//**
@@ -129,6 +269,7 @@ private:
  *
  * In order to create the in ring buffer the client should implement a class
  * inherited from RingBufferInBase and override processRequest() method.
+ * Requests may be passed to the command handlers with RingProtocol.
  *
  * @snippet ExampleBackend.hpp ExampleInRingBuffer
  *
@@ -156,6 +297,34 @@ public:
 		BACK_RING_INIT(&mRing, static_cast<Page*>(mBuffer.get()), size);
 	}
 
+	/**
+	 * Enables measuring of the request latency from dequeuing the request
+	 * to sending its response. The request and the response are matched by
+	 * id. Latencies are accounted per request type. Should be called before
+	 * the ring buffer is started.
+	 * @param[in] requestId   returns id of the request
+	 * @param[in] responseId  returns id of the request the response is for
+	 * @param[in] requestType returns type of the request
+	 */
+	void setLatencyTracking(std::function<uint64_t(const Req&)> requestId,
+							std::function<uint64_t(const Rsp&)> responseId,
+							std::function<uint32_t(const Req&)> requestType)
+	{
+		mRequestId = requestId;
+		mResponseId = responseId;
+		mRequestType = requestType;
+
+		mLatencyTracker = std::make_shared<LatencyTracker>(RING_SIZE(&mRing));
+
+		mMetrics.addLatencyTracker("request_latency", mLatencyTracker);
+	}
+
+	/**
+	 * Returns the latency tracker or nullptr if latency tracking is not
+	 * enabled
+	 */
+	LatencyTrackerPtr getLatencyTracker() const { return mLatencyTracker; }
+
 protected:
 
 	/**
@@ -166,6 +335,13 @@ protected:
 	 */
 	virtual void processRequest(const Req& req) = 0;
 
+	/**
+	 * Returns size of the request accounted by the scheduler byte rate
+	 * limit. The client may override it to account the request payload.
+	 * @param req request
+	 */
+	virtual size_t getRequestSize(const Req& req) { return sizeof(Req); }
+
 	/**
 	 * Sends the response to the frontend
 	 * @param rsp response
@@ -180,19 +356,79 @@ protected:
 
 		RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&mRing, notify);
 
+		mResponsesProduced.add();
+
+		XENBE_TRACE(Response, getDomId(), getPort(), mRing.rsp_prod_pvt,
+					mRing.req_cons);
+
+		if (mLatencyTracker)
+		{
+			mLatencyTracker->onResponse(mResponseId(rsp));
+		}
+
 		if (notify)
 		{
 			mEventChannel.notify();
+
+			mNotificationsSent.add();
+
+			XENBE_TRACE(Notify, getDomId(), getPort(), mRing.rsp_prod_pvt,
+						mRing.req_cons);
+		}
+	}
+
+	/**
+	 * Resets the ring indices. The frontend should have reinitialized the
+	 * shared ring.
+	 */
+	bool onReset() override
+	{
+		mRing.req_cons = 0;
+		mRing.rsp_prod_pvt = 0;
+
+		xen_rmb();
+
+		if (mRing.sring->rsp_prod != 0 ||
+			RING_REQUEST_PROD_OVERFLOW(&mRing, mRing.sring->req_prod))
+		{
+			return false;
 		}
+
+		return true;
+	}
+
+	void onSaveState(RingBufferState& state) override
+	{
+		state.reqCons = mRing.req_cons;
+		state.rspProdPvt = mRing.rsp_prod_pvt;
+	}
+
+	void onRestoreState(const RingBufferState& state) override
+	{
+		mRing.req_cons = state.reqCons;
+		mRing.rsp_prod_pvt = state.rspProdPvt;
 	}
 
 private:
 
 	Ring mRing;
 
+	LatencyTrackerPtr mLatencyTracker;
+	std::function<uint64_t(const Req&)> mRequestId;
+	std::function<uint64_t(const Rsp&)> mResponseId;
+	std::function<uint32_t(const Req&)> mRequestType;
+
 	void onReceiveIndication()
+	{
+		SchedulerBudget budget = { SIZE_MAX, SIZE_MAX, 0, 0 };
+
+		onProcessRequests(budget);
+	}
+
+	bool onProcessRequests(SchedulerBudget& budget) override
 	{
 		int numPendingRequests = 0;
+		auto numRequests = budget.numRequests;
 
 		do {
 			Req req;
@@ -204,14 +440,29 @@ private:
 
 			if (RING_REQUEST_PROD_OVERFLOW(&mRing, rp))
 			{
+				mRingOverflow.add();
+
+				XENBE_TRACE(Overflow, getDomId(), getPort(), rp, rc);
+
 				throw RingBufferException("Ring buffer producer overflow", EIO);
 			}
 
 			while (rc != rp)
 			{
+				// the rest is processed in the next slice, the frontend
+				// is not asked for a notification
+
+				if (!budget.isAvailable())
+				{
+					return true;
+				}
 
 				if (RING_REQUEST_CONS_OVERFLOW(&mRing, rc))
 				{
+					mRingOverflow.add();
+
+					XENBE_TRACE(Overflow, getDomId(), getPort(), rp, rc);
+
 					throw RingBufferException("Ring buffer consumer overflow", EIO);
 				}
 
@@ -221,12 +472,33 @@ private:
 
 				xen_mb();
 
+				mRequestsConsumed.add();
+
+				XENBE_TRACE(Request, getDomId(), getPort(), rp, rc);
+
+				if (mLatencyTracker)
+				{
+					mLatencyTracker->onRequest(mRequestId(req),
+											   mRequestType(req));
+				}
+
 				processRequest(req);
+
+				budget.consume(getRequestSize(req));
 			}
 
 			RING_FINAL_CHECK_FOR_REQUESTS(&mRing, numPendingRequests);
 		}
 		while (numPendingRequests);
+
+		// woken up without new requests
+
+		if (budget.numRequests == numRequests)
+		{
+			mSpuriousWakeups.add();
+		}
+
+		return false;
 	}
 };
 
@@ -272,9 +544,9 @@ public:
 				static_cast<uint8_t*>(mBuffer.get()) + offset)),
 		mNumEvents(size/sizeof(Event))
 	{
-		mPage->in_prod = mPage->in_cons;
-
-		xen_wmb();
+		// the ring is initialized by the frontend: the ring buffer created
+		// on live upgrade keeps the events not consumed yet, the indices are
+		// reset only by onReset() when the frontend reconnects
 	}
 
 	/**
@@ -287,17 +559,21 @@ public:
 
 		if (static_cast<int>(mPage->in_prod - mPage->in_cons) >= mNumEvents)
 		{
-			LOG(mLog, WARNING) << "Ring buffer overflow, port: " << getPort()
-							   <<", prod: " << mPage->in_prod
-							   << ", cons: " << mPage->in_cons;
+			mRingFull.add();
+
+			XENBE_TRACE(Overflow, getDomId(), getPort(), mPage->in_prod,
+						mPage->in_cons);
+
+			RLOG(mLog, WARNING) << "Ring buffer overflow, port: " << getPort()
+								<< ", prod: " << mPage->in_prod
+								<< ", cons: " << mPage->in_cons;
 
 			return;
 		}
 
-		LOG(mLog, DEBUG) << "Send event, port: " << getPort()
-						 <<", prod: " << mPage->in_prod
-						 << ", cons: " << mPage->in_cons
-						 << ", num events: " << mNumEvents;
+		BLOG(mLog, DEBUG, "Send event, port: {}, prod: {}, cons: {}, "
+			 "num events: {}", getPort(), mPage->in_prod, mPage->in_cons,
+			 mNumEvents);
 
 		mEventBuffer[mPage->in_prod % mNumEvents] = event;
 
@@ -306,12 +582,32 @@ public:
 		xen_wmb();
 
 		mEventChannel.notify();
+
+		mEventsProduced.add();
+		mNotificationsSent.add();
+
+		XENBE_TRACE(Event, getDomId(), getPort(), mPage->in_prod,
+					mPage->in_cons);
 	}
 
 protected:
 
 	void onReceiveIndication() {}
 
+	/**
+	 * Drops the events not consumed by the previous frontend instance.
+	 */
+	bool onReset() override
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mPage->in_prod = mPage->in_cons;
+
+		xen_wmb();
+
+		return true;
+	}
+
 private:
 
 	Page* mPage;
@@ -0,0 +1,344 @@
+/*
+ *  Ring protocol descriptor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_RINGPROTOCOL_HPP_
+#define XENBE_RINGPROTOCOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "Metrics.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Declares the command of the ring protocol for XENBE_RING_PROTOCOL.
+ * @param id      request id of the command
+ * @param payload pointer to the member of the request union which holds the
+ *                command payload
+ * @param handler pointer to the backend member function which handles the
+ *                command: void (const Payload& payload, Rsp& rsp)
+ * @ingroup backend
+ ******************************************************************************/
+#define XENBE_RING_COMMAND(id, payload, handler) \
+	XenBackend::RingCommand<(id), decltype(payload), (payload), \
+							decltype(handler), (handler)>
+
+/***************************************************************************//**
+ * Declares the ring protocol.
+ * @param page shared ring type defined by DEFINE_RING_TYPES()
+ * @param id   pointer to the request member which holds the request id
+ * @param op   pointer to the request member which holds the request union
+ * @param ...  commands declared with XENBE_RING_COMMAND
+ * @ingroup backend
+ ******************************************************************************/
+#define XENBE_RING_PROTOCOL(page, id, op, ...) \
+	XenBackend::RingProtocol<page, decltype(id), (id), decltype(op), (op), \
+							 __VA_ARGS__>
+
+/***************************************************************************//**
+ * Command of the ring protocol: the request id, the payload member of the
+ * request union and the backend member function which handles the payload.
+ * Should be declared with XENBE_RING_COMMAND.
+ * @ingroup backend
+ ******************************************************************************/
+template<uint32_t cId, typename PayloadPtr, PayloadPtr cPayload,
+		 typename HandlerPtr, HandlerPtr cHandler>
+struct RingCommand
+{
+	static_assert(!std::is_same<PayloadPtr, PayloadPtr>::value,
+				  "Command handler should be "
+				  "void (Backend::*)(const Payload&, Rsp&)");
+};
+
+/// @cond HIDDEN_SYMBOLS
+template<uint32_t cId, typename Op, typename Payload, Payload Op::*cPayload,
+		 typename Backend, typename Rsp,
+		 void (Backend::*cHandler)(const Payload&, Rsp&)>
+struct RingCommand<cId, Payload Op::*, cPayload,
+				   void (Backend::*)(const Payload&, Rsp&), cHandler>
+{
+	static_assert(std::is_standard_layout<Payload>::value &&
+				  std::is_trivially_copyable<Payload>::value,
+				  "Command payload should be a plain structure");
+
+	typedef Op OpType;
+	typedef Backend BackendType;
+	typedef Rsp RspType;
+
+	static constexpr uint32_t id = cId;
+
+	template<typename Req, Op Req::*cOp>
+	static void handle(Backend& backend, const Req& req, Rsp& rsp)
+	{
+		(backend.*cHandler)((req.*cOp).*cPayload, rsp);
+	}
+};
+
+namespace RingProtocolDetail {
+
+template<size_t... cIndices>
+struct Indices {};
+
+template<size_t cSize, size_t... cIndices>
+struct MakeIndices : MakeIndices<cSize - 1, cSize - 1, cIndices...> {};
+
+template<size_t... cIndices>
+struct MakeIndices<0, cIndices...>
+{
+	typedef Indices<cIndices...> type;
+};
+
+struct NotFound {};
+
+template<typename T>
+struct Tag
+{
+	typedef T type;
+};
+
+template<uint32_t cId, typename... Commands>
+struct Find : Tag<NotFound> {};
+
+template<uint32_t cId, typename Command, typename... Commands>
+struct Find<cId, Command, Commands...> :
+	std::conditional<Command::id == cId, Tag<Command>,
+					 Find<cId, Commands...>>::type {};
+
+template<typename... Commands>
+struct Limits;
+
+template<typename Command>
+struct Limits<Command>
+{
+	static constexpr uint32_t min = Command::id;
+	static constexpr uint32_t max = Command::id;
+	static constexpr bool unique = true;
+};
+
+template<typename Command, typename... Commands>
+struct Limits<Command, Commands...>
+{
+	static constexpr uint32_t min = Command::id < Limits<Commands...>::min ?
+									Command::id : Limits<Commands...>::min;
+	static constexpr uint32_t max = Command::id > Limits<Commands...>::max ?
+									Command::id : Limits<Commands...>::max;
+	static constexpr bool unique = Limits<Commands...>::unique &&
+		std::is_same<typename Find<Command::id, Commands...>::type,
+					 NotFound>::value;
+};
+
+template<typename First, typename... Commands>
+struct SameTypes : std::true_type {};
+
+template<typename First, typename Command, typename... Commands>
+struct SameTypes<First, Command, Commands...> :
+	std::integral_constant<bool,
+		std::is_same<typename First::BackendType,
+					 typename Command::BackendType>::value &&
+		std::is_same<typename First::RspType,
+					 typename Command::RspType>::value &&
+		std::is_same<typename First::OpType,
+					 typename Command::OpType>::value &&
+		SameTypes<First, Commands...>::value> {};
+
+template<typename Protocol, typename Indices, typename... Commands>
+struct Table;
+
+template<typename Protocol, size_t... cIndices, typename... Commands>
+struct Table<Protocol, Indices<cIndices...>, Commands...>
+{
+	static constexpr typename Protocol::Handler handlers[] = {
+		Protocol::getHandler(Find<Protocol::cMinId + cIndices,
+								  Commands...>())...
+	};
+};
+
+template<typename Protocol, size_t... cIndices, typename... Commands>
+constexpr typename Protocol::Handler
+Table<Protocol, Indices<cIndices...>, Commands...>::handlers[];
+
+}
+/// @endcond
+
+/***************************************************************************//**
+ * Ring protocol descriptor.
+ *
+ * Describes the requests of the ring buffer as a list of commands, so the
+ * backend doesn't write the switch on the request id. The request is
+ * dispatched with one lookup in the dense table of handlers indexed by the
+ * request id. The table is generated at compile time and covers ids from the
+ * lowest to the highest command id, so the ids should be close to each
+ * other.
+ *
+ * The descriptor is checked at compile time: the request and the response
+ * should be the types of the shared ring, command ids should be unique, all
+ * handlers should be members of one backend and fill one response type.
+ *
+ * Each command has the "requests_<id>" counter in the metrics group, requests
+ * with unknown id are counted by "requests_unknown".
+ *
+ * The protocol should be declared with XENBE_RING_PROTOCOL:
+ *
+ * @snippet ExampleBackend.hpp ExampleProtocol
+ *
+ * and used in processRequest():
+ *
+ * @snippet ExampleBackend.cpp processRequest
+ *
+ * @ingroup backend
+ ******************************************************************************/
+template<typename Page, typename IdPtr, IdPtr cIdPtr, typename OpPtr,
+		 OpPtr cOpPtr, typename... Commands>
+class RingProtocol;
+
+template<typename Page, typename Req, typename Id, Id Req::*cId,
+		 typename Op, Op Req::*cOp, typename... CommandList>
+class RingProtocol<Page, Id Req::*, cId, Op Req::*, cOp, CommandList...>
+{
+	static_assert(sizeof...(CommandList) > 0,
+				  "Protocol should have commands");
+
+	typedef typename RingProtocolDetail::Find<
+		RingProtocolDetail::Limits<CommandList...>::min,
+		CommandList...>::type First;
+
+	typedef RingProtocolDetail::Limits<CommandList...> Limits;
+
+public:
+
+	typedef typename First::BackendType Backend;
+	typedef typename First::RspType Rsp;
+	typedef void (*Handler)(Backend&, const Req&, Rsp&);
+
+	/**
+	 * Lowest command id
+	 */
+	static constexpr uint32_t cMinId = Limits::min;
+
+	/**
+	 * Number of entries in the dispatch table
+	 */
+	static constexpr size_t cTableSize = Limits::max - Limits::min + 1;
+
+	/**
+	 * Maximal number of entries in the dispatch table
+	 */
+	static constexpr size_t cMaxTableSize = 256;
+
+	static_assert(std::is_same<
+				  decltype(std::declval<Page&>().ring[0].req), Req>::value,
+				  "Request type doesn't match the shared ring");
+	static_assert(std::is_same<
+				  decltype(std::declval<Page&>().ring[0].rsp), Rsp>::value,
+				  "Response type doesn't match the shared ring");
+	static_assert(std::is_same<typename First::OpType, Op>::value,
+				  "Payload should be the member of the request union");
+	static_assert(std::is_integral<Id>::value,
+				  "Request id should be integral");
+	static_assert(std::is_standard_layout<Req>::value &&
+				  std::is_trivially_copyable<Req>::value &&
+				  std::is_standard_layout<Rsp>::value &&
+				  std::is_trivially_copyable<Rsp>::value,
+				  "Request and response should be plain structures");
+	static_assert(sizeof(Req) <= sizeof(Page::ring[0]) &&
+				  sizeof(Rsp) <= sizeof(Page::ring[0]),
+				  "Request and response should fit the ring entry");
+	static_assert(RingProtocolDetail::SameTypes<First, CommandList...>::value,
+				  "Commands should have the same backend, response and "
+				  "request union");
+	static_assert(Limits::unique, "Command ids should be unique");
+	static_assert(cTableSize <= cMaxTableSize,
+				  "Command ids are too sparse for the dispatch table");
+
+	/**
+	 * @param[in] metrics metrics group to add the command counters
+	 */
+	explicit RingProtocol(MetricsGroup& metrics) :
+		mUnknown(metrics.addCounter("requests_unknown"))
+	{
+		for(size_t i = 0; i < cTableSize; i++)
+		{
+			mCounters[i] = Table::handlers[i] ?
+						   &metrics.addCounter("requests_" +
+											   std::to_string(cMinId + i)) :
+						   nullptr;
+		}
+	}
+
+	RingProtocol(const RingProtocol&) = delete;
+	RingProtocol& operator=(RingProtocol const&) = delete;
+
+	/**
+	 * Calls the handler of the request
+	 * @param[in]  backend backend which handles the request
+	 * @param[in]  req     request
+	 * @param[out] rsp     response filled by the handler
+	 * @return <i>false</i> if the request id is unknown
+	 */
+	bool dispatch(Backend& backend, const Req& req, Rsp& rsp)
+	{
+		size_t index = static_cast<uint32_t>(req.*cId) - cMinId;
+
+		if (index >= cTableSize || !Table::handlers[index])
+		{
+			mUnknown.add();
+
+			return false;
+		}
+
+		mCounters[index]->add();
+
+		Table::handlers[index](backend, req, rsp);
+
+		return true;
+	}
+
+	/// @cond HIDDEN_SYMBOLS
+	template<typename Command>
+	static constexpr Handler getHandler(RingProtocolDetail::Tag<Command>)
+	{
+		return &Command::template handle<Req, cOp>;
+	}
+
+	static constexpr Handler getHandler(
+			RingProtocolDetail::Tag<RingProtocolDetail::NotFound>)
+	{
+		return nullptr;
+	}
+	/// @endcond
+
+private:
+
+	typedef RingProtocolDetail::Table<RingProtocol,
+		typename RingProtocolDetail::MakeIndices<
+			cTableSize <= cMaxTableSize ? cTableSize : 1>::type,
+		CommandList...> Table;
+
+	MetricsCounter& mUnknown;
+	MetricsCounter* mCounters[cTableSize];
+};
+
+}
+
+#endif /* XENBE_RINGPROTOCOL_HPP_ */
@@ -0,0 +1,353 @@
+/*
+ *  Fair-share request scheduler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_SCHEDULER_HPP_
+#define XENBE_SCHEDULER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+extern "C" {
+#include <xenctrl.h>
+}
+
+#include "Exception.hpp"
+#include "Log.hpp"
+#include "Reactor.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by Scheduler.
+ * @ingroup backend
+ ******************************************************************************/
+class SchedulerException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Amount of work allowed for one scheduling slice.
+ * @ingroup backend
+ ******************************************************************************/
+struct SchedulerBudget
+{
+	/**
+	 * Number of requests which may be processed
+	 */
+	size_t maxRequests;
+
+	/**
+	 * Number of request bytes which may be processed. The request which
+	 * exceeds the budget is still processed.
+	 */
+	size_t maxBytes;
+
+	/**
+	 * Number of processed requests
+	 */
+	size_t numRequests;
+
+	/**
+	 * Number of processed request bytes
+	 */
+	size_t numBytes;
+
+	/**
+	 * Returns <i>true</i> if the budget is not exhausted
+	 */
+	bool isAvailable() const
+	{
+		return numRequests < maxRequests && numBytes < maxBytes;
+	}
+
+	/**
+	 * Accounts the processed request
+	 * @param[in] size request size
+	 */
+	void consume(size_t size)
+	{
+		numRequests++;
+		numBytes += size;
+	}
+};
+
+/***************************************************************************//**
+ * Request source scheduled by Scheduler, for example the in ring buffer.
+ * @ingroup backend
+ ******************************************************************************/
+class Schedulable
+{
+public:
+
+	virtual ~Schedulable() {}
+
+	/**
+	 * Processes pending requests within the budget. Is called from the
+	 * scheduler thread.
+	 * @param[in,out] budget budget, processed requests are accounted in it
+	 * @return <i>true</i> if there are pending requests left
+	 */
+	virtual bool processRequests(SchedulerBudget& budget) = 0;
+};
+
+/***************************************************************************//**
+ * Token bucket rate limiter.
+ * @ingroup backend
+ ******************************************************************************/
+class TokenBucket
+{
+public:
+
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	/**
+	 * @param[in] rate  tokens per second, 0 for unlimited
+	 * @param[in] burst bucket capacity
+	 */
+	explicit TokenBucket(double rate = 0, double burst = 0);
+
+	/**
+	 * Returns <i>true</i> if the rate is limited
+	 */
+	bool isLimited() const { return mRate > 0; }
+
+	/**
+	 * Returns number of available tokens
+	 * @param[in] now current time
+	 */
+	double getAvailable(TimePoint now);
+
+	/**
+	 * Takes tokens. The bucket may go into debt which is paid by the following
+	 * refills.
+	 * @param[in] tokens number of tokens
+	 */
+	void take(double tokens);
+
+	/**
+	 * Returns time till at least one token is available
+	 * @param[in] now current time
+	 */
+	std::chrono::microseconds getWaitTime(TimePoint now);
+
+private:
+
+	double mRate;
+	double mBurst;
+	double mTokens;
+	TimePoint mLastTime;
+
+	void refill(TimePoint now);
+};
+
+/***************************************************************************//**
+ * Throttling statistics of the domain.
+ * @ingroup backend
+ ******************************************************************************/
+struct SchedulerStats
+{
+	/**
+	 * Number of processed requests
+	 */
+	uint64_t numRequests;
+
+	/**
+	 * Number of processed request bytes
+	 */
+	uint64_t numBytes;
+
+	/**
+	 * Number of slices ended because the per-wakeup budget was exhausted
+	 */
+	uint64_t numBudgetExhausted;
+
+	/**
+	 * Number of times the domain was delayed by the rate limit
+	 */
+	uint64_t numThrottled;
+
+	/**
+	 * Total time the domain was delayed by the rate limit
+	 */
+	std::chrono::microseconds throttledTime;
+};
+
+/***************************************************************************//**
+ * Fair-share scheduler of frontend requests.
+ *
+ * Without the scheduler the ring buffer is drained until it is empty in the
+ * event channel thread, so a frontend which keeps producing requests delays
+ * all other frontends handled by the same thread. When the scheduler is set
+ * to the ring buffer (see RingBufferBase::setScheduler()), the indication
+ * only activates the ring buffer and requests are processed by the scheduler
+ * in slices:
+ * - each slice processes at most the per-wakeup budget of requests, the ring
+ * buffer with requests left is queued again;
+ * - domains are served by weighted fair queuing: each domain has a virtual
+ * time advanced by processed requests divided by the domain weight, the
+ * active domain with the least virtual time is served next. The ring buffers
+ * of the same domain are served round robin;
+ * - optional token buckets limit requests per second and bytes per second of
+ * the domain. The domain out of tokens is skipped till the bucket is
+ * refilled.
+ *
+ * All slices are run in the reactor thread, the scheduler creates its own
+ * reactor if none is given.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class Scheduler
+{
+public:
+
+	/**
+	 * @param[in] name    scheduler name used in logs
+	 * @param[in] reactor reactor which runs the slices, if nullptr the
+	 *                    scheduler starts own reactor
+	 */
+	explicit Scheduler(const std::string& name = "",
+					   ReactorPtr reactor = ReactorPtr());
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(Scheduler const&) = delete;
+	~Scheduler();
+
+	/**
+	 * Sets the number of requests processed per wakeup
+	 * @param[in] budget number of requests
+	 */
+	void setBudget(size_t budget);
+
+	/**
+	 * Sets the weight of the domain
+	 * @param[in] domId  domain id
+	 * @param[in] weight weight, 1 by default
+	 */
+	void setWeight(domid_t domId, unsigned weight);
+
+	/**
+	 * Limits the domain request rate
+	 * @param[in] domId          domain id
+	 * @param[in] requestsPerSec requests per second, 0 for unlimited
+	 * @param[in] bytesPerSec    bytes per second, 0 for unlimited
+	 */
+	void setRateLimit(domid_t domId, double requestsPerSec,
+					  double bytesPerSec = 0);
+
+	/**
+	 * Returns throttling statistics of the domain
+	 * @param[in] domId domain id
+	 */
+	SchedulerStats getStats(domid_t domId);
+
+	/**
+	 * Adds the request source
+	 * @param[in] client request source
+	 * @param[in] domId  domain id of the source
+	 */
+	void add(Schedulable* client, domid_t domId);
+
+	/**
+	 * Removes the request source. Waits if the source is being processed.
+	 * @param[in] client request source
+	 */
+	void remove(Schedulable* client);
+
+	/**
+	 * Queues the request source for processing
+	 * @param[in] client request source
+	 */
+	void activate(Schedulable* client);
+
+	/**
+	 * Returns the reactor which runs the slices
+	 */
+	ReactorPtr getReactor() const { return mReactor; }
+
+private:
+
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	// virtual time of one request with weight 1
+	static const uint64_t cRequestCost = 1024;
+	// slices run by one reactor task
+	static const int cMaxSlicesPerRun = 16;
+	static const int cBurstMs = 100;
+
+	struct Client
+	{
+		domid_t domId;
+		bool queued;
+	};
+
+	struct Domain
+	{
+		Domain();
+
+		unsigned weight;
+		uint64_t virtualTime;
+		TokenBucket requestBucket;
+		TokenBucket byteBucket;
+		TimePoint throttledUntil;
+		std::list<Schedulable*> queue;
+		SchedulerStats stats;
+	};
+
+	ReactorPtr mReactor;
+	bool mOwnReactor;
+	// posted tasks are skipped once it is reset
+	std::shared_ptr<bool> mAlive;
+
+	size_t mBudget;
+	uint64_t mVirtualTime;
+	bool mRunPosted;
+	bool mDelayedRunPosted;
+	Schedulable* mRunning;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+
+	std::unordered_map<Schedulable*, Client> mClients;
+	std::unordered_map<domid_t, Domain> mDomains;
+	std::list<domid_t> mActiveDomains;
+
+	Log mLog;
+
+	void queue(Schedulable* client, Client& info);
+	void postRun();
+	void postDelayedRun(std::chrono::microseconds delay);
+	void run();
+	bool selectDomain(TimePoint now, domid_t& domId,
+					  std::chrono::microseconds& wait);
+	bool throttle(Domain& domain, TimePoint now);
+	void runSlice(std::unique_lock<std::mutex>& lock, domid_t domId,
+				  TimePoint now);
+};
+
+typedef std::shared_ptr<Scheduler> SchedulerPtr;
+
+}
+
+#endif /* XENBE_SCHEDULER_HPP_ */
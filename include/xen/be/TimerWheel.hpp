@@ -0,0 +1,174 @@
+/*
+ *  Hierarchical timer wheel
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_TIMERWHEEL_HPP_
+#define XENBE_TIMERWHEEL_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Runs timer callbacks of all Timer instances on one thread.
+ *
+ * Timers are kept in the hierarchical wheel: four levels of 256 slots, the
+ * slot of the first level is 1 ms, the slot of each next level covers the
+ * whole previous level. A timer is put to the slot by its expiration time,
+ * so starting and stopping the timer is O(1) and doesn't depend on the
+ * number of timers. When the first level turns over, timers of the next
+ * level slot are moved to the lower level. Timeouts longer than about 49
+ * days are moved through the last level several times.
+ *
+ * The thread sleeps until the nearest slot of the first level which has
+ * timers or until the first level turns over. Callbacks are called one after
+ * another by the wheel thread without the lock, so a long callback delays
+ * other timers: this is reported by CallbackMonitor.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class TimerWheel
+{
+public:
+
+	typedef std::function<void()> Callback;
+
+	static const size_t cLevelBits = 8;
+	static const size_t cNumSlots = 1 << cLevelBits;
+	static const size_t cNumLevels = 4;
+
+	/// @cond HIDDEN_SYMBOLS
+	// slot lists are circular, the head is the link without the timer
+	struct Link
+	{
+		Link() : prev(this), next(this) {}
+
+		Link* prev;
+		Link* next;
+	};
+	/// @endcond
+
+	/**
+	 * Timer state kept by the wheel
+	 */
+	class Entry : private Link
+	{
+	public:
+
+		/**
+		 * @param[in] callback callback
+		 * @param[in] periodic <i>true</i> if the timer restarts after expiration
+		 */
+		Entry(Callback callback, bool periodic);
+		Entry(const Entry&) = delete;
+		Entry& operator=(Entry const&) = delete;
+
+	private:
+
+		friend class TimerWheel;
+
+		enum class State
+		{
+			Idle, Pending, Expired
+		};
+
+		Callback mCallback;
+		bool mPeriodic;
+		State mState;
+		uint64_t mPeriod;
+		uint64_t mExpires;
+		size_t mSlot;
+
+		// stopped while the callback is running: isn't restarted after it
+		bool mCancelled;
+	};
+
+	TimerWheel();
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(TimerWheel const&) = delete;
+	~TimerWheel();
+
+	/**
+	 * Returns the wheel shared by the library
+	 */
+	static TimerWheel& getDefault();
+
+	/**
+	 * Starts the timer
+	 * @param[in] entry timer entry
+	 * @param[in] time  timeout
+	 * @return <i>false</i> if the timer is already started
+	 */
+	bool start(Entry& entry, std::chrono::milliseconds time);
+
+	/**
+	 * Stops the timer. If the callback is running on other thread, waits
+	 * until it is completed.
+	 * @param[in] entry timer entry
+	 */
+	void stop(Entry& entry);
+
+	/**
+	 * Returns number of started timers
+	 */
+	size_t getNumTimers() const;
+
+private:
+
+	std::chrono::steady_clock::time_point mStartTime;
+	uint64_t mCurrentTick;
+	uint64_t mWakeupTick;
+	size_t mNumTimers;
+
+	Link mSlots[cNumLevels * cNumSlots];
+	Link mExpired;
+
+	// slots of the first level which have timers
+	uint64_t mOccupied[cNumSlots / 64];
+
+	// the entry which callback is running, is reset if the entry is stopped
+	Entry* mRunning;
+
+	bool mTerminate;
+	mutable std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::condition_variable mRunningCondVar;
+	std::thread mThread;
+
+	static Entry* getEntry(Link* link) { return static_cast<Entry*>(link); }
+	static void link(Link& head, Entry& entry);
+	static void unlink(Entry& entry);
+
+	uint64_t getTick() const;
+	void insert(Entry& entry);
+	void remove(Entry& entry);
+	void cascade(size_t level);
+	void advance(uint64_t tick);
+	uint64_t getWakeupTick() const;
+	void run();
+};
+
+}
+
+#endif /* XENBE_TIMERWHEEL_HPP_ */
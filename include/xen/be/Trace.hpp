@@ -0,0 +1,271 @@
+/*
+ *  Ring activity trace
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_TRACE_HPP_
+#define XENBE_TRACE_HPP_
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+}
+
+#include "Exception.hpp"
+
+/**
+ * @def XENBE_TRACE(event, domId, port, prod, cons)
+ * Records the trace event if tracing is enabled. When tracing is disabled
+ * costs one relaxed load and a branch.
+ * @param[in] event trace event (XenBackend::TraceEvent)
+ * @param[in] domId domain id
+ * @param[in] port  event channel port
+ * @param[in] prod  producer index
+ * @param[in] cons  consumer index
+ * @ingroup backend
+ */
+#define XENBE_TRACE(event, domId, port, prod, cons) \
+	do \
+	{ \
+		if (XenBackend::Trace::isEnabled()) \
+		{ \
+			XenBackend::Trace::record(XenBackend::TraceEvent::event, \
+									  domId, port, prod, cons); \
+		} \
+	} \
+	while (0)
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by Trace.
+ * @ingroup backend
+ ******************************************************************************/
+class TraceException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Traced ring events.
+ * @ingroup backend
+ ******************************************************************************/
+enum class TraceEvent : uint16_t
+{
+	Notify = 1,
+	Indication,
+	Request,
+	Response,
+	Event,
+	Overflow,
+	Error
+};
+
+/***************************************************************************//**
+ * Binary trace record.
+ * @ingroup backend
+ ******************************************************************************/
+struct TraceRecord
+{
+	/**
+	 * Monotonic time in nanoseconds
+	 */
+	uint64_t timestamp;
+	uint16_t event;
+	uint16_t domId;
+	uint32_t port;
+	uint32_t prod;
+	uint32_t cons;
+};
+
+/***************************************************************************//**
+ * Trace record read from the dump.
+ * @ingroup backend
+ ******************************************************************************/
+struct TraceEntry
+{
+	/**
+	 * Id of the thread which recorded the event
+	 */
+	uint32_t threadId;
+	TraceRecord record;
+};
+
+/***************************************************************************//**
+ * Per-thread binary trace of ring activity.
+ *
+ * Each thread records fixed-size records into its own ring of cNumRecords
+ * records, the oldest records are overwritten. Recording doesn't take locks
+ * or allocate memory except the ring allocation on the first record of the
+ * thread. The ring of the exited thread is kept for dumps and reused by the
+ * next thread.
+ *
+ * The trace is written to the file:
+ * - on dump() call;
+ * - on the signal if installSignalHandler() is called. Dumping is async
+ * signal safe;
+ * - on the ring buffer or event channel error if the dump path is set.
+ *
+ * The dump consists of the file header, followed by the buffer header and
+ * records of each thread. read() reads the dump and printTimeline() prints
+ * records of all threads sorted by time. The xenbe-trace tool does it
+ * for the dump file.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class Trace
+{
+public:
+
+	static const size_t cNumRecords = 4096;
+	static const size_t cMaxThreads = 256;
+	static const uint32_t cVersion = 1;
+
+	/**
+	 * Returns <i>true</i> if tracing is enabled
+	 */
+	static bool isEnabled()
+	{
+		return sEnabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Enables or disables tracing
+	 * @param[in] enabled enable flag
+	 */
+	static void setEnabled(bool enabled);
+
+	/**
+	 * Records the event into the ring of the current thread
+	 * @param[in] event event
+	 * @param[in] domId domain id
+	 * @param[in] port  event channel port
+	 * @param[in] prod  producer index
+	 * @param[in] cons  consumer index
+	 */
+	static void record(TraceEvent event, domid_t domId, uint32_t port,
+					   uint32_t prod, uint32_t cons);
+
+	/**
+	 * Drops all recorded events
+	 */
+	static void clear();
+
+	/**
+	 * Sets the file written on the signal and on errors
+	 * @param[in] path file path, empty to disable dumps on errors
+	 */
+	static void setDumpPath(const std::string& path);
+
+	/**
+	 * Installs the handler which dumps the trace to the dump path on the
+	 * signal
+	 * @param[in] signal signal number
+	 */
+	static void installSignalHandler(int signal = SIGUSR2);
+
+	/**
+	 * Dumps the trace to the file descriptor
+	 * @param[in] fd file descriptor
+	 */
+	static void dump(int fd);
+
+	/**
+	 * Dumps the trace to the file
+	 * @param[in] path file path
+	 */
+	static void dump(const std::string& path);
+
+	/**
+	 * Records the error event and dumps the trace to the dump path if it is
+	 * set
+	 * @param[in] domId domain id
+	 * @param[in] port  event channel port
+	 */
+	static void onError(domid_t domId, uint32_t port);
+
+	/**
+	 * Reads the dump sorted by time
+	 * @param[in] path dump file path
+	 */
+	static std::vector<TraceEntry> read(const std::string& path);
+
+	/**
+	 * Prints the timeline of the records. Time is relative to the first
+	 * record.
+	 * @param[in] entries records sorted by time
+	 * @param[in] stream  output stream
+	 */
+	static void printTimeline(const std::vector<TraceEntry>& entries,
+							  std::ostream& stream);
+
+	/**
+	 * Returns name of the event
+	 * @param[in] event event
+	 */
+	static const char* getEventName(uint16_t event);
+
+private:
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t recordSize;
+		uint32_t numBuffers;
+	};
+
+	struct BufferHeader
+	{
+		uint32_t threadId;
+		uint32_t numRecords;
+	};
+
+	struct Buffer
+	{
+		std::atomic<uint64_t> head;
+		std::atomic<bool> used;
+		uint32_t threadId;
+		TraceRecord records[cNumRecords];
+	};
+
+	class ThreadBuffer
+	{
+	public:
+		~ThreadBuffer();
+
+		Buffer* buffer = nullptr;
+	};
+
+	static std::atomic<bool> sEnabled;
+	static std::atomic<Buffer*> sBuffers[cMaxThreads];
+	static char sDumpPath[256];
+
+	static Buffer* getBuffer();
+	static void signalHandler(int signal);
+};
+
+}
+
+#endif /* XENBE_TRACE_HPP_ */
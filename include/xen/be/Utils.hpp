@@ -24,10 +24,15 @@
 #include <condition_variable>
 #include <functional>
 #include <list>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
 
 extern "C" {
@@ -35,6 +40,10 @@ extern "C" {
 #include <xen/io/xenbus.h>
 }
 
+#include "Executor.hpp"
+#include "Log.hpp"
+#include "TimerWheel.hpp"
+
 namespace XenBackend {
 
 /***************************************************************************//**
@@ -67,26 +76,53 @@ public:
 };
 
 /***************************************************************************//**
- * Class to poll file descriptor.
+ * Class to poll file descriptors.
+ *
+ * The PollFd class waits for a set of file descriptors and an internal
+ * eventfd. The eventfd breaks poll() when stop() method is invoked. It is used
+ * to unblock poll() when an object using PollFd is been deleted.
  *
- * The PollFd class also opens an additional pipe. On poll() method it waits
- * for both: the defined file descriptor and the internal pipe file descriptor.
- * The internal pipe file descriptor breaks poll() when stop() method is
- * invoked. It is used to unblock poll() when an object using PollFd is been
- * deleted.
+ * Descriptors may be added and removed at any time from any thread: the
+ * running poll() is woken up and waits for the new set. When a descriptor has
+ * a callback, poll() calls it with the occurred events, so one thread may
+ * wait for event channels, sockets and devices together. A descriptor
+ * without callback is checked for errors and just makes poll() return.
+ * Callbacks are called by the thread calling poll() and are not called after
+ * the descriptor is removed, unless it is removed by another thread while the
+ * callback is being called.
  * @ingroup backend
  ******************************************************************************/
 class PollFd
 {
 public:
 
+	typedef std::function<void(short int revents)> Callback;
+
+	PollFd();
+
 	/**
 	 * @param fd     file descriptor
 	 * @param events events to poll (same as in system poll function)
 	 */
 	PollFd(int fd, short int events);
+	PollFd(const PollFd&) = delete;
+	PollFd& operator=(PollFd const&) = delete;
 	~PollFd();
 
+	/**
+	 * Adds the file descriptor
+	 * @param fd       file descriptor
+	 * @param events   events to poll (same as in system poll function)
+	 * @param callback callback which is called with occurred events
+	 */
+	void addFd(int fd, short int events, Callback callback = nullptr);
+
+	/**
+	 * Removes the file descriptor
+	 * @param fd file descriptor
+	 */
+	void removeFd(int fd);
+
 	/**
 	 * Polls the file descriptors for defined events
 	 * @return <i>true</i> if one of defined events occurred and <i>false</i>
@@ -101,29 +137,35 @@ public:
 
 private:
 
-	enum PipeType
-	{
-		READ = 0,
-		WRITE = 1
-	};
+	// the eventfd is the first descriptor of the poll set
+	static const size_t cEventFdIndex = 0;
 
-	enum PollIndex
-	{
-		FILE = 0,
-		PIPE = 1
-	};
+	int mEventFd;
+
+	std::mutex mMutex;
+	std::vector<pollfd> mFds;
+	std::vector<Callback> mCallbacks;
+	bool mChanged;
+	bool mStopped;
 
-	pollfd mFds[2];
-	int mPipeFds[2];
+	// the set used by poll(), is updated from the one above when changed
+	std::vector<pollfd> mPollFds;
+	std::vector<Callback> mPollCallbacks;
 
-	void init(int fd, short int events);
+	void init();
 	void release();
+	void update();
+	bool isRemoved(int fd);
+	void signal();
+	static void checkEvents(short int revents);
 };
 
 /***************************************************************************//**
  * Implements asynchronous context
  *
- * This class allows to call a function asynchronously.
+ * This class allows to call a function asynchronously. Functions are called
+ * one after another in the calling order by the serial executor on top of
+ * the shared executor, so the context doesn't have its own thread.
  *
  * @ingroup backend
  ******************************************************************************/
@@ -133,11 +175,14 @@ public:
 
 	typedef std::function<void()> AsyncCall;
 
-	AsyncContext();
+	/**
+	 * @param[in] executor executor to call functions
+	 */
+	explicit AsyncContext(Executor& executor = Executor::getDefault());
 	~AsyncContext();
 
 	/**
-	 * Stops async thread
+	 * Waits for called functions, further calls are ignored
 	 */
 	void stop();
 
@@ -147,22 +192,150 @@ public:
 	 */
 	void call(AsyncCall f);
 
+private:
+
+	// the call and the time it is added
+	struct Call
+	{
+		AsyncCall func;
+		int64_t time;
+
+		void operator()();
+	};
+
+	SerialExecutor mSerialExecutor;
+};
+
+/***************************************************************************//**
+ * Bounded pool of worker threads.
+ *
+ * Tasks are posted with a key. Tasks with different keys run concurrently on
+ * up to numWorkers threads, tasks with the same key run one after another in
+ * the posting order. If the pool has no workers, tasks are run synchronously
+ * by post().
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class WorkerPool
+{
+public:
+
+	typedef std::function<void()> Task;
+
+	/**
+	 * @param numWorkers number of worker threads
+	 */
+	explicit WorkerPool(size_t numWorkers);
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(WorkerPool const&) = delete;
+	~WorkerPool();
+
+	/**
+	 * Returns number of worker threads
+	 */
+	size_t getNumWorkers() const { return mThreads.size(); }
+
+	/**
+	 * Posts the task
+	 * @param key  ordering key
+	 * @param task task
+	 */
+	void post(uint64_t key, Task task);
+
+	/**
+	 * Waits until all posted tasks are completed
+	 */
+	void wait();
+
+	/**
+	 * Completes posted tasks and stops worker threads
+	 */
+	void stop();
+
 private:
 
 	bool mTerminate;
+	size_t mNumPending;
 	std::mutex mMutex;
 	std::condition_variable mCondVar;
-	std::thread mThread;
+	std::condition_variable mIdleCondVar;
+	std::vector<std::thread> mThreads;
 
-	std::list<AsyncCall> mAsyncCalls;
+	std::unordered_map<uint64_t, std::list<Task>> mStrands;
+	std::list<uint64_t> mReadyKeys;
+
+	Log mLog;
 
 	void run();
+	void runTask(Task& task);
+};
+
+/***************************************************************************//**
+ * Read-write lock.
+ *
+ * Allows many concurrent readers or one writer. lock()/unlock() take the lock
+ * exclusively and can be used with std::lock_guard, ReadLockGuard takes the
+ * lock shared.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class RWLock
+{
+public:
+
+	RWLock();
+	RWLock(const RWLock&) = delete;
+	RWLock& operator=(RWLock const&) = delete;
+	~RWLock();
+
+	/**
+	 * Takes the lock exclusively
+	 */
+	void lock();
+
+	/**
+	 * Releases the exclusive lock
+	 */
+	void unlock();
+
+	/**
+	 * Takes the lock shared
+	 */
+	void lockShared();
+
+	/**
+	 * Releases the shared lock
+	 */
+	void unlockShared();
+
+private:
+
+	pthread_rwlock_t mLock;
+};
+
+/***************************************************************************//**
+ * Holds RWLock shared within the scope.
+ * @ingroup backend
+ ******************************************************************************/
+class ReadLockGuard
+{
+public:
+
+	explicit ReadLockGuard(RWLock& lock) : mLock(lock) { mLock.lockShared(); }
+	ReadLockGuard(const ReadLockGuard&) = delete;
+	ReadLockGuard& operator=(ReadLockGuard const&) = delete;
+	~ReadLockGuard() { mLock.unlockShared(); }
+
+private:
+
+	RWLock& mLock;
 };
 
 /***************************************************************************//**
  * Implements timer
  *
- * This class allows to call event in scheduled time or periodically
+ * This class allows to call event in scheduled time or periodically. Timers
+ * don't have own threads: callbacks are called by the timer wheel thread.
  *
  * @ingroup backend
  ******************************************************************************/
@@ -170,9 +343,15 @@ class Timer
 {
 public:
 
-	typedef std::function<void()> Callback;
+	typedef TimerWheel::Callback Callback;
 
-	Timer(Callback callback, bool periodic = false);
+	/**
+	 * @param[in] callback callback
+	 * @param[in] periodic <i>true</i> if the timer restarts after expiration
+	 * @param[in] wheel    timer wheel to run the timer
+	 */
+	Timer(Callback callback, bool periodic = false,
+		  TimerWheel& wheel = TimerWheel::getDefault());
 	~Timer();
 
 	/**
@@ -181,23 +360,14 @@ public:
 	void start(std::chrono::milliseconds time);
 
 	/**
-	 * Stops timer
+	 * Stops timer. If the callback is running, waits until it is completed.
 	 */
 	void stop();
 
 private:
 
-	Callback mCallback;
-	std::chrono::milliseconds mTime;
-	bool mPeriodic;
-
-	bool mTerminate;
-	std::thread mThread;
-	std::mutex mMutex;
-	std::mutex mItfMutex;
-	std::condition_variable mCondVar;
-
-	void run();
+	TimerWheel& mWheel;
+	TimerWheel::Entry mEntry;
 };
 
 }
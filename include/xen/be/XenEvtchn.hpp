@@ -24,6 +24,7 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 
 extern "C" {
 #include <xenctrl.h>
@@ -32,6 +33,7 @@ extern "C" {
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "Reactor.hpp"
 #include "Utils.hpp"
 
 namespace XenBackend {
@@ -69,6 +71,12 @@ class XenEvtchnException : public Exception
  * ...
  *
  * @endcode
+ *
+ * The bound event channel may be handed over to another process: the old
+ * process passes the descriptor returned by getFd() and calls detach(), the
+ * new process registers the received descriptor with addInherited(). Then
+ * XenEvtchn instance created for the same domain and port uses the inherited
+ * binding instead of binding the port again.
  * @ingroup xen
  ******************************************************************************/
 class XenEvtchn
@@ -98,11 +106,30 @@ public:
 	 */
 	void start();
 
+	/**
+	 * Starts listening to the event channel in the reactor thread instead of
+	 * own thread
+	 * @param[in] reactor reactor
+	 */
+	void start(ReactorPtr reactor);
+
 	/**
 	 * Stops listening to the event channel
 	 */
 	void stop();
 
+	/**
+	 * Returns <i>true</i> if listening to the event channel is started
+	 */
+	bool isStarted() const { return mStarted; }
+
+	/**
+	 * Stops listening to the event channel and keeps the port bound when
+	 * the instance is deleted, so the binding stays with the handed over
+	 * descriptor.
+	 */
+	void detach();
+
 	/**
 	 * Notifies the event channel
 	 */
@@ -113,28 +140,65 @@ public:
 	 */
 	xenevtchn_port_or_error_t getPort() const { return mPort; }
 
+	/**
+	 * Returns event channel file descriptor
+	 */
+	int getFd() const;
+
 	/**
 	 * Sets error callback
 	 * @param errorCallback error callback
 	 */
 	void setErrorCallback(ErrorCallback errorCallback);
 
+	/**
+	 * Registers the event channel descriptor inherited from another process.
+	 * The ownership of the descriptor is taken.
+	 * @param[in] domId      domain id
+	 * @param[in] port       remote event channel port number
+	 * @param[in] localPort  local port bound on the descriptor
+	 * @param[in] fd         event channel file descriptor
+	 */
+	static void addInherited(domid_t domId, evtchn_port_t port,
+							 evtchn_port_t localPort, int fd);
+
+	/**
+	 * Closes inherited descriptors which are not used by any instance
+	 */
+	static void clearInherited();
+
 private:
 
+	struct Inherited
+	{
+		evtchn_port_t localPort;
+		int fd;
+	};
+
+	static std::mutex sInheritedMutex;
+	static std::unordered_map<uint64_t, Inherited> sInherited;
+
 	xenevtchn_port_or_error_t mPort;
 	xenevtchn_handle *mHandle;
 	Callback mCallback;
 	ErrorCallback mErrorCallback;
 	std::atomic_bool mStarted;
+	bool mDetached;
 	Log mLog;
 
 	std::mutex mMutex;
 	std::thread mThread;
 	std::unique_ptr<PollFd> mPollFd;
+	ReactorPtr mReactor;
+	int mReactorFd;
 
 	void init(domid_t domId, evtchn_port_t port);
+	bool initInherited(domid_t domId, evtchn_port_t port);
 	void release();
 	void eventThread();
+	void reactorEvent();
+	void processEvent(int64_t readyTime);
+	void handleError(const std::exception& e);
 };
 
 }
@@ -50,6 +50,97 @@ class XenStoreException : public Exception
 	using Exception::Exception;
 };
 
+/***************************************************************************//**
+ * Flat snapshot of a Xen Store subtree.
+ *
+ * The snapshot is produced by XenStore::readTree(). All paths and values are
+ * stored in one contiguous arena, nodes only keep offsets into it. Nodes are
+ * stored in the depth-first order with sorted children, so the node lookup is
+ * done by binary search. Paths are relative to the root of the snapshot, the
+ * root node itself has an empty path.
+ *
+ * @code
+ * auto tree = xenStore.readTree("/local/domain/0/backend/vif", 2);
+ *
+ * for(size_t i = 0; i < tree.size(); i++)
+ * {
+ *     LOG("Tree", DEBUG) << tree.getPath(i) << " : " << tree.getValue(i);
+ * }
+ *
+ * auto index = tree.find("5/0/state");
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenStoreTree
+{
+public:
+
+	/**
+	 * Returned by find() when the node is not found
+	 */
+	static const size_t npos = static_cast<size_t>(-1);
+
+	/**
+	 * Returns the absolute path of the snapshot root
+	 */
+	const std::string& getRootPath() const { return mRootPath; }
+
+	/**
+	 * Returns number of nodes in the snapshot
+	 */
+	size_t size() const { return mNodes.size(); }
+
+	/**
+	 * Returns path of the node relative to the snapshot root
+	 * @param[in] index node index
+	 */
+	const char* getPath(size_t index) const
+	{
+		return &mArena[mNodes[index].pathOffset];
+	}
+
+	/**
+	 * Returns value of the node
+	 * @param[in] index node index
+	 */
+	const char* getValue(size_t index) const
+	{
+		return &mArena[mNodes[index].valueOffset];
+	}
+
+	/**
+	 * Returns depth of the node, the root node has depth 0
+	 * @param[in] index node index
+	 */
+	unsigned int getDepth(size_t index) const { return mNodes[index].depth; }
+
+	/**
+	 * Finds the node by the relative path
+	 * @param[in] path path relative to the snapshot root
+	 * @return node index or npos if not found
+	 */
+	size_t find(const std::string& path) const;
+
+private:
+
+	friend class XenStore;
+
+	struct Node
+	{
+		uint32_t pathOffset;
+		uint32_t valueOffset;
+		uint32_t depth;
+	};
+
+	std::string mRootPath;
+	std::vector<Node> mNodes;
+	std::vector<char> mArena;
+
+	void clear(const std::string& rootPath);
+	void addNode(const std::string& path, const char* value, size_t length,
+				 unsigned int depth);
+};
+
 /***************************************************************************//**
  * Provides Xen Store functionality.
  * @ingroup xen
@@ -59,7 +150,8 @@ class XenStore
 public:
 
 	/**
-	 * Callback which is called when the watch is triggered
+	 * Callback which is called when the watch is triggered, receives the
+	 * path of the changed entry: the watched path or a path under it
 	 */
 	typedef std::function<void(const std::string& path)> WatchCallback;
 
@@ -139,6 +231,15 @@ public:
 	 */
 	std::vector<std::string> readDirectory(const std::string& path);
 
+	/**
+	 * Reads XS subtree in one transaction
+	 * @param path  path to the subtree root
+	 * @param depth number of levels to read below the root, negative value
+	 * means the whole subtree
+	 * @return flat snapshot of the subtree
+	 */
+	XenStoreTree readTree(const std::string& path, int depth = -1);
+
 	/**
 	 * Sets watch for XS entry change.
 	 * @param path       path to the entry
@@ -170,6 +271,8 @@ public:
 
 private:
 
+	const int cMaxTransactionRetries = 16;
+
 	xs_handle*	mXsHandle;
 	ErrorCallback mErrorCallback;
 	std::atomic_bool mStarted;
@@ -188,6 +291,9 @@ private:
 	void watchesThread();
 	std::string readXsWatch(std::string& token);
 	WatchCallback getWatchCallback(const std::string& path);
+	void readTreeNode(xs_transaction_t transaction, const std::string& path,
+					  const std::string& relPath, unsigned int depth,
+					  int maxDepth, XenStoreTree& tree);
 };
 
 }
@@ -0,0 +1,258 @@
+/*
+ *  Asynchronous Xen Store client
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_XENSTORECLIENT_HPP_
+#define XENBE_XENSTORECLIENT_HPP_
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+#include <xen/io/xs_wire.h>
+}
+
+#include "Exception.hpp"
+#include "Log.hpp"
+#include "XenStore.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Asynchronous Xen Store client.
+ *
+ * The client speaks the xenstored wire protocol directly over the xenstored
+ * unix socket or /dev/xen/xenbus. Unlike XenStore, it doesn't wait for the
+ * reply: each request is tagged with a request id and sent immediately, so
+ * many requests can be in flight on one connection. Replies are matched by
+ * the request id and delivered to the callback or the future.
+ *
+ * The client doesn't own a thread. The owner polls getFd() for POLLIN in its
+ * event loop and calls process() when the descriptor is readable. All
+ * callbacks, including watch callbacks, are invoked from process().
+ *
+ * @code
+ * XenStoreClient client;
+ * PollFd pollFd(client.getFd(), POLLIN);
+ *
+ * client.read("/local/domain/5/device/vif/0/state",
+ *             [](int error, const std::string& value) { ... });
+ *
+ * while(pollFd.poll())
+ * {
+ *     client.process();
+ * }
+ * @endcode
+ *
+ * Requests are never blocked on the socket: if xenstored doesn't read fast
+ * enough, the rest of the request is queued and written by the following
+ * send or process() call. xenstored replies to the requests it has read, so
+ * the descriptor becomes readable and the queue is flushed.
+ *
+ * If the connection is closed or fails, process() and the sending request
+ * throw XenStoreException and all pending requests are completed with the
+ * connection error. Requests pending when the client is deleted are completed
+ * with ECONNRESET.
+ *
+ * Requests may be issued from any thread, including the thread which calls
+ * process(). A future returned by the client must not be waited for on the
+ * thread which calls process().
+ * @ingroup xen
+ ******************************************************************************/
+class XenStoreClient
+{
+public:
+
+	/**
+	 * Callback which is called when the read request is completed
+	 */
+	typedef std::function<void(int error,
+							   const std::string& value)> ReadCallback;
+
+	/**
+	 * Callback which is called when the directory request is completed
+	 */
+	typedef std::function<void(int error,
+							   const std::vector<std::string>& items)>
+		DirectoryCallback;
+
+	/**
+	 * Callback which is called when the request without data is completed
+	 */
+	typedef std::function<void(int error)> DoneCallback;
+
+	/**
+	 * Callback which is called when the watch is triggered, receives the
+	 * path of the changed entry
+	 */
+	typedef std::function<void(const std::string& path)> WatchCallback;
+
+	/**
+	 * @param path path to the xenstored socket or xenbus device. If empty,
+	 * XENSTORED_PATH environment variable, the default xenstored socket and
+	 * /dev/xen/xenbus are tried in this order.
+	 */
+	explicit XenStoreClient(const std::string& path = "");
+	XenStoreClient(const XenStoreClient&) = delete;
+	XenStoreClient& operator=(XenStoreClient const&) = delete;
+	~XenStoreClient();
+
+	/**
+	 * Returns file descriptor to be polled for POLLIN
+	 */
+	int getFd() const { return mFd; }
+
+	/**
+	 * Reads available replies and invokes their callbacks. Doesn't block.
+	 * @return number of processed messages
+	 */
+	size_t process();
+
+	/**
+	 * Returns number of requests waiting for the reply
+	 */
+	size_t getNumPending();
+
+	/**
+	 * Reads XS entry.
+	 * @param path     path to the entry
+	 * @param callback completion callback
+	 */
+	void read(const std::string& path, ReadCallback callback);
+
+	/**
+	 * Writes XS entry.
+	 * @param path     path to the entry
+	 * @param value    value to write
+	 * @param callback completion callback
+	 */
+	void write(const std::string& path, const std::string& value,
+			   DoneCallback callback);
+
+	/**
+	 * Removes XS entry.
+	 * @param path     path to the entry
+	 * @param callback completion callback
+	 */
+	void remove(const std::string& path, DoneCallback callback);
+
+	/**
+	 * Reads XS directory.
+	 * @param path     path to the directory
+	 * @param callback completion callback
+	 */
+	void readDirectory(const std::string& path, DirectoryCallback callback);
+
+	/**
+	 * Gets the home path of the domain.
+	 * @param domId    domain id
+	 * @param callback completion callback
+	 */
+	void getDomainPath(domid_t domId, ReadCallback callback);
+
+	/**
+	 * Sets watch for XS entry change.
+	 * @param path     path to the entry
+	 * @param callback callback which will be called when the entry is changed
+	 * @param done     optional completion callback
+	 */
+	void setWatch(const std::string& path, WatchCallback callback,
+				  DoneCallback done = nullptr);
+
+	/**
+	 * Clears watch for XS entry change.
+	 * @param path path to the entry
+	 * @param done optional completion callback
+	 */
+	void clearWatch(const std::string& path, DoneCallback done = nullptr);
+
+	/**
+	 * Reads XS entry.
+	 * @param path path to the entry
+	 * @return future of the entry value
+	 */
+	std::future<std::string> read(const std::string& path);
+
+	/**
+	 * Writes XS entry.
+	 * @param path  path to the entry
+	 * @param value value to write
+	 * @return future of the request completion
+	 */
+	std::future<void> write(const std::string& path, const std::string& value);
+
+	/**
+	 * Removes XS entry.
+	 * @param path path to the entry
+	 * @return future of the request completion
+	 */
+	std::future<void> remove(const std::string& path);
+
+	/**
+	 * Reads XS directory.
+	 * @param path path to the directory
+	 * @return future of the directory items
+	 */
+	std::future<std::vector<std::string>> readDirectory(
+			const std::string& path);
+
+private:
+
+	typedef std::function<void(int error, const char* payload,
+							   size_t length)> ReplyCallback;
+
+	int mFd;
+	uint32_t mReqId;
+	Log mLog;
+
+	std::mutex mMutex;
+	std::unordered_map<uint32_t, ReplyCallback> mPending;
+	std::unordered_map<std::string, WatchCallback> mWatches;
+
+	std::vector<char> mInBuffer;
+
+	// guards the outgoing queue and writes to the descriptor
+	std::mutex mWriteMutex;
+	std::vector<char> mOutBuffer;
+
+	void init(const std::string& path);
+	void release();
+
+	void send(xsd_sockmsg_type type, const std::string& payload,
+			  ReplyCallback callback);
+	int flush();
+	void failPending(int error);
+	void dispatch(const xsd_sockmsg& msg, const char* payload);
+	void dispatchWatch(const char* payload, size_t length);
+
+	static std::string getDefaultPath();
+	static int getError(const char* payload, size_t length);
+	static DoneCallback makeDone(std::shared_ptr<std::promise<void>> result,
+								 const std::string& msg);
+};
+
+}
+
+#endif /* XENBE_XENSTORECLIENT_HPP_ */
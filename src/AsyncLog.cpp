@@ -0,0 +1,497 @@
+/*
+ *  Asynchronous log backend
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "AsyncLog.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <sys/uio.h>
+
+#include "Log.hpp"
+#include "Metrics.hpp"
+
+using std::atomic;
+using std::atomic_thread_fence;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::condition_variable;
+using std::lock_guard;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::this_thread::sleep_for;
+using std::to_string;
+using std::unique_lock;
+using std::unique_ptr;
+
+namespace XenBackend {
+
+namespace {
+
+const milliseconds cIdleTimeout(100);
+const microseconds cFullRetryDelay(50);
+
+// Serializes start and stop
+mutex sControlMutex;
+
+// Lines of all async logs
+struct LogMetrics
+{
+	LogMetrics() :
+		group("log"),
+		written(group.addCounter("lines_written")),
+		batches(group.addCounter("batches")),
+		dropped(group.addCounter("lines_dropped"))
+	{}
+
+	MetricsGroup group;
+	MetricsCounter& written;
+	MetricsCounter& batches;
+	MetricsCounter& dropped;
+};
+
+LogMetrics& getMetrics()
+{
+	static LogMetrics sMetrics;
+
+	return sMetrics;
+}
+
+// Writes all vectors, the vectors are modified on partial write
+bool writeAll(int fd, iovec* iov, int count)
+{
+	while (count)
+	{
+		auto written = writev(fd, iov, count);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		while (count && static_cast<size_t>(written) >= iov->iov_len)
+		{
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count)
+		{
+			iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+}
+
+/*******************************************************************************
+ * AsyncLog::Queue
+ ******************************************************************************/
+
+/*
+ * Bounded MPSC queue: each slot has the sequence number which tells whether
+ * the slot is free for the producer at the position or is filled for the
+ * consumer at the position. Producers claim positions with CAS, so they
+ * don't take locks.
+ */
+struct AsyncLog::Queue
+{
+	struct Slot
+	{
+		atomic<size_t> sequence;
+		string line;
+	};
+
+	Queue(int fd, size_t capacity, OverflowMode mode) :
+		fd(fd),
+		mode(mode),
+		enqueuePos(0),
+		dequeuePos(0),
+		writtenPos(0),
+		sleeping(false),
+		terminate(false),
+		reportedDropped(getMetrics().dropped.get())
+	{
+		size_t size = 1;
+
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+
+		slots.reset(new Slot[size]);
+		mask = size - 1;
+
+		for(size_t i = 0; i < size; i++)
+		{
+			slots[i].sequence.store(i, memory_order_relaxed);
+		}
+	}
+
+	Slot* claim(size_t& pos)
+	{
+		pos = enqueuePos.load(memory_order_relaxed);
+
+		while (true)
+		{
+			auto& slot = slots[pos & mask];
+			auto diff = static_cast<intptr_t>(
+					slot.sequence.load(memory_order_acquire)) -
+					static_cast<intptr_t>(pos);
+
+			if (diff == 0)
+			{
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+													 memory_order_relaxed))
+				{
+					return &slot;
+				}
+			}
+			else if (diff < 0)
+			{
+				// the consumer hasn't freed the slot yet: the queue is full
+
+				return nullptr;
+			}
+			else
+			{
+				pos = enqueuePos.load(memory_order_relaxed);
+			}
+		}
+	}
+
+	void wakeup()
+	{
+		if (sleeping.load(memory_order_relaxed) && sleeping.exchange(false))
+		{
+			lock_guard<mutex> lock(sleepMutex);
+
+			sleepCondVar.notify_one();
+		}
+	}
+
+	int fd;
+	OverflowMode mode;
+	size_t mask;
+	unique_ptr<Slot[]> slots;
+
+	atomic<size_t> enqueuePos;
+	uint8_t padding[64];
+
+	// used by the writer thread only
+	size_t dequeuePos;
+	atomic<size_t> writtenPos;
+
+	atomic<bool> sleeping;
+	bool terminate;
+	uint64_t reportedDropped;
+	string batch[cMaxBatch];
+
+	mutex sleepMutex;
+	condition_variable sleepCondVar;
+	thread writer;
+};
+
+/*******************************************************************************
+ * AsyncLog
+ ******************************************************************************/
+
+const size_t AsyncLog::cDefaultCapacity;
+const size_t AsyncLog::cMaxBatch;
+
+atomic<AsyncLog::Queue*> AsyncLog::sQueue(nullptr);
+atomic<size_t> AsyncLog::sNumProducers(0);
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void AsyncLog::start(int fd, size_t capacity, OverflowMode mode)
+{
+	static bool sAtExitRegistered = false;
+
+	lock_guard<mutex> lock(sControlMutex);
+
+	if (sQueue.load())
+	{
+		throw AsyncLogException("Async log is already started", EPERM);
+	}
+
+	auto queue = new Queue(fd, capacity, mode);
+
+	queue->writer = thread(&AsyncLog::run, queue);
+
+	sQueue.store(queue, memory_order_release);
+
+	// the queued lines are written on exit
+
+	if (!sAtExitRegistered)
+	{
+		atexit([] { AsyncLog::stop(); });
+
+		sAtExitRegistered = true;
+	}
+}
+
+void AsyncLog::stop()
+{
+	lock_guard<mutex> lock(sControlMutex);
+
+	// the summaries are queued while the writer is running
+
+	Log::flushSuppressed();
+
+	auto queue = sQueue.exchange(nullptr);
+
+	if (!queue)
+	{
+		return;
+	}
+
+	// the writer is running until blocked producers have queued their lines
+
+	while (sNumProducers.load())
+	{
+		std::this_thread::yield();
+	}
+
+	{
+		lock_guard<mutex> queueLock(queue->sleepMutex);
+
+		queue->terminate = true;
+	}
+
+	queue->sleepCondVar.notify_one();
+
+	queue->writer.join();
+
+	delete queue;
+}
+
+bool AsyncLog::push(string& line)
+{
+	sNumProducers.fetch_add(1);
+
+	auto queue = sQueue.load();
+
+	if (!queue)
+	{
+		sNumProducers.fetch_sub(1, memory_order_release);
+
+		return false;
+	}
+
+	size_t pos;
+
+	auto slot = queue->claim(pos);
+
+	while (!slot && queue->mode == OverflowMode::Block)
+	{
+		queue->wakeup();
+
+		sleep_for(cFullRetryDelay);
+
+		slot = queue->claim(pos);
+	}
+
+	if (slot)
+	{
+		slot->line.swap(line);
+		slot->sequence.store(pos + 1, memory_order_release);
+
+		// pairs with the writer setting the sleeping flag and checking
+		// the queue
+
+		atomic_thread_fence(memory_order_seq_cst);
+
+		queue->wakeup();
+	}
+	else
+	{
+		getMetrics().dropped.add();
+	}
+
+	sNumProducers.fetch_sub(1, memory_order_release);
+
+	return true;
+}
+
+void AsyncLog::flush()
+{
+	sNumProducers.fetch_add(1);
+
+	auto queue = sQueue.load();
+
+	if (queue)
+	{
+		auto pos = queue->enqueuePos.load();
+
+		while (queue->writtenPos.load(memory_order_acquire) < pos)
+		{
+			queue->wakeup();
+
+			sleep_for(milliseconds(1));
+		}
+	}
+
+	sNumProducers.fetch_sub(1, memory_order_release);
+}
+
+uint64_t AsyncLog::getNumDropped()
+{
+	return getMetrics().dropped.get();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void AsyncLog::run(Queue* queue)
+{
+	while (true)
+	{
+		if (writeBatch(queue))
+		{
+			continue;
+		}
+
+		unique_lock<mutex> lock(queue->sleepMutex);
+
+		if (queue->terminate)
+		{
+			// no producers are left, the queue is empty
+
+			break;
+		}
+
+		queue->sleeping.store(true);
+
+		auto& slot = queue->slots[queue->dequeuePos & queue->mask];
+
+		if (slot.sequence.load() == queue->dequeuePos + 1)
+		{
+			queue->sleeping.store(false);
+
+			continue;
+		}
+
+		queue->sleepCondVar.wait_for(lock, cIdleTimeout, [queue]
+			{ return !queue->sleeping || queue->terminate; });
+
+		queue->sleeping.store(false);
+	}
+}
+
+size_t AsyncLog::writeBatch(Queue* queue)
+{
+	size_t count = 0;
+
+	while (count < cMaxBatch)
+	{
+		auto& slot = queue->slots[queue->dequeuePos & queue->mask];
+
+		if (slot.sequence.load(memory_order_acquire) != queue->dequeuePos + 1)
+		{
+			break;
+		}
+
+		queue->batch[count].swap(slot.line);
+		slot.line.clear();
+
+		// the slot is free for the producer on the next lap
+
+		slot.sequence.store(queue->dequeuePos + queue->mask + 1,
+							memory_order_release);
+
+		queue->dequeuePos++;
+		count++;
+	}
+
+	auto dropped = getMetrics().dropped.get();
+	string notice;
+
+	if (dropped != queue->reportedDropped)
+	{
+		notice = "AsyncLog: log lines dropped: " +
+				 to_string(dropped - queue->reportedDropped) + "\n";
+
+		queue->reportedDropped = dropped;
+	}
+
+	// the writer wakes up at least each idle timeout, so the summaries of
+	// RLOG() statements which don't fire again are written with a delay of
+	// about one second
+
+	if (LogRateLimiter::hasSummaries())
+	{
+		notice += LogRateLimiter::takeSummaries(false);
+	}
+
+	if (!count && notice.empty())
+	{
+		return 0;
+	}
+
+	iovec iov[cMaxBatch + 1];
+	int numVectors = 0;
+
+	for(size_t i = 0; i < count; i++)
+	{
+		iov[numVectors].iov_base = &queue->batch[i][0];
+		iov[numVectors++].iov_len = queue->batch[i].size();
+	}
+
+	if (!notice.empty())
+	{
+		iov[numVectors].iov_base = &notice[0];
+		iov[numVectors++].iov_len = notice.size();
+	}
+
+	// there is no place to report the write error to
+
+	writeAll(queue->fd, iov, numVectors);
+
+	queue->writtenPos.store(queue->dequeuePos, memory_order_release);
+
+	getMetrics().written.add(count);
+	getMetrics().batches.add();
+
+	return count + (notice.empty() ? 0 : 1);
+}
+
+}
@@ -26,15 +26,17 @@
 #include "Utils.hpp"
 
 using std::bind;
-using std::find_if;
-using std::list;
+using std::lock_guard;
 using std::make_pair;
+using std::make_shared;
+using std::mutex;
 using std::unique_ptr;
 using std::pair;
 using std::placeholders::_1;
 using std::stoi;
 using std::string;
 using std::to_string;
+using std::unordered_map;
 using std::vector;
 
 namespace XenBackend {
@@ -71,14 +73,35 @@ namespace XenBackend {
  * @example ExampleBackend.hpp
  ******************************************************************************/
 
+namespace {
+
+// Returns the path of the direct child of the parent which contains the path
+bool getChildPath(const string& parent, const string& path, string& child)
+{
+	if (path.length() <= parent.length() + 1 ||
+		path.compare(0, parent.length(), parent) != 0 ||
+		path[parent.length()] != '/')
+	{
+		return false;
+	}
+
+	child = path.substr(0, path.find('/', parent.length() + 1));
+
+	return true;
+}
+
+}
+
 /*******************************************************************************
  * BackendBase
  ******************************************************************************/
 
-BackendBase::BackendBase(const string& name, const string& deviceName) :
+BackendBase::BackendBase(const string& name, const string& deviceName,
+						 size_t numWorkers, size_t numShards) :
 	mXenStore(bind(&BackendBase::onError, this, _1)),
 	mDomId(0),
 	mDeviceName(deviceName),
+	mWorkerPool(numWorkers),
 	mLog(name.empty() ? "Backend" : name)
 {
 	mDomId = mXenStore.readInt("domid");
@@ -86,6 +109,17 @@ BackendBase::BackendBase(const string& name, const string& deviceName) :
 	mFrontendsPath = mXenStore.getDomainPath(mDomId) + "/backend/" +
 					 mDeviceName;
 
+	for(size_t i = 0; i < numShards; i++)
+	{
+		auto reactor = make_shared<Reactor>("Shard" + to_string(i));
+
+		reactor->start();
+
+		mShards.push_back(reactor);
+	}
+
+	mShardEvents.resize(numShards);
+
 	LOG(mLog, DEBUG) << "Create backend, device: " << deviceName << ", "
 					 << "dom Id: " << mDomId;
 }
@@ -94,12 +128,21 @@ BackendBase::~BackendBase()
 {
 	stop();
 
-	for(auto frontend : mFrontendHandlers)
+	mWorkerPool.wait();
+
+	for(auto frontend : mFrontendHandlers.clear())
 	{
-		frontend->stop();
+		mWorkerPool.post(Registry::getKey(frontend->getDomId(),
+										  frontend->getDevId()),
+						 bind(&FrontendHandlerBase::stop, frontend));
 	}
 
-	mFrontendHandlers.clear();
+	mWorkerPool.stop();
+
+	for(auto reactor : mShards)
+	{
+		reactor->stop();
+	}
 
 	LOG(mLog, DEBUG) << "Delete";
 }
@@ -114,6 +157,12 @@ void BackendBase::start()
 
 	mXenStore.setWatch(mFrontendsPath,
 					   bind(&BackendBase::domainListChanged, this, _1));
+
+	mXenStore.setWatch(cIntroduceDomainPath,
+					   bind(&BackendBase::domainListChanged, this, _1));
+
+	mXenStore.setWatch(cReleaseDomainPath,
+					   bind(&BackendBase::domainReleased, this, _1));
 }
 
 void BackendBase::stop()
@@ -123,6 +172,123 @@ void BackendBase::stop()
 	mXenStore.stop();
 }
 
+void BackendBase::handover(int socket)
+{
+	stop();
+
+	mWorkerPool.wait();
+
+	vector<FrontendState> states;
+
+	// handed over frontends are released without closing when deleted
+
+	auto frontends = mFrontendHandlers.clear();
+
+	for(auto frontend : frontends)
+	{
+		states.push_back(frontend->handover());
+	}
+
+	LiveUpgrade::send(socket, states);
+
+	LOG(mLog, INFO) << "Frontends handed over: " << states.size();
+}
+
+void BackendBase::setScheduler(SchedulerPtr scheduler)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mScheduler = scheduler;
+}
+
+void BackendBase::enableMetricsServer(const string& path)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mMetricsServer.reset(new MetricsServer(path));
+}
+
+size_t BackendBase::getShard(domid_t domId)
+{
+	if (mShards.empty())
+	{
+		throw BackendException("Backend has no shards", EINVAL);
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mDomainShards.find(domId);
+
+	if (it != mDomainShards.end())
+	{
+		return it->second;
+	}
+
+	return domId % mShards.size();
+}
+
+void BackendBase::moveDomain(domid_t domId, size_t shard)
+{
+	if (shard >= mShards.size())
+	{
+		throw BackendException("Invalid shard: " + to_string(shard), EINVAL);
+	}
+
+	LOG(mLog, INFO) << "Move domain " << domId << " to shard " << shard;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mDomainShards[domId] = shard;
+	}
+
+	for(auto frontend : mFrontendHandlers.getFrontends())
+	{
+		if (frontend->getDomId() == domId)
+		{
+			frontend->setReactor(mShards[shard]);
+		}
+	}
+}
+
+void BackendBase::rebalance()
+{
+	vector<ShardLoad> loads(mShards.size());
+
+	for(size_t i = 0; i < mShards.size(); i++)
+	{
+		auto numEvents = mShards[i]->getNumEvents();
+
+		loads[i].shard = i;
+		loads[i].numEvents = numEvents - mShardEvents[i];
+
+		mShardEvents[i] = numEvents;
+	}
+
+	unordered_map<domid_t, uint64_t> domainEvents;
+
+	for(auto frontend : mFrontendHandlers.getFrontends())
+	{
+		domainEvents[frontend->getDomId()] += frontend->getNumEvents();
+	}
+
+	for(auto& domain : domainEvents)
+	{
+		auto lastEvents = mDomainEvents[domain.first];
+
+		// ring buffers are recreated on reconnect, so the counter may
+		// start again
+		auto numEvents = domain.second >= lastEvents ?
+						 domain.second - lastEvents : domain.second;
+
+		loads[getShard(domain.first)].domains[domain.first] = numEvents;
+	}
+
+	mDomainEvents.swap(domainEvents);
+
+	onRebalance(loads);
+}
+
 /*******************************************************************************
  * Protected
  ******************************************************************************/
@@ -132,7 +298,7 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 	auto domId = frontendHandler->getDomId();
 	auto devId = frontendHandler->getDevId();
 
-	if (getFrontendHandler(domId, devId))
+	if (!mFrontendHandlers.add(domId, devId, frontendHandler))
 	{
 		throw BackendException("Frontend already exists", EEXIST);
 	}
@@ -140,13 +306,47 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 	auto frontendPath = mFrontendsPath + "/" + to_string(domId) + "/" +
 						to_string(devId);
 
-	mXenStore.setWatch(frontendPath,
-					   bind(&BackendBase::frontendPathChanged, this,
-							_1, domId, devId));
+	try
+	{
+		mXenStore.setWatch(frontendPath,
+						   bind(&BackendBase::frontendPathChanged, this,
+								frontendPath, domId, devId));
+
+		if (!mShards.empty())
+		{
+			frontendHandler->setReactor(mShards[getShard(domId)]);
+		}
 
-	frontendHandler->start();
+		{
+			lock_guard<mutex> lock(mMutex);
 
-	mFrontendHandlers.push_back(frontendHandler);
+			if (mScheduler)
+			{
+				frontendHandler->setScheduler(mScheduler);
+			}
+		}
+
+		frontendHandler->start();
+	}
+	catch(const std::exception& e)
+	{
+		mFrontendHandlers.remove(domId, devId);
+
+		throw;
+	}
+}
+
+vector<FrontendHandlerPtr> BackendBase::getFrontendHandlers() const
+{
+	return mFrontendHandlers.getFrontends();
+}
+
+void BackendBase::onFrontendsChanged(const FrontendChanges& changes)
+{
+}
+
+void BackendBase::onRebalance(const vector<ShardLoad>& loads)
+{
 }
 
 /*******************************************************************************
@@ -155,95 +355,233 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 
 void BackendBase::domainListChanged(const string& path)
 {
-	for (auto domain : mXenStore.readDirectory(path))
+	string domPath;
+
+	// the watch is recursive: changes inside known domains are handled by
+	// their own watches, only the new domain is added here
+
+	if (getChildPath(mFrontendsPath, path, domPath))
 	{
-		domid_t domId = stoi(domain);
+		domid_t domId = stoi(domPath.substr(mFrontendsPath.length() + 1));
 
-		if (find(mDomainList.begin(), mDomainList.end(), domId) ==
-			mDomainList.end())
+		if (!mDiscovery.hasDomain(domId) && mXenStore.checkIfExist(domPath))
 		{
-			mXenStore.setWatch(mFrontendsPath + "/" + domain,
-							   bind(&BackendBase::deviceListChanged, this,
-									_1, domId));
-
-			mDomainList.push_back(domId);
+			processChanges(mDiscovery.addDomain(domId));
 		}
+
+		return;
+	}
+
+	vector<domid_t> domains;
+
+	for (auto domain : mXenStore.readDirectory(mFrontendsPath))
+	{
+		domains.push_back(stoi(domain));
+	}
+
+	processChanges(mDiscovery.updateDomains(domains));
+}
+
+void BackendBase::domainReleased(const string& path)
+{
+	vector<domid_t> domains;
+
+	try
+	{
+		XenStat xenStat;
+
+		domains = xenStat.getExistingDoms();
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, WARNING) << "Can't get existing domains: " << e.what();
+
+		domainListChanged(mFrontendsPath);
+
+		return;
 	}
+
+	// backend entries are not read: frontends of the released domains are
+	// removed, nothing is done if the released domain has no frontends
+	processChanges(mDiscovery.retainDomains(domains));
 }
 
 void BackendBase::deviceListChanged(const string& path, domid_t domId)
+{
+	auto domPath = mFrontendsPath + "/" + to_string(domId);
+	string devPath;
+
+	if (getChildPath(domPath, path, devPath))
+	{
+		deviceChanged(devPath, domId,
+					  stoi(devPath.substr(domPath.length() + 1)));
+
+		return;
+	}
+
+	if (!mXenStore.checkIfExist(domPath))
+	{
+		processChanges(mDiscovery.removeDomain(domId));
+
+		return;
+	}
+
+	vector<uint16_t> devices;
+
+	for (auto device : mXenStore.readDirectory(domPath))
+	{
+		devices.push_back(stoi(device));
+	}
+
+	processChanges(mDiscovery.updateDevices(domId, devices));
+}
+
+void BackendBase::deviceChanged(const string& path, domid_t domId,
+								uint16_t devId)
 {
 	if (!mXenStore.checkIfExist(path))
 	{
-		auto it = find(mDomainList.begin(), mDomainList.end(), domId);
+		processChanges(mDiscovery.removeDevice(domId, devId));
 
-		if (it != mDomainList.end())
-		{
-			mXenStore.clearWatch(path);
-			mDomainList.erase(it);
-		}
+		return;
+	}
+
+	auto changes = mDiscovery.addDevice(domId, devId);
+
+	processChanges(changes);
+
+	// the backend may add the handler later, when the frontend is ready:
+	// the device without handler is notified on each change of its entries
 
+	if (changes.added.empty())
+	{
+		scheduleFrontend(domId, devId);
+	}
+}
+
+void BackendBase::processChanges(const FrontendChanges& changes)
+{
+	if (changes.empty())
+	{
 		return;
 	}
 
-	for (auto device : mXenStore.readDirectory(path))
+	LOG(mLog, DEBUG) << "Frontends changed, version: " << changes.version
+					 << ", added: " << changes.added.size()
+					 << ", removed: " << changes.removed.size();
+
+	for(auto domId : changes.removedDomains)
 	{
-		uint16_t devId = stoi(device);
+		mXenStore.clearWatch(mFrontendsPath + "/" + to_string(domId));
+	}
 
-		try
-		{
-			if (!getFrontendHandler(domId, devId))
-			{
-				LOG(mLog, DEBUG) << "New frontend found, domid: "
-						<< domId << ", devid: " << devId;
+	for(auto& frontend : changes.removed)
+	{
+		deleteFrontend(frontend.first, frontend.second);
+	}
 
-				onNewFrontend(domId, devId);
-			}
-		}
-		catch(const std::exception& e)
+	for(auto domId : changes.addedDomains)
+	{
+		mXenStore.setWatch(mFrontendsPath + "/" + to_string(domId),
+						   bind(&BackendBase::deviceListChanged, this,
+								_1, domId));
+	}
+
+	for(auto& frontend : changes.added)
+	{
+		scheduleFrontend(frontend.first, frontend.second);
+	}
+
+	onFrontendsChanged(changes);
+}
+
+void BackendBase::scheduleFrontend(domid_t domId, uint16_t devId)
+{
+	auto key = Registry::getKey(domId, devId);
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		// creating of this frontend is already scheduled
+		if (!mNewFrontends.insert(key).second)
 		{
-			LOG(mLog, ERROR) << e.what();
+			return;
 		}
 	}
+
+	// the handler is checked after the key is inserted: the key of the
+	// created frontend is erased after its handler is added, so the handler
+	// added by the just finished creating is found here
+
+	if (getFrontendHandler(domId, devId))
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mNewFrontends.erase(key);
+
+		return;
+	}
+
+	mWorkerPool.post(key, bind(&BackendBase::createFrontend, this,
+							   domId, devId));
 }
 
-void BackendBase::frontendPathChanged(const string& path, domid_t domId,
-									  uint16_t devId)
+void BackendBase::createFrontend(domid_t domId, uint16_t devId)
 {
-	LOG(mLog, DEBUG) << "Frontend path changed: " << path;
+	try
+	{
+		LOG(mLog, DEBUG) << "New frontend found, domid: "
+				<< domId << ", devid: " << devId;
 
-	if (!mXenStore.checkIfExist(path))
+		onNewFrontend(domId, devId);
+	}
+	catch(const std::exception& e)
 	{
-		mXenStore.clearWatch(path);
+		LOG(mLog, ERROR) << e.what();
 
-		auto frontendHandler = getFrontendHandler(domId, devId);
+		// forget the device to retry on the next change
+		mDiscovery.removeDevice(domId, devId);
+	}
 
-		if (frontendHandler)
-		{
-			LOG(mLog, DEBUG) << "Delete frontend, domid: "
-							 << domId << ", devid: " << devId;
+	lock_guard<mutex> lock(mMutex);
 
-			frontendHandler->stop();
+	mNewFrontends.erase(Registry::getKey(domId, devId));
+}
 
-			mFrontendHandlers.remove(frontendHandler);
-		}
+void BackendBase::deleteFrontend(domid_t domId, uint16_t devId)
+{
+	auto frontendHandler = mFrontendHandlers.remove(domId, devId);
+
+	if (frontendHandler)
+	{
+		LOG(mLog, DEBUG) << "Delete frontend, domid: "
+						 << domId << ", devid: " << devId;
+
+		mXenStore.clearWatch(mFrontendsPath + "/" + to_string(domId) + "/" +
+							 to_string(devId));
+
+		mWorkerPool.post(Registry::getKey(domId, devId),
+						 bind(&FrontendHandlerBase::stop, frontendHandler));
 	}
 }
 
-FrontendHandlerPtr BackendBase::getFrontendHandler(domid_t domId,
-												   uint16_t devId)
+void BackendBase::frontendPathChanged(const string& path, domid_t domId,
+									  uint16_t devId)
 {
-	auto it = find_if(mFrontendHandlers.begin(), mFrontendHandlers.end(),
-					  [&](FrontendHandlerPtr frontend) {
-							return (frontend->getDomId() == domId) &&
-								   (frontend->getDevId() == devId); } );
+	LOG(mLog, DEBUG) << "Frontend path changed: " << path;
 
-	if (it != mFrontendHandlers.end())
+	if (!mXenStore.checkIfExist(path))
 	{
-		return *it;
+		mDiscovery.removeDevice(domId, devId);
+
+		deleteFrontend(domId, devId);
 	}
+}
 
-	return FrontendHandlerPtr();
+FrontendHandlerPtr BackendBase::getFrontendHandler(domid_t domId,
+												   uint16_t devId)
+{
+	return mFrontendHandlers.find(domId, devId);
 }
 
 void BackendBase::onError(const std::exception& e)
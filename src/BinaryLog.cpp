@@ -0,0 +1,689 @@
+/*
+ *  Structured binary log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "BinaryLog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::system_clock;
+using std::hex;
+using std::ifstream;
+using std::list;
+using std::lock_guard;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::mutex;
+using std::ostream;
+using std::ostringstream;
+using std::stable_sort;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace XenBackend {
+
+namespace {
+
+const char cMagic[4] = { 'X', 'B', 'L', 'G' };
+
+// Site id of the site definition record
+const uint32_t cDefinitionId = 0;
+
+struct FileHeader
+{
+	char magic[4];
+	uint32_t version;
+};
+
+struct RecordHeader
+{
+	uint32_t siteId;
+	uint32_t size;
+	uint32_t threadId;
+	uint32_t reserved;
+	uint64_t timestamp;
+};
+
+struct Definition
+{
+	LogLevel level;
+	int line;
+	string format;
+	string types;
+	string file;
+};
+
+struct Record
+{
+	RecordHeader header;
+	string data;
+};
+
+atomic<uint32_t> sLastSiteId(cDefinitionId);
+atomic<uint64_t> sGeneration(0);
+
+bool writeAll(int fd, const void* data, size_t size)
+{
+	auto ptr = static_cast<const uint8_t*>(data);
+
+	while (size)
+	{
+		auto written = ::write(fd, ptr, size);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		ptr += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+// Reads the value of the type from the record data
+template<typename T>
+bool getValue(const string& data, size_t& pos, T& value)
+{
+	if (pos + sizeof(value) > data.size())
+	{
+		return false;
+	}
+
+	memcpy(&value, &data[pos], sizeof(value));
+	pos += sizeof(value);
+
+	return true;
+}
+
+bool getString(const string& data, size_t& pos, string& value)
+{
+	auto end = data.find('\0', pos);
+
+	if (end == string::npos)
+	{
+		return false;
+	}
+
+	value = data.substr(pos, end - pos);
+	pos = end + 1;
+
+	return true;
+}
+
+bool parseDefinition(const string& data, uint32_t& id, Definition& definition)
+{
+	size_t pos = 0;
+	int32_t level;
+
+	if (!getValue(data, pos, id) || !getValue(data, pos, level) ||
+		!getValue(data, pos, definition.line) ||
+		!getString(data, pos, definition.format) ||
+		!getString(data, pos, definition.types) ||
+		!getString(data, pos, definition.file))
+	{
+		return false;
+	}
+
+	definition.level = static_cast<LogLevel>(level);
+
+	return true;
+}
+
+// Writes the argument value of the type to the stream
+bool formatValue(ostringstream& stream, char type, const string& data,
+				 size_t& pos)
+{
+	switch(type)
+	{
+		case 'i':
+		{
+			int64_t value;
+
+			if (!getValue(data, pos, value))
+			{
+				return false;
+			}
+
+			stream << value;
+
+			return true;
+		}
+
+		case 'u':
+		{
+			uint64_t value;
+
+			if (!getValue(data, pos, value))
+			{
+				return false;
+			}
+
+			stream << value;
+
+			return true;
+		}
+
+		case 'd':
+		{
+			double value;
+
+			if (!getValue(data, pos, value))
+			{
+				return false;
+			}
+
+			stream << value;
+
+			return true;
+		}
+
+		case 'p':
+		{
+			uint64_t value;
+
+			if (!getValue(data, pos, value))
+			{
+				return false;
+			}
+
+			stream << "0x" << hex << value << std::dec;
+
+			return true;
+		}
+
+		case 's':
+		{
+			uint32_t length;
+
+			if (!getValue(data, pos, length) || pos + length > data.size())
+			{
+				return false;
+			}
+
+			stream.write(&data[pos], length);
+			pos += length;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+string formatMessage(const Definition& definition, const string& data)
+{
+	ostringstream stream;
+	size_t pos = 0;
+	size_t formatPos = 0;
+
+	for(auto type : definition.types)
+	{
+		auto placeholder = definition.format.find("{}", formatPos);
+
+		if (placeholder == string::npos)
+		{
+			break;
+		}
+
+		stream << definition.format.substr(formatPos, placeholder - formatPos);
+
+		if (!formatValue(stream, type, data, pos))
+		{
+			stream << "<invalid>";
+
+			return stream.str();
+		}
+
+		formatPos = placeholder + 2;
+	}
+
+	stream << definition.format.substr(formatPos);
+
+	return stream.str();
+}
+
+}
+
+/*******************************************************************************
+ * BinaryLogSite
+ ******************************************************************************/
+
+BinaryLogSite::BinaryLogSite(const char* format, const char* types,
+							 const char* file, int line, LogLevel level) :
+	format(format),
+	types(types),
+	file(file),
+	line(line),
+	level(level),
+	id(++sLastSiteId),
+	generation(0)
+{
+}
+
+/*******************************************************************************
+ * BinaryLog
+ ******************************************************************************/
+
+struct BinaryLog::Buffer
+{
+	Buffer() : threadId(syscall(SYS_gettid)), size(0)
+	{
+		lock.clear();
+	}
+
+	void acquire()
+	{
+		while (lock.test_and_set(memory_order_acquire))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	void release()
+	{
+		lock.clear(memory_order_release);
+	}
+
+	void put(const void* value, size_t length)
+	{
+		memcpy(data + size, value, length);
+		size += length;
+	}
+
+	void write(int fd)
+	{
+		writeAll(fd, data, size);
+
+		size = 0;
+	}
+
+	std::atomic_flag lock;
+	uint32_t threadId;
+	size_t size;
+	uint8_t data[cBufferSize];
+};
+
+// Buffers of all threads, are written on flush and close
+struct BinaryLog::Registry
+{
+	std::mutex mutex;
+	list<Buffer*> buffers;
+};
+
+const size_t BinaryLog::cBufferSize;
+const uint32_t BinaryLog::cVersion;
+
+atomic<int> BinaryLog::sFd(-1);
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void BinaryLog::open(const string& path)
+{
+	lock_guard<mutex> lock(getRegistry().mutex);
+
+	if (sFd.load() >= 0)
+	{
+		throw BinaryLogException("Binary log is already opened", EPERM);
+	}
+
+	auto fd = ::open(path.c_str(),
+					 O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+	{
+		throw BinaryLogException("Can't open binary log: " + path, errno);
+	}
+
+	FileHeader header = {};
+
+	memcpy(header.magic, cMagic, sizeof(cMagic));
+	header.version = cVersion;
+
+	if (!writeAll(fd, &header, sizeof(header)))
+	{
+		auto error = errno;
+
+		::close(fd);
+
+		throw BinaryLogException("Can't write binary log: " + path, error);
+	}
+
+	// sites are defined again in the new file
+
+	sGeneration++;
+
+	sFd.store(fd, memory_order_release);
+}
+
+void BinaryLog::close()
+{
+	lock_guard<mutex> lock(getRegistry().mutex);
+
+	auto fd = sFd.exchange(-1);
+
+	if (fd < 0)
+	{
+		return;
+	}
+
+	// threads which have seen the descriptor are finished when their buffer
+	// is released
+
+	for(auto buffer : getRegistry().buffers)
+	{
+		buffer->acquire();
+		buffer->write(fd);
+		buffer->release();
+	}
+
+	::close(fd);
+}
+
+void BinaryLog::flush()
+{
+	lock_guard<mutex> lock(getRegistry().mutex);
+
+	auto fd = sFd.load();
+
+	if (fd < 0)
+	{
+		return;
+	}
+
+	for(auto buffer : getRegistry().buffers)
+	{
+		buffer->acquire();
+		buffer->write(fd);
+		buffer->release();
+	}
+}
+
+vector<BinaryLogEntry> BinaryLog::read(const string& path)
+{
+	ifstream file(path, ifstream::binary);
+
+	if (!file)
+	{
+		throw BinaryLogException("Can't open binary log: " + path, ENOENT);
+	}
+
+	FileHeader header;
+
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		memcmp(header.magic, cMagic, sizeof(cMagic)) != 0 ||
+		header.version != cVersion)
+	{
+		throw BinaryLogException("Invalid binary log: " + path, EINVAL);
+	}
+
+	unordered_map<uint32_t, Definition> definitions;
+	vector<Record> records;
+	Record record;
+
+	// the definition may follow the record written by another thread, so
+	// records are formatted when the whole file is read. The last record
+	// may be truncated if the process has crashed.
+
+	while (file.read(reinterpret_cast<char*>(&record.header),
+					 sizeof(record.header)))
+	{
+		record.data.resize(record.header.size);
+
+		if (!file.read(&record.data[0], record.data.size()))
+		{
+			break;
+		}
+
+		if (record.header.siteId == cDefinitionId)
+		{
+			uint32_t id;
+			Definition definition;
+
+			if (!parseDefinition(record.data, id, definition))
+			{
+				throw BinaryLogException("Invalid site definition: " + path,
+										 EINVAL);
+			}
+
+			definitions[id] = definition;
+		}
+		else
+		{
+			records.push_back(record);
+		}
+	}
+
+	vector<BinaryLogEntry> entries;
+
+	for(auto& record : records)
+	{
+		BinaryLogEntry entry;
+
+		entry.timestamp = record.header.timestamp;
+		entry.threadId = record.header.threadId;
+
+		auto it = definitions.find(record.header.siteId);
+
+		if (it == definitions.end())
+		{
+			entry.level = LogLevel::logDISABLE;
+			entry.line = 0;
+			entry.message = "<unknown site " +
+							std::to_string(record.header.siteId) + ">";
+		}
+		else
+		{
+			entry.level = it->second.level;
+			entry.file = it->second.file;
+			entry.line = it->second.line;
+			entry.message = formatMessage(it->second, record.data);
+		}
+
+		entries.push_back(entry);
+	}
+
+	stable_sort(entries.begin(), entries.end(),
+				[](const BinaryLogEntry& a, const BinaryLogEntry& b)
+				{ return a.timestamp < b.timestamp; });
+
+	return entries;
+}
+
+void BinaryLog::print(const vector<BinaryLogEntry>& entries, ostream& stream)
+{
+	static const char* cLevels[] = {"", "ERR", "WRN", "INF", "DBG"};
+
+	for(auto& entry : entries)
+	{
+		time_t time = entry.timestamp / 1000000000;
+		tm localTime;
+		char buffer[64];
+
+		localtime_r(&time, &localTime);
+		strftime(buffer, sizeof(buffer), "%d.%m.%y %X.", &localTime);
+
+		auto level = static_cast<size_t>(entry.level);
+
+		stream << buffer << std::setfill('0') << std::setw(3)
+			   << entry.timestamp / 1000000 % 1000 << std::setfill(' ')
+			   << " | " << entry.file << " " << entry.line
+			   << " | " << (level < 5 ? cLevels[level] : "") << " - "
+			   << entry.message << "\n";
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+BinaryLog::Registry& BinaryLog::getRegistry()
+{
+	static Registry sRegistry;
+
+	return sRegistry;
+}
+
+BinaryLog::Buffer& BinaryLog::getBuffer()
+{
+	// the buffer is written and unregistered when the thread exits
+
+	struct ThreadBuffer
+	{
+		ThreadBuffer() : buffer(new Buffer())
+		{
+			lock_guard<mutex> lock(getRegistry().mutex);
+
+			getRegistry().buffers.push_back(buffer);
+		}
+
+		~ThreadBuffer()
+		{
+			lock_guard<mutex> lock(getRegistry().mutex);
+
+			auto fd = sFd.load();
+
+			if (fd >= 0)
+			{
+				buffer->write(fd);
+			}
+
+			getRegistry().buffers.remove(buffer);
+
+			delete buffer;
+		}
+
+		Buffer* buffer;
+	};
+
+	static thread_local ThreadBuffer sThreadBuffer;
+
+	return *sThreadBuffer.buffer;
+}
+
+uint8_t* BinaryLog::beginRecord(const BinaryLogSite& site, size_t size)
+{
+	auto& buffer = getBuffer();
+
+	buffer.acquire();
+
+	auto fd = sFd.load(memory_order_acquire);
+
+	if (fd < 0 || sizeof(RecordHeader) + size > cBufferSize)
+	{
+		buffer.release();
+
+		return nullptr;
+	}
+
+	auto timestamp = duration_cast<nanoseconds>(
+			system_clock::now().time_since_epoch()).count();
+	auto generation = sGeneration.load(memory_order_relaxed);
+
+	// the site is defined in the file before its first record
+
+	if (site.generation.load(memory_order_relaxed) != generation)
+	{
+		site.generation.store(generation, memory_order_relaxed);
+
+		auto formatLength = strlen(site.format) + 1;
+		auto typesLength = strlen(site.types) + 1;
+		auto fileLength = strlen(site.file) + 1;
+
+		RecordHeader header = {};
+
+		header.siteId = cDefinitionId;
+		header.size = 3 * sizeof(uint32_t) + formatLength + typesLength +
+					  fileLength;
+		header.threadId = buffer.threadId;
+		header.timestamp = timestamp;
+
+		if (sizeof(header) + header.size <= cBufferSize)
+		{
+			if (buffer.size + sizeof(header) + header.size > cBufferSize)
+			{
+				buffer.write(fd);
+			}
+
+			int32_t level = static_cast<int32_t>(site.level);
+			int32_t line = site.line;
+
+			buffer.put(&header, sizeof(header));
+			buffer.put(&site.id, sizeof(site.id));
+			buffer.put(&level, sizeof(level));
+			buffer.put(&line, sizeof(line));
+			buffer.put(site.format, formatLength);
+			buffer.put(site.types, typesLength);
+			buffer.put(site.file, fileLength);
+		}
+	}
+
+	RecordHeader header = {};
+
+	header.siteId = site.id;
+	header.size = size;
+	header.threadId = buffer.threadId;
+	header.timestamp = timestamp;
+
+	if (buffer.size + sizeof(header) + size > cBufferSize)
+	{
+		buffer.write(fd);
+	}
+
+	buffer.put(&header, sizeof(header));
+
+	auto data = buffer.data + buffer.size;
+
+	buffer.size += size;
+
+	return data;
+}
+
+void BinaryLog::endRecord()
+{
+	getBuffer().release();
+}
+
+}
@@ -0,0 +1,208 @@
+/*
+ *  Callback monitor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "CallbackMonitor.hpp"
+
+#include <mutex>
+
+#include "Histogram.hpp"
+#include "Metrics.hpp"
+
+using std::atomic;
+using std::chrono::nanoseconds;
+using std::lock_guard;
+using std::memory_order_relaxed;
+using std::mutex;
+using std::string;
+
+namespace XenBackend {
+
+namespace {
+
+const size_t cNumSources = static_cast<size_t>(CallbackSource::ReactorTask) +
+							 1;
+
+// Lag and duration histograms of each source
+struct CallbackMetrics
+{
+	CallbackMetrics() : group("callbacks")
+	{
+		for(size_t i = 0; i < cNumSources; i++)
+		{
+			string name = CallbackMonitor::getSourceName(
+					static_cast<CallbackSource>(i));
+
+			lag[i] = &group.addHistogram(name + "_lag");
+			duration[i] = &group.addHistogram(name + "_duration");
+			slow[i] = &group.addCounter(name + "_slow");
+		}
+	}
+
+	MetricsGroup group;
+	LatencyHistogram* lag[cNumSources];
+	LatencyHistogram* duration[cNumSources];
+	MetricsCounter* slow[cNumSources];
+};
+
+CallbackMetrics& getMetrics()
+{
+	static CallbackMetrics sMetrics;
+
+	return sMetrics;
+}
+
+// The hook is copied under the lock, so it may be replaced while called
+struct HookHolder
+{
+	std::mutex mutex;
+	CallbackMonitor::SlowCallbackHook hook;
+};
+
+HookHolder& getHookHolder()
+{
+	static HookHolder sHolder;
+
+	return sHolder;
+}
+
+}
+
+/*******************************************************************************
+ * CallbackMonitor
+ ******************************************************************************/
+
+atomic<int64_t> CallbackMonitor::sThreshold(0);
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void CallbackMonitor::setSlowCallbackHook(SlowCallbackHook hook,
+										  nanoseconds threshold)
+{
+	auto& holder = getHookHolder();
+
+	lock_guard<mutex> lock(holder.mutex);
+
+	holder.hook = hook;
+
+	sThreshold.store(hook ? threshold.count() : 0);
+}
+
+const char* CallbackMonitor::getSourceName(CallbackSource source)
+{
+	switch(source)
+	{
+		case CallbackSource::EventChannel:
+			return "evtchn";
+
+		case CallbackSource::XenStoreWatch:
+			return "xs_watch";
+
+		case CallbackSource::AsyncContext:
+			return "async";
+
+		case CallbackSource::Timer:
+			return "timer";
+
+		case CallbackSource::ReactorTask:
+			return "reactor_task";
+	}
+
+	return "unknown";
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void CallbackMonitor::record(CallbackSource source, int port,
+							 const string* path, int64_t lag, int64_t duration)
+{
+	auto& metrics = getMetrics();
+	auto index = static_cast<size_t>(source);
+
+	// the ready time may be a bit later than the start for timers
+
+	if (lag < 0)
+	{
+		lag = 0;
+	}
+
+	metrics.lag[index]->record(lag);
+	metrics.duration[index]->record(duration);
+
+	auto threshold = sThreshold.load(memory_order_relaxed);
+
+	if (!threshold || (lag <= threshold && duration <= threshold))
+	{
+		return;
+	}
+
+	metrics.slow[index]->add();
+
+	CallbackMonitor::SlowCallbackHook hook;
+
+	{
+		auto& holder = getHookHolder();
+
+		lock_guard<mutex> lock(holder.mutex);
+
+		hook = holder.hook;
+	}
+
+	if (hook)
+	{
+		hook({ source, port, path ? *path : string(), nanoseconds(lag),
+			   nanoseconds(duration) });
+	}
+}
+
+/*******************************************************************************
+ * CallbackMonitor::Scope
+ ******************************************************************************/
+
+CallbackMonitor::Scope::Scope(CallbackSource source, int64_t readyTime,
+							  int port) :
+	mSource(source),
+	mReadyTime(readyTime),
+	mStartTime(LatencyTracker::getTime()),
+	mPort(port),
+	mPath(nullptr)
+{
+}
+
+CallbackMonitor::Scope::Scope(CallbackSource source, int64_t readyTime,
+							  const string& path) :
+	mSource(source),
+	mReadyTime(readyTime),
+	mStartTime(LatencyTracker::getTime()),
+	mPort(-1),
+	mPath(&path)
+{
+}
+
+CallbackMonitor::Scope::~Scope()
+{
+	record(mSource, mPort, mPath, mStartTime - mReadyTime,
+		   LatencyTracker::getTime() - mStartTime);
+}
+
+}
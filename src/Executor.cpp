@@ -0,0 +1,439 @@
+/*
+ *  Work-stealing executor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Executor.hpp"
+
+#include "Log.hpp"
+#include "Metrics.hpp"
+
+using std::lock_guard;
+using std::move;
+using std::mutex;
+using std::shared_ptr;
+using std::thread;
+using std::unique_lock;
+
+namespace XenBackend {
+
+namespace {
+
+// Tasks of all executors
+struct ExecutorMetrics
+{
+	ExecutorMetrics() :
+		group("executor"),
+		tasks(group.addCounter("tasks")),
+		stolen(group.addCounter("tasks_stolen")),
+		errors(group.addCounter("errors"))
+	{}
+
+	MetricsGroup group;
+	MetricsCounter& tasks;
+	MetricsCounter& stolen;
+	MetricsCounter& errors;
+};
+
+ExecutorMetrics& getMetrics()
+{
+	static ExecutorMetrics sMetrics;
+
+	return sMetrics;
+}
+
+// Executor and index of the worker running on the current thread
+thread_local const Executor* sCurrentExecutor = nullptr;
+thread_local size_t sCurrentWorker = 0;
+
+}
+
+/*******************************************************************************
+ * ExecutorTask
+ ******************************************************************************/
+
+const size_t ExecutorTask::cInlineSize;
+
+/*******************************************************************************
+ * Executor
+ ******************************************************************************/
+
+Executor::Executor(size_t numWorkers) :
+	mNextWorker(0),
+	mNumPending(0),
+	mNumSleeping(0),
+	mNumPosting(0),
+	mTerminate(false)
+{
+	if (numWorkers == 0)
+	{
+		numWorkers = 1;
+	}
+
+	for(size_t i = 0; i < numWorkers; i++)
+	{
+		mWorkers.emplace_back(new Worker());
+	}
+
+	for(size_t i = 0; i < numWorkers; i++)
+	{
+		mWorkers[i]->thread = thread(&Executor::run, this, i);
+	}
+}
+
+Executor::~Executor()
+{
+	stop();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+Executor& Executor::getDefault()
+{
+	// is not destroyed on exit: tasks may use objects which are already
+	// destroyed at that time
+
+	static Executor* sExecutor = new Executor(thread::hardware_concurrency());
+
+	return *sExecutor;
+}
+
+bool Executor::post(ExecutorTask task)
+{
+	// pairs with stop setting the terminate flag and waiting for posts
+
+	mNumPosting.fetch_add(1);
+
+	if (mTerminate.load())
+	{
+		mNumPosting.fetch_sub(1);
+
+		return false;
+	}
+
+	size_t index;
+
+	if (sCurrentExecutor == this)
+	{
+		index = sCurrentWorker;
+	}
+	else
+	{
+		index = mNextWorker.fetch_add(1, std::memory_order_relaxed) %
+				mWorkers.size();
+	}
+
+	{
+		lock_guard<mutex> lock(mWorkers[index]->mutex);
+
+		mWorkers[index]->tasks.push_back(move(task));
+	}
+
+	mNumPending.fetch_add(1);
+
+	wakeup();
+
+	mNumPosting.fetch_sub(1);
+
+	return true;
+}
+
+void Executor::stop()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+	}
+
+	mCondVar.notify_all();
+
+	for(auto& worker : mWorkers)
+	{
+		if (worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+	}
+
+	// tasks posted while workers were exiting are run here
+
+	while (mNumPosting.load() != 0)
+	{
+		std::this_thread::yield();
+	}
+
+	ExecutorTask task;
+
+	while (takeTask(0, task))
+	{
+		runTask(task);
+
+		task.reset();
+	}
+}
+
+void Executor::runTask(ExecutorTask& task)
+{
+	getMetrics().tasks.add();
+
+	try
+	{
+		task();
+	}
+	catch(const std::exception& e)
+	{
+		getMetrics().errors.add();
+
+		LOG("Executor", ERROR) << e.what();
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Executor::run(size_t index)
+{
+	sCurrentExecutor = this;
+	sCurrentWorker = index;
+
+	ExecutorTask task;
+
+	while (true)
+	{
+		if (takeTask(index, task))
+		{
+			runTask(task);
+
+			task.reset();
+
+			continue;
+		}
+
+		unique_lock<mutex> lock(mMutex);
+
+		// pairs with the post incrementing pending tasks and checking
+		// sleeping workers
+
+		mNumSleeping.fetch_add(1);
+
+		mCondVar.wait(lock, [this]
+			{ return mNumPending.load() != 0 || mTerminate.load(); });
+
+		mNumSleeping.fetch_sub(1);
+
+		if (mNumPending.load() == 0 && mTerminate.load())
+		{
+			break;
+		}
+	}
+
+	sCurrentExecutor = nullptr;
+}
+
+bool Executor::takeTask(size_t index, ExecutorTask& task)
+{
+	if (mNumPending.load(std::memory_order_relaxed) == 0)
+	{
+		return false;
+	}
+
+	// tasks are taken in the posting order, so the drain task reposted by
+	// the serial executor runs after other tasks of the worker
+
+	{
+		auto& worker = *mWorkers[index];
+
+		lock_guard<mutex> lock(worker.mutex);
+
+		if (!worker.tasks.empty())
+		{
+			task = move(worker.tasks.front());
+			worker.tasks.pop_front();
+
+			mNumPending.fetch_sub(1);
+
+			return true;
+		}
+	}
+
+	for(size_t i = 1; i < mWorkers.size(); i++)
+	{
+		auto& victim = *mWorkers[(index + i) % mWorkers.size()];
+
+		lock_guard<mutex> lock(victim.mutex);
+
+		if (!victim.tasks.empty())
+		{
+			task = move(victim.tasks.front());
+			victim.tasks.pop_front();
+
+			mNumPending.fetch_sub(1);
+
+			getMetrics().stolen.add();
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Executor::wakeup()
+{
+	if (mNumSleeping.load() != 0)
+	{
+		// the worker is either waiting or checks pending tasks under the lock
+
+		lock_guard<mutex> lock(mMutex);
+
+		mCondVar.notify_one();
+	}
+}
+
+/*******************************************************************************
+ * SerialExecutor
+ ******************************************************************************/
+
+const size_t SerialExecutor::cMaxBatch;
+
+SerialExecutor::SerialExecutor(Executor& executor) :
+	mExecutor(executor),
+	mState(new State())
+{
+}
+
+SerialExecutor::~SerialExecutor()
+{
+	stop();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void SerialExecutor::post(ExecutorTask task)
+{
+	{
+		lock_guard<mutex> lock(mState->mutex);
+
+		if (mState->stopped)
+		{
+			return;
+		}
+
+		mState->tasks.push_back(move(task));
+
+		// the drain task is posted or is running
+
+		if (mState->scheduled)
+		{
+			return;
+		}
+
+		mState->scheduled = true;
+	}
+
+	auto& executor = mExecutor;
+	auto state = mState;
+
+	if (!mExecutor.post([&executor, state] { drain(executor, state); }))
+	{
+		cancel(*state);
+	}
+}
+
+void SerialExecutor::stop()
+{
+	unique_lock<mutex> lock(mState->mutex);
+
+	mState->stopped = true;
+
+	if (mState->runningThread == std::this_thread::get_id())
+	{
+		return;
+	}
+
+	mState->condVar.wait(lock, [this] { return !mState->scheduled; });
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void SerialExecutor::drain(Executor& executor, shared_ptr<State> state)
+{
+	unique_lock<mutex> lock(state->mutex);
+
+	for(size_t i = 0; i < cMaxBatch && !state->tasks.empty(); i++)
+	{
+		auto task = move(state->tasks.front());
+
+		state->tasks.pop_front();
+		state->runningThread = std::this_thread::get_id();
+
+		lock.unlock();
+
+		Executor::runTask(task);
+
+		task.reset();
+
+		lock.lock();
+
+		state->runningThread = thread::id();
+	}
+
+	if (state->tasks.empty())
+	{
+		state->scheduled = false;
+
+		state->condVar.notify_all();
+
+		return;
+	}
+
+	// other serial executors run before the rest of tasks
+
+	lock.unlock();
+
+	if (!executor.post([&executor, state] { drain(executor, state); }))
+	{
+		cancel(*state);
+	}
+}
+
+void SerialExecutor::cancel(State& state)
+{
+	// the executor is stopped: queued tasks are dropped, so stop doesn't
+	// wait for the drain task which is never run
+
+	std::deque<ExecutorTask> tasks;
+
+	lock_guard<mutex> lock(state.mutex);
+
+	tasks.swap(state.tasks);
+
+	state.scheduled = false;
+
+	state.condVar.notify_all();
+}
+
+}
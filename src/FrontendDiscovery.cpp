@@ -0,0 +1,336 @@
+/*
+ *  Frontend discovery
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "FrontendDiscovery.hpp"
+
+#include <algorithm>
+
+using std::lock_guard;
+using std::lower_bound;
+using std::make_pair;
+using std::mutex;
+using std::sort;
+using std::unique;
+using std::vector;
+
+namespace XenBackend {
+
+namespace {
+
+// Sorts and removes duplicates
+template<typename T>
+void normalize(vector<T>& items)
+{
+	sort(items.begin(), items.end());
+	items.erase(unique(items.begin(), items.end()), items.end());
+}
+
+// Walks two sorted sequences once and reports items which are only in one of
+// them
+template<typename T>
+void diff(const vector<T>& from, const vector<T>& to,
+		  vector<T>& added, vector<T>& removed)
+{
+	auto itFrom = from.begin();
+	auto itTo = to.begin();
+
+	while (itFrom != from.end() || itTo != to.end())
+	{
+		if (itTo == to.end() || (itFrom != from.end() && *itFrom < *itTo))
+		{
+			removed.push_back(*itFrom++);
+		}
+		else if (itFrom == from.end() || *itTo < *itFrom)
+		{
+			added.push_back(*itTo++);
+		}
+		else
+		{
+			itFrom++;
+			itTo++;
+		}
+	}
+}
+
+}
+
+/*******************************************************************************
+ * FrontendDiscovery
+ ******************************************************************************/
+
+FrontendDiscovery::FrontendDiscovery() :
+	mVersion(0)
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+FrontendChanges FrontendDiscovery::updateDomains(vector<domid_t> domains)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	diffDomains(domains, true, changes);
+
+	return commit(changes);
+}
+
+FrontendChanges FrontendDiscovery::retainDomains(vector<domid_t> domains)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	diffDomains(domains, false, changes);
+
+	return commit(changes);
+}
+
+FrontendChanges FrontendDiscovery::addDomain(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	if (mDomains.insert(make_pair(domId, vector<uint16_t>())).second)
+	{
+		changes.addedDomains.push_back(domId);
+	}
+
+	return commit(changes);
+}
+
+FrontendChanges FrontendDiscovery::removeDomain(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	auto it = mDomains.find(domId);
+
+	if (it != mDomains.end())
+	{
+		eraseDomain(it, changes);
+	}
+
+	return commit(changes);
+}
+
+FrontendChanges FrontendDiscovery::updateDevices(domid_t domId,
+												 vector<uint16_t> devices)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	normalize(devices);
+
+	auto result = mDomains.insert(make_pair(domId, vector<uint16_t>()));
+
+	if (result.second)
+	{
+		changes.addedDomains.push_back(domId);
+	}
+
+	auto& current = result.first->second;
+
+	vector<uint16_t> added, removed;
+
+	diff(current, devices, added, removed);
+
+	for(auto devId : added)
+	{
+		changes.added.push_back(make_pair(domId, devId));
+	}
+
+	for(auto devId : removed)
+	{
+		changes.removed.push_back(make_pair(domId, devId));
+	}
+
+	current.swap(devices);
+
+	return commit(changes);
+}
+
+FrontendChanges FrontendDiscovery::addDevice(domid_t domId, uint16_t devId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	auto result = mDomains.insert(make_pair(domId, vector<uint16_t>()));
+
+	if (result.second)
+	{
+		changes.addedDomains.push_back(domId);
+	}
+
+	auto& devices = result.first->second;
+	auto itDev = lower_bound(devices.begin(), devices.end(), devId);
+
+	if (itDev == devices.end() || *itDev != devId)
+	{
+		devices.insert(itDev, devId);
+
+		changes.added.push_back(make_pair(domId, devId));
+	}
+
+	return commit(changes);
+}
+
+FrontendChanges FrontendDiscovery::removeDevice(domid_t domId, uint16_t devId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendChanges changes;
+
+	auto it = mDomains.find(domId);
+
+	if (it != mDomains.end())
+	{
+		auto& devices = it->second;
+		auto itDev = lower_bound(devices.begin(), devices.end(), devId);
+
+		if (itDev != devices.end() && *itDev == devId)
+		{
+			devices.erase(itDev);
+
+			changes.removed.push_back(make_pair(domId, devId));
+		}
+	}
+
+	return commit(changes);
+}
+
+uint64_t FrontendDiscovery::getVersion() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mVersion;
+}
+
+bool FrontendDiscovery::hasDomain(domid_t domId) const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mDomains.find(domId) != mDomains.end();
+}
+
+vector<domid_t> FrontendDiscovery::getDomains() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	vector<domid_t> result;
+
+	result.reserve(mDomains.size());
+
+	for(auto& domain : mDomains)
+	{
+		result.push_back(domain.first);
+	}
+
+	return result;
+}
+
+FrontendSnapshot FrontendDiscovery::getSnapshot() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	FrontendSnapshot snapshot;
+
+	snapshot.version = mVersion;
+
+	for(auto& domain : mDomains)
+	{
+		for(auto devId : domain.second)
+		{
+			snapshot.frontends.push_back(make_pair(domain.first, devId));
+		}
+	}
+
+	return snapshot;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void FrontendDiscovery::eraseDomain(DomainMap::iterator it,
+									FrontendChanges& changes)
+{
+	for(auto devId : it->second)
+	{
+		changes.removed.push_back(make_pair(it->first, devId));
+	}
+
+	changes.removedDomains.push_back(it->first);
+
+	mDomains.erase(it);
+}
+
+void FrontendDiscovery::diffDomains(vector<domid_t>& domains, bool addNew,
+									FrontendChanges& changes)
+{
+	normalize(domains);
+
+	vector<domid_t> current, added, removed;
+
+	current.reserve(mDomains.size());
+
+	for(auto& domain : mDomains)
+	{
+		current.push_back(domain.first);
+	}
+
+	diff(current, domains, added, removed);
+
+	for(auto domId : removed)
+	{
+		eraseDomain(mDomains.find(domId), changes);
+	}
+
+	if (addNew)
+	{
+		for(auto domId : added)
+		{
+			mDomains.insert(make_pair(domId, vector<uint16_t>()));
+		}
+
+		changes.addedDomains.swap(added);
+	}
+}
+
+FrontendChanges FrontendDiscovery::commit(FrontendChanges& changes)
+{
+	if (!changes.empty())
+	{
+		mVersion++;
+	}
+
+	changes.version = mVersion;
+
+	return changes;
+}
+
+}
@@ -34,6 +34,7 @@ extern "C" {
 
 using std::bind;
 using std::find;
+using std::find_if;
 using std::lock_guard;
 using std::make_pair;
 using std::mutex;
@@ -60,7 +61,15 @@ FrontendHandlerBase::FrontendHandlerBase(const std::string& name,
 	mBackendState(XenbusStateUnknown),
 	mFrontendState(XenbusStateUnknown),
 	mXenStore(bind(&FrontendHandlerBase::onError, this, _1)),
-	mLog(name.empty() ? "FrontendHandler" : name)
+	mInherited(false),
+	mHandedOver(false),
+	mStarted(false),
+	mLog(name.empty() ? "FrontendHandler" : name),
+	mMetrics("frontend", domId, devId),
+	mBackendStateTransitions(mMetrics.addCounter("backend_state_transitions")),
+	mFrontendStateTransitions(
+			mMetrics.addCounter("frontend_state_transitions")),
+	mRingBuffersAdded(mMetrics.addCounter("ring_buffers_added"))
 {
 	LOG(mLog, DEBUG) << Utils::logDomId(mDomId, mDevId)
 					 << "Create frontend handler";
@@ -80,17 +89,79 @@ FrontendHandlerBase::~FrontendHandlerBase()
  * Public
  ******************************************************************************/
 
+void FrontendHandlerBase::setReactor(ReactorPtr reactor)
+{
+	auto oldReactor = getReactor();
+
+	if (reactor == oldReactor)
+	{
+		return;
+	}
+
+	LOG(mLog, DEBUG) << Utils::logDomId(mDomId, mDevId) << "Set reactor";
+
+	// ring buffers are moved in the old reactor thread, so no indication is
+	// handled in both threads
+
+	if (oldReactor && !oldReactor->isReactorThread())
+	{
+		oldReactor->post(bind(&FrontendHandlerBase::moveToReactor, this,
+							  reactor));
+
+		oldReactor->flush();
+	}
+	else
+	{
+		moveToReactor(reactor);
+	}
+}
+
+ReactorPtr FrontendHandlerBase::getReactor()
+{
+	lock_guard<mutex> lock(mReactorMutex);
+
+	return mReactor;
+}
+
+void FrontendHandlerBase::setScheduler(SchedulerPtr scheduler)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mScheduler = scheduler;
+}
+
+uint64_t FrontendHandlerBase::getNumEvents()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	uint64_t numEvents = 0;
+
+	for(auto ringBuffer : mRingBuffers)
+	{
+		numEvents += ringBuffer->getNumIndications();
+	}
+
+	return numEvents;
+}
+
 void FrontendHandlerBase::start()
 {
 	lock_guard<mutex> lock(mMutex);
 
-	mXenStore.setWatch(mFeStatePath,
-					   bind(&FrontendHandlerBase::frontendStateChanged, this));
+	if (mInherited)
+	{
+		restoreState();
+	}
+
+	mXenStore.setWatch(mFeStatePath, [this] (const string& path)
+		{ dispatch(bind(&FrontendHandlerBase::frontendStateChanged, this)); });
 
-	mXenStore.setWatch(mBeStatePath,
-					   bind(&FrontendHandlerBase::backendStateChanged, this));
+	mXenStore.setWatch(mBeStatePath, [this] (const string& path)
+		{ dispatch(bind(&FrontendHandlerBase::backendStateChanged, this)); });
 
 	mXenStore.start();
+
+	mStarted = true;
 }
 
 void FrontendHandlerBase::stop()
@@ -99,13 +170,60 @@ void FrontendHandlerBase::stop()
 
 	mXenStore.stop();
 
+	// posted callbacks take the mutex, so they have to be completed before
+	// the mutex is taken here
+
+	flushReactor();
+
 	lock_guard<mutex> lock(mMutex);
 
+	mStarted = false;
+
 	close(XenbusStateClosed);
 
 	mAsyncContext.stop();
 }
 
+FrontendState FrontendHandlerBase::handover()
+{
+	mXenStore.clearWatches();
+
+	mXenStore.stop();
+
+	flushReactor();
+
+	lock_guard<mutex> lock(mMutex);
+
+	LOG(mLog, INFO) << Utils::logDomId(mDomId, mDevId) << "Hand over";
+
+	FrontendState state;
+
+	state.devName = mDevName;
+	state.domId = mDomId;
+	state.devId = mDevId;
+	state.backendState = mBackendState;
+	state.frontendState = mFrontendState;
+
+	releaseSuspended();
+
+	for(auto ringBuffer : mRingBuffers)
+	{
+		ringBuffer->stop();
+
+		state.ringBuffers.push_back(ringBuffer->getState());
+
+		// the descriptor stays open until the ring buffer is deleted
+
+		ringBuffer->detach();
+	}
+
+	onSaveState(state);
+
+	mHandedOver = true;
+
+	return state;
+}
+
 /*******************************************************************************
  * Protected
  ******************************************************************************/
@@ -118,9 +236,44 @@ void FrontendHandlerBase::addRingBuffer(RingBufferPtr ringBuffer)
 					<< ringBuffer->getPort();
 
 	ringBuffer->setErrorCallback(bind(&FrontendHandlerBase::onError, this, _1));
-	ringBuffer->start();
+	ringBuffer->getMetrics().setDevId(mDevId);
+
+	if (mInherited)
+	{
+		for(auto& state : mInheritedState.ringBuffers)
+		{
+			if (state.port == ringBuffer->getPort() &&
+				state.ref == ringBuffer->getRef())
+			{
+				ringBuffer->setState(state);
+			}
+		}
+	}
+
+	// resumed ring buffer is already started
+
+	if (!ringBuffer->isStarted())
+	{
+		auto reactor = getReactor();
+
+		if (mScheduler)
+		{
+			ringBuffer->setScheduler(mScheduler);
+		}
+
+		if (reactor)
+		{
+			ringBuffer->start(reactor);
+		}
+		else
+		{
+			ringBuffer->start();
+		}
+	}
 
 	mRingBuffers.push_back(ringBuffer);
+
+	mRingBuffersAdded.add();
 }
 
 void FrontendHandlerBase::setBackendState(xenbus_state state)
@@ -136,6 +289,8 @@ void FrontendHandlerBase::setBackendState(xenbus_state state)
 
 	mBackendState = state;
 
+	mBackendStateTransitions.add();
+
 	if (mXenStore.checkIfExist(mBeStatePath))
 	{
 		mXenStore.writeInt(mBeStatePath, state);
@@ -158,7 +313,7 @@ void FrontendHandlerBase::onStateInitializing()
 		LOG(mLog, WARNING) << Utils::logDomId(mDomId, mDevId)
 						   << "Frontend restarted";
 
-		close(XenbusStateInitWait);
+		restart();
 	}
 
 	if (mBackendState == XenbusStateInitialising ||
@@ -178,9 +333,7 @@ void FrontendHandlerBase::onStateInitialized()
 	if (mBackendState == XenbusStateInitialising ||
 		mBackendState == XenbusStateInitWait)
 	{
-		onBind();
-
-		setBackendState(XenbusStateConnected);
+		bindRingBuffers();
 	}
 }
 
@@ -189,9 +342,7 @@ void FrontendHandlerBase::onStateConnected()
 	if (mBackendState == XenbusStateInitialising ||
 		mBackendState == XenbusStateInitWait)
 	{
-		onBind();
-
-		setBackendState(XenbusStateConnected);
+		bindRingBuffers();
 	}
 }
 
@@ -245,6 +396,21 @@ void FrontendHandlerBase::init()
 {
 	initXenStorePathes();
 
+	if (LiveUpgrade::takeInherited(mDevName, mDomId, mDevId, mInheritedState))
+	{
+		LOG(mLog, INFO) << Utils::logDomId(mDomId, mDevId)
+						<< "Inherit state, backend: "
+						<< Utils::logState(mInheritedState.backendState)
+						<< ", frontend: "
+						<< Utils::logState(mInheritedState.frontendState);
+
+		mInherited = true;
+		mBackendState = mInheritedState.backendState;
+		mFrontendState = mInheritedState.frontendState;
+
+		return;
+	}
+
 	if (mXenStore.checkIfExist(mBeStatePath))
 	{
 		mBackendState = static_cast<xenbus_state>(mXenStore.readInt(mBeStatePath));
@@ -270,6 +436,193 @@ void FrontendHandlerBase::release()
 	}
 
 	mRingBuffers.clear();
+
+	releaseSuspended();
+}
+
+void FrontendHandlerBase::releaseSuspended()
+{
+	for(auto ringBuffer : mSuspendedRingBuffers)
+	{
+		LOG(mLog, DEBUG) << Utils::logDomId(mDomId, mDevId)
+						 << "Release suspended ring buffer, ref: "
+						 << ringBuffer->getRef() << ", port: "
+						 << ringBuffer->getPort();
+
+		ringBuffer->stop();
+	}
+
+	mSuspendedRingBuffers.clear();
+}
+
+RingBufferPtr FrontendHandlerBase::takeSuspendedRingBuffer(evtchn_port_t port,
+														   grant_ref_t ref)
+{
+	auto it = find_if(mSuspendedRingBuffers.begin(),
+					  mSuspendedRingBuffers.end(),
+					  [port](const RingBufferPtr& ringBuffer)
+					  { return ringBuffer->getPort() == port; });
+
+	if (it == mSuspendedRingBuffers.end())
+	{
+		return RingBufferPtr();
+	}
+
+	auto ringBuffer = *it;
+
+	mSuspendedRingBuffers.erase(it);
+
+	// the port is bound by the suspended ring buffer, so it has to be released
+	// before a new ring buffer is created on it
+
+	if (ringBuffer->getRef() != ref)
+	{
+		ringBuffer->stop();
+
+		return RingBufferPtr();
+	}
+
+	return ringBuffer;
+}
+
+bool FrontendHandlerBase::resumeRingBuffer(RingBufferPtr ringBuffer)
+{
+	if (!ringBuffer->resume())
+	{
+		return false;
+	}
+
+	LOG(mLog, INFO) << Utils::logDomId(mDomId, mDevId)
+					<< "Reuse ring buffer, ref: " << ringBuffer->getRef()
+					<< ", port: " << ringBuffer->getPort();
+
+	return true;
+}
+
+void FrontendHandlerBase::bindRingBuffers()
+{
+	onBind();
+
+	releaseSuspended();
+
+	setBackendState(XenbusStateConnected);
+
+	// the frontend may post requests to the resumed ring buffers before it
+	// is connected
+
+	for(auto ringBuffer : mRingBuffers)
+	{
+		ringBuffer->processPending();
+	}
+}
+
+void FrontendHandlerBase::restoreState()
+{
+	// the backend state is not changed, so the frontend doesn't notice
+	// the new backend process
+
+	try
+	{
+		if (mBackendState == XenbusStateConnected)
+		{
+			onBind();
+		}
+
+		onRestoreState(mInheritedState);
+	}
+	catch(const std::exception& e)
+	{
+		mInherited = false;
+
+		throw;
+	}
+
+	mInherited = false;
+}
+
+void FrontendHandlerBase::moveToReactor(ReactorPtr reactor)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mStarted)
+	{
+		for(auto& ringBuffers : { mRingBuffers, mSuspendedRingBuffers })
+		{
+			for(auto ringBuffer : ringBuffers)
+			{
+				ringBuffer->stop();
+
+				if (reactor)
+				{
+					ringBuffer->start(reactor);
+				}
+				else
+				{
+					ringBuffer->start();
+				}
+			}
+		}
+	}
+
+	lock_guard<mutex> reactorLock(mReactorMutex);
+
+	mReactor = reactor;
+}
+
+void FrontendHandlerBase::dispatch(Reactor::Callback callback)
+{
+	auto reactor = getReactor();
+
+	if (reactor)
+	{
+		reactor->post(callback);
+	}
+	else
+	{
+		callback();
+	}
+}
+
+void FrontendHandlerBase::flushReactor()
+{
+	// the reactor may be changed by a posted callback
+
+	ReactorPtr reactor;
+
+	while (reactor != getReactor())
+	{
+		reactor = getReactor();
+
+		if (reactor)
+		{
+			reactor->flush();
+		}
+	}
+}
+
+void FrontendHandlerBase::restart()
+{
+	LOG(mLog, INFO) << "Restart";
+
+	setBackendState(XenbusStateClosing);
+
+	onClosing();
+
+	// keep mappings and event channels for the case the frontend reconnects
+	// with the same ring buffers
+
+	releaseSuspended();
+
+	for(auto ringBuffer : mRingBuffers)
+	{
+		ringBuffer->suspend();
+	}
+
+	mSuspendedRingBuffers.swap(mRingBuffers);
+
+	setBackendState(XenbusStateClosed);
+
+	setBackendState(XenbusStateInitWait);
 }
 
 void FrontendHandlerBase::frontendStateChanged()
@@ -290,6 +643,8 @@ void FrontendHandlerBase::frontendStateChanged()
 
 	mFrontendState = state;
 
+	mFrontendStateTransitions.add();
+
 	LOG(mLog, INFO) << Utils::logDomId(mDomId, mDevId)
 					<< "Frontend state changed to: "
 					<< Utils::logState(state);
@@ -369,6 +724,18 @@ void FrontendHandlerBase::onError(const std::exception& e)
 
 void FrontendHandlerBase::close(xenbus_state stateAfterClose)
 {
+	// the frontend is served by the new backend process, only local
+	// resources are released
+
+	if (mHandedOver)
+	{
+		onClosing();
+
+		release();
+
+		return;
+	}
+
 	LOG(mLog, INFO) << "Close";
 
 	if (mBackendState != XenbusStateClosed)
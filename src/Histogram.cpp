@@ -0,0 +1,383 @@
+/*
+ *  Latency histograms
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Histogram.hpp"
+
+#include <cmath>
+
+using std::make_pair;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::pair;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * LatencyHistogram
+ ******************************************************************************/
+
+const uint64_t LatencyHistogram::cSubBuckets;
+const size_t LatencyHistogram::cNumBuckets;
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+uint64_t LatencyHistogram::getCount() const
+{
+	uint64_t count = 0;
+
+	for(auto& bucket : mCounts)
+	{
+		count += bucket.load(memory_order_relaxed);
+	}
+
+	return count;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+	auto count = getCount();
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	uint64_t target = std::ceil(percentile / 100.0 * count);
+
+	if (target == 0)
+	{
+		target = 1;
+	}
+
+	uint64_t total = 0;
+
+	for(size_t i = 0; i < cNumBuckets; i++)
+	{
+		total += mCounts[i].load(memory_order_relaxed);
+
+		if (total >= target)
+		{
+			return getHighestValue(i);
+		}
+	}
+
+	return getHighestValue(cNumBuckets - 1);
+}
+
+HistogramSnapshot LatencyHistogram::getSnapshot() const
+{
+	HistogramSnapshot snapshot = {};
+
+	bool first = true;
+	double sum = 0;
+
+	for(size_t i = 0; i < cNumBuckets; i++)
+	{
+		auto count = mCounts[i].load(memory_order_relaxed);
+
+		if (count)
+		{
+			if (first)
+			{
+				snapshot.min = getLowestValue(i);
+				first = false;
+			}
+
+			snapshot.max = getHighestValue(i);
+			snapshot.count += count;
+
+			sum += (getLowestValue(i) + getHighestValue(i)) / 2.0 * count;
+		}
+	}
+
+	if (snapshot.count)
+	{
+		snapshot.mean = sum / snapshot.count;
+	}
+
+	snapshot.p50 = getPercentile(50.0);
+	snapshot.p90 = getPercentile(90.0);
+	snapshot.p99 = getPercentile(99.0);
+	snapshot.p999 = getPercentile(99.9);
+
+	return snapshot;
+}
+
+void LatencyHistogram::reset()
+{
+	for(auto& bucket : mCounts)
+	{
+		bucket.store(0, memory_order_relaxed);
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+uint64_t LatencyHistogram::getLowestValue(size_t index)
+{
+	if (index < cSubBuckets)
+	{
+		return index;
+	}
+
+	int shift = index / cSubBuckets - 1;
+
+	return (index % cSubBuckets + cSubBuckets) << shift;
+}
+
+uint64_t LatencyHistogram::getHighestValue(size_t index)
+{
+	if (index < cSubBuckets)
+	{
+		return index;
+	}
+
+	int shift = index / cSubBuckets - 1;
+
+	return getLowestValue(index) + (1ULL << shift) - 1;
+}
+
+/*******************************************************************************
+ * LatencyTracker
+ ******************************************************************************/
+
+const uint32_t LatencyTracker::cMaxTypes;
+const uint64_t LatencyTracker::cFree;
+const uint64_t LatencyTracker::cRemoved;
+
+LatencyTracker::LatencyTracker(size_t maxPending) :
+	mNumDropped(0)
+{
+	// keep the table at most half full, so probe sequences are short
+
+	size_t size = 1;
+
+	while (size < 2 * maxPending)
+	{
+		size <<= 1;
+	}
+
+	mPending.reset(new Pending[size]);
+	mMask = size - 1;
+
+	for(size_t i = 0; i < size; i++)
+	{
+		mPending[i].id = cFree;
+	}
+
+	for(auto& histogram : mHistograms)
+	{
+		histogram = nullptr;
+	}
+}
+
+LatencyTracker::~LatencyTracker()
+{
+	for(auto& histogram : mHistograms)
+	{
+		delete histogram.load();
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void LatencyTracker::onRequest(uint64_t id, uint32_t type, int64_t start)
+{
+	if (id >= cRemoved)
+	{
+		mNumDropped.fetch_add(1, memory_order_relaxed);
+
+		return;
+	}
+
+	// answered entries are marked removed, so lookups pass them and stop at
+	// the first free entry. Only this thread frees removed entries: ones
+	// which are followed by the free entry aren't passed by any lookup.
+
+	Pending* target = nullptr;
+
+	for(size_t i = 0; i <= mMask; i++)
+	{
+		auto index = (id + i) & mMask;
+		auto current = mPending[index].id.load(memory_order_acquire);
+
+		if (current == cRemoved && !target)
+		{
+			target = &mPending[index];
+		}
+
+		if (current == cFree)
+		{
+			if (!target)
+			{
+				target = &mPending[index];
+			}
+
+			for(size_t j = i; j > 0; j--)
+			{
+				auto& removed = mPending[(id + j - 1) & mMask];
+
+				if (removed.id.load(memory_order_acquire) != cRemoved)
+				{
+					break;
+				}
+
+				removed.id.store(cFree, memory_order_release);
+			}
+
+			break;
+		}
+	}
+
+	if (!target)
+	{
+		mNumDropped.fetch_add(1, memory_order_relaxed);
+
+		return;
+	}
+
+	target->start = start;
+	target->type = type < cMaxTypes ? type : cMaxTypes - 1;
+
+	target->id.store(id, memory_order_release);
+}
+
+void LatencyTracker::onResponse(uint64_t id)
+{
+	if (id >= cRemoved)
+	{
+		return;
+	}
+
+	for(size_t i = 0; i <= mMask; i++)
+	{
+		auto& pending = mPending[(id + i) & mMask];
+		auto current = pending.id.load(memory_order_acquire);
+
+		// not measured
+
+		if (current == cFree)
+		{
+			return;
+		}
+
+		if (current == id)
+		{
+			auto elapsed = getTime() - pending.start;
+
+			getHistogram(pending.type).record(elapsed > 0 ? elapsed : 0);
+
+			pending.id.store(cRemoved, memory_order_release);
+
+			return;
+		}
+	}
+}
+
+HistogramSnapshot LatencyTracker::getSnapshot(uint32_t type) const
+{
+	LatencyHistogram* histogram = nullptr;
+
+	if (type < cMaxTypes)
+	{
+		histogram = mHistograms[type].load(memory_order_acquire);
+	}
+
+	if (!histogram)
+	{
+		return HistogramSnapshot();
+	}
+
+	return histogram->getSnapshot();
+}
+
+vector<pair<uint32_t, HistogramSnapshot>> LatencyTracker::getSnapshot() const
+{
+	vector<pair<uint32_t, HistogramSnapshot>> snapshots;
+
+	for(uint32_t type = 0; type < cMaxTypes; type++)
+	{
+		auto histogram = mHistograms[type].load(memory_order_acquire);
+
+		if (histogram)
+		{
+			snapshots.push_back(make_pair(type, histogram->getSnapshot()));
+		}
+	}
+
+	return snapshots;
+}
+
+void LatencyTracker::reset()
+{
+	for(auto& histogram : mHistograms)
+	{
+		auto value = histogram.load(memory_order_acquire);
+
+		if (value)
+		{
+			value->reset();
+		}
+	}
+
+	mNumDropped = 0;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+LatencyHistogram& LatencyTracker::getHistogram(uint32_t type)
+{
+	auto histogram = mHistograms[type].load(memory_order_acquire);
+
+	if (!histogram)
+	{
+		// the histogram is created once on the first request of the type
+
+		auto created = new LatencyHistogram();
+
+		if (mHistograms[type].compare_exchange_strong(histogram, created))
+		{
+			histogram = created;
+		}
+		else
+		{
+			delete created;
+		}
+	}
+
+	return *histogram;
+}
+
+}
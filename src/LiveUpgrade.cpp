@@ -0,0 +1,471 @@
+/*
+ *  Live upgrade
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "LiveUpgrade.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "XenEvtchn.hpp"
+
+using std::hex;
+using std::istringstream;
+using std::lock_guard;
+using std::make_tuple;
+using std::map;
+using std::min;
+using std::mutex;
+using std::ostringstream;
+using std::setfill;
+using std::setw;
+using std::stoi;
+using std::string;
+using std::vector;
+
+namespace XenBackend {
+
+namespace {
+
+struct MessageHeader
+{
+	uint64_t dataSize;
+	uint32_t numFds;
+};
+
+void writeAll(int socket, const void* data, size_t size)
+{
+	auto buffer = static_cast<const uint8_t*>(data);
+
+	while (size)
+	{
+		auto ret = ::send(socket, buffer, size, MSG_NOSIGNAL);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret <= 0)
+		{
+			throw LiveUpgradeException("Can't send upgrade state", errno);
+		}
+
+		buffer += ret;
+		size -= ret;
+	}
+}
+
+void readAll(int socket, void* data, size_t size)
+{
+	auto buffer = static_cast<uint8_t*>(data);
+
+	while (size)
+	{
+		auto ret = recv(socket, buffer, size, 0);
+
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret == 0)
+		{
+			throw LiveUpgradeException("Upgrade socket closed", EPIPE);
+		}
+
+		if (ret < 0)
+		{
+			throw LiveUpgradeException("Can't receive upgrade state", errno);
+		}
+
+		buffer += ret;
+		size -= ret;
+	}
+}
+
+string toHex(const string& data)
+{
+	if (data.empty())
+	{
+		return "-";
+	}
+
+	ostringstream ss;
+
+	for(auto c : data)
+	{
+		ss << hex << setw(2) << setfill('0')
+		   << static_cast<int>(static_cast<uint8_t>(c));
+	}
+
+	return ss.str();
+}
+
+string fromHex(const string& hexData)
+{
+	string data;
+
+	if (hexData == "-")
+	{
+		return data;
+	}
+
+	if (hexData.size() % 2)
+	{
+		throw LiveUpgradeException("Invalid upgrade state data", EINVAL);
+	}
+
+	for(size_t i = 0; i < hexData.size(); i += 2)
+	{
+		data.push_back(static_cast<char>(
+				stoi(hexData.substr(i, 2), nullptr, 16)));
+	}
+
+	return data;
+}
+
+}
+
+/*******************************************************************************
+ * LiveUpgrade
+ ******************************************************************************/
+
+const int LiveUpgrade::cVersion;
+const size_t LiveUpgrade::cMaxFdsPerMessage;
+
+mutex LiveUpgrade::sMutex;
+map<LiveUpgrade::Key, FrontendState> LiveUpgrade::sInherited;
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+string LiveUpgrade::serialize(const vector<FrontendState>& states,
+							  vector<int>& fds)
+{
+	ostringstream ss;
+
+	ss << "xenbe-upgrade " << cVersion << " " << states.size() << "\n";
+
+	for(auto& state : states)
+	{
+		ss << "frontend " << state.devName << " " << state.domId << " "
+		   << state.devId << " " << state.backendState << " "
+		   << state.frontendState << " " << state.ringBuffers.size() << " "
+		   << state.fds.size() << " " << toHex(state.data) << "\n";
+
+		for(auto& ringBuffer : state.ringBuffers)
+		{
+			ss << "ring " << ringBuffer.port << " " << ringBuffer.ref << " "
+			   << ringBuffer.localPort << " " << ringBuffer.reqCons << " "
+			   << ringBuffer.rspProdPvt << "\n";
+
+			fds.push_back(ringBuffer.fd);
+		}
+
+		fds.insert(fds.end(), state.fds.begin(), state.fds.end());
+	}
+
+	return ss.str();
+}
+
+vector<FrontendState> LiveUpgrade::deserialize(const string& data,
+											   const vector<int>& fds)
+{
+	istringstream ss(data);
+	string tag;
+	int version = 0;
+	size_t numFrontends = 0;
+	size_t fdIndex = 0;
+
+	ss >> tag >> version >> numFrontends;
+
+	if (!ss || tag != "xenbe-upgrade" || version != cVersion)
+	{
+		throw LiveUpgradeException("Unsupported upgrade state", EINVAL);
+	}
+
+	vector<FrontendState> states(numFrontends);
+
+	for(auto& state : states)
+	{
+		int backendState = 0, frontendState = 0;
+		size_t numRingBuffers = 0, numFds = 0;
+		string hexData;
+
+		ss >> tag >> state.devName >> state.domId >> state.devId
+		   >> backendState >> frontendState >> numRingBuffers >> numFds
+		   >> hexData;
+
+		if (!ss || tag != "frontend")
+		{
+			throw LiveUpgradeException("Invalid upgrade state", EINVAL);
+		}
+
+		state.backendState = static_cast<xenbus_state>(backendState);
+		state.frontendState = static_cast<xenbus_state>(frontendState);
+		state.data = fromHex(hexData);
+
+		state.ringBuffers.resize(numRingBuffers);
+
+		for(auto& ringBuffer : state.ringBuffers)
+		{
+			ss >> tag >> ringBuffer.port >> ringBuffer.ref
+			   >> ringBuffer.localPort >> ringBuffer.reqCons
+			   >> ringBuffer.rspProdPvt;
+
+			if (!ss || tag != "ring" || fdIndex >= fds.size())
+			{
+				throw LiveUpgradeException("Invalid upgrade state", EINVAL);
+			}
+
+			ringBuffer.fd = fds[fdIndex++];
+		}
+
+		if (fds.size() - fdIndex < numFds)
+		{
+			throw LiveUpgradeException("Invalid upgrade state", EINVAL);
+		}
+
+		state.fds.assign(fds.begin() + fdIndex, fds.begin() + fdIndex + numFds);
+
+		fdIndex += numFds;
+	}
+
+	return states;
+}
+
+void LiveUpgrade::sendFds(int socket, const string& data,
+						  const vector<int>& fds)
+{
+	MessageHeader header = { data.size(),
+							 static_cast<uint32_t>(fds.size()) };
+
+	writeAll(socket, &header, sizeof(header));
+	writeAll(socket, data.data(), data.size());
+
+	// descriptors are sent in chunks as the number of descriptors per
+	// message is limited by the kernel
+
+	for(size_t i = 0; i < fds.size(); i += cMaxFdsPerMessage)
+	{
+		auto numFds = min(cMaxFdsPerMessage, fds.size() - i);
+		vector<uint8_t> control(CMSG_SPACE(numFds * sizeof(int)));
+		char byte = 0;
+		iovec iov = { &byte, sizeof(byte) };
+		msghdr msg = {};
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+
+		auto cmsg = CMSG_FIRSTHDR(&msg);
+
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+
+		memcpy(CMSG_DATA(cmsg), &fds[i], numFds * sizeof(int));
+
+		ssize_t ret;
+
+		do
+		{
+			ret = sendmsg(socket, &msg, MSG_NOSIGNAL);
+		}
+		while (ret < 0 && errno == EINTR);
+
+		if (ret != sizeof(byte))
+		{
+			throw LiveUpgradeException("Can't send file descriptors", errno);
+		}
+	}
+}
+
+void LiveUpgrade::receiveFds(int socket, string& data, vector<int>& fds)
+{
+	MessageHeader header;
+
+	readAll(socket, &header, sizeof(header));
+
+	data.resize(header.dataSize);
+
+	readAll(socket, &data[0], data.size());
+
+	while (fds.size() < header.numFds)
+	{
+		auto numFds = min<size_t>(cMaxFdsPerMessage,
+								  header.numFds - fds.size());
+		vector<uint8_t> control(CMSG_SPACE(numFds * sizeof(int)));
+		char byte = 0;
+		iovec iov = { &byte, sizeof(byte) };
+		msghdr msg = {};
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+
+		ssize_t ret;
+
+		do
+		{
+			ret = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+		}
+		while (ret < 0 && errno == EINTR);
+
+		if (ret <= 0)
+		{
+			throw LiveUpgradeException("Can't receive file descriptors",
+									   ret ? errno : EPIPE);
+		}
+
+		auto cmsg = CMSG_FIRSTHDR(&msg);
+
+		if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS || (msg.msg_flags & MSG_CTRUNC))
+		{
+			throw LiveUpgradeException("Can't receive file descriptors",
+									   EBADMSG);
+		}
+
+		auto received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		auto begin = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+
+		if (!received)
+		{
+			throw LiveUpgradeException("Can't receive file descriptors",
+									   EBADMSG);
+		}
+
+		fds.insert(fds.end(), begin, begin + received);
+	}
+}
+
+void LiveUpgrade::send(int socket, const vector<FrontendState>& states)
+{
+	vector<int> fds;
+
+	auto data = serialize(states, fds);
+
+	sendFds(socket, data, fds);
+}
+
+vector<FrontendState> LiveUpgrade::receive(int socket)
+{
+	string data;
+	vector<int> fds;
+
+	try
+	{
+		receiveFds(socket, data, fds);
+
+		return deserialize(data, fds);
+	}
+	catch(const std::exception& e)
+	{
+		for(auto fd : fds)
+		{
+			close(fd);
+		}
+
+		throw;
+	}
+}
+
+void LiveUpgrade::setInherited(const vector<FrontendState>& states)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	for(auto& state : states)
+	{
+		// event channels are taken by XenEvtchn when the ring buffers are
+		// created
+
+		for(auto& ringBuffer : state.ringBuffers)
+		{
+			XenEvtchn::addInherited(state.domId, ringBuffer.port,
+									ringBuffer.localPort, ringBuffer.fd);
+		}
+
+		auto key = make_tuple(state.devName, state.domId, state.devId);
+		auto it = sInherited.find(key);
+
+		if (it != sInherited.end())
+		{
+			closeFds(it->second);
+		}
+
+		sInherited[key] = state;
+	}
+}
+
+bool LiveUpgrade::takeInherited(const string& devName, domid_t domId,
+								uint16_t devId, FrontendState& state)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto it = sInherited.find(make_tuple(devName, domId, devId));
+
+	if (it == sInherited.end())
+	{
+		return false;
+	}
+
+	state = it->second;
+
+	sInherited.erase(it);
+
+	return true;
+}
+
+void LiveUpgrade::clearInherited()
+{
+	lock_guard<mutex> lock(sMutex);
+
+	for(auto& inherited : sInherited)
+	{
+		closeFds(inherited.second);
+	}
+
+	sInherited.clear();
+
+	XenEvtchn::clearInherited();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void LiveUpgrade::closeFds(const FrontendState& state)
+{
+	for(auto fd : state.fds)
+	{
+		close(fd);
+	}
+}
+
+}
@@ -0,0 +1,280 @@
+/*
+ *  Metrics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Metrics.hpp"
+
+using std::atomic;
+using std::lock_guard;
+using std::make_pair;
+using std::memory_order_relaxed;
+using std::mutex;
+using std::string;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * MetricsCounter
+ ******************************************************************************/
+
+const size_t MetricsCounter::cNumSlots;
+
+MetricsCounter::MetricsCounter()
+{
+	for(auto& slot : mSlots)
+	{
+		slot.value = 0;
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+uint64_t MetricsCounter::get() const
+{
+	uint64_t value = 0;
+
+	for(auto& slot : mSlots)
+	{
+		value += slot.value.load(memory_order_relaxed);
+	}
+
+	return value;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+size_t MetricsCounter::getSlot()
+{
+	static atomic<size_t> sNextSlot(0);
+	static thread_local size_t sSlot = sNextSlot++ % cNumSlots;
+
+	return sSlot;
+}
+
+/*******************************************************************************
+ * MetricsSnapshot
+ ******************************************************************************/
+
+uint64_t MetricsSnapshot::get(const string& name) const
+{
+	for(auto& value : values)
+	{
+		if (value.first == name)
+		{
+			return value.second;
+		}
+	}
+
+	for(auto& gauge : gauges)
+	{
+		if (gauge.first == name)
+		{
+			return gauge.second;
+		}
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+ * MetricsGroup
+ ******************************************************************************/
+
+MetricsGroup::MetricsGroup(const string& type, domid_t domId, int devId,
+						   int port) :
+	mType(type),
+	mDomId(domId),
+	mDevId(devId),
+	mPort(port)
+{
+	Metrics::add(this);
+}
+
+MetricsGroup::~MetricsGroup()
+{
+	Metrics::remove(this);
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+MetricsCounter& MetricsGroup::addCounter(const string& name)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mCounters.emplace_back(name, false);
+
+	return mCounters.back().counter;
+}
+
+MetricsCounter& MetricsGroup::addGauge(const string& name)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mCounters.emplace_back(name, true);
+
+	return mCounters.back().counter;
+}
+
+LatencyHistogram& MetricsGroup::addHistogram(const string& name)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mHistograms.emplace_back(name);
+
+	return mHistograms.back().histogram;
+}
+
+void MetricsGroup::addLatencyTracker(const string& name,
+									 LatencyTrackerPtr tracker)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mTrackers.push_back(make_pair(name, tracker));
+}
+
+void MetricsGroup::setDevId(int devId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mDevId = devId;
+}
+
+void MetricsGroup::setName(const string& name)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mName = name;
+}
+
+MetricsSnapshot MetricsGroup::getSnapshot() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	MetricsSnapshot snapshot;
+
+	snapshot.type = mType;
+	snapshot.name = mName;
+	snapshot.domId = mDomId;
+	snapshot.devId = mDevId;
+	snapshot.port = mPort;
+
+	for(auto& entry : mCounters)
+	{
+		auto& values = entry.gauge ? snapshot.gauges : snapshot.values;
+
+		values.push_back(make_pair(entry.name, entry.counter.get()));
+	}
+
+	for(auto& entry : mHistograms)
+	{
+		snapshot.histograms.push_back({ entry.name, -1,
+										entry.histogram.getSnapshot() });
+	}
+
+	for(auto& tracker : mTrackers)
+	{
+		for(auto& histogram : tracker.second->getSnapshot())
+		{
+			snapshot.histograms.push_back({
+				tracker.first, static_cast<int>(histogram.first),
+				histogram.second });
+		}
+	}
+
+	return snapshot;
+}
+
+/*******************************************************************************
+ * Metrics
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+vector<MetricsSnapshot> Metrics::getSnapshot()
+{
+	auto& registry = getRegistry();
+
+	lock_guard<mutex> lock(registry.mutex);
+
+	vector<MetricsSnapshot> snapshots;
+
+	for(auto group : registry.groups)
+	{
+		snapshots.push_back(group->getSnapshot());
+	}
+
+	return snapshots;
+}
+
+vector<MetricsSnapshot> Metrics::getSnapshot(const string& type)
+{
+	vector<MetricsSnapshot> snapshots;
+
+	for(auto& snapshot : getSnapshot())
+	{
+		if (snapshot.type == type)
+		{
+			snapshots.push_back(snapshot);
+		}
+	}
+
+	return snapshots;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+Metrics::Registry& Metrics::getRegistry()
+{
+	// constructed on first use as groups may be static objects
+
+	static Registry sRegistry;
+
+	return sRegistry;
+}
+
+void Metrics::add(const MetricsGroup* group)
+{
+	auto& registry = getRegistry();
+
+	lock_guard<mutex> lock(registry.mutex);
+
+	registry.groups.push_back(group);
+}
+
+void Metrics::remove(const MetricsGroup* group)
+{
+	auto& registry = getRegistry();
+
+	lock_guard<mutex> lock(registry.mutex);
+
+	registry.groups.remove(group);
+}
+
+}
@@ -0,0 +1,599 @@
+/*
+ *  Metrics export server
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "MetricsServer.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::chrono::milliseconds;
+using std::ifstream;
+using std::istringstream;
+using std::make_pair;
+using std::map;
+using std::ostringstream;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace XenBackend {
+
+namespace {
+
+const milliseconds cRetryDelay(10);
+
+// Escapes the Prometheus label value
+string escapeLabel(const string& value)
+{
+	string result;
+
+	for(auto c : value)
+	{
+		switch(c)
+		{
+			case '\\':
+				result += "\\\\";
+				break;
+			case '"':
+				result += "\\\"";
+				break;
+			case '\n':
+				result += "\\n";
+				break;
+			default:
+				result += c;
+		}
+	}
+
+	return result;
+}
+
+// Returns the JSON string literal
+string quoteJson(const string& value)
+{
+	string result = "\"";
+
+	for(auto c : value)
+	{
+		if (c == '\\' || c == '"')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+
+			snprintf(escaped, sizeof(escaped), "\\u%04x",
+					 static_cast<unsigned char>(c));
+
+			result += escaped;
+		}
+		else
+		{
+			result += c;
+		}
+	}
+
+	return result + "\"";
+}
+
+string getLabels(const MetricsSnapshot& snapshot)
+{
+	string labels = "domid=\"" + to_string(snapshot.domId) + "\"";
+
+	if (snapshot.devId >= 0)
+	{
+		labels += ",devid=\"" + to_string(snapshot.devId) + "\"";
+	}
+
+	if (snapshot.port >= 0)
+	{
+		labels += ",port=\"" + to_string(snapshot.port) + "\"";
+	}
+
+	if (!snapshot.name.empty())
+	{
+		labels += ",name=\"" + escapeLabel(snapshot.name) + "\"";
+	}
+
+	return labels;
+}
+
+uint64_t getNumThreads()
+{
+	ifstream status("/proc/self/status");
+	string line;
+
+	while (getline(status, line))
+	{
+		if (line.compare(0, 8, "Threads:") == 0)
+		{
+			return stoull(line.substr(8));
+		}
+	}
+
+	return 0;
+}
+
+// Samples of one metric, Prometheus requires them to be grouped
+struct Family
+{
+	string type;
+	string samples;
+};
+
+void addSample(map<string, Family>& families, const string& family,
+			   const string& type, const string& name, const string& labels,
+			   uint64_t value)
+{
+	auto& entry = families[family];
+
+	entry.type = type;
+	entry.samples += name + "{" + labels + "} " + to_string(value) + "\n";
+}
+
+string getHttpResponse(const string& status, const string& contentType,
+					   const string& body)
+{
+	return "HTTP/1.0 " + status + "\r\n"
+		   "Content-Type: " + contentType + "\r\n"
+		   "Content-Length: " + to_string(body.size()) + "\r\n"
+		   "Connection: close\r\n\r\n" + body;
+}
+
+}
+
+/*******************************************************************************
+ * MetricsServer
+ ******************************************************************************/
+
+const size_t MetricsServer::cMaxClients;
+const size_t MetricsServer::cMaxRequestSize;
+const milliseconds MetricsServer::cClientTimeout(5000);
+
+MetricsServer::MetricsServer(const string& path) :
+	mPath(path),
+	mFd(-1),
+	mLastClientId(0),
+	mReactor("MetricsServer"),
+	mLog("MetricsServer")
+{
+	try
+	{
+		init();
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+
+	LOG(mLog, INFO) << "Serve metrics on: " << mPath;
+}
+
+MetricsServer::~MetricsServer()
+{
+	mReactor.stop();
+
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+string MetricsServer::formatPrometheus(const vector<MetricsSnapshot>& snapshots)
+{
+	map<string, Family> families;
+
+	for(auto& snapshot : snapshots)
+	{
+		auto prefix = "xenbe_" + snapshot.type + "_";
+		auto labels = getLabels(snapshot);
+
+		for(auto& value : snapshot.values)
+		{
+			auto name = prefix + value.first;
+
+			addSample(families, name, "counter", name, labels, value.second);
+		}
+
+		for(auto& gauge : snapshot.gauges)
+		{
+			auto name = prefix + gauge.first;
+
+			addSample(families, name, "gauge", name, labels, gauge.second);
+		}
+
+		for(auto& histogram : snapshot.histograms)
+		{
+			auto name = prefix + histogram.name + "_nanoseconds";
+			auto histogramLabels = labels;
+			auto& value = histogram.snapshot;
+
+			if (histogram.requestType >= 0)
+			{
+				histogramLabels += ",request_type=\"" +
+								   to_string(histogram.requestType) + "\"";
+			}
+
+			for(auto& quantile : { make_pair("0.5", value.p50),
+								   make_pair("0.9", value.p90),
+								   make_pair("0.99", value.p99),
+								   make_pair("0.999", value.p999) })
+			{
+				addSample(families, name, "summary", name,
+						  histogramLabels + ",quantile=\"" +
+						  quantile.first + "\"", quantile.second);
+			}
+
+			addSample(families, name, "summary", name + "_sum",
+					  histogramLabels,
+					  static_cast<uint64_t>(value.mean * value.count));
+			addSample(families, name, "summary", name + "_count",
+					  histogramLabels, value.count);
+		}
+	}
+
+	string result;
+
+	for(auto& family : families)
+	{
+		result += "# TYPE " + family.first + " " + family.second.type + "\n" +
+				  family.second.samples;
+	}
+
+	return result;
+}
+
+string MetricsServer::formatJson(const vector<MetricsSnapshot>& snapshots)
+{
+	ostringstream stream;
+
+	stream << "[";
+
+	for(size_t i = 0; i < snapshots.size(); i++)
+	{
+		auto& snapshot = snapshots[i];
+
+		stream << (i ? "," : "") << "\n{"
+			   << "\"type\":" << quoteJson(snapshot.type) << ","
+			   << "\"name\":" << quoteJson(snapshot.name) << ","
+			   << "\"domid\":" << snapshot.domId << ","
+			   << "\"devid\":" << snapshot.devId << ","
+			   << "\"port\":" << snapshot.port << ",";
+
+		for(auto& values : { make_pair("counters", &snapshot.values),
+							 make_pair("gauges", &snapshot.gauges) })
+		{
+			stream << "\"" << values.first << "\":{";
+
+			for(size_t j = 0; j < values.second->size(); j++)
+			{
+				auto& value = (*values.second)[j];
+
+				stream << (j ? "," : "") << quoteJson(value.first) << ":"
+					   << value.second;
+			}
+
+			stream << "},";
+		}
+
+		stream << "\"histograms\":[";
+
+		for(size_t j = 0; j < snapshot.histograms.size(); j++)
+		{
+			auto& histogram = snapshot.histograms[j];
+			auto& value = histogram.snapshot;
+
+			stream << (j ? "," : "") << "{"
+				   << "\"name\":" << quoteJson(histogram.name) << ","
+				   << "\"request_type\":" << histogram.requestType << ","
+				   << "\"count\":" << value.count << ","
+				   << "\"min\":" << value.min << ","
+				   << "\"max\":" << value.max << ","
+				   << "\"mean\":" << static_cast<uint64_t>(value.mean) << ","
+				   << "\"p50\":" << value.p50 << ","
+				   << "\"p90\":" << value.p90 << ","
+				   << "\"p99\":" << value.p99 << ","
+				   << "\"p999\":" << value.p999 << "}";
+		}
+
+		stream << "]}";
+	}
+
+	stream << "\n]\n";
+
+	return stream.str();
+}
+
+vector<MetricsSnapshot> MetricsServer::getSnapshot()
+{
+	auto snapshots = Metrics::getSnapshot();
+
+	MetricsSnapshot process {};
+
+	process.type = "process";
+	process.devId = -1;
+	process.port = -1;
+	process.gauges.push_back(make_pair("threads", getNumThreads()));
+
+	snapshots.push_back(process);
+
+	return snapshots;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void MetricsServer::init()
+{
+	sockaddr_un addr {};
+
+	if (mPath.length() >= sizeof(addr.sun_path))
+	{
+		throw MetricsServerException("Socket path is too long: " + mPath,
+									 ENAMETOOLONG);
+	}
+
+	mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (mFd < 0)
+	{
+		throw MetricsServerException("Can't create socket", errno);
+	}
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, mPath.c_str());
+
+	// the socket of the previous run
+
+	unlink(mPath.c_str());
+
+	if (bind(mFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		throw MetricsServerException("Can't bind socket: " + mPath, errno);
+	}
+
+	if (listen(mFd, cMaxClients) < 0)
+	{
+		throw MetricsServerException("Can't listen socket: " + mPath, errno);
+	}
+
+	mReactor.addFd(mFd, [this] { acceptClient(); });
+
+	mReactor.start();
+}
+
+void MetricsServer::release()
+{
+	for(auto& client : mClients)
+	{
+		close(client.first);
+	}
+
+	mClients.clear();
+
+	if (mFd >= 0)
+	{
+		close(mFd);
+
+		unlink(mPath.c_str());
+	}
+}
+
+void MetricsServer::acceptClient()
+{
+	while (true)
+	{
+		auto fd = accept4(mFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				RLOG(mLog, ERROR) << "Can't accept client, error: " << errno;
+			}
+
+			return;
+		}
+
+		if (mClients.size() >= cMaxClients)
+		{
+			RLOG(mLog, WARNING) << "Too many clients";
+
+			close(fd);
+
+			continue;
+		}
+
+		auto id = ++mLastClientId;
+
+		mClients[fd] = { id, "", "", 0 };
+
+		mReactor.addFd(fd, [this, fd] { readClient(fd); });
+
+		mReactor.postDelayed(cClientTimeout,
+							 [this, fd, id] { closeClient(fd, id); });
+	}
+}
+
+void MetricsServer::readClient(int fd)
+{
+	auto it = mClients.find(fd);
+
+	if (it == mClients.end())
+	{
+		return;
+	}
+
+	auto& client = it->second;
+	auto id = client.id;
+	bool closed = false;
+
+	while (true)
+	{
+		char buffer[512];
+
+		auto size = recv(fd, buffer, sizeof(buffer), 0);
+
+		if (size > 0)
+		{
+			client.request.append(buffer, size);
+
+			if (client.request.size() > cMaxRequestSize)
+			{
+				closeClient(fd, id);
+
+				return;
+			}
+
+			continue;
+		}
+
+		if (size < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		closed = size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+
+		break;
+	}
+
+	// only the request line is used, headers are ignored
+
+	auto end = client.request.find('\n');
+
+	if (client.response.empty() && end != string::npos)
+	{
+		client.response = getResponse(client.request.substr(0, end));
+
+		writeClient(fd, id);
+
+		return;
+	}
+
+	if (closed)
+	{
+		closeClient(fd, id);
+	}
+}
+
+void MetricsServer::writeClient(int fd, uint64_t id)
+{
+	auto it = mClients.find(fd);
+
+	if (it == mClients.end() || it->second.id != id)
+	{
+		return;
+	}
+
+	auto& client = it->second;
+
+	while (client.sent < client.response.size())
+	{
+		auto size = send(fd, &client.response[client.sent],
+						 client.response.size() - client.sent, MSG_NOSIGNAL);
+
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			// the reactor waits for input only, so retry later
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				mReactor.postDelayed(cRetryDelay,
+									 [this, fd, id] { writeClient(fd, id); });
+
+				return;
+			}
+
+			LOG(mLog, DEBUG) << "Can't send response, error: " << errno;
+
+			break;
+		}
+
+		client.sent += size;
+	}
+
+	closeClient(fd, id);
+}
+
+void MetricsServer::closeClient(int fd, uint64_t id)
+{
+	auto it = mClients.find(fd);
+
+	if (it == mClients.end() || it->second.id != id)
+	{
+		return;
+	}
+
+	mReactor.removeFd(fd);
+
+	close(fd);
+
+	mClients.erase(it);
+}
+
+string MetricsServer::getResponse(const string& request)
+{
+	istringstream stream(request);
+	string method, target;
+
+	stream >> method >> target;
+
+	LOG(mLog, DEBUG) << "Request: " << method << " " << target;
+
+	if (method == "GET" && target == "/metrics")
+	{
+		return getHttpResponse("200 OK", "text/plain; version=0.0.4",
+							   formatPrometheus(getSnapshot()));
+	}
+
+	if (method == "GET" && target == "/metrics.json")
+	{
+		return getHttpResponse("200 OK", "application/json",
+							   formatJson(getSnapshot()));
+	}
+
+	return getHttpResponse("404 Not Found", "text/plain", "Not found\n");
+}
+
+}
@@ -0,0 +1,511 @@
+/*
+ *  Reactor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Reactor.hpp"
+
+#include "CallbackMonitor.hpp"
+#include "Histogram.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::list;
+using std::lock_guard;
+using std::make_pair;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * Reactor
+ ******************************************************************************/
+
+std::atomic<ReactorBackend> Reactor::sDefaultBackend(ReactorBackend::Epoll);
+
+Reactor::Reactor(const string& name, ReactorBackend backend) :
+	mTerminate(false),
+	mRunning(false),
+	mDeleted(std::make_shared<bool>(false)),
+	mNumEvents(0),
+	mReadyTime(0),
+	mNextIoId(0),
+	mLog(name.empty() ? "Reactor" : name),
+	mMetrics("reactor"),
+	mLoops(mMetrics.addCounter("loops")),
+	mFdEvents(mMetrics.addCounter("fd_events")),
+	mNumTasks(mMetrics.addCounter("tasks")),
+	mErrors(mMetrics.addCounter("errors")),
+	mIoRequests(mMetrics.addCounter("io_requests"))
+{
+	mMetrics.setName(name.empty() ? "Reactor" : name);
+
+	init(backend);
+}
+
+Reactor::~Reactor()
+{
+	stop();
+
+	// the last reference is dropped by the callback: the thread can't join
+	// itself, it exits when the callback returns
+
+	if (mThread.joinable())
+	{
+		*mDeleted = true;
+
+		mThread.detach();
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+ReactorBackend Reactor::getDefaultBackend()
+{
+	return sDefaultBackend.load();
+}
+
+void Reactor::setDefaultBackend(ReactorBackend backend)
+{
+	sDefaultBackend = backend;
+}
+
+void Reactor::start()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mThread.joinable())
+	{
+		throw ReactorException("Reactor is already started", EPERM);
+	}
+
+	mTerminate = false;
+	mRunning = true;
+
+	mThread = thread(&Reactor::run, this);
+}
+
+void Reactor::stop()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+	}
+
+	wakeup();
+
+	if (mThread.joinable() && !isReactorThread())
+	{
+		mThread.join();
+	}
+}
+
+void Reactor::addFd(int fd, Callback callback)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mPoller->addFd(fd);
+
+		mCallbacks[fd] = callback;
+	}
+
+	// the poller may update its set on the next wait
+
+	if (!isReactorThread())
+	{
+		wakeup();
+	}
+}
+
+void Reactor::removeFd(int fd)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mCallbacks.erase(fd))
+		{
+			return;
+		}
+
+		mPoller->removeFd(fd);
+	}
+
+	// the callback may be running in the reactor thread
+
+	flush();
+}
+
+void Reactor::submitRead(int fd, const iovec* iov, int iovcnt, off_t offset,
+						 IoCallback callback)
+{
+	submitIo(ReactorIo::Type::Read, fd, iov, iovcnt, offset, callback);
+}
+
+void Reactor::submitWrite(int fd, const iovec* iov, int iovcnt, off_t offset,
+						  IoCallback callback)
+{
+	submitIo(ReactorIo::Type::Write, fd, iov, iovcnt, offset, callback);
+}
+
+void Reactor::post(Callback task)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTasks.push_back({ LatencyTracker::getTime(), task });
+	}
+
+	wakeup();
+}
+
+void Reactor::postDelayed(milliseconds delay, Callback task)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mDelayedTasks.insert(make_pair(steady_clock::now() + delay, task));
+	}
+
+	wakeup();
+}
+
+void Reactor::flush()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (!mRunning || isReactorThread())
+	{
+		return;
+	}
+
+	bool done = false;
+
+	mTasks.push_back({ LatencyTracker::getTime(), [this, &done]
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		done = true;
+
+		mCondVar.notify_all();
+	}});
+
+	lock.unlock();
+
+	wakeup();
+
+	lock.lock();
+
+	// the reactor thread may exit on error or stop from its callback
+
+	mCondVar.wait(lock, [this, &done] { return done || !mRunning; });
+}
+
+bool Reactor::isReactorThread() const
+{
+	return mThread.get_id() == std::this_thread::get_id();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Reactor::init(ReactorBackend backend)
+{
+	if (backend == ReactorBackend::IoUring)
+	{
+		try
+		{
+			mPoller.reset(new IoUringPoller());
+
+			return;
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, WARNING) << "Can't use io_uring, epoll is used: "
+							   << e.what();
+		}
+	}
+
+	mPoller.reset(new EpollPoller());
+}
+
+void Reactor::wakeup()
+{
+	try
+	{
+		mPoller->wakeup();
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+}
+
+void Reactor::submitIo(ReactorIo::Type type, int fd, const iovec* iov,
+					   int iovcnt, off_t offset, IoCallback callback)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto id = mNextIoId++;
+
+		mIoCallbacks[id] = callback;
+
+		mPoller->submit({ type, fd, iov, iovcnt, offset, id });
+	}
+
+	mIoRequests.add();
+
+	// requests submitted by the reactor thread go with the next wait
+
+	if (!isReactorThread())
+	{
+		wakeup();
+	}
+}
+
+void Reactor::run()
+{
+	vector<ReactorEvent> events;
+
+	// keeps the flag when the reactor is deleted by the callback
+	auto deleted = mDeleted;
+
+	while(true)
+	{
+		try
+		{
+			mPoller->wait(getTimeout(), events);
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << e.what();
+
+			break;
+		}
+
+		// events of the batch are ready at once: callbacks run before delay
+		// the following ones
+		mReadyTime = LatencyTracker::getTime();
+
+		mLoops.add();
+
+		for(auto& event : events)
+		{
+			if (event.type == ReactorEvent::Type::Io)
+			{
+				IoCallback callback;
+
+				{
+					lock_guard<mutex> lock(mMutex);
+
+					auto it = mIoCallbacks.find(event.id);
+
+					if (it == mIoCallbacks.end())
+					{
+						continue;
+					}
+
+					callback = std::move(it->second);
+
+					mIoCallbacks.erase(it);
+				}
+
+				if (!runIoCallback(callback, event.result))
+				{
+					return;
+				}
+
+				continue;
+			}
+
+			Callback callback;
+
+			{
+				lock_guard<mutex> lock(mMutex);
+
+				auto it = mCallbacks.find(event.fd);
+
+				// removed by previous callback
+
+				if (it == mCallbacks.end())
+				{
+					continue;
+				}
+
+				callback = it->second;
+			}
+
+			mFdEvents.add();
+
+			if (!runCallback(callback))
+			{
+				return;
+			}
+		}
+
+		if (!runTasks())
+		{
+			return;
+		}
+
+		lock_guard<mutex> lock(mMutex);
+
+		if (mTerminate && mTasks.empty())
+		{
+			break;
+		}
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	mRunning = false;
+
+	mCondVar.notify_all();
+}
+
+int Reactor::getTimeout()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (!mTasks.empty() || mTerminate)
+	{
+		return 0;
+	}
+
+	if (mDelayedTasks.empty())
+	{
+		return -1;
+	}
+
+	auto now = steady_clock::now();
+	auto deadline = mDelayedTasks.begin()->first;
+
+	if (deadline <= now)
+	{
+		return 0;
+	}
+
+	// round up to not wake up before the deadline
+
+	return duration_cast<milliseconds>(deadline - now).count() + 1;
+}
+
+bool Reactor::runTasks()
+{
+	list<Task> tasks;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		tasks.swap(mTasks);
+
+		auto now = steady_clock::now();
+
+		while (!mDelayedTasks.empty() && mDelayedTasks.begin()->first <= now)
+		{
+			auto deadline = mDelayedTasks.begin()->first;
+
+			tasks.push_back({ duration_cast<nanoseconds>(
+									deadline.time_since_epoch()).count(),
+							  mDelayedTasks.begin()->second });
+			mDelayedTasks.erase(mDelayedTasks.begin());
+		}
+	}
+
+	if (!tasks.empty())
+	{
+		mNumTasks.add(tasks.size());
+	}
+
+	for(auto& task : tasks)
+	{
+		CallbackMonitor::Scope scope(CallbackSource::ReactorTask,
+									 task.readyTime);
+
+		if (!runCallback(task.callback))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Reactor::runCallback(Callback& callback)
+{
+	// the flag is kept alive by the reactor thread
+	auto deleted = mDeleted.get();
+
+	mNumEvents++;
+
+	try
+	{
+		callback();
+	}
+	catch(const std::exception& e)
+	{
+		if (*deleted)
+		{
+			return false;
+		}
+
+		mErrors.add();
+
+		LOG(mLog, ERROR) << e.what();
+	}
+
+	return !*deleted;
+}
+
+bool Reactor::runIoCallback(IoCallback& callback, ssize_t result)
+{
+	auto deleted = mDeleted.get();
+
+	mNumEvents++;
+
+	try
+	{
+		callback(result);
+	}
+	catch(const std::exception& e)
+	{
+		if (*deleted)
+		{
+			return false;
+		}
+
+		mErrors.add();
+
+		LOG(mLog, ERROR) << e.what();
+	}
+
+	return !*deleted;
+}
+
+}
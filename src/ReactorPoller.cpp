@@ -0,0 +1,741 @@
+/*
+ *  Reactor pollers
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "ReactorPoller.hpp"
+
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef REACTOR_HAS_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "Reactor.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * EpollPoller
+ ******************************************************************************/
+
+EpollPoller::EpollPoller() :
+	mEpollFd(-1)
+{
+	mPipeFds[0] = -1;
+	mPipeFds[1] = -1;
+
+	try
+	{
+		init();
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+EpollPoller::~EpollPoller()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void EpollPoller::addFd(int fd)
+{
+	epoll_event event = {};
+
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		throw ReactorException("Can't add file descriptor", errno);
+	}
+}
+
+void EpollPoller::removeFd(int fd)
+{
+	epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EpollPoller::submit(const ReactorIo& io)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mRequests.push_back(io);
+}
+
+void EpollPoller::wait(int timeout, vector<ReactorEvent>& events)
+{
+	vector<ReactorIo> requests;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		requests.swap(mRequests);
+	}
+
+	events.clear();
+
+	epoll_event epollEvents[cMaxEvents];
+
+	auto numEvents = epoll_wait(mEpollFd, epollEvents, cMaxEvents,
+								requests.empty() ? timeout : 0);
+
+	if (numEvents < 0)
+	{
+		if (errno != EINTR)
+		{
+			throw ReactorException("Can't wait for events", errno);
+		}
+
+		numEvents = 0;
+	}
+
+	for(int i = 0; i < numEvents; i++)
+	{
+		if (epollEvents[i].data.fd == mPipeFds[0])
+		{
+			uint8_t data[64];
+
+			while (read(mPipeFds[0], data, sizeof(data)) > 0) {}
+
+			continue;
+		}
+
+		events.push_back({ ReactorEvent::Type::Fd, epollEvents[i].data.fd,
+						   0, 0 });
+	}
+
+	// epoll can't wait for file I/O: it is done in place
+
+	for(auto& io : requests)
+	{
+		auto result = io.type == ReactorIo::Type::Read ?
+					  preadv(io.fd, io.iov, io.iovcnt, io.offset) :
+					  pwritev(io.fd, io.iov, io.iovcnt, io.offset);
+
+		if (result < 0)
+		{
+			result = -errno;
+		}
+
+		events.push_back({ ReactorEvent::Type::Io, -1, io.id, result });
+	}
+}
+
+void EpollPoller::wakeup()
+{
+	uint8_t data = 0;
+
+	// the pipe is full if the poller is already woken up
+
+	if (write(mPipeFds[1], &data, sizeof(data)) < 0 && errno != EAGAIN)
+	{
+		throw ReactorException("Can't wake up reactor", errno);
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void EpollPoller::init()
+{
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (mEpollFd < 0)
+	{
+		throw ReactorException("Can't create epoll", errno);
+	}
+
+	if (pipe2(mPipeFds, O_NONBLOCK | O_CLOEXEC) < 0)
+	{
+		throw ReactorException("Can't create pipe", errno);
+	}
+
+	epoll_event event = {};
+
+	event.events = EPOLLIN;
+	event.data.fd = mPipeFds[0];
+
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mPipeFds[0], &event) < 0)
+	{
+		throw ReactorException("Can't add pipe", errno);
+	}
+}
+
+void EpollPoller::release()
+{
+	for(auto fd : { mEpollFd, mPipeFds[0], mPipeFds[1] })
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+}
+
+/*******************************************************************************
+ * IoUringPoller
+ ******************************************************************************/
+
+const unsigned IoUringPoller::cNumEntries;
+
+#ifdef REACTOR_HAS_IO_URING
+
+namespace {
+
+// Kind of the request is kept in the upper bits of the user data. Poll
+// requests keep the descriptor in the lower bits and the poll number above
+// it, so completions of the removed poll are not taken for the new one.
+const uint64_t cTagMask = 3ULL << 62;
+const uint64_t cWakeupTag = 0;
+const uint64_t cPollTag = 1ULL << 62;
+const uint64_t cIoTag = 2ULL << 62;
+const uint64_t cRemoveTag = 3ULL << 62;
+
+const uint32_t cPollNumberMask = 0x3FFFFFFF;
+
+}
+
+IoUringPoller::IoUringPoller(unsigned numEntries) :
+	mRingFd(-1),
+	mEventFd(-1),
+	mSqRing(nullptr),
+	mSqRingSize(0),
+	mCqRing(nullptr),
+	mCqRingSize(0),
+	mSqes(nullptr),
+	mSqesSize(0),
+	mSqLocalTail(0),
+	mNextPoll(0)
+{
+	try
+	{
+		init(numEntries);
+		probe();
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+IoUringPoller::~IoUringPoller()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void IoUringPoller::addFd(int fd)
+{
+	// the poll request fails asynchronously: check the descriptor here as
+	// epoll does
+
+	if (fcntl(fd, F_GETFD) < 0)
+	{
+		throw ReactorException("Can't add file descriptor", errno);
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	if (mPolls.find(fd) != mPolls.end())
+	{
+		throw ReactorException("Can't add file descriptor", EEXIST);
+	}
+
+	auto userData = cPollTag |
+					(static_cast<uint64_t>(mNextPoll++ & cPollNumberMask) << 32) |
+					static_cast<uint32_t>(fd);
+
+	mPolls[fd] = userData;
+
+	mOperations.push_back({ IORING_OP_POLL_ADD, fd, 0, IORING_POLL_ADD_MULTI,
+							0, POLLIN, userData });
+}
+
+void IoUringPoller::removeFd(int fd)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mPolls.find(fd);
+
+	if (it == mPolls.end())
+	{
+		return;
+	}
+
+	mOperations.push_back({ IORING_OP_POLL_REMOVE, -1, it->second, 0, 0, 0,
+							cRemoveTag });
+
+	mPolls.erase(it);
+}
+
+void IoUringPoller::submit(const ReactorIo& io)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mOperations.push_back({ static_cast<uint8_t>(
+								io.type == ReactorIo::Type::Read ?
+								IORING_OP_READV : IORING_OP_WRITEV),
+							io.fd, reinterpret_cast<uint64_t>(io.iov),
+							static_cast<uint32_t>(io.iovcnt),
+							static_cast<uint64_t>(io.offset), 0,
+							cIoTag | io.id });
+}
+
+void IoUringPoller::wait(int timeout, vector<ReactorEvent>& events)
+{
+	vector<Operation> operations;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		operations.swap(mOperations);
+	}
+
+	for(auto& operation : operations)
+	{
+		putOperation(operation);
+	}
+
+	events.clear();
+
+	checkReadyFds(events);
+
+	// queued requests are submitted by the same call which waits
+
+	enter(events.empty() && timeout != 0 ? 1 : 0, timeout);
+
+	reapCompletions(events);
+
+	for(auto& event : events)
+	{
+		if (event.type == ReactorEvent::Type::Fd)
+		{
+			mReadyFds.push_back(event.fd);
+		}
+	}
+}
+
+void IoUringPoller::wakeup()
+{
+	if (eventfd_write(mEventFd, 1) < 0)
+	{
+		throw ReactorException("Can't wake up reactor", errno);
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void IoUringPoller::init(unsigned numEntries)
+{
+	mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (mEventFd < 0)
+	{
+		throw ReactorException("Can't create eventfd", errno);
+	}
+
+	io_uring_params params = {};
+
+	mRingFd = syscall(__NR_io_uring_setup, numEntries, &params);
+
+	if (mRingFd < 0)
+	{
+		throw ReactorException("Can't create io_uring", errno);
+	}
+
+	// the wait timeout is passed by io_uring_enter and completions are not
+	// dropped when the completion queue is full
+
+	if (!(params.features & IORING_FEAT_EXT_ARG) ||
+		!(params.features & IORING_FEAT_NODROP))
+	{
+		throw ReactorException("io_uring features are not supported", ENOSYS);
+	}
+
+	mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	mCqRingSize = params.cq_off.cqes +
+				  params.cq_entries * sizeof(io_uring_cqe);
+	mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	auto map = [this](size_t size, off_t offset)
+	{
+		auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, mRingFd, offset);
+
+		if (ptr == MAP_FAILED)
+		{
+			throw ReactorException("Can't map io_uring", errno);
+		}
+
+		return ptr;
+	};
+
+	mSqRing = map(mSqRingSize, IORING_OFF_SQ_RING);
+	mCqRing = map(mCqRingSize, IORING_OFF_CQ_RING);
+	mSqes = static_cast<io_uring_sqe*>(map(mSqesSize, IORING_OFF_SQES));
+
+	auto sqRing = static_cast<uint8_t*>(mSqRing);
+	auto cqRing = static_cast<uint8_t*>(mCqRing);
+
+	mSqHead = reinterpret_cast<unsigned*>(sqRing + params.sq_off.head);
+	mSqTail = reinterpret_cast<unsigned*>(sqRing + params.sq_off.tail);
+	mSqMask = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_mask);
+	mSqArray = reinterpret_cast<unsigned*>(sqRing + params.sq_off.array);
+	mSqLocalTail = *mSqTail;
+
+	mCqHead = reinterpret_cast<unsigned*>(cqRing + params.cq_off.head);
+	mCqTail = reinterpret_cast<unsigned*>(cqRing + params.cq_off.tail);
+	mCqMask = *reinterpret_cast<unsigned*>(cqRing + params.cq_off.ring_mask);
+	mCqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+}
+
+void IoUringPoller::release()
+{
+	if (mSqes)
+	{
+		munmap(mSqes, mSqesSize);
+	}
+
+	if (mCqRing)
+	{
+		munmap(mCqRing, mCqRingSize);
+	}
+
+	if (mSqRing)
+	{
+		munmap(mSqRing, mSqRingSize);
+	}
+
+	for(auto fd : { mRingFd, mEventFd })
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+}
+
+void IoUringPoller::probe()
+{
+	// multishot poll is not reported by features: arm the wakeup poll and
+	// check that it stays armed after the first completion
+
+	armWakeup();
+	wakeup();
+
+	enter(1, 1000);
+
+	auto head = *mCqHead;
+
+	if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE))
+	{
+		throw ReactorException("io_uring poll doesn't complete", ETIME);
+	}
+
+	auto& cqe = mCqes[head & mCqMask];
+	auto res = cqe.res;
+	auto flags = cqe.flags;
+
+	__atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+
+	if (res < 0)
+	{
+		throw ReactorException("io_uring poll is not supported", -res);
+	}
+
+	if (!(flags & IORING_CQE_F_MORE))
+	{
+		throw ReactorException("Multishot poll is not supported", ENOSYS);
+	}
+
+	eventfd_t value;
+
+	eventfd_read(mEventFd, &value);
+}
+
+void IoUringPoller::armWakeup()
+{
+	putOperation({ IORING_OP_POLL_ADD, mEventFd, 0, IORING_POLL_ADD_MULTI, 0,
+				   POLLIN, cWakeupTag });
+}
+
+io_uring_sqe* IoUringPoller::getSqe()
+{
+	// the queue is full: submit what is queued to free the entries
+
+	if (getNumToSubmit() > mSqMask)
+	{
+		enter(0, 0);
+	}
+
+	auto index = mSqLocalTail & mSqMask;
+	auto sqe = &mSqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	mSqArray[index] = index;
+
+	return sqe;
+}
+
+void IoUringPoller::putOperation(const Operation& operation)
+{
+	auto sqe = getSqe();
+
+	sqe->opcode = operation.opcode;
+	sqe->fd = operation.fd;
+	sqe->addr = operation.addr;
+	sqe->len = operation.len;
+	sqe->off = operation.offset;
+	sqe->poll32_events = operation.flags;
+	sqe->user_data = operation.userData;
+
+	__atomic_store_n(mSqTail, ++mSqLocalTail, __ATOMIC_RELEASE);
+}
+
+unsigned IoUringPoller::getNumToSubmit() const
+{
+	return mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUringPoller::enter(unsigned minComplete, int timeout)
+{
+	auto numToSubmit = getNumToSubmit();
+
+	if (numToSubmit == 0 && minComplete == 0)
+	{
+		return 0;
+	}
+
+	__kernel_timespec ts = {};
+	io_uring_getevents_arg arg = {};
+	unsigned flags = 0;
+
+	if (minComplete)
+	{
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+		arg.sigmask_sz = _NSIG / 8;
+
+		if (timeout >= 0)
+		{
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+
+			arg.ts = reinterpret_cast<uint64_t>(&ts);
+		}
+	}
+
+	auto ret = syscall(__NR_io_uring_enter, mRingFd, numToSubmit, minComplete,
+					   flags, minComplete ? &arg : nullptr,
+					   minComplete ? sizeof(arg) : 0);
+
+	// timeout, signal or full completion queue: completions are reaped by
+	// the caller
+
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+	{
+		throw ReactorException("Can't wait for events", errno);
+	}
+
+	return ret;
+}
+
+void IoUringPoller::checkReadyFds(vector<ReactorEvent>& events)
+{
+	if (mReadyFds.empty())
+	{
+		return;
+	}
+
+	vector<pollfd> fds;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		for(auto fd : mReadyFds)
+		{
+			if (mPolls.find(fd) != mPolls.end())
+			{
+				fds.push_back({ fd, POLLIN, 0 });
+			}
+		}
+	}
+
+	mReadyFds.clear();
+
+	if (fds.empty() || poll(fds.data(), fds.size(), 0) <= 0)
+	{
+		return;
+	}
+
+	for(auto& fd : fds)
+	{
+		if (fd.revents)
+		{
+			events.push_back({ ReactorEvent::Type::Fd, fd.fd, 0, 0 });
+		}
+	}
+}
+
+void IoUringPoller::reapCompletions(vector<ReactorEvent>& events)
+{
+	auto head = *mCqHead;
+	auto tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+	vector<Operation> rearms;
+
+	for(; head != tail; head++)
+	{
+		auto& cqe = mCqes[head & mCqMask];
+		auto tag = cqe.user_data & cTagMask;
+
+		if (tag == cWakeupTag)
+		{
+			eventfd_t value;
+
+			eventfd_read(mEventFd, &value);
+
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+			{
+				rearms.push_back({ IORING_OP_POLL_ADD, mEventFd, 0,
+								   IORING_POLL_ADD_MULTI, 0, POLLIN,
+								   cWakeupTag });
+			}
+		}
+		else if (tag == cPollTag)
+		{
+			int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+
+			{
+				lock_guard<mutex> lock(mMutex);
+
+				auto it = mPolls.find(fd);
+
+				// completion of the removed poll
+
+				if (it == mPolls.end() || it->second != cqe.user_data)
+				{
+					continue;
+				}
+			}
+
+			// the poll is terminated by the kernel, but the descriptor is
+			// still used; failed poll is reported for the callback to get
+			// the error and is not armed again
+
+			if (!(cqe.flags & IORING_CQE_F_MORE) && cqe.res >= 0)
+			{
+				rearms.push_back({ IORING_OP_POLL_ADD, fd, 0,
+								   IORING_POLL_ADD_MULTI, 0, POLLIN,
+								   cqe.user_data });
+			}
+
+			bool reported = false;
+
+			for(auto& event : events)
+			{
+				if (event.type == ReactorEvent::Type::Fd && event.fd == fd)
+				{
+					reported = true;
+				}
+			}
+
+			if (!reported)
+			{
+				events.push_back({ ReactorEvent::Type::Fd, fd, 0, 0 });
+			}
+		}
+		else if (tag == cIoTag)
+		{
+			events.push_back({ ReactorEvent::Type::Io, -1,
+							   cqe.user_data & ~cTagMask, cqe.res });
+		}
+	}
+
+	__atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+
+	for(auto& operation : rearms)
+	{
+		putOperation(operation);
+	}
+}
+
+#else
+
+IoUringPoller::IoUringPoller(unsigned numEntries)
+{
+	throw ReactorException("io_uring is not supported", ENOSYS);
+}
+
+IoUringPoller::~IoUringPoller()
+{
+}
+
+void IoUringPoller::addFd(int fd)
+{
+}
+
+void IoUringPoller::removeFd(int fd)
+{
+}
+
+void IoUringPoller::submit(const ReactorIo& io)
+{
+}
+
+void IoUringPoller::wait(int timeout, vector<ReactorEvent>& events)
+{
+}
+
+void IoUringPoller::wakeup()
+{
+}
+
+#endif
+
+}
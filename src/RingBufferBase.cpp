@@ -23,6 +23,8 @@
 #include "Log.hpp"
 
 using std::bind;
+using std::lock_guard;
+using std::mutex;
 
 namespace XenBackend {
 
@@ -32,11 +34,22 @@ namespace XenBackend {
 
 RingBufferBase::RingBufferBase(domid_t domId, evtchn_port_t port,
 							   grant_ref_t ref) :
-	mEventChannel(domId, port, [this] { onReceiveIndication(); }),
+	mEventChannel(domId, port, [this] { onIndication(); }),
 	mBuffer(domId, ref, PROT_READ | PROT_WRITE),
 	mLog("RingBuffer"),
+	mMetrics("ring", domId, -1, port),
+	mRequestsConsumed(mMetrics.addCounter("requests_consumed")),
+	mResponsesProduced(mMetrics.addCounter("responses_produced")),
+	mEventsProduced(mMetrics.addCounter("events_produced")),
+	mNotificationsSent(mMetrics.addCounter("notifications_sent")),
+	mNotificationsReceived(mMetrics.addCounter("notifications_received")),
+	mSpuriousWakeups(mMetrics.addCounter("spurious_wakeups")),
+	mRingFull(mMetrics.addCounter("ring_full")),
+	mRingOverflow(mMetrics.addCounter("ring_overflow")),
+	mDomId(domId),
 	mPort(port),
-	mRef(ref)
+	mRef(ref),
+	mSuspended(false)
 {
 	LOG(mLog, DEBUG) << "Create ring buffer, port: " << mPort
 					 << ", ref: " << mRef;
@@ -56,17 +69,215 @@ RingBufferBase::~RingBufferBase()
 
 void RingBufferBase::start()
 {
+	startScheduling();
+
 	mEventChannel.start();
 }
 
+void RingBufferBase::start(ReactorPtr reactor)
+{
+	startScheduling();
+
+	mEventChannel.start(reactor);
+}
+
 void RingBufferBase::stop()
 {
 	mEventChannel.stop();
+
+	if (mScheduler)
+	{
+		mScheduler->remove(this);
+	}
+}
+
+void RingBufferBase::suspend()
+{
+	lock_guard<mutex> lock(mIndicationMutex);
+
+	LOG(mLog, DEBUG) << "Suspend ring buffer, port: " << mPort
+					 << ", ref: " << mRef;
+
+	mSuspended = true;
+}
+
+bool RingBufferBase::resume()
+{
+	lock_guard<mutex> lock(mIndicationMutex);
+
+	LOG(mLog, DEBUG) << "Resume ring buffer, port: " << mPort
+					 << ", ref: " << mRef;
+
+	if (!onReset())
+	{
+		LOG(mLog, WARNING) << "Shared ring is not reset, port: " << mPort
+						   << ", ref: " << mRef;
+
+		return false;
+	}
+
+	mSuspended = false;
+
+	return true;
+}
+
+void RingBufferBase::processPending()
+{
+	lock_guard<mutex> lock(mIndicationMutex);
+
+	if (mSuspended)
+	{
+		return;
+	}
+
+	handleIndication();
+}
+
+RingBufferState RingBufferBase::getState()
+{
+	lock_guard<mutex> lock(mIndicationMutex);
+
+	RingBufferState state = { mPort, mRef,
+							  static_cast<evtchn_port_t>(
+									  mEventChannel.getPort()),
+							  mEventChannel.getFd(), 0, 0 };
+
+	onSaveState(state);
+
+	return state;
+}
+
+void RingBufferBase::setState(const RingBufferState& state)
+{
+	lock_guard<mutex> lock(mIndicationMutex);
+
+	LOG(mLog, DEBUG) << "Restore ring buffer, port: " << mPort
+					 << ", ref: " << mRef;
+
+	onRestoreState(state);
+}
+
+void RingBufferBase::detach()
+{
+	mEventChannel.detach();
 }
 
 void RingBufferBase::setErrorCallback(ErrorCallback errorCallback)
 {
-	mEventChannel.setErrorCallback(errorCallback);
+	{
+		lock_guard<mutex> lock(mIndicationMutex);
+
+		mErrorCallback = errorCallback;
+	}
+
+	if (!errorCallback)
+	{
+		mEventChannel.setErrorCallback(errorCallback);
+
+		return;
+	}
+
+	mEventChannel.setErrorCallback([this, errorCallback]
+								   (const std::exception& e)
+	{
+		Trace::onError(mDomId, mPort);
+
+		errorCallback(e);
+	});
+}
+
+bool RingBufferBase::processRequests(SchedulerBudget& budget)
+{
+	ErrorCallback errorCallback;
+
+	try
+	{
+		lock_guard<mutex> lock(mIndicationMutex);
+
+		if (mSuspended)
+		{
+			return false;
+		}
+
+		return onProcessRequests(budget);
+	}
+	catch(const std::exception& e)
+	{
+		// the error is reported as if it happened in the event channel
+		// thread
+
+		Trace::onError(mDomId, mPort);
+
+		{
+			lock_guard<mutex> lock(mIndicationMutex);
+
+			errorCallback = mErrorCallback;
+		}
+
+		if (!errorCallback)
+		{
+			throw;
+		}
+
+		errorCallback(e);
+	}
+
+	return false;
+}
+
+/*******************************************************************************
+ * Protected
+ ******************************************************************************/
+
+bool RingBufferBase::onProcessRequests(SchedulerBudget& budget)
+{
+	onReceiveIndication();
+
+	return false;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void RingBufferBase::startScheduling()
+{
+	if (mScheduler)
+	{
+		mScheduler->add(this, mDomId);
+
+		// requests may be left from the previous start
+
+		mScheduler->activate(this);
+	}
+}
+
+void RingBufferBase::onIndication()
+{
+	lock_guard<mutex> lock(mIndicationMutex);
+
+	mNotificationsReceived.add();
+
+	XENBE_TRACE(Indication, mDomId, mPort, 0, 0);
+
+	if (mSuspended)
+	{
+		return;
+	}
+
+	handleIndication();
+}
+
+void RingBufferBase::handleIndication()
+{
+	if (mScheduler)
+	{
+		mScheduler->activate(this);
+	}
+	else
+	{
+		onReceiveIndication();
+	}
 }
 
 }
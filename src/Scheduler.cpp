@@ -0,0 +1,526 @@
+/*
+ *  Fair-share request scheduler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::find;
+using std::lock_guard;
+using std::make_shared;
+using std::max;
+using std::min;
+using std::mutex;
+using std::numeric_limits;
+using std::string;
+using std::unique_lock;
+using std::weak_ptr;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * TokenBucket
+ ******************************************************************************/
+
+TokenBucket::TokenBucket(double rate, double burst) :
+	mRate(rate),
+	mBurst(max(burst, 1.0)),
+	mTokens(mBurst),
+	mLastTime(steady_clock::now())
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+double TokenBucket::getAvailable(TimePoint now)
+{
+	refill(now);
+
+	return mTokens;
+}
+
+void TokenBucket::take(double tokens)
+{
+	mTokens -= tokens;
+}
+
+microseconds TokenBucket::getWaitTime(TimePoint now)
+{
+	refill(now);
+
+	if (mTokens >= 1.0 || !isLimited())
+	{
+		return microseconds(0);
+	}
+
+	// round up to not wake up before the token is available
+
+	return microseconds(static_cast<int64_t>(
+			std::ceil((1.0 - mTokens) * 1000000.0 / mRate)));
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void TokenBucket::refill(TimePoint now)
+{
+	if (now <= mLastTime)
+	{
+		return;
+	}
+
+	duration<double> elapsed = now - mLastTime;
+
+	mTokens = min(mBurst, mTokens + elapsed.count() * mRate);
+	mLastTime = now;
+}
+
+/*******************************************************************************
+ * Scheduler
+ ******************************************************************************/
+
+const uint64_t Scheduler::cRequestCost;
+const int Scheduler::cMaxSlicesPerRun;
+const int Scheduler::cBurstMs;
+
+Scheduler::Domain::Domain() :
+	weight(1),
+	virtualTime(0),
+	stats()
+{
+}
+
+Scheduler::Scheduler(const string& name, ReactorPtr reactor) :
+	mReactor(reactor),
+	mOwnReactor(!reactor),
+	mAlive(make_shared<bool>(true)),
+	mBudget(numeric_limits<size_t>::max()),
+	mVirtualTime(0),
+	mRunPosted(false),
+	mDelayedRunPosted(false),
+	mRunning(nullptr),
+	mLog(name.empty() ? "Scheduler" : name)
+{
+	if (mOwnReactor)
+	{
+		mReactor = make_shared<Reactor>(name.empty() ? "Scheduler" : name);
+
+		mReactor->start();
+	}
+}
+
+Scheduler::~Scheduler()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mAlive.reset();
+	}
+
+	// wait for the running slice
+
+	if (mOwnReactor)
+	{
+		mReactor->stop();
+	}
+	else
+	{
+		mReactor->flush();
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void Scheduler::setBudget(size_t budget)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (budget == 0)
+	{
+		throw SchedulerException("Invalid budget", EINVAL);
+	}
+
+	mBudget = budget;
+}
+
+void Scheduler::setWeight(domid_t domId, unsigned weight)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (weight == 0)
+	{
+		throw SchedulerException("Invalid weight", EINVAL);
+	}
+
+	mDomains[domId].weight = weight;
+}
+
+void Scheduler::setRateLimit(domid_t domId, double requestsPerSec,
+							 double bytesPerSec)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	LOG(mLog, DEBUG) << "Set rate limit, dom: " << domId
+					 << ", requests/s: " << requestsPerSec
+					 << ", bytes/s: " << bytesPerSec;
+
+	auto& domain = mDomains[domId];
+
+	domain.requestBucket = TokenBucket(requestsPerSec,
+									   requestsPerSec * cBurstMs / 1000);
+	domain.byteBucket = TokenBucket(bytesPerSec,
+									bytesPerSec * cBurstMs / 1000);
+}
+
+SchedulerStats Scheduler::getStats(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mDomains.find(domId);
+
+	if (it == mDomains.end())
+	{
+		return SchedulerStats();
+	}
+
+	return it->second.stats;
+}
+
+void Scheduler::add(Schedulable* client, domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mClients[client] = { domId, false };
+
+	// create the domain with default settings
+
+	mDomains[domId];
+}
+
+void Scheduler::remove(Schedulable* client)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	// the client may remove itself from the slice
+
+	mCondVar.wait(lock, [this, client] {
+		return mRunning != client || mReactor->isReactorThread(); });
+
+	auto it = mClients.find(client);
+
+	if (it == mClients.end())
+	{
+		return;
+	}
+
+	auto domId = it->second.domId;
+	auto& domain = mDomains[domId];
+
+	domain.queue.remove(client);
+
+	if (domain.queue.empty())
+	{
+		mActiveDomains.remove(domId);
+	}
+
+	mClients.erase(it);
+}
+
+void Scheduler::activate(Schedulable* client)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mClients.find(client);
+
+	if (it == mClients.end() || it->second.queued)
+	{
+		return;
+	}
+
+	queue(client, it->second);
+
+	postRun();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void Scheduler::queue(Schedulable* client, Client& info)
+{
+	auto& domain = mDomains[info.domId];
+
+	info.queued = true;
+
+	domain.queue.push_back(client);
+
+	if (find(mActiveDomains.begin(), mActiveDomains.end(), info.domId) ==
+		mActiveDomains.end())
+	{
+		// idle domain doesn't save up virtual time
+
+		domain.virtualTime = max(domain.virtualTime, mVirtualTime);
+
+		mActiveDomains.push_back(info.domId);
+	}
+}
+
+void Scheduler::postRun()
+{
+	if (mRunPosted)
+	{
+		return;
+	}
+
+	mRunPosted = true;
+
+	weak_ptr<bool> alive = mAlive;
+
+	mReactor->post([this, alive] { if (alive.lock()) run(); });
+}
+
+void Scheduler::postDelayedRun(microseconds delay)
+{
+	if (mDelayedRunPosted)
+	{
+		return;
+	}
+
+	mDelayedRunPosted = true;
+
+	weak_ptr<bool> alive = mAlive;
+
+	// the reactor timer resolution is milliseconds
+
+	mReactor->postDelayed(duration_cast<milliseconds>(delay +
+													  microseconds(999)),
+		[this, alive]
+		{
+			if (alive.lock())
+			{
+				{
+					lock_guard<mutex> lock(mMutex);
+
+					mDelayedRunPosted = false;
+				}
+
+				run();
+			}
+		});
+}
+
+void Scheduler::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mRunPosted = false;
+
+	domid_t domId = 0;
+	auto wait = microseconds::max();
+
+	for(int i = 0; i < cMaxSlicesPerRun; i++)
+	{
+		auto now = steady_clock::now();
+
+		if (!selectDomain(now, domId, wait))
+		{
+			break;
+		}
+
+		runSlice(lock, domId, now);
+	}
+
+	// let other reactor tasks run between the slices
+
+	wait = microseconds::max();
+
+	if (selectDomain(steady_clock::now(), domId, wait))
+	{
+		postRun();
+	}
+	else if (wait != microseconds::max())
+	{
+		postDelayedRun(wait);
+	}
+}
+
+bool Scheduler::selectDomain(TimePoint now, domid_t& domId,
+							 microseconds& wait)
+{
+	bool selected = false;
+	uint64_t virtualTime = 0;
+
+	for(auto id : mActiveDomains)
+	{
+		auto& domain = mDomains[id];
+
+		if (domain.queue.empty())
+		{
+			continue;
+		}
+
+		if (domain.throttledUntil > now || throttle(domain, now))
+		{
+			wait = min(wait, duration_cast<microseconds>(
+					domain.throttledUntil - now));
+
+			continue;
+		}
+
+		if (!selected || domain.virtualTime < virtualTime)
+		{
+			selected = true;
+			virtualTime = domain.virtualTime;
+			domId = id;
+		}
+	}
+
+	return selected;
+}
+
+bool Scheduler::throttle(Domain& domain, TimePoint now)
+{
+	auto until = now;
+
+	if (domain.requestBucket.isLimited() &&
+		domain.requestBucket.getAvailable(now) < 1.0)
+	{
+		until = max(until, now + domain.requestBucket.getWaitTime(now));
+	}
+
+	if (domain.byteBucket.isLimited() &&
+		domain.byteBucket.getAvailable(now) < 1.0)
+	{
+		until = max(until, now + domain.byteBucket.getWaitTime(now));
+	}
+
+	if (until == now)
+	{
+		return false;
+	}
+
+	domain.throttledUntil = until;
+	domain.stats.numThrottled++;
+	domain.stats.throttledTime += duration_cast<microseconds>(until - now);
+
+	return true;
+}
+
+void Scheduler::runSlice(unique_lock<mutex>& lock, domid_t domId,
+						 TimePoint now)
+{
+	auto& domain = mDomains[domId];
+	auto client = domain.queue.front();
+
+	domain.queue.pop_front();
+
+	mClients[client].queued = false;
+
+	mVirtualTime = max(mVirtualTime, domain.virtualTime);
+
+	SchedulerBudget budget = { mBudget, numeric_limits<size_t>::max(), 0, 0 };
+
+	if (domain.requestBucket.isLimited())
+	{
+		budget.maxRequests = min(budget.maxRequests, static_cast<size_t>(
+				domain.requestBucket.getAvailable(now)));
+	}
+
+	if (domain.byteBucket.isLimited())
+	{
+		budget.maxBytes = static_cast<size_t>(
+				domain.byteBucket.getAvailable(now));
+	}
+
+	bool pending = false;
+
+	mRunning = client;
+
+	lock.unlock();
+
+	try
+	{
+		pending = client->processRequests(budget);
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+
+	lock.lock();
+
+	mRunning = nullptr;
+
+	mCondVar.notify_all();
+
+	domain.stats.numRequests += budget.numRequests;
+	domain.stats.numBytes += budget.numBytes;
+
+	domain.requestBucket.take(budget.numRequests);
+	domain.byteBucket.take(budget.numBytes);
+
+	// the empty slice costs as one request, so polling doesn't come for free
+
+	domain.virtualTime += max<uint64_t>(budget.numRequests, 1) *
+						  cRequestCost / domain.weight;
+
+	auto it = mClients.find(client);
+
+	// the client is removed during the slice
+
+	if (it == mClients.end())
+	{
+		if (domain.queue.empty())
+		{
+			mActiveDomains.remove(domId);
+		}
+
+		return;
+	}
+
+	if (pending)
+	{
+		domain.stats.numBudgetExhausted++;
+
+		if (!it->second.queued)
+		{
+			queue(client, it->second);
+		}
+	}
+
+	if (domain.queue.empty())
+	{
+		mActiveDomains.remove(domId);
+	}
+}
+
+}
@@ -0,0 +1,436 @@
+/*
+ *  Hierarchical timer wheel
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "TimerWheel.hpp"
+
+#include "CallbackMonitor.hpp"
+#include "Log.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+namespace XenBackend {
+
+namespace {
+
+const uint64_t cSlotMask = TimerWheel::cNumSlots - 1;
+
+// the farthest tick the wheel can hold, later timers are put there and are
+// moved through the wheel again
+const uint64_t cMaxDelta =
+	(1ULL << (TimerWheel::cLevelBits * TimerWheel::cNumLevels)) - 1;
+
+const uint64_t cNoWakeup = UINT64_MAX;
+
+}
+
+/*******************************************************************************
+ * TimerWheel::Entry
+ ******************************************************************************/
+
+TimerWheel::Entry::Entry(Callback callback, bool periodic) :
+	mCallback(callback),
+	mPeriodic(periodic),
+	mState(State::Idle),
+	mPeriod(0),
+	mExpires(0),
+	mSlot(0),
+	mCancelled(false)
+{
+}
+
+/*******************************************************************************
+ * TimerWheel
+ ******************************************************************************/
+
+const size_t TimerWheel::cLevelBits;
+const size_t TimerWheel::cNumSlots;
+const size_t TimerWheel::cNumLevels;
+
+TimerWheel::TimerWheel() :
+	mStartTime(steady_clock::now()),
+	mCurrentTick(0),
+	mWakeupTick(cNoWakeup),
+	mNumTimers(0),
+	mOccupied(),
+	mRunning(nullptr),
+	mTerminate(false)
+{
+	mThread = thread(&TimerWheel::run, this);
+}
+
+TimerWheel::~TimerWheel()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+	}
+
+	mCondVar.notify_all();
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+TimerWheel& TimerWheel::getDefault()
+{
+	// is not destroyed on exit: static timers may be stopped after
+
+	static TimerWheel* sWheel = new TimerWheel();
+
+	return *sWheel;
+}
+
+bool TimerWheel::start(Entry& entry, milliseconds time)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (entry.mState != Entry::State::Idle)
+	{
+		return false;
+	}
+
+	// the wheel isn't advanced while it has no timers
+
+	if (mNumTimers == 0)
+	{
+		mCurrentTick = getTick();
+	}
+
+	// rounded up to not expire before the time
+
+	auto now = duration_cast<nanoseconds>(steady_clock::now() - mStartTime);
+	auto ticks = time.count() > 0 ? time.count() : 1;
+
+	entry.mCancelled = false;
+	entry.mPeriod = ticks;
+	entry.mExpires = (now.count() + 999999) / 1000000 + ticks;
+
+	insert(entry);
+
+	mNumTimers++;
+
+	if (entry.mExpires < mWakeupTick)
+	{
+		mCondVar.notify_one();
+	}
+
+	return true;
+}
+
+void TimerWheel::stop(Entry& entry)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (entry.mState != Entry::State::Idle)
+	{
+		remove(entry);
+
+		mNumTimers--;
+	}
+
+	if (mRunning == &entry)
+	{
+		// the callback stops its own timer: the wheel doesn't touch the
+		// entry after the callback
+
+		if (std::this_thread::get_id() == mThread.get_id())
+		{
+			mRunning = nullptr;
+
+			return;
+		}
+
+		entry.mCancelled = true;
+
+		mRunningCondVar.wait(lock, [this, &entry]
+							 { return mRunning != &entry; });
+	}
+}
+
+size_t TimerWheel::getNumTimers() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mNumTimers;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void TimerWheel::link(Link& head, Entry& entry)
+{
+	entry.prev = head.prev;
+	entry.next = &head;
+	head.prev->next = &entry;
+	head.prev = &entry;
+}
+
+void TimerWheel::unlink(Entry& entry)
+{
+	entry.prev->next = entry.next;
+	entry.next->prev = entry.prev;
+	entry.prev = &entry;
+	entry.next = &entry;
+}
+
+uint64_t TimerWheel::getTick() const
+{
+	return duration_cast<milliseconds>(steady_clock::now() -
+									   mStartTime).count();
+}
+
+void TimerWheel::insert(Entry& entry)
+{
+	// the current tick slot is expired after cascading, so cascaded timers
+	// may be put there but started timers are put to the next tick
+
+	auto placement = entry.mExpires;
+
+	if (placement < mCurrentTick)
+	{
+		placement = mCurrentTick;
+	}
+
+	if (placement - mCurrentTick > cMaxDelta)
+	{
+		placement = mCurrentTick + cMaxDelta;
+	}
+
+	auto delta = placement - mCurrentTick;
+	size_t level = 0;
+
+	while (level < cNumLevels - 1 &&
+		   delta >= (1ULL << (cLevelBits * (level + 1))))
+	{
+		level++;
+	}
+
+	auto index = (placement >> (cLevelBits * level)) & cSlotMask;
+
+	entry.mSlot = level * cNumSlots + index;
+	entry.mState = Entry::State::Pending;
+
+	link(mSlots[entry.mSlot], entry);
+
+	if (level == 0)
+	{
+		mOccupied[index / 64] |= 1ULL << (index % 64);
+	}
+}
+
+void TimerWheel::remove(Entry& entry)
+{
+	unlink(entry);
+
+	if (entry.mState == Entry::State::Pending && entry.mSlot < cNumSlots &&
+		mSlots[entry.mSlot].next == &mSlots[entry.mSlot])
+	{
+		mOccupied[entry.mSlot / 64] &= ~(1ULL << (entry.mSlot % 64));
+	}
+
+	entry.mState = Entry::State::Idle;
+}
+
+void TimerWheel::cascade(size_t level)
+{
+	auto& head = mSlots[level * cNumSlots +
+						((mCurrentTick >> (cLevelBits * level)) & cSlotMask)];
+
+	while (head.next != &head)
+	{
+		auto entry = getEntry(head.next);
+
+		unlink(*entry);
+
+		insert(*entry);
+	}
+}
+
+void TimerWheel::advance(uint64_t tick)
+{
+	if (mNumTimers == 0)
+	{
+		mCurrentTick = tick;
+
+		return;
+	}
+
+	while (mCurrentTick < tick)
+	{
+		mCurrentTick++;
+
+		// higher levels first: their timers may go to the lower level slot
+		// which is cascaded at this tick as well
+
+		for(auto level = cNumLevels - 1; level > 0; level--)
+		{
+			if ((mCurrentTick & ((1ULL << (cLevelBits * level)) - 1)) == 0)
+			{
+				cascade(level);
+			}
+		}
+
+		auto index = mCurrentTick & cSlotMask;
+		auto& head = mSlots[index];
+
+		while (head.next != &head)
+		{
+			auto entry = getEntry(head.next);
+
+			unlink(*entry);
+			link(mExpired, *entry);
+
+			entry->mState = Entry::State::Expired;
+		}
+
+		mOccupied[index / 64] &= ~(1ULL << (index % 64));
+	}
+}
+
+uint64_t TimerWheel::getWakeupTick() const
+{
+	if (mNumTimers == 0)
+	{
+		return cNoWakeup;
+	}
+
+	// the nearest first level slot till the end of the turn, the next turn
+	// starts with cascading
+
+	auto nextTurn = (mCurrentTick | cSlotMask) + 1;
+
+	for(auto index = (mCurrentTick + 1) & cSlotMask;
+		index != 0 && index < cNumSlots; )
+	{
+		auto bits = mOccupied[index / 64] >> (index % 64);
+
+		if (bits)
+		{
+			return mCurrentTick + 1 + __builtin_ctzll(bits) + index -
+				   ((mCurrentTick + 1) & cSlotMask);
+		}
+
+		index = (index / 64 + 1) * 64;
+	}
+
+	return nextTurn;
+}
+
+void TimerWheel::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	while (!mTerminate)
+	{
+		advance(getTick());
+
+		while (mExpired.next != &mExpired)
+		{
+			auto entry = getEntry(mExpired.next);
+
+			unlink(*entry);
+
+			entry->mState = Entry::State::Idle;
+			mNumTimers--;
+			mRunning = entry;
+
+			auto readyTime = duration_cast<nanoseconds>(
+					mStartTime.time_since_epoch() +
+					milliseconds(entry->mExpires)).count();
+
+			lock.unlock();
+
+			try
+			{
+				CallbackMonitor::Scope scope(CallbackSource::Timer,
+											 readyTime);
+
+				if (entry->mCallback)
+				{
+					entry->mCallback();
+				}
+			}
+			catch(const std::exception& e)
+			{
+				LOG("TimerWheel", ERROR) << e.what();
+			}
+
+			lock.lock();
+
+			// the entry may be stopped or started again by the callback
+
+			if (mRunning == entry)
+			{
+				if (entry->mPeriodic && !entry->mCancelled &&
+					entry->mState == Entry::State::Idle)
+				{
+					auto now = getTick();
+
+					entry->mExpires += entry->mPeriod;
+
+					if (entry->mExpires <= now)
+					{
+						entry->mExpires = now + entry->mPeriod;
+					}
+
+					insert(*entry);
+
+					mNumTimers++;
+				}
+
+				mRunning = nullptr;
+			}
+
+			mRunningCondVar.notify_all();
+		}
+
+		mWakeupTick = getWakeupTick();
+
+		if (mWakeupTick == cNoWakeup)
+		{
+			mCondVar.wait(lock);
+		}
+		else
+		{
+			mCondVar.wait_until(lock, mStartTime + milliseconds(mWakeupTick));
+		}
+
+		// timers started while processing don't need to wake up the thread
+
+		mWakeupTick = 0;
+	}
+}
+
+}
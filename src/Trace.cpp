@@ -0,0 +1,460 @@
+/*
+ *  Ring activity trace
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::fixed;
+using std::ifstream;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::min;
+using std::ostream;
+using std::setprecision;
+using std::setw;
+using std::stable_sort;
+using std::string;
+using std::vector;
+
+namespace XenBackend {
+
+namespace {
+
+const char cMagic[4] = { 'X', 'B', 'T', 'R' };
+
+// Writes the whole buffer, is async signal safe
+bool writeAll(int fd, const void* data, size_t size)
+{
+	auto ptr = static_cast<const uint8_t*>(data);
+
+	while (size)
+	{
+		auto written = ::write(fd, ptr, size);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		ptr += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+}
+
+/*******************************************************************************
+ * Trace
+ ******************************************************************************/
+
+const size_t Trace::cNumRecords;
+const size_t Trace::cMaxThreads;
+const uint32_t Trace::cVersion;
+
+atomic<bool> Trace::sEnabled(false);
+atomic<Trace::Buffer*> Trace::sBuffers[Trace::cMaxThreads];
+char Trace::sDumpPath[256];
+
+Trace::ThreadBuffer::~ThreadBuffer()
+{
+	// the records are kept for dumps until the ring is reused
+
+	if (buffer)
+	{
+		buffer->used.store(false, memory_order_release);
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void Trace::setEnabled(bool enabled)
+{
+	sEnabled = enabled;
+}
+
+void Trace::record(TraceEvent event, domid_t domId, uint32_t port,
+				   uint32_t prod, uint32_t cons)
+{
+	auto buffer = getBuffer();
+
+	if (!buffer)
+	{
+		return;
+	}
+
+	auto head = buffer->head.load(memory_order_relaxed);
+	auto& record = buffer->records[head & (cNumRecords - 1)];
+
+	record.timestamp = duration_cast<nanoseconds>(
+			steady_clock::now().time_since_epoch()).count();
+	record.event = static_cast<uint16_t>(event);
+	record.domId = domId;
+	record.port = port;
+	record.prod = prod;
+	record.cons = cons;
+
+	buffer->head.store(head + 1, memory_order_release);
+}
+
+void Trace::clear()
+{
+	for(auto& slot : sBuffers)
+	{
+		auto buffer = slot.load(memory_order_acquire);
+
+		if (buffer)
+		{
+			buffer->head.store(0, memory_order_release);
+		}
+	}
+}
+
+void Trace::setDumpPath(const string& path)
+{
+	if (path.size() >= sizeof(sDumpPath))
+	{
+		throw TraceException("Dump path is too long", ENAMETOOLONG);
+	}
+
+	strcpy(sDumpPath, path.c_str());
+}
+
+void Trace::installSignalHandler(int signal)
+{
+	struct sigaction action = {};
+
+	action.sa_handler = signalHandler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+
+	if (sigaction(signal, &action, nullptr) < 0)
+	{
+		throw TraceException("Can't install signal handler", errno);
+	}
+}
+
+void Trace::dump(int fd)
+{
+	// no allocations and locks here as it is called from the signal handler
+
+	FileHeader header = {};
+
+	memcpy(header.magic, cMagic, sizeof(cMagic));
+	header.version = cVersion;
+	header.recordSize = sizeof(TraceRecord);
+
+	for(auto& slot : sBuffers)
+	{
+		if (slot.load(memory_order_acquire))
+		{
+			header.numBuffers++;
+		}
+	}
+
+	if (!writeAll(fd, &header, sizeof(header)))
+	{
+		return;
+	}
+
+	for(uint32_t i = 0; i < cMaxThreads && header.numBuffers; i++)
+	{
+		auto buffer = sBuffers[i].load(memory_order_acquire);
+
+		if (!buffer)
+		{
+			continue;
+		}
+
+		header.numBuffers--;
+
+		auto head = buffer->head.load(memory_order_acquire);
+		auto numRecords = min<uint64_t>(head, cNumRecords);
+		auto tail = head - numRecords;
+
+		BufferHeader bufferHeader = { buffer->threadId,
+									  static_cast<uint32_t>(numRecords) };
+
+		if (!writeAll(fd, &bufferHeader, sizeof(bufferHeader)))
+		{
+			return;
+		}
+
+		// the ring may wrap, so the records are written in two chunks
+
+		auto start = tail & (cNumRecords - 1);
+		auto size = min<uint64_t>(numRecords, cNumRecords - start);
+
+		if (!writeAll(fd, &buffer->records[start], size * sizeof(TraceRecord)) ||
+			!writeAll(fd, &buffer->records[0],
+					  (numRecords - size) * sizeof(TraceRecord)))
+		{
+			return;
+		}
+	}
+}
+
+void Trace::dump(const string& path)
+{
+	auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+	{
+		throw TraceException("Can't open dump file: " + path, errno);
+	}
+
+	dump(fd);
+
+	close(fd);
+}
+
+void Trace::onError(domid_t domId, uint32_t port)
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+
+	record(TraceEvent::Error, domId, port, 0, 0);
+
+	if (sDumpPath[0])
+	{
+		try
+		{
+			dump(sDumpPath);
+		}
+		catch(const TraceException&)
+		{
+			// the error is reported by the caller, the dump is best effort
+		}
+	}
+}
+
+vector<TraceEntry> Trace::read(const string& path)
+{
+	ifstream file(path, ifstream::binary);
+
+	if (!file)
+	{
+		throw TraceException("Can't open dump file: " + path, ENOENT);
+	}
+
+	FileHeader header;
+
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		memcmp(header.magic, cMagic, sizeof(cMagic)) != 0 ||
+		header.version != cVersion ||
+		header.recordSize != sizeof(TraceRecord))
+	{
+		throw TraceException("Invalid dump file: " + path, EINVAL);
+	}
+
+	vector<TraceEntry> entries;
+
+	for(uint32_t i = 0; i < header.numBuffers; i++)
+	{
+		BufferHeader bufferHeader;
+
+		if (!file.read(reinterpret_cast<char*>(&bufferHeader),
+					   sizeof(bufferHeader)))
+		{
+			throw TraceException("Truncated dump file: " + path, EINVAL);
+		}
+
+		for(uint32_t j = 0; j < bufferHeader.numRecords; j++)
+		{
+			TraceEntry entry;
+
+			entry.threadId = bufferHeader.threadId;
+
+			if (!file.read(reinterpret_cast<char*>(&entry.record),
+						   sizeof(entry.record)))
+			{
+				throw TraceException("Truncated dump file: " + path, EINVAL);
+			}
+
+			entries.push_back(entry);
+		}
+	}
+
+	stable_sort(entries.begin(), entries.end(),
+				[](const TraceEntry& a, const TraceEntry& b)
+				{ return a.record.timestamp < b.record.timestamp; });
+
+	return entries;
+}
+
+void Trace::printTimeline(const vector<TraceEntry>& entries, ostream& stream)
+{
+	if (entries.empty())
+	{
+		return;
+	}
+
+	auto start = entries[0].record.timestamp;
+
+	for(auto& entry : entries)
+	{
+		auto& record = entry.record;
+
+		stream << setw(14) << fixed << setprecision(3)
+			   << (record.timestamp - start) / 1000.0 << " us"
+			   << "  thread: " << setw(6) << entry.threadId
+			   << "  dom: " << setw(5) << record.domId
+			   << "  port: " << setw(5) << record.port
+			   << "  " << std::left << setw(10)
+			   << getEventName(record.event) << std::right
+			   << "  prod: " << record.prod
+			   << ", cons: " << record.cons << "\n";
+	}
+}
+
+const char* Trace::getEventName(uint16_t event)
+{
+	switch(static_cast<TraceEvent>(event))
+	{
+		case TraceEvent::Notify:
+			return "notify";
+		case TraceEvent::Indication:
+			return "indication";
+		case TraceEvent::Request:
+			return "request";
+		case TraceEvent::Response:
+			return "response";
+		case TraceEvent::Event:
+			return "event";
+		case TraceEvent::Overflow:
+			return "overflow";
+		case TraceEvent::Error:
+			return "error";
+	}
+
+	return "unknown";
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+Trace::Buffer* Trace::getBuffer()
+{
+	static thread_local ThreadBuffer sThreadBuffer;
+
+	if (sThreadBuffer.buffer)
+	{
+		return sThreadBuffer.buffer;
+	}
+
+	Buffer* buffer = nullptr;
+
+	// reuse the ring of the exited thread
+
+	for(auto& slot : sBuffers)
+	{
+		auto candidate = slot.load(memory_order_acquire);
+		bool used = false;
+
+		if (candidate &&
+			candidate->used.compare_exchange_strong(used, true))
+		{
+			buffer = candidate;
+
+			break;
+		}
+	}
+
+	if (!buffer)
+	{
+		auto created = new Buffer();
+
+		created->used = true;
+
+		for(auto& slot : sBuffers)
+		{
+			Buffer* empty = nullptr;
+
+			if (slot.compare_exchange_strong(empty, created))
+			{
+				buffer = created;
+
+				break;
+			}
+		}
+
+		// too many threads, the events of this thread are not traced
+
+		if (!buffer)
+		{
+			delete created;
+
+			return nullptr;
+		}
+	}
+
+	buffer->threadId = syscall(SYS_gettid);
+	buffer->head.store(0, memory_order_release);
+
+	sThreadBuffer.buffer = buffer;
+
+	return buffer;
+}
+
+void Trace::signalHandler(int signal)
+{
+	auto savedErrno = errno;
+
+	if (sDumpPath[0])
+	{
+		auto fd = open(sDumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (fd >= 0)
+		{
+			dump(fd);
+
+			close(fd);
+		}
+	}
+
+	errno = savedErrno;
+}
+
+}
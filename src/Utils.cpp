@@ -23,7 +23,11 @@
 #include <cstring>
 #include <vector>
 
+#include <sys/eventfd.h>
+
+#include "CallbackMonitor.hpp"
 #include "Exception.hpp"
+#include "Histogram.hpp"
 #include "Version.hpp"
 
 using std::chrono::milliseconds;
@@ -75,18 +79,20 @@ string Utils::getVersion()
  * PollFd
  ******************************************************************************/
 
-PollFd::PollFd(int fd, short int events)
+const size_t PollFd::cEventFdIndex;
+
+PollFd::PollFd() :
+	mEventFd(-1),
+	mChanged(true),
+	mStopped(false)
 {
-	try
-	{
-		init(fd, events);
-	}
-	catch(const std::exception& e)
-	{
-		release();
+	init();
+}
 
-		throw;
-	}
+PollFd::PollFd(int fd, short int events) :
+	PollFd()
+{
+	addFd(fd, events);
 }
 
 PollFd::~PollFd()
@@ -94,89 +100,219 @@ PollFd::~PollFd()
 	release();
 }
 
-bool PollFd::poll()
+void PollFd::addFd(int fd, short int events, Callback callback)
 {
-	mFds[PollIndex::FILE].revents = 0;
-	mFds[PollIndex::PIPE].revents = 0;
-
-	if (::poll(mFds, 2, -1) < 0)
 	{
-		if (errno != EINTR)
+		lock_guard<mutex> lock(mMutex);
+
+		for(auto& pollFd : mFds)
 		{
-			throw Exception("Error polling files", errno);
+			if (pollFd.fd == fd)
+			{
+				throw Exception("File descriptor is already added", EEXIST);
+			}
 		}
+
+		mFds.push_back({fd, events, 0});
+		mCallbacks.push_back(callback);
+
+		mChanged = true;
 	}
 
-	if (mFds[PollIndex::PIPE].revents & POLLIN)
+	signal();
+}
+
+void PollFd::removeFd(int fd)
+{
 	{
-		uint8_t data;
+		lock_guard<mutex> lock(mMutex);
 
-		if (read(mFds[PollIndex::PIPE].fd, &data, sizeof(data)) < 0)
+		for(size_t i = cEventFdIndex + 1; i < mFds.size(); i++)
 		{
-			throw Exception("Error reading pipe", errno);
-		}
+			if (mFds[i].fd == fd)
+			{
+				mFds.erase(mFds.begin() + i);
+				mCallbacks.erase(mCallbacks.begin() + i);
 
-		return false;
+				mChanged = true;
+
+				break;
+			}
+		}
 	}
 
-	if (mFds[PollIndex::FILE].revents & (~mFds[PollIndex::FILE].events))
+	signal();
+}
+
+bool PollFd::poll()
+{
+	while (true)
 	{
-		if (mFds[PollIndex::FILE].revents & POLLERR)
+		update();
+
+		for(auto& pollFd : mPollFds)
 		{
-			throw Exception("Poll error condition", EPERM);
+			pollFd.revents = 0;
 		}
 
-		if (mFds[PollIndex::FILE].revents & POLLHUP)
+		if (::poll(mPollFds.data(), mPollFds.size(), -1) < 0)
 		{
-			throw Exception("Poll hang up", EPERM);
+			if (errno != EINTR)
+			{
+				throw Exception("Error polling files", errno);
+			}
+
+			continue;
 		}
 
-		if (mFds[PollIndex::FILE].revents & POLLNVAL)
+		if (mPollFds[cEventFdIndex].revents & POLLIN)
 		{
-			throw Exception("Poll invalid request", EINVAL);
+			eventfd_t value;
+
+			if (eventfd_read(mEventFd, &value) < 0)
+			{
+				throw Exception("Error reading eventfd", errno);
+			}
+
+			lock_guard<mutex> lock(mMutex);
+
+			// otherwise the set is changed: poll again
+
+			if (mStopped)
+			{
+				mStopped = false;
+
+				return false;
+			}
+
+			continue;
 		}
-	}
 
-	return true;
+		bool occurred = false;
+
+		for(size_t i = cEventFdIndex + 1; i < mPollFds.size(); i++)
+		{
+			auto revents = mPollFds[i].revents;
+
+			if (!revents)
+			{
+				continue;
+			}
+
+			occurred = true;
+
+			if (mPollCallbacks[i])
+			{
+				if (isRemoved(mPollFds[i].fd))
+				{
+					continue;
+				}
+
+				mPollCallbacks[i](revents);
+			}
+			else
+			{
+				checkEvents(revents & ~mPollFds[i].events);
+			}
+		}
+
+		if (occurred)
+		{
+			return true;
+		}
+	}
 }
 
 void PollFd::stop()
 {
-	uint8_t data = 0xFF;
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mStopped = true;
+	}
+
+	signal();
+}
+
+void PollFd::init()
+{
+	mEventFd = eventfd(0, 0);
+
+	if (mEventFd < 0)
+	{
+		throw Exception("Can't create eventfd", errno);
+	}
+
+	mFds.push_back({mEventFd, POLLIN, 0});
+	mCallbacks.push_back(nullptr);
+}
+
+void PollFd::release()
+{
+	if (mEventFd >= 0)
+	{
+		close(mEventFd);
+	}
+}
 
-	if (write(mPipeFds[PipeType::WRITE], &data, sizeof(data)) < 0)
+void PollFd::update()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mChanged)
 	{
-		throw Exception("Error writing pipe", errno);
+		mPollFds = mFds;
+		mPollCallbacks = mCallbacks;
+
+		mChanged = false;
 	}
 }
 
-void PollFd::init(int fd, short int events)
+bool PollFd::isRemoved(int fd)
 {
-	mPipeFds[PipeType::READ] = -1;
-	mPipeFds[PipeType::WRITE] = -1;
+	lock_guard<mutex> lock(mMutex);
+
+	// the set isn't changed since the poll started
 
-	if (pipe(mPipeFds) < 0)
+	if (!mChanged)
 	{
-		throw Exception("Can't create pipe", errno);
+		return false;
+	}
+
+	for(auto& pollFd : mFds)
+	{
+		if (pollFd.fd == fd)
+		{
+			return false;
+		}
 	}
 
-	mFds[PollIndex::FILE].fd = fd;
-	mFds[PollIndex::FILE].events = events;
+	return true;
+}
 
-	mFds[PollIndex::PIPE].fd = mPipeFds[PipeType::READ];
-	mFds[PollIndex::PIPE].events = POLLIN;
+void PollFd::signal()
+{
+	if (eventfd_write(mEventFd, 1) < 0)
+	{
+		throw Exception("Error writing eventfd", errno);
+	}
 }
 
-void PollFd::release()
+void PollFd::checkEvents(short int revents)
 {
-	if (mPipeFds[PipeType::READ] >= 0)
+	if (revents & POLLERR)
 	{
-		close(mPipeFds[PipeType::READ]);
+		throw Exception("Poll error condition", EPERM);
 	}
 
-	if (mPipeFds[PipeType::WRITE] >= 0)
+	if (revents & POLLHUP)
 	{
-		close(mPipeFds[PipeType::WRITE]);
+		throw Exception("Poll hang up", EPERM);
+	}
+
+	if (revents & POLLNVAL)
+	{
+		throw Exception("Poll invalid request", EINVAL);
 	}
 }
 
@@ -184,10 +320,9 @@ void PollFd::release()
  * AsyncContext
  ******************************************************************************/
 
-AsyncContext::AsyncContext() :
-	mTerminate(false)
+AsyncContext::AsyncContext(Executor& executor) :
+	mSerialExecutor(executor)
 {
-	mThread = thread(&AsyncContext::run, this);
 }
 
 AsyncContext::~AsyncContext()
@@ -197,123 +332,217 @@ AsyncContext::~AsyncContext()
 
 void AsyncContext::stop()
 {
+	mSerialExecutor.stop();
+}
+
+void AsyncContext::call(AsyncCall f)
+{
+	mSerialExecutor.post(Call{ std::move(f), LatencyTracker::getTime() });
+}
+
+void AsyncContext::Call::operator()()
+{
+	CallbackMonitor::Scope scope(CallbackSource::AsyncContext, time);
+
+	func();
+}
+
+/*******************************************************************************
+ * WorkerPool
+ ******************************************************************************/
+
+WorkerPool::WorkerPool(size_t numWorkers) :
+	mTerminate(false),
+	mNumPending(0),
+	mLog("WorkerPool")
+{
+	for(size_t i = 0; i < numWorkers; i++)
 	{
-		unique_lock<mutex> lock(mMutex);
+		mThreads.push_back(thread(&WorkerPool::run, this));
+	}
+}
 
-		mTerminate = true;
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
 
-		mCondVar.notify_all();
+void WorkerPool::post(uint64_t key, Task task)
+{
+	if (mThreads.empty())
+	{
+		runTask(task);
+
+		return;
 	}
 
-	if (mThread.joinable())
+	lock_guard<mutex> lock(mMutex);
+
+	auto& strand = mStrands[key];
+
+	strand.push_back(task);
+
+	mNumPending++;
+
+	// the key is already queued or its task is running
+	if (strand.size() == 1)
 	{
-		mThread.join();
+		mReadyKeys.push_back(key);
+
+		mCondVar.notify_one();
 	}
 }
 
-void AsyncContext::call(AsyncCall f)
+void WorkerPool::wait()
 {
 	unique_lock<mutex> lock(mMutex);
 
-	mAsyncCalls.push_back(f);
+	mIdleCondVar.wait(lock, [this] { return mNumPending == 0; });
+}
+
+void WorkerPool::stop()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
 
-	mCondVar.notify_all();
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	for(auto& thread : mThreads)
+	{
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
 }
 
-void AsyncContext::run()
+void WorkerPool::run()
 {
 	unique_lock<mutex> lock(mMutex);
 
-	while(!mTerminate)
+	while(true)
 	{
 		mCondVar.wait(lock, [this] { return mTerminate ||
-									 !mAsyncCalls.empty(); });
+									 !mReadyKeys.empty(); });
 
-		while(!mAsyncCalls.empty())
+		if (mReadyKeys.empty())
 		{
+			return;
+		}
+
+		auto key = mReadyKeys.front();
+
+		mReadyKeys.pop_front();
+
+		auto& strand = mStrands[key];
+		auto task = strand.front();
 
-			auto asyncCall = mAsyncCalls.front();
+		lock.unlock();
 
-			lock.unlock();
+		runTask(task);
 
-			asyncCall();
+		lock.lock();
 
-			lock.lock();
+		strand.pop_front();
 
-			mAsyncCalls.pop_front();
+		if (strand.empty())
+		{
+			mStrands.erase(key);
 		}
+		else
+		{
+			mReadyKeys.push_back(key);
+
+			mCondVar.notify_one();
+		}
+
+		if (--mNumPending == 0)
+		{
+			mIdleCondVar.notify_all();
+		}
+	}
+}
+
+void WorkerPool::runTask(Task& task)
+{
+	try
+	{
+		task();
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
 	}
 }
 
 /*******************************************************************************
- * Timer
+ * RWLock
  ******************************************************************************/
 
-Timer::Timer(function<void()> callback, bool periodic) :
-	mCallback(callback),
-	mPeriodic(periodic),
-	mTerminate(true)
+RWLock::RWLock()
 {
+	auto ret = pthread_rwlock_init(&mLock, nullptr);
+
+	if (ret)
+	{
+		throw Exception("Can't create rw lock", ret);
+	}
 }
 
-Timer::~Timer()
+RWLock::~RWLock()
 {
-	stop();
+	pthread_rwlock_destroy(&mLock);
 }
 
-void Timer::start(milliseconds time)
+void RWLock::lock()
 {
-	lock_guard<mutex> lock(mItfMutex);
-
-	if (mTerminate)
-	{
-		mTime = time;
+	pthread_rwlock_wrlock(&mLock);
+}
 
-		mTerminate = false;
+void RWLock::unlock()
+{
+	pthread_rwlock_unlock(&mLock);
+}
 
-		mThread = thread(&Timer::run, this);
-	}
-	else
-	{
-		throw Exception("Timer is already started", EPERM);
-	}
+void RWLock::lockShared()
+{
+	pthread_rwlock_rdlock(&mLock);
 }
 
-void Timer::stop()
+void RWLock::unlockShared()
 {
-	lock_guard<mutex> lock(mItfMutex);
+	pthread_rwlock_unlock(&mLock);
+}
 
-	if (mPeriodic)
-	{
-		unique_lock<mutex> lock(mMutex);
+/*******************************************************************************
+ * Timer
+ ******************************************************************************/
 
-		mTerminate = true;
+Timer::Timer(Callback callback, bool periodic, TimerWheel& wheel) :
+	mWheel(wheel),
+	mEntry(callback, periodic)
+{
+}
 
-		mCondVar.notify_all();
-	}
+Timer::~Timer()
+{
+	stop();
+}
 
-	if (mThread.joinable())
+void Timer::start(milliseconds time)
+{
+	if (!mWheel.start(mEntry, time))
 	{
-		mThread.join();
+		throw Exception("Timer is already started", EPERM);
 	}
 }
 
-void Timer::run()
+void Timer::stop()
 {
-	unique_lock<mutex> lock(mMutex);
-
-	do
-	{
-		if (!mCondVar.wait_for(lock, mTime, [this]
-							   { return static_cast<bool>(mTerminate); }))
-		{
-			if (mCallback)
-			{
-				mCallback();
-			}
-		}
-	}
-	while(!mTerminate && mPeriodic);
+	mWheel.stop(mEntry);
 }
 
 }
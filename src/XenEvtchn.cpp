@@ -21,11 +21,17 @@
 #include "XenEvtchn.hpp"
 
 #include <poll.h>
+#include <unistd.h>
 
+#include "CallbackMonitor.hpp"
+#include "Histogram.hpp"
+
+using std::bind;
 using std::lock_guard;
 using std::mutex;
 using std::thread;
 using std::to_string;
+using std::unordered_map;
 
 namespace XenBackend {
 
@@ -33,6 +39,9 @@ namespace XenBackend {
  * XenEvtchn
  ******************************************************************************/
 
+mutex XenEvtchn::sInheritedMutex;
+unordered_map<uint64_t, XenEvtchn::Inherited> XenEvtchn::sInherited;
+
 XenEvtchn::XenEvtchn(domid_t domId, evtchn_port_t port, Callback callback,
 					 ErrorCallback errorCallback) :
 	mPort(-1),
@@ -40,7 +49,9 @@ XenEvtchn::XenEvtchn(domid_t domId, evtchn_port_t port, Callback callback,
 	mCallback(callback),
 	mErrorCallback(errorCallback),
 	mStarted(false),
-	mLog("XenEvtchn")
+	mDetached(false),
+	mLog("XenEvtchn"),
+	mReactorFd(-1)
 {
 	try
 	{
@@ -78,6 +89,23 @@ void XenEvtchn::start()
 	mThread = thread(&XenEvtchn::eventThread, this);
 }
 
+void XenEvtchn::start(ReactorPtr reactor)
+{
+	DLOG(mLog, DEBUG) << "Start event channel on reactor, port: " << mPort;
+
+	if (mStarted)
+	{
+		throw XenEvtchnException("Event channel is already started", EPERM);
+	}
+
+	mReactor = reactor;
+	mReactorFd = xenevtchn_fd(mHandle);
+
+	mReactor->addFd(mReactorFd, bind(&XenEvtchn::reactorEvent, this));
+
+	mStarted = true;
+}
+
 void XenEvtchn::stop()
 {
 	if (!mStarted)
@@ -87,7 +115,13 @@ void XenEvtchn::stop()
 
 	DLOG(mLog, DEBUG) << "Stop event channel, port: " << mPort;
 
-	if (mPollFd)
+	if (mReactor)
+	{
+		mReactor->removeFd(mReactorFd);
+
+		mReactor.reset();
+	}
+	else if (mPollFd)
 	{
 		mPollFd->stop();
 	}
@@ -100,6 +134,20 @@ void XenEvtchn::stop()
 	mStarted = false;
 }
 
+void XenEvtchn::detach()
+{
+	stop();
+
+	DLOG(mLog, DEBUG) << "Detach event channel, port: " << mPort;
+
+	mDetached = true;
+}
+
+int XenEvtchn::getFd() const
+{
+	return xenevtchn_fd(mHandle);
+}
+
 void XenEvtchn::notify()
 {
 	DLOG(mLog, DEBUG) << "Notify event channel, port: " << mPort;
@@ -117,12 +165,47 @@ void XenEvtchn::setErrorCallback(ErrorCallback errorCallback)
 	mErrorCallback = errorCallback;
 }
 
+void XenEvtchn::addInherited(domid_t domId, evtchn_port_t port,
+							 evtchn_port_t localPort, int fd)
+{
+	lock_guard<mutex> lock(sInheritedMutex);
+
+	auto key = (static_cast<uint64_t>(domId) << 32) | port;
+	auto it = sInherited.find(key);
+
+	if (it != sInherited.end())
+	{
+		close(it->second.fd);
+	}
+
+	sInherited[key] = { localPort, fd };
+}
+
+void XenEvtchn::clearInherited()
+{
+	lock_guard<mutex> lock(sInheritedMutex);
+
+	for(auto& inherited : sInherited)
+	{
+		close(inherited.second.fd);
+	}
+
+	sInherited.clear();
+}
+
 /*******************************************************************************
  * Private
  ******************************************************************************/
 
 void XenEvtchn::init(domid_t domId, evtchn_port_t port)
 {
+	if (initInherited(domId, port))
+	{
+		mPollFd.reset(new PollFd(xenevtchn_fd(mHandle), POLLIN));
+
+		return;
+	}
+
 	mHandle = xenevtchn_open(nullptr, 0);
 
 	if (!mHandle)
@@ -145,9 +228,50 @@ void XenEvtchn::init(domid_t domId, evtchn_port_t port)
 					  << mPort;
 }
 
+bool XenEvtchn::initInherited(domid_t domId, evtchn_port_t port)
+{
+	Inherited inherited;
+
+	{
+		lock_guard<mutex> lock(sInheritedMutex);
+
+		auto it = sInherited.find((static_cast<uint64_t>(domId) << 32) | port);
+
+		if (it == sInherited.end())
+		{
+			return false;
+		}
+
+		inherited = it->second;
+
+		sInherited.erase(it);
+	}
+
+#ifdef EVTCHN_HAS_FDOPEN
+	mHandle = xenevtchn_fdopen(nullptr, inherited.fd, 0);
+#else
+	errno = ENOTSUP;
+#endif
+
+	if (!mHandle)
+	{
+		close(inherited.fd);
+
+		throw XenEvtchnException("Can't open inherited event channel", errno);
+	}
+
+	mPort = inherited.localPort;
+
+	DLOG(mLog, DEBUG) << "Inherit event channel, dom: " << domId
+					  << ", remote port: " << port << ", local port: "
+					  << mPort;
+
+	return true;
+}
+
 void XenEvtchn::release()
 {
-	if (mPort != -1)
+	if (mPort != -1 && !mDetached)
 	{
 		xenevtchn_unbind(mHandle, mPort);
 	}
@@ -166,44 +290,76 @@ void XenEvtchn::eventThread()
 	{
 		while(mCallback && mPollFd->poll())
 		{
-			auto port = xenevtchn_pending(mHandle);
+			processEvent(LatencyTracker::getTime());
+		}
+	}
+	catch(const std::exception& e)
+	{
+		handleError(e);
+	}
+}
 
-			if (port < 0)
-			{
-				throw XenEvtchnException("Can't get pending port", errno);
-			}
+void XenEvtchn::reactorEvent()
+{
+	try
+	{
+		// the lag includes callbacks run before by the reactor
+		processEvent(mReactor->getReadyTime());
+	}
+	catch(const std::exception& e)
+	{
+		// stop handling the channel as the event thread does on error
 
-			if (xenevtchn_unmask(mHandle, port) < 0)
-			{
-				throw XenEvtchnException("Can't unmask event channel", errno);
-			}
+		mReactor->removeFd(mReactorFd);
 
-			if (port != mPort)
-			{
-				throw XenEvtchnException("Error port number: " +
-										 to_string(port) + ", expected: " +
-										 to_string(mPort), EINVAL);
-			}
+		handleError(e);
+	}
+}
 
-			DLOG(mLog, DEBUG) << "Event received, port: " << mPort;
+void XenEvtchn::processEvent(int64_t readyTime)
+{
+	auto port = xenevtchn_pending(mHandle);
 
-			mCallback();
-		}
+	if (port < 0)
+	{
+		throw XenEvtchnException("Can't get pending port", errno);
 	}
-	catch(const std::exception& e)
+
+	if (xenevtchn_unmask(mHandle, port) < 0)
 	{
-		lock_guard<mutex> lock(mMutex);
+		throw XenEvtchnException("Can't unmask event channel", errno);
+	}
 
-		if (mErrorCallback)
-		{
-			mErrorCallback(e);
-		}
-		else
-		{
-			LOG(mLog, ERROR) << e.what();
-		}
+	if (port != mPort)
+	{
+		throw XenEvtchnException("Error port number: " +
+								 to_string(port) + ", expected: " +
+								 to_string(mPort), EINVAL);
+	}
+
+	DLOG(mLog, DEBUG) << "Event received, port: " << mPort;
+
+	if (mCallback)
+	{
+		CallbackMonitor::Scope scope(CallbackSource::EventChannel, readyTime,
+									 mPort);
+
+		mCallback();
 	}
 }
 
+void XenEvtchn::handleError(const std::exception& e)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mErrorCallback)
+	{
+		mErrorCallback(e);
+	}
+	else
+	{
+		RLOG(mLog, ERROR) << e.what();
+	}
 }
 
+}
@@ -20,8 +20,43 @@
 
 #include "XenGnttab.hpp"
 
+#include "Metrics.hpp"
+
 namespace XenBackend {
 
+namespace {
+
+// Map and unmap counters of all grant table buffers
+struct GnttabMetrics
+{
+	GnttabMetrics() :
+		group("gnttab"),
+		buffersMapped(group.addCounter("buffers_mapped")),
+		buffersUnmapped(group.addCounter("buffers_unmapped")),
+		pagesMapped(group.addCounter("pages_mapped")),
+		pagesUnmapped(group.addCounter("pages_unmapped")),
+		buffersInUse(group.addGauge("buffers_in_use")),
+		pagesInUse(group.addGauge("pages_in_use"))
+	{}
+
+	MetricsGroup group;
+	MetricsCounter& buffersMapped;
+	MetricsCounter& buffersUnmapped;
+	MetricsCounter& pagesMapped;
+	MetricsCounter& pagesUnmapped;
+	MetricsCounter& buffersInUse;
+	MetricsCounter& pagesInUse;
+};
+
+GnttabMetrics& getMetrics()
+{
+	static GnttabMetrics sMetrics;
+
+	return sMetrics;
+}
+
+}
+
 /*******************************************************************************
  * XenGnttab
  ******************************************************************************/
@@ -100,6 +135,10 @@ void XenGnttabBuffer::init(domid_t domId, const grant_ref_t* refs,
 		throw XenGnttabException("Can't map buffer", errno);
 	}
 
+	getMetrics().buffersMapped.add();
+	getMetrics().pagesMapped.add(count);
+	getMetrics().buffersInUse.add();
+	getMetrics().pagesInUse.add(count);
 }
 
 void XenGnttabBuffer::release()
@@ -109,6 +148,11 @@ void XenGnttabBuffer::release()
 	if (mBuffer)
 	{
 		xengnttab_unmap(mHandle, mBuffer, mCount);
+
+		getMetrics().buffersUnmapped.add();
+		getMetrics().pagesUnmapped.add(mCount);
+		getMetrics().buffersInUse.sub();
+		getMetrics().pagesInUse.sub(mCount);
 	}
 }
 
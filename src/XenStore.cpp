@@ -19,10 +19,21 @@
  */
 #include "XenStore.hpp"
 
+#include <algorithm>
+#include <chrono>
+
 #include <poll.h>
 
+#include "CallbackMonitor.hpp"
+#include "Metrics.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
+using std::lower_bound;
 using std::mutex;
+using std::sort;
 using std::string;
 using std::thread;
 using std::to_string;
@@ -30,10 +41,134 @@ using std::vector;
 
 namespace XenBackend {
 
+/*******************************************************************************
+ * XenStoreTree
+ ******************************************************************************/
+
+namespace {
+
+// Compares paths component by component: '/' is ordered before any other
+// character, so the depth-first order with sorted children is ascending.
+int comparePath(const char* path1, const char* path2)
+{
+	for(; *path1 && *path1 == *path2; path1++, path2++) {}
+
+	auto rank = [](char c) -> unsigned int
+	{
+		return c == '/' ? 1 : (c ? static_cast<unsigned char>(c) + 1 : 0);
+	};
+
+	return static_cast<int>(rank(*path1)) - static_cast<int>(rank(*path2));
+}
+
+}
+
+const size_t XenStoreTree::npos;
+
+size_t XenStoreTree::find(const string& path) const
+{
+	auto it = lower_bound(mNodes.begin(), mNodes.end(), path,
+						  [this](const Node& node, const string& value)
+						  { return comparePath(&mArena[node.pathOffset],
+											   value.c_str()) < 0; });
+
+	if (it != mNodes.end() &&
+		comparePath(&mArena[it->pathOffset], path.c_str()) == 0)
+	{
+		return it - mNodes.begin();
+	}
+
+	return npos;
+}
+
+void XenStoreTree::clear(const string& rootPath)
+{
+	mRootPath = rootPath;
+	mNodes.clear();
+	mArena.clear();
+}
+
+void XenStoreTree::addNode(const string& path, const char* value,
+						   size_t length, unsigned int depth)
+{
+	Node node;
+
+	node.pathOffset = mArena.size();
+	mArena.insert(mArena.end(), path.begin(), path.end());
+	mArena.push_back('\0');
+
+	node.valueOffset = mArena.size();
+	mArena.insert(mArena.end(), value, value + length);
+	mArena.push_back('\0');
+
+	node.depth = depth;
+
+	mNodes.push_back(node);
+}
+
 /*******************************************************************************
  * XenStore
  ******************************************************************************/
 
+namespace {
+
+// Requests and latencies of all XenStore connections
+struct XenStoreMetrics
+{
+	XenStoreMetrics() :
+		group("xenstore"),
+		requests(group.addCounter("requests")),
+		errors(group.addCounter("errors")),
+		readLatency(group.addHistogram("read_latency")),
+		writeLatency(group.addHistogram("write_latency")),
+		removeLatency(group.addHistogram("remove_latency")),
+		directoryLatency(group.addHistogram("directory_latency")),
+		treeLatency(group.addHistogram("tree_latency"))
+	{}
+
+	MetricsGroup group;
+	MetricsCounter& requests;
+	MetricsCounter& errors;
+	LatencyHistogram& readLatency;
+	LatencyHistogram& writeLatency;
+	LatencyHistogram& removeLatency;
+	LatencyHistogram& directoryLatency;
+	LatencyHistogram& treeLatency;
+};
+
+XenStoreMetrics& getMetrics()
+{
+	static XenStoreMetrics sMetrics;
+
+	return sMetrics;
+}
+
+// Records the request latency when goes out of scope
+class RequestTimer
+{
+public:
+
+	explicit RequestTimer(LatencyHistogram& histogram) :
+		mHistogram(histogram),
+		mStart(steady_clock::now())
+	{
+		getMetrics().requests.add();
+	}
+
+	~RequestTimer()
+	{
+		mHistogram.record(duration_cast<nanoseconds>(
+				steady_clock::now() - mStart).count());
+	}
+
+private:
+
+	LatencyHistogram& mHistogram;
+	steady_clock::time_point mStart;
+};
+
+}
+
 XenStore::XenStore(ErrorCallback errorCallback) :
 	mXsHandle(nullptr),
 	mErrorCallback(errorCallback),
@@ -101,12 +236,16 @@ unsigned int XenStore::readUint(const string& path)
 
 string XenStore::readString(const string& path)
 {
+	RequestTimer timer(getMetrics().readLatency);
+
 	unsigned length;
 	auto pData = static_cast<char*>(xs_read(mXsHandle, XBT_NULL, path.c_str(),
 											&length));
 
 	if (!pData)
 	{
+		getMetrics().errors.add();
+
 		throw XenStoreException("Can't read from: " + path, errno);
 	}
 
@@ -141,9 +280,13 @@ void XenStore::writeString(const string& path, const string& value)
 {
 	LOG(mLog, DEBUG) << "Write string " << path << " : " << value;
 
+	RequestTimer timer(getMetrics().writeLatency);
+
 	if (!xs_write(mXsHandle, XBT_NULL, path.c_str(), value.c_str(),
 				  value.length()))
 	{
+		getMetrics().errors.add();
+
 		throw XenStoreException("Can't write value to " + path, errno);
 	}
 }
@@ -152,14 +295,20 @@ void XenStore::removePath(const string& path)
 {
 	LOG(mLog, DEBUG) << "Remove path " << path;
 
+	RequestTimer timer(getMetrics().removeLatency);
+
 	if (!xs_rm(mXsHandle, XBT_NULL, path.c_str()))
 	{
+		getMetrics().errors.add();
+
 		throw XenStoreException("Can't remove path " + path, errno);
 	}
 }
 
 vector<string> XenStore::readDirectory(const string& path)
 {
+	RequestTimer timer(getMetrics().directoryLatency);
+
 	unsigned int num;
 	auto items = xs_directory(mXsHandle, XBT_NULL, path.c_str(), &num);
 
@@ -182,8 +331,62 @@ vector<string> XenStore::readDirectory(const string& path)
 	return vector<string>();
 }
 
+XenStoreTree XenStore::readTree(const string& path, int depth)
+{
+	RequestTimer timer(getMetrics().treeLatency);
+
+	XenStoreTree tree;
+	string rootPath = path;
+
+	while (rootPath.length() > 1 && rootPath.back() == '/')
+	{
+		rootPath.pop_back();
+	}
+
+	for(int retry = 0; ; retry++)
+	{
+		auto transaction = xs_transaction_start(mXsHandle);
+
+		if (transaction == XBT_NULL)
+		{
+			throw XenStoreException("Can't start transaction", errno);
+		}
+
+		tree.clear(rootPath);
+
+		try
+		{
+			readTreeNode(transaction, rootPath, "", 0, depth, tree);
+		}
+		catch(const std::exception& e)
+		{
+			xs_transaction_end(mXsHandle, transaction, true);
+
+			throw;
+		}
+
+		if (xs_transaction_end(mXsHandle, transaction, false))
+		{
+			break;
+		}
+
+		if (errno != EAGAIN || retry >= cMaxTransactionRetries)
+		{
+			throw XenStoreException("Can't end transaction", errno);
+		}
+
+		LOG(mLog, DEBUG) << "Retry read tree: " << rootPath;
+	}
+
+	LOG(mLog, DEBUG) << "Read tree " << rootPath << ", nodes: " << tree.size();
+
+	return tree;
+}
+
 bool XenStore::checkIfExist(const string& path)
 {
+	RequestTimer timer(getMetrics().readLatency);
+
 	unsigned length;
 	auto pData = xs_read(mXsHandle, XBT_NULL, path.c_str(), &length);
 
@@ -348,12 +551,62 @@ XenStore::WatchCallback XenStore::getWatchCallback(const string& path)
 	return callback;
 }
 
+void XenStore::readTreeNode(xs_transaction_t transaction, const string& path,
+							const string& relPath, unsigned int depth,
+							int maxDepth, XenStoreTree& tree)
+{
+	unsigned int length;
+	auto pData = static_cast<char*>(xs_read(mXsHandle, transaction,
+											path.c_str(), &length));
+
+	if (!pData)
+	{
+		getMetrics().errors.add();
+
+		throw XenStoreException("Can't read from: " + path, errno);
+	}
+
+	tree.addNode(relPath, pData, length, depth);
+
+	free(pData);
+
+	if (maxDepth >= 0 && depth >= static_cast<unsigned int>(maxDepth))
+	{
+		return;
+	}
+
+	unsigned int num;
+	auto items = xs_directory(mXsHandle, transaction, path.c_str(), &num);
+
+	if (!items)
+	{
+		return;
+	}
+
+	vector<string> children(items, items + num);
+
+	free(items);
+
+	sort(children.begin(), children.end());
+
+	// the root path "/" already ends with the separator
+	auto dirPath = path.back() == '/' ? path : path + "/";
+
+	for(auto& child : children)
+	{
+		readTreeNode(transaction, dirPath + child,
+					 relPath.empty() ? child : relPath + "/" + child,
+					 depth + 1, maxDepth, tree);
+	}
+}
+
 void XenStore::watchesThread()
 {
 	try
 	{
 		while(mPollFd->poll())
 		{
+			auto readyTime = LatencyTracker::getTime();
 			string token;
 
 			auto path = readXsWatch(token);
@@ -366,7 +619,10 @@ void XenStore::watchesThread()
 				{
 					LOG(mLog, DEBUG) << "Watch triggered: " << token;
 
-					callback(token);
+					CallbackMonitor::Scope scope(CallbackSource::XenStoreWatch,
+												 readyTime, token);
+
+					callback(path);
 				}
 			}
 		}
@@ -379,7 +635,7 @@ void XenStore::watchesThread()
 		}
 		else
 		{
-			LOG(mLog, ERROR) << e.what();
+			RLOG(mLog, ERROR) << e.what();
 		}
 	}
 }
@@ -0,0 +1,665 @@
+/*
+ *  Asynchronous Xen Store client
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "XenStoreClient.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::future;
+using std::lock_guard;
+using std::make_exception_ptr;
+using std::make_shared;
+using std::mutex;
+using std::promise;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unordered_map;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * XenStoreClient
+ ******************************************************************************/
+
+XenStoreClient::XenStoreClient(const string& path) :
+	mFd(-1),
+	mReqId(0),
+	mLog("XenStoreClient")
+{
+	try
+	{
+		init(path.empty() ? getDefaultPath() : path);
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+XenStoreClient::~XenStoreClient()
+{
+	failPending(ECONNRESET);
+
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+size_t XenStoreClient::process()
+{
+	char buffer[XENSTORE_PAYLOAD_MAX];
+
+	while(true)
+	{
+		auto size = ::read(mFd, buffer, sizeof(buffer));
+
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+
+			auto error = errno;
+
+			failPending(error);
+
+			throw XenStoreException("Can't read from xenstored", error);
+		}
+
+		if (size == 0)
+		{
+			failPending(ECONNRESET);
+
+			throw XenStoreException("Connection to xenstored closed",
+									ECONNRESET);
+		}
+
+		mInBuffer.insert(mInBuffer.end(), buffer, buffer + size);
+	}
+
+	size_t offset = 0;
+	size_t numMessages = 0;
+
+	while (mInBuffer.size() - offset >= sizeof(xsd_sockmsg))
+	{
+		xsd_sockmsg msg;
+
+		memcpy(&msg, &mInBuffer[offset], sizeof(msg));
+
+		if (msg.len > XENSTORE_PAYLOAD_MAX)
+		{
+			failPending(EBADMSG);
+
+			throw XenStoreException("Invalid xenstored message length: " +
+									to_string(msg.len), EBADMSG);
+		}
+
+		if (mInBuffer.size() - offset < sizeof(msg) + msg.len)
+		{
+			break;
+		}
+
+		dispatch(msg, &mInBuffer[offset + sizeof(msg)]);
+
+		offset += sizeof(msg) + msg.len;
+		numMessages++;
+	}
+
+	mInBuffer.erase(mInBuffer.begin(), mInBuffer.begin() + offset);
+
+	// queued requests are written after the replies are read: xenstored
+	// replies to the written ones, so the descriptor becomes readable again
+	// until the queue is empty
+
+	int error = 0;
+
+	{
+		lock_guard<mutex> lock(mWriteMutex);
+
+		error = flush();
+	}
+
+	if (error)
+	{
+		failPending(error);
+
+		throw XenStoreException("Can't write to xenstored", error);
+	}
+
+	return numMessages;
+}
+
+size_t XenStoreClient::getNumPending()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mPending.size();
+}
+
+void XenStoreClient::read(const string& path, ReadCallback callback)
+{
+	send(XS_READ, path + '\0',
+		 [callback](int error, const char* payload, size_t length)
+		 { callback(error, error ? string() : string(payload, length)); });
+}
+
+void XenStoreClient::write(const string& path, const string& value,
+						   DoneCallback callback)
+{
+	send(XS_WRITE, path + '\0' + value,
+		 [callback](int error, const char* payload, size_t length)
+		 { callback(error); });
+}
+
+void XenStoreClient::remove(const string& path, DoneCallback callback)
+{
+	send(XS_RM, path + '\0',
+		 [callback](int error, const char* payload, size_t length)
+		 { callback(error); });
+}
+
+void XenStoreClient::readDirectory(const string& path,
+								   DirectoryCallback callback)
+{
+	send(XS_DIRECTORY, path + '\0',
+		 [callback](int error, const char* payload, size_t length)
+		 {
+			vector<string> items;
+
+			for(size_t pos = 0; !error && pos < length;)
+			{
+				auto item = string(payload + pos);
+
+				pos += item.length() + 1;
+
+				if (!item.empty())
+				{
+					items.push_back(item);
+				}
+			}
+
+			callback(error, items);
+		 });
+}
+
+void XenStoreClient::getDomainPath(domid_t domId, ReadCallback callback)
+{
+	send(XS_GET_DOMAIN_PATH, to_string(domId) + '\0',
+		 [callback](int error, const char* payload, size_t length)
+		 {
+			callback(error, error ? string() :
+							string(payload, strnlen(payload, length)));
+		 });
+}
+
+void XenStoreClient::setWatch(const string& path, WatchCallback callback,
+							  DoneCallback done)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mWatches[path] = callback;
+	}
+
+	LOG(mLog, DEBUG) << "Set watch: " << path;
+
+	send(XS_WATCH, path + '\0' + path + '\0',
+		 [this, path, done](int error, const char* payload, size_t length)
+		 {
+			if (error)
+			{
+				LOG(mLog, ERROR) << "Failed to set watch: " << path;
+
+				lock_guard<mutex> lock(mMutex);
+
+				mWatches.erase(path);
+			}
+
+			if (done)
+			{
+				done(error);
+			}
+		 });
+}
+
+void XenStoreClient::clearWatch(const string& path, DoneCallback done)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mWatches.erase(path);
+	}
+
+	LOG(mLog, DEBUG) << "Clear watch: " << path;
+
+	send(XS_UNWATCH, path + '\0' + path + '\0',
+		 [this, path, done](int error, const char* payload, size_t length)
+		 {
+			if (error)
+			{
+				LOG(mLog, ERROR) << "Failed to clear watch: " << path;
+			}
+
+			if (done)
+			{
+				done(error);
+			}
+		 });
+}
+
+future<string> XenStoreClient::read(const string& path)
+{
+	auto result = make_shared<promise<string>>();
+
+	read(path, [result, path](int error, const string& value)
+		 {
+			if (error)
+			{
+				result->set_exception(make_exception_ptr(
+						XenStoreException("Can't read from: " + path, error)));
+			}
+			else
+			{
+				result->set_value(value);
+			}
+		 });
+
+	return result->get_future();
+}
+
+future<void> XenStoreClient::write(const string& path, const string& value)
+{
+	auto result = make_shared<promise<void>>();
+
+	write(path, value, makeDone(result, "Can't write value to " + path));
+
+	return result->get_future();
+}
+
+future<void> XenStoreClient::remove(const string& path)
+{
+	auto result = make_shared<promise<void>>();
+
+	remove(path, makeDone(result, "Can't remove path " + path));
+
+	return result->get_future();
+}
+
+future<vector<string>> XenStoreClient::readDirectory(const string& path)
+{
+	auto result = make_shared<promise<vector<string>>>();
+
+	readDirectory(path,
+				  [result, path](int error, const vector<string>& items)
+				  {
+					if (error)
+					{
+						result->set_exception(make_exception_ptr(
+								XenStoreException("Can't read directory: " +
+												  path, error)));
+					}
+					else
+					{
+						result->set_value(items);
+					}
+				  });
+
+	return result->get_future();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenStoreClient::init(const string& path)
+{
+	struct stat pathStat;
+
+	if (stat(path.c_str(), &pathStat) < 0)
+	{
+		throw XenStoreException("Can't access xenstored: " + path, errno);
+	}
+
+	if (S_ISSOCK(pathStat.st_mode))
+	{
+		sockaddr_un addr {};
+
+		if (path.length() >= sizeof(addr.sun_path))
+		{
+			throw XenStoreException("Socket path is too long: " + path,
+									ENAMETOOLONG);
+		}
+
+		mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if (mFd < 0)
+		{
+			throw XenStoreException("Can't create socket", errno);
+		}
+
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path.c_str());
+
+		if (connect(mFd, reinterpret_cast<sockaddr*>(&addr),
+					sizeof(addr)) < 0)
+		{
+			throw XenStoreException("Can't connect to xenstored: " + path,
+									errno);
+		}
+	}
+	else
+	{
+		mFd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+		if (mFd < 0)
+		{
+			throw XenStoreException("Can't open xenbus: " + path, errno);
+		}
+	}
+
+	if (fcntl(mFd, F_SETFL, fcntl(mFd, F_GETFL) | O_NONBLOCK) < 0)
+	{
+		throw XenStoreException("Can't set non blocking mode", errno);
+	}
+
+	LOG(mLog, DEBUG) << "Create xen store client: " << path;
+}
+
+void XenStoreClient::release()
+{
+	if (mFd >= 0)
+	{
+		close(mFd);
+
+		mFd = -1;
+
+		LOG(mLog, DEBUG) << "Delete xen store client";
+	}
+}
+
+void XenStoreClient::send(xsd_sockmsg_type type, const string& payload,
+						  ReplyCallback callback)
+{
+	if (payload.length() > XENSTORE_PAYLOAD_MAX)
+	{
+		throw XenStoreException("Request is too long", E2BIG);
+	}
+
+	xsd_sockmsg msg {};
+
+	msg.type = type;
+	msg.len = payload.length();
+
+	// the request is registered before it is written, the reply may be
+	// processed by another thread as soon as xenstored reads the request
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		msg.req_id = ++mReqId;
+
+		mPending[msg.req_id] = callback;
+	}
+
+	int error = 0;
+
+	{
+		lock_guard<mutex> lock(mWriteMutex);
+
+		// xenbus device requires the whole message in one write, messages
+		// are queued whole
+		mOutBuffer.insert(mOutBuffer.end(), reinterpret_cast<char*>(&msg),
+						  reinterpret_cast<char*>(&msg) + sizeof(msg));
+		mOutBuffer.insert(mOutBuffer.end(), payload.begin(), payload.end());
+
+		error = flush();
+	}
+
+	if (error)
+	{
+		// this request is reported by the exception, other requests are
+		// completed with the error
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			mPending.erase(msg.req_id);
+		}
+
+		failPending(error);
+
+		throw XenStoreException("Can't write to xenstored", error);
+	}
+}
+
+int XenStoreClient::flush()
+{
+	size_t written = 0;
+
+	while (written < mOutBuffer.size())
+	{
+		auto size = ::write(mFd, mOutBuffer.data() + written,
+							mOutBuffer.size() - written);
+
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			// the rest is written when xenstored reads requests and the
+			// replies are processed
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+
+			mOutBuffer.clear();
+
+			return errno;
+		}
+
+		written += size;
+	}
+
+	mOutBuffer.erase(mOutBuffer.begin(), mOutBuffer.begin() + written);
+
+	return 0;
+}
+
+void XenStoreClient::failPending(int error)
+{
+	unordered_map<uint32_t, ReplyCallback> pending;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		pending.swap(mPending);
+	}
+
+	if (pending.size())
+	{
+		LOG(mLog, ERROR) << "Fail pending requests: " << pending.size()
+						 << ", error: " << error;
+	}
+
+	// callbacks are called without the lock: they may send new requests
+
+	for(auto& request : pending)
+	{
+		if (request.second)
+		{
+			request.second(error, nullptr, 0);
+		}
+	}
+}
+
+void XenStoreClient::dispatch(const xsd_sockmsg& msg, const char* payload)
+{
+	if (msg.type == XS_WATCH_EVENT)
+	{
+		dispatchWatch(payload, msg.len);
+
+		return;
+	}
+
+	ReplyCallback callback;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mPending.find(msg.req_id);
+
+		if (it == mPending.end())
+		{
+			RLOG(mLog, WARNING) << "Unexpected reply, id: " << msg.req_id;
+
+			return;
+		}
+
+		callback = it->second;
+
+		mPending.erase(it);
+	}
+
+	int error = 0;
+
+	if (msg.type == XS_ERROR)
+	{
+		error = getError(payload, msg.len);
+	}
+
+	if (callback)
+	{
+		callback(error, payload, msg.len);
+	}
+}
+
+void XenStoreClient::dispatchWatch(const char* payload, size_t length)
+{
+	auto pathLength = strnlen(payload, length);
+
+	if (pathLength == length)
+	{
+		RLOG(mLog, WARNING) << "Malformed watch event";
+
+		return;
+	}
+
+	string path(payload, pathLength);
+	string token(payload + pathLength + 1,
+				 strnlen(payload + pathLength + 1, length - pathLength - 1));
+
+	WatchCallback callback;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mWatches.find(token);
+
+		if (it == mWatches.end())
+		{
+			return;
+		}
+
+		callback = it->second;
+	}
+
+	LOG(mLog, DEBUG) << "Watch triggered: " << token << ", path: " << path;
+
+	if (callback)
+	{
+		callback(path);
+	}
+}
+
+string XenStoreClient::getDefaultPath()
+{
+	auto envPath = getenv("XENSTORED_PATH");
+
+	if (envPath)
+	{
+		return envPath;
+	}
+
+	string socketPath = "/var/run/xenstored/socket";
+
+	if (access(socketPath.c_str(), F_OK) == 0)
+	{
+		return socketPath;
+	}
+
+	return "/dev/xen/xenbus";
+}
+
+int XenStoreClient::getError(const char* payload, size_t length)
+{
+	string strError(payload, strnlen(payload, length));
+
+	for(auto& xsdError : xsd_errors)
+	{
+		if (strError == xsdError.errstring)
+		{
+			return xsdError.errnum;
+		}
+	}
+
+	return EINVAL;
+}
+
+XenStoreClient::DoneCallback XenStoreClient::makeDone(
+		shared_ptr<promise<void>> result, const string& msg)
+{
+	return [result, msg](int error)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException(msg, error)));
+		}
+		else
+		{
+			result->set_value();
+		}
+	};
+}
+
+}
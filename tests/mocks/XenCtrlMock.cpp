@@ -104,9 +104,23 @@ void XenCtrlMock::addDomInfo(const xc_domaininfo_t& info)
 	if (it != sDomInfos.end())
 	{
 		*it = info;
+
+		return;
 	}
 
-	sDomInfos.push_back(info);
+	it = find_if(sDomInfos.begin(), sDomInfos.end(),
+				 [&info](const xc_domaininfo_t& item)
+				 { return item.domain > info.domain; });
+
+	sDomInfos.insert(it, info);
+}
+
+void XenCtrlMock::removeDomInfo(domid_t domId)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	sDomInfos.remove_if([domId](const xc_domaininfo_t& item)
+						{ return item.domain == domId; });
 }
 
 int XenCtrlMock::getDomInfos(domid_t firstDom, unsigned int maxDoms,
@@ -118,12 +132,7 @@ int XenCtrlMock::getDomInfos(domid_t firstDom, unsigned int maxDoms,
 
 	auto it = find_if(sDomInfos.begin(), sDomInfos.end(),
 					 [&firstDom](const xc_domaininfo_t& item)
-					 { return item.domain == firstDom; });
-
-	if (it == sDomInfos.end())
-	{
-		it = sDomInfos.begin();
-	}
+					 { return item.domain >= firstDom; });
 
 	for(; it != sDomInfos.end(); it++)
 	{
@@ -46,6 +46,7 @@ public:
 	}
 
 	static void addDomInfo(const xc_domaininfo_t& info);
+	static void removeDomInfo(domid_t domId);
 	static int getDomInfos(domid_t firstDom, unsigned int maxDoms,
 						   xc_domaininfo_t* info);
 
@@ -24,6 +24,9 @@
 
 #include <cstdlib>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "Exception.hpp"
 
 using std::find_if;
@@ -40,6 +43,7 @@ using XenBackend::Exception;
 struct xenevtchn_handle
 {
 	XenEvtchnMock* mock;
+	int fd;
 };
 
 xenevtchn_handle* xenevtchn_open(struct xentoollog_logger* logger,
@@ -53,14 +57,50 @@ xenevtchn_handle* xenevtchn_open(struct xentoollog_logger* logger,
 				malloc(sizeof(xenevtchn_handle)));
 
 		xce->mock = new XenEvtchnMock();
+		xce->fd = -1;
 	}
 
 	return xce;
 }
 
+xenevtchn_handle* xenevtchn_fdopen(struct xentoollog_logger* logger,
+								   int fd, unsigned open_flags)
+{
+	if (XenEvtchnMock::getErrorMode())
+	{
+		return nullptr;
+	}
+
+	// the inherited descriptor refers to the pipe of the mock which has
+	// opened it, as a real descriptor refers to the same bindings
+
+	auto mock = XenEvtchnMock::getClientByFd(fd);
+
+	if (!mock)
+	{
+		errno = EBADF;
+
+		return nullptr;
+	}
+
+	auto xce = static_cast<xenevtchn_handle*>(malloc(sizeof(xenevtchn_handle)));
+
+	xce->mock = mock;
+	xce->fd = fd;
+
+	return xce;
+}
+
 int xenevtchn_close(xenevtchn_handle* xce)
 {
-	delete xce->mock;
+	if (xce->fd >= 0)
+	{
+		close(xce->fd);
+	}
+	else
+	{
+		delete xce->mock;
+	}
 
 	free(xce);
 
@@ -174,6 +214,30 @@ void XenEvtchnMock::signalPort(evtchn_port_t port)
 	client->mPipe.write();
 }
 
+XenEvtchnMock* XenEvtchnMock::getClientByFd(int fd)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	struct stat fdStat, clientStat;
+
+	if (fstat(fd, &fdStat) < 0)
+	{
+		return nullptr;
+	}
+
+	for(auto client : sClients)
+	{
+		if (fstat(client->getFd(), &clientStat) == 0 &&
+			clientStat.st_dev == fdStat.st_dev &&
+			clientStat.st_ino == fdStat.st_ino)
+		{
+			return client;
+		}
+	}
+
+	return nullptr;
+}
+
 void XenEvtchnMock::setNotifyCbk(evtchn_port_t port, NotifyCbk cbk)
 {
 	getClientByPort(port)->mNotifyCbk = cbk;
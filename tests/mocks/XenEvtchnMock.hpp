@@ -66,6 +66,7 @@ public:
 		return sLastBoundPort;
 	}
 	static void signalPort(evtchn_port_t port);
+	static XenEvtchnMock* getClientByFd(int fd);
 	static void setNotifyCbk(evtchn_port_t port, NotifyCbk cbk);
 
 	int getFd() const { return mPipe.getFd(); }
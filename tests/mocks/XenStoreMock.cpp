@@ -32,6 +32,7 @@ extern "C" {
 using std::find;
 using std::list;
 using std::lock_guard;
+using std::make_pair;
 using std::mutex;
 using std::string;
 using std::unordered_map;
@@ -206,6 +207,26 @@ bool xs_unwatch(xs_handle* h, const char* path, const char* token)
 	return h->mock->unwatch(path);
 }
 
+xs_transaction_t xs_transaction_start(xs_handle* h)
+{
+	if (XenStoreMock::getErrorMode())
+	{
+		return XBT_NULL;
+	}
+
+	return 1;
+}
+
+bool xs_transaction_end(xs_handle* h, xs_transaction_t t, bool abort)
+{
+	if (XenStoreMock::getErrorMode())
+	{
+		return false;
+	}
+
+	return true;
+}
+
 char **xs_read_watch(struct xs_handle *h, unsigned int *num)
 {
 	if (XenStoreMock::getErrorMode())
@@ -214,11 +235,12 @@ char **xs_read_watch(struct xs_handle *h, unsigned int *num)
 	}
 
 	char** value = nullptr;
-	string path;
+	string path, token;
 
-	while (h->mock->getChangedEntry(path))
+	if (h->mock->getChangedEntry(path, token))
 	{
-		size_t totalLength = 2 * sizeof(char*) + 2 * (path.length() + 1);
+		size_t totalLength = 2 * sizeof(char*) + path.length() + 1 +
+							 token.length() + 1;
 
 		value = static_cast<char**>(malloc(totalLength));
 		char* pos = reinterpret_cast<char*>(&value[2]);
@@ -229,7 +251,7 @@ char **xs_read_watch(struct xs_handle *h, unsigned int *num)
 
 		value[1] = pos + path.length() + 1;
 
-		strcpy(value[1], path.c_str());
+		strcpy(value[1], token.c_str());
 	}
 
 	return value;
@@ -244,9 +266,9 @@ char** xs_check_watch(xs_handle* h)
 	}
 
 	char** value = nullptr;
-	string path;
+	string path, token;
 
-	if (h->mock->getChangedEntry(path))
+	if (h->mock->getChangedEntry(path, token))
 	{
 		size_t totalLength = 2 * sizeof(char*) + path.length() + 1;
 
@@ -421,7 +443,10 @@ bool XenStoreMock::watch(const std::string& path)
 		mWatches.push_back(path);
 	}
 
-	pushWatch(path);
+	// the new watch is triggered once for this client only
+
+	mChangedEntries.push_back(make_pair(path, path));
+	mPipe.write();
 
 	return true;
 }
@@ -442,13 +467,14 @@ bool XenStoreMock::unwatch(const std::string& path)
 	return false;
 }
 
-bool XenStoreMock::getChangedEntry(std::string& path)
+bool XenStoreMock::getChangedEntry(std::string& path, std::string& token)
 {
 	lock_guard<mutex> lock(sMutex);
 
 	if (mChangedEntries.size())
 	{
-		path = mChangedEntries.front();
+		path = mChangedEntries.front().first;
+		token = mChangedEntries.front().second;
 
 		mChangedEntries.pop_front();
 
@@ -462,13 +488,20 @@ bool XenStoreMock::getChangedEntry(std::string& path)
 
 void XenStoreMock::pushWatch(const std::string& path)
 {
+	// as in Xen store, watches are recursive: the entry change triggers
+	// watches of the entry and of all its parents
+
 	for(auto client : sClients)
 	{
-		if (find(client->mWatches.begin(), client->mWatches.end(), path) !=
-			client->mWatches.end())
+		for(auto& watch : client->mWatches)
 		{
-			client->mChangedEntries.push_back(path);
-			client->mPipe.write();
+			if (path.compare(0, watch.length(), watch) == 0 &&
+				(path.length() == watch.length() ||
+				 path[watch.length()] == '/'))
+			{
+				client->mChangedEntries.push_back(make_pair(path, watch));
+				client->mPipe.write();
+			}
 		}
 	}
 }
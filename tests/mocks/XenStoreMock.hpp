@@ -59,7 +59,7 @@ public:
 	int getFd() const { return mPipe.getFd(); }
 	bool watch(const std::string& path);
 	bool unwatch(const std::string& path);
-	bool getChangedEntry(std::string& path);
+	bool getChangedEntry(std::string& path, std::string& token);
 
 	typedef std::function<void(const std::string& path,
 							   const std::string& value)> Callback;
@@ -83,7 +83,7 @@ private:
 	Pipe mPipe;
 
 	std::list<std::string> mWatches;
-	std::list<std::string> mChangedEntries;
+	std::list<std::pair<std::string, std::string>> mChangedEntries;
 
 	static void pushWatch(const std::string& path);
 };
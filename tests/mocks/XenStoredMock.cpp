@@ -0,0 +1,478 @@
+/*
+ *  XenStoredMock
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "XenStoredMock.hpp"
+
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Exception.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::vector;
+
+using XenBackend::Exception;
+
+/*******************************************************************************
+ * XenStoredMock
+ ******************************************************************************/
+
+XenStoredMock::XenStoredMock(const string& socketPath) :
+	mPath(socketPath),
+	mListenFd(-1),
+	mNumRequests(0)
+{
+	sockaddr_un addr {};
+
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, mPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	unlink(mPath.c_str());
+
+	mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (mListenFd < 0)
+	{
+		throw Exception("Can't create socket", errno);
+	}
+
+	if (bind(mListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+		listen(mListenFd, 16) < 0)
+	{
+		close(mListenFd);
+
+		throw Exception("Can't listen socket: " + mPath, errno);
+	}
+
+	mEntries["/local"] = "";
+	mEntries["/local/domain"] = "";
+
+	mThread = thread(&XenStoredMock::run, this);
+}
+
+XenStoredMock::~XenStoredMock()
+{
+	mPipe.write();
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	for(auto& connection : mConnections)
+	{
+		close(connection.fd);
+	}
+
+	close(mListenFd);
+
+	unlink(mPath.c_str());
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void XenStoredMock::writeValue(const string& path, const string& value)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	write(path, value);
+}
+
+bool XenStoredMock::readValue(const string& path, string& value)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mEntries.find(path);
+
+	if (it == mEntries.end())
+	{
+		return false;
+	}
+
+	value = it->second;
+
+	return true;
+}
+
+size_t XenStoredMock::getNumRequests()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mNumRequests;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenStoredMock::run()
+{
+	while(true)
+	{
+		vector<pollfd> fds;
+
+		fds.push_back({ mPipe.getFd(), POLLIN, 0 });
+		fds.push_back({ mListenFd, POLLIN, 0 });
+
+		for(auto& connection : mConnections)
+		{
+			fds.push_back({ connection.fd, POLLIN, 0 });
+		}
+
+		if (poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return;
+		}
+
+		if (fds[0].revents)
+		{
+			mPipe.read();
+
+			return;
+		}
+
+		if (fds[1].revents & POLLIN)
+		{
+			acceptConnection();
+		}
+
+		auto it = mConnections.begin();
+
+		for(size_t i = 2; i < fds.size(); i++)
+		{
+			if (fds[i].revents && !readConnection(*it))
+			{
+				close(it->fd);
+
+				lock_guard<mutex> lock(mMutex);
+
+				it = mConnections.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+}
+
+void XenStoredMock::acceptConnection()
+{
+	int fd = accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+	if (fd >= 0)
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mConnections.push_back(Connection { fd, {}, {} });
+	}
+}
+
+bool XenStoredMock::readConnection(Connection& connection)
+{
+	char buffer[65536];
+
+	auto size = read(connection.fd, buffer, sizeof(buffer));
+
+	if (size <= 0)
+	{
+		return false;
+	}
+
+	connection.buffer.insert(connection.buffer.end(), buffer, buffer + size);
+
+	size_t offset = 0;
+
+	lock_guard<mutex> lock(mMutex);
+
+	while (connection.buffer.size() - offset >= sizeof(xsd_sockmsg))
+	{
+		xsd_sockmsg msg;
+
+		memcpy(&msg, &connection.buffer[offset], sizeof(msg));
+
+		if (connection.buffer.size() - offset < sizeof(msg) + msg.len)
+		{
+			break;
+		}
+
+		string payload(&connection.buffer[offset + sizeof(msg)], msg.len);
+
+		handleRequest(connection, msg, payload.c_str());
+
+		offset += sizeof(msg) + msg.len;
+	}
+
+	connection.buffer.erase(connection.buffer.begin(),
+							connection.buffer.begin() + offset);
+
+	return true;
+}
+
+void XenStoredMock::handleRequest(Connection& connection,
+								  const xsd_sockmsg& msg, const char* payload)
+{
+	string path(payload);
+	string error;
+
+	mNumRequests++;
+
+	switch(msg.type)
+	{
+	case XS_READ:
+	{
+		auto it = mEntries.find(path);
+
+		if (it == mEntries.end())
+		{
+			error = "ENOENT";
+		}
+		else
+		{
+			reply(connection, msg.type, msg, it->second);
+		}
+
+		break;
+	}
+
+	case XS_WRITE:
+		write(path, string(payload + path.length() + 1,
+						   msg.len - path.length() - 1));
+		reply(connection, msg.type, msg, string("OK") + '\0');
+
+		break;
+
+	case XS_MKDIR:
+		if (mEntries.find(path) == mEntries.end())
+		{
+			write(path, "");
+		}
+
+		reply(connection, msg.type, msg, string("OK") + '\0');
+
+		break;
+
+	case XS_RM:
+		if (remove(path))
+		{
+			reply(connection, msg.type, msg, string("OK") + '\0');
+		}
+		else
+		{
+			error = "ENOENT";
+		}
+
+		break;
+
+	case XS_DIRECTORY:
+		if (mEntries.find(path) == mEntries.end())
+		{
+			error = "ENOENT";
+		}
+		else
+		{
+			reply(connection, msg.type, msg, directory(path));
+		}
+
+		break;
+
+	case XS_WATCH:
+	{
+		string token(payload + path.length() + 1);
+
+		connection.watches.push_back(make_pair(path, token));
+
+		reply(connection, msg.type, msg, string("OK") + '\0');
+
+		sendWatchEvent(connection, path, token);
+
+		break;
+	}
+
+	case XS_UNWATCH:
+	{
+		string token(payload + path.length() + 1);
+
+		connection.watches.remove(make_pair(path, token));
+
+		reply(connection, msg.type, msg, string("OK") + '\0');
+
+		break;
+	}
+
+	case XS_GET_DOMAIN_PATH:
+		reply(connection, msg.type, msg, "/local/domain/" + path + '\0');
+
+		break;
+
+	case XS_TRANSACTION_START:
+		reply(connection, msg.type, msg, string("1") + '\0');
+
+		break;
+
+	case XS_TRANSACTION_END:
+		reply(connection, msg.type, msg, string("OK") + '\0');
+
+		break;
+
+	default:
+		error = "EINVAL";
+
+		break;
+	}
+
+	if (!error.empty())
+	{
+		reply(connection, XS_ERROR, msg, error + '\0');
+	}
+}
+
+void XenStoredMock::reply(Connection& connection, uint32_t type,
+						  const xsd_sockmsg& msg, const string& payload)
+{
+	xsd_sockmsg header = msg;
+
+	header.type = type;
+	header.len = payload.length();
+
+	string buffer(reinterpret_cast<char*>(&header), sizeof(header));
+
+	buffer += payload;
+
+	size_t written = 0;
+
+	while (written < buffer.length())
+	{
+		auto size = ::write(connection.fd, buffer.data() + written,
+							buffer.length() - written);
+
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return;
+		}
+
+		written += size;
+	}
+}
+
+void XenStoredMock::write(const string& path, const string& value)
+{
+	for(auto pos = path.find('/', 1); pos != string::npos;
+		pos = path.find('/', pos + 1))
+	{
+		auto parent = path.substr(0, pos);
+
+		if (mEntries.find(parent) == mEntries.end())
+		{
+			mEntries[parent] = "";
+		}
+	}
+
+	mEntries[path] = value;
+
+	fireWatches(path);
+}
+
+bool XenStoredMock::remove(const string& path)
+{
+	auto it = mEntries.find(path);
+
+	if (it == mEntries.end())
+	{
+		return false;
+	}
+
+	it = mEntries.erase(it);
+
+	auto prefix = path + "/";
+
+	while (it != mEntries.end() &&
+		   it->first.compare(0, prefix.length(), prefix) == 0)
+	{
+		it = mEntries.erase(it);
+	}
+
+	fireWatches(path);
+
+	return true;
+}
+
+string XenStoredMock::directory(const string& path)
+{
+	string result;
+	auto prefix = path + "/";
+
+	for(auto it = mEntries.lower_bound(prefix);
+		it != mEntries.end() &&
+		it->first.compare(0, prefix.length(), prefix) == 0; it++)
+	{
+		auto name = it->first.substr(prefix.length());
+
+		if (name.find('/') == string::npos)
+		{
+			result += name + '\0';
+		}
+	}
+
+	return result;
+}
+
+void XenStoredMock::fireWatches(const string& path)
+{
+	for(auto& connection : mConnections)
+	{
+		for(auto& watch : connection.watches)
+		{
+			if (path == watch.first ||
+				path.compare(0, watch.first.length() + 1,
+							 watch.first + "/") == 0)
+			{
+				sendWatchEvent(connection, path, watch.second);
+			}
+		}
+	}
+}
+
+void XenStoredMock::sendWatchEvent(Connection& connection, const string& path,
+								   const string& token)
+{
+	xsd_sockmsg msg {};
+
+	reply(connection, XS_WATCH_EVENT, msg, path + '\0' + token + '\0');
+}
@@ -0,0 +1,90 @@
+/*
+ *  XenStoredMock
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef TESTS_MOCKS_XENSTOREDMOCK_HPP_
+#define TESTS_MOCKS_XENSTOREDMOCK_HPP_
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <xen/io/xs_wire.h>
+}
+
+#include "Pipe.hpp"
+
+/*
+ * Local stand-in xenstored: serves the xenstored wire protocol on a unix
+ * socket. Supports read, write, mkdir, rm, directory, watches, domain path
+ * and trivial transactions.
+ */
+class XenStoredMock
+{
+public:
+
+	explicit XenStoredMock(const std::string& socketPath);
+	~XenStoredMock();
+
+	const std::string& getPath() const { return mPath; }
+
+	void writeValue(const std::string& path, const std::string& value);
+	bool readValue(const std::string& path, std::string& value);
+
+	size_t getNumRequests();
+
+private:
+
+	struct Connection
+	{
+		int fd;
+		std::vector<char> buffer;
+		std::list<std::pair<std::string, std::string>> watches;
+	};
+
+	std::string mPath;
+	int mListenFd;
+	Pipe mPipe;
+	std::thread mThread;
+	std::mutex mMutex;
+	size_t mNumRequests;
+
+	std::map<std::string, std::string> mEntries;
+	std::list<Connection> mConnections;
+
+	void run();
+	void acceptConnection();
+	bool readConnection(Connection& connection);
+	void handleRequest(Connection& connection, const xsd_sockmsg& msg,
+					   const char* payload);
+	void reply(Connection& connection, uint32_t type, const xsd_sockmsg& msg,
+			   const std::string& payload);
+	void write(const std::string& path, const std::string& value);
+	bool remove(const std::string& path);
+	std::string directory(const std::string& path);
+	void fireWatches(const std::string& path);
+	void sendWatchEvent(Connection& connection, const std::string& path,
+						const std::string& token);
+};
+
+#endif /* TESTS_MOCKS_XENSTOREDMOCK_HPP_ */
@@ -0,0 +1,344 @@
+/*
+ *  Test AsyncLog
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "AsyncLog.hpp"
+#include "Log.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::filebuf;
+using std::ifstream;
+using std::istringstream;
+using std::regex;
+using std::regex_match;
+using std::streambuf;
+using std::string;
+using std::thread;
+using std::this_thread::sleep_for;
+using std::to_string;
+using std::vector;
+
+using XenBackend::AsyncLog;
+using XenBackend::AsyncLogException;
+using XenBackend::Log;
+
+static string getLogPath()
+{
+	return "/tmp/xenbe_test_" + to_string(getpid()) + ".log";
+}
+
+static vector<string> readLines(const string& path, const string& pattern)
+{
+	ifstream file(path);
+	vector<string> lines;
+	string line;
+
+	while (getline(file, line))
+	{
+		if (line.find(pattern) != string::npos)
+		{
+			lines.push_back(line);
+		}
+	}
+
+	return lines;
+}
+
+TEST_CASE("AsyncLog", "[asynclog]")
+{
+	// the log mask disables log instances in tests, so the name is used
+
+	const char* log = "AsyncLogTest";
+
+	SECTION("Check not started")
+	{
+		string line = "line\n";
+
+		REQUIRE_FALSE(AsyncLog::isRunning());
+		REQUIRE_FALSE(AsyncLog::push(line));
+		REQUIRE(line == "line\n");
+	}
+
+	SECTION("Check threads")
+	{
+		auto fd = open(getLogPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+					   0644);
+
+		REQUIRE(fd >= 0);
+
+		AsyncLog::start(fd, 16);
+
+		REQUIRE(AsyncLog::isRunning());
+		REQUIRE_THROWS_AS(AsyncLog::start(fd), AsyncLogException);
+
+		const int cNumThreads = 4;
+		const int cNumLines = 1000;
+
+		vector<thread> threads;
+
+		for(int i = 0; i < cNumThreads; i++)
+		{
+			threads.emplace_back([log, i, cNumLines] {
+				for(int j = 0; j < cNumLines; j++)
+				{
+					LOG(log, INFO) << "thread: " << i << " line: " << j;
+				}
+			});
+		}
+
+		for(auto& t : threads)
+		{
+			t.join();
+		}
+
+		AsyncLog::flush();
+
+		REQUIRE(readLines(getLogPath(), "AsyncLogTest").size() ==
+				cNumThreads * cNumLines);
+
+		AsyncLog::stop();
+
+		REQUIRE_FALSE(AsyncLog::isRunning());
+
+		close(fd);
+
+		// lines of each thread are written in order
+
+		vector<int> next(cNumThreads, 0);
+
+		for(auto& line : readLines(getLogPath(), "AsyncLogTest"))
+		{
+			istringstream stream(line.substr(line.find("thread:")));
+			string label;
+			int threadIndex, lineIndex;
+
+			stream >> label >> threadIndex >> label >> lineIndex;
+
+			REQUIRE(lineIndex == next[threadIndex]++);
+		}
+	}
+
+	SECTION("Check format")
+	{
+		auto fd = open(getLogPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+					   0644);
+
+		REQUIRE(fd >= 0);
+
+		AsyncLog::start(fd);
+
+		LOG(log, INFO) << "first";
+		LOG(log, WARNING) << "second";
+
+		AsyncLog::stop();
+
+		close(fd);
+
+		auto lines = readLines(getLogPath(), "AsyncLogTest");
+
+		REQUIRE(lines.size() == 2);
+
+		regex format("\\d{2}\\.\\d{2}\\.\\d{2} \\d{2}:\\d{2}:\\d{2}\\.\\d{3} "
+					 "\\| AsyncLogTest +\\| (INF|WRN) - (first|second)");
+
+		REQUIRE(regex_match(lines[0], format));
+		REQUIRE(regex_match(lines[1], format));
+		REQUIRE(lines[1].find("| WRN - second") != string::npos);
+	}
+
+	SECTION("Check drop")
+	{
+		int fds[2];
+
+		REQUIRE(pipe(fds) == 0);
+
+		auto numDropped = AsyncLog::getNumDropped();
+
+		AsyncLog::start(fds[1], 4, AsyncLog::OverflowMode::Drop);
+
+		// nobody reads the pipe, so the writer blocks and the queue is full
+
+		const int cNumLines = 10000;
+
+		for(int i = 0; i < cNumLines; i++)
+		{
+			LOG(log, INFO) << "line: " << i;
+		}
+
+		auto dropped = AsyncLog::getNumDropped() - numDropped;
+
+		REQUIRE(dropped > 0);
+
+		string output;
+
+		thread reader([&output, &fds] {
+			char buffer[4096];
+			ssize_t size;
+
+			while ((size = read(fds[0], buffer, sizeof(buffer))) > 0)
+			{
+				output.append(buffer, size);
+			}
+		});
+
+		AsyncLog::stop();
+
+		close(fds[1]);
+
+		reader.join();
+
+		close(fds[0]);
+
+		size_t numLines = 0;
+		size_t pos = 0;
+
+		while ((pos = output.find("AsyncLogTest", pos)) != string::npos)
+		{
+			numLines++;
+			pos++;
+		}
+
+		REQUIRE(numLines + dropped == cNumLines);
+		REQUIRE(output.find("log lines dropped") != string::npos);
+	}
+
+	SECTION("Check suppressed summary")
+	{
+		auto fd = open(getLogPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+					   0644);
+
+		REQUIRE(fd >= 0);
+
+		AsyncLog::start(fd);
+
+		for(size_t i = 0; i < 2 * Log::getDefaultRateLimit(); i++)
+		{
+			RLOG(log, INFO) << "repeated";
+		}
+
+		// the statement doesn't fire again: the writer logs the summary
+		// after the second is over
+
+		auto getSummaries = []
+		{
+			vector<string> summaries;
+
+			for(auto& line : readLines(getLogPath(), "AsyncLogTest"))
+			{
+				if (line.find("| INF - suppressed ") != string::npos)
+				{
+					summaries.push_back(line);
+				}
+			}
+
+			return summaries;
+		};
+
+		for(int i = 0; i < 300 && getSummaries().empty(); i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		auto lines = getSummaries();
+
+		AsyncLog::stop();
+
+		close(fd);
+
+		REQUIRE(lines.size() == 1);
+	}
+
+	remove(getLogPath().c_str());
+}
+
+TEST_CASE("AsyncLogBenchmark", "[.benchmark]")
+{
+	const char* log = "AsyncLogBenchmark";
+	filebuf devNull;
+
+	devNull.open("/dev/null", std::ios::out);
+
+	auto fd = open("/dev/null", O_WRONLY);
+
+	const int cNumThreads = 4;
+	const int cNumLines = 50000;
+
+	auto measure = [log, cNumThreads, cNumLines]()
+	{
+		vector<thread> threads;
+
+		auto start = steady_clock::now();
+
+		for(int i = 0; i < cNumThreads; i++)
+		{
+			threads.emplace_back([log, cNumLines] {
+				for(int j = 0; j < cNumLines; j++)
+				{
+					LOG(log, INFO) << "Benchmark line: " << j;
+				}
+			});
+		}
+
+		for(auto& t : threads)
+		{
+			t.join();
+		}
+
+		return duration_cast<nanoseconds>(steady_clock::now() - start).count() /
+			   (cNumThreads * cNumLines);
+	};
+
+	streambuf* saved = std::cout.rdbuf();
+
+	Log::setStreamBuffer(&devNull);
+
+	auto syncTime = measure();
+
+	AsyncLog::start(fd);
+
+	auto asyncTime = measure();
+
+	AsyncLog::stop();
+
+	Log::setStreamBuffer(saved);
+
+	close(fd);
+
+	cout << "Sync log: " << syncTime << " ns/line, async log: "
+		 << asyncTime << " ns/line" << endl;
+}
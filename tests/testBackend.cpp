@@ -4,7 +4,12 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <iostream>
+#include <map>
 #include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "catch.hpp"
 
@@ -16,13 +21,26 @@
 #include "testBackend.hpp"
 #include "testFrontendHandler.hpp"
 
+using std::chrono::duration_cast;
 using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::condition_variable;
+using std::cout;
+using std::endl;
+using std::make_pair;
+using std::map;
 using std::mutex;
+using std::pair;
+using std::set;
 using std::string;
+using std::this_thread::sleep_for;
 using std::to_string;
 using std::unique_lock;
+using std::vector;
 
+using XenBackend::BackendBase;
+using XenBackend::FrontendChanges;
+using XenBackend::FrontendSnapshot;
 using XenBackend::FrontendHandlerPtr;
 using XenBackend::Log;
 using XenBackend::LogLevel;
@@ -76,11 +94,18 @@ bool waitForFrontend()
 
 TEST_CASE("BackendHandler", "[backendhandler]")
 {
+	XenCtrlMock::setErrorMode(false);
 	XenEvtchnMock::setErrorMode(false);
 	XenGnttabMock::setErrorMode(false);
 	XenStoreMock::setErrorMode(false);
 	XenStoreMock::setWriteValueCbk(nullptr);
 
+	xc_domaininfo_t info = {};
+
+	info.domain = gFrontDomId;
+
+	XenCtrlMock::addDomInfo(info);
+
 	TestFrontendHandler::prepareXenStore(gDevName,
 										 gDomId, gFrontDomId,
 										 gFrontDevId);
@@ -108,6 +133,388 @@ TEST_CASE("BackendHandler", "[backendhandler]")
 	}
 
 	testBackend.stop();
+
+	XenCtrlMock::removeDomInfo(gFrontDomId);
+}
+
+class ScaleBackend : public BackendBase
+{
+public:
+
+	ScaleBackend(const string& devName, size_t numWorkers = 0,
+				 milliseconds bringUpTime = milliseconds(0)) :
+		BackendBase("ScaleBackend", devName, numWorkers),
+		mBringUpTime(bringUpTime)
+	{}
+
+	size_t getNumFrontends()
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		return mFrontends.size();
+	}
+
+	size_t getNumBatches()
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		return mNumBatches;
+	}
+
+	size_t getNumCalls(domid_t domId, uint16_t devId)
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		return mNumCalls[make_pair(domId, devId)];
+	}
+
+	FrontendSnapshot getSnapshot() const { return getFrontendSnapshot(); }
+
+	bool waitForFrontends(size_t numFrontends)
+	{
+		for(int i = 0; i < 1000 && getNumFrontends() < numFrontends; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		return getNumFrontends() == numFrontends;
+	}
+
+private:
+
+	milliseconds mBringUpTime;
+	mutex mMutex;
+	set<pair<domid_t, uint16_t>> mFrontends;
+	map<pair<domid_t, uint16_t>, size_t> mNumCalls;
+	size_t mNumBatches = 0;
+
+	void onNewFrontend(domid_t domId, uint16_t devId) override
+	{
+		// simulates mapping and Xen store reads of the real frontend
+		sleep_for(mBringUpTime);
+
+		unique_lock<mutex> lock(mMutex);
+
+		mFrontends.insert(make_pair(domId, devId));
+		mNumCalls[make_pair(domId, devId)]++;
+	}
+
+	void onFrontendsChanged(const FrontendChanges& changes) override
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		mNumBatches++;
+	}
+};
+
+static string getScalePath(const string& devName, int domId, int devId)
+{
+	return "/local/domain/" + to_string(gDomId) + "/backend/" + devName +
+		   "/" + to_string(domId) + "/" + to_string(devId) + "/frontend";
+}
+
+static void prepareScale(const string& devName, int numDomains, int numDevices)
+{
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	XenCtrlMock::setErrorMode(false);
+
+	XenStoreMock::writeValue("domid", to_string(gDomId));
+	XenStoreMock::setDomainPath(gDomId, "/local/domain/" + to_string(gDomId));
+
+	for(int domId = 1; domId <= numDomains; domId++)
+	{
+		xc_domaininfo_t info = {};
+
+		info.domain = domId;
+
+		XenCtrlMock::addDomInfo(info);
+
+		for(int devId = 0; devId < numDevices; devId++)
+		{
+			XenStoreMock::writeValue(getScalePath(devName, domId, devId), "");
+		}
+	}
+}
+
+static void cleanupScale(const string& devName, int numDomains, int numDevices)
+{
+	for(int domId = 1; domId <= numDomains; domId++)
+	{
+		XenCtrlMock::removeDomInfo(domId);
+
+		for(int devId = 0; devId < numDevices; devId++)
+		{
+			XenStoreMock::deleteEntry(getScalePath(devName, domId, devId));
+		}
+	}
+}
+
+TEST_CASE("BackendScale", "[backendhandler]")
+{
+	const int cNumDomains = 64;
+	const int cNumDevices = 64;
+	const string cDevName = "scale_device";
+
+	prepareScale(cDevName, cNumDomains, cNumDevices);
+
+	SECTION("Check discovery")
+	{
+		ScaleBackend backend(cDevName);
+
+		backend.start();
+
+		REQUIRE(backend.waitForFrontends(cNumDomains * cNumDevices));
+
+		backend.stop();
+	}
+
+	SECTION("Check parallel discovery")
+	{
+		ScaleBackend backend(cDevName, 8);
+
+		backend.start();
+
+		REQUIRE(backend.waitForFrontends(cNumDomains * cNumDevices));
+
+		backend.stop();
+	}
+
+	SECTION("Check incremental changes")
+	{
+		ScaleBackend backend(cDevName);
+
+		backend.start();
+
+		REQUIRE(backend.waitForFrontends(cNumDomains * cNumDevices));
+
+		auto snapshot = backend.getSnapshot();
+
+		REQUIRE(snapshot.frontends.size() == cNumDomains * cNumDevices);
+
+		// domain list and every domain device list
+		auto numBatches = backend.getNumBatches();
+
+		REQUIRE(numBatches == cNumDomains + 1);
+
+		// nothing changed: no batch is produced
+		XenStoreMock::writeValue("@introduceDomain", "");
+		XenStoreMock::writeValue("@releaseDomain", "");
+
+		sleep_for(milliseconds(50));
+
+		REQUIRE(backend.getNumBatches() == numBatches);
+		REQUIRE(backend.getSnapshot().version == snapshot.version);
+
+		XenCtrlMock::removeDomInfo(1);
+		XenStoreMock::writeValue("@releaseDomain", "");
+
+		for(int i = 0; i < 100 && backend.getNumBatches() == numBatches; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		snapshot = backend.getSnapshot();
+
+		REQUIRE(snapshot.frontends.size() == (cNumDomains - 1) * cNumDevices);
+		REQUIRE(snapshot.frontends.front().first == 2);
+
+		backend.stop();
+	}
+
+	SECTION("Check notifying frontends without handler")
+	{
+		ScaleBackend backend(cDevName);
+
+		backend.start();
+
+		REQUIRE(backend.waitForFrontends(cNumDomains * cNumDevices));
+		REQUIRE(backend.getNumCalls(1, 0) == 1);
+
+		// only the changed device is notified: the new one and the one
+		// without handler whose entry is changed
+
+		auto numBatches = backend.getNumBatches();
+
+		XenStoreMock::writeValue(getScalePath(cDevName, 1, cNumDevices), "");
+
+		REQUIRE(backend.waitForFrontends(cNumDomains * cNumDevices + 1));
+		REQUIRE(backend.getNumBatches() == numBatches + 1);
+
+		XenStoreMock::writeValue(getScalePath(cDevName, 1, 0), "");
+
+		for(int i = 0; i < 100 && backend.getNumCalls(1, 0) < 2; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(backend.getNumCalls(1, 0) == 2);
+		REQUIRE(backend.getNumCalls(1, 1) == 1);
+		REQUIRE(backend.getNumCalls(1, cNumDevices) == 1);
+		REQUIRE(backend.getNumCalls(2, 0) == 1);
+
+		backend.stop();
+
+		XenStoreMock::deleteEntry(getScalePath(cDevName, 1, cNumDevices));
+	}
+
+	cleanupScale(cDevName, cNumDomains, cNumDevices);
+}
+
+class ShardBackend : public BackendBase
+{
+public:
+
+	ShardBackend(const string& devName, size_t numShards) :
+		BackendBase("ShardBackend", devName, 0, numShards),
+		mDevName(devName)
+	{}
+
+	FrontendHandlerPtr getFrontend(domid_t domId)
+	{
+		for(auto frontend : getFrontendHandlers())
+		{
+			if (frontend->getDomId() == domId)
+			{
+				return frontend;
+			}
+		}
+
+		return FrontendHandlerPtr();
+	}
+
+	bool waitForFrontends(size_t numFrontends)
+	{
+		for(int i = 0; i < 100 && getFrontendHandlers().size() < numFrontends;
+			i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		return getFrontendHandlers().size() == numFrontends;
+	}
+
+	vector<ShardLoad> mLoads;
+
+private:
+
+	string mDevName;
+
+	void onNewFrontend(domid_t domId, uint16_t devId) override
+	{
+		addFrontendHandler(FrontendHandlerPtr(
+				new TestFrontendHandler(mDevName, getDomId(), domId, devId)));
+	}
+
+	void onRebalance(const vector<ShardLoad>& loads) override
+	{
+		mLoads = loads;
+	}
+};
+
+TEST_CASE("BackendShards", "[backendhandler]")
+{
+	const int cNumDomains = 4;
+	const string cDevName = "shard_device";
+
+	XenCtrlMock::setErrorMode(false);
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	for(int domId = 1; domId <= cNumDomains; domId++)
+	{
+		xc_domaininfo_t info = {};
+
+		info.domain = domId;
+
+		XenCtrlMock::addDomInfo(info);
+
+		TestFrontendHandler::prepareXenStore(cDevName, gDomId, domId, 0);
+	}
+
+	ShardBackend backend(cDevName, 2);
+
+	backend.start();
+
+	REQUIRE(backend.getNumShards() == 2);
+	REQUIRE(backend.waitForFrontends(cNumDomains));
+
+	SECTION("Check domain shards")
+	{
+		REQUIRE(backend.getShard(1) == 1);
+		REQUIRE(backend.getShard(2) == 0);
+
+		REQUIRE(backend.getFrontend(1)->getReactor());
+		REQUIRE(backend.getFrontend(1)->getReactor() ==
+				backend.getFrontend(3)->getReactor());
+		REQUIRE(backend.getFrontend(1)->getReactor() !=
+				backend.getFrontend(2)->getReactor());
+	}
+
+	SECTION("Check move domain")
+	{
+		backend.moveDomain(1, 0);
+
+		REQUIRE(backend.getShard(1) == 0);
+		REQUIRE(backend.getFrontend(1)->getReactor() ==
+				backend.getFrontend(2)->getReactor());
+
+		REQUIRE_THROWS(backend.moveDomain(1, 2));
+	}
+
+	SECTION("Check rebalance")
+	{
+		backend.moveDomain(3, 0);
+
+		backend.rebalance();
+
+		REQUIRE(backend.mLoads.size() == 2);
+		REQUIRE(backend.mLoads[0].domains.size() == 3);
+		REQUIRE(backend.mLoads[1].domains.size() == 1);
+		REQUIRE(backend.mLoads[1].domains.count(1) == 1);
+	}
+
+	backend.stop();
+
+	for(int domId = 1; domId <= cNumDomains; domId++)
+	{
+		XenCtrlMock::removeDomInfo(domId);
+
+		XenStoreMock::deleteEntry("/local/domain/" + to_string(gDomId) +
+								  "/backend/" + cDevName + "/" +
+								  to_string(domId) + "/0/frontend");
+	}
+}
+
+TEST_CASE("BackendBringUpBenchmark", "[.benchmark]")
+{
+	const int cNumDomains = 100;
+	const string cDevName = "bringup_device";
+
+	prepareScale(cDevName, cNumDomains, 1);
+
+	for(size_t numWorkers : { 0, 4, 16 })
+	{
+		ScaleBackend backend(cDevName, numWorkers, milliseconds(5));
+
+		auto start = steady_clock::now();
+
+		backend.start();
+
+		REQUIRE(backend.waitForFrontends(cNumDomains));
+
+		auto time = duration_cast<milliseconds>(steady_clock::now() - start);
+
+		cout << "Frontends: " << cNumDomains << ", workers: " << numWorkers
+			 << ", bring up: " << time.count() << " ms" << endl;
+
+		backend.stop();
+	}
+
+	cleanupScale(cDevName, cNumDomains, 1);
 }
 
 int main( int argc, char* argv[] )
@@ -0,0 +1,234 @@
+/*
+ *  Test BinaryLog
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "AsyncLog.hpp"
+#include "BinaryLog.hpp"
+#include "Log.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::filebuf;
+using std::ifstream;
+using std::ofstream;
+using std::ostringstream;
+using std::streambuf;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::vector;
+
+using XenBackend::AsyncLog;
+using XenBackend::BinaryLog;
+using XenBackend::BinaryLogEntry;
+using XenBackend::BinaryLogException;
+using XenBackend::Log;
+using XenBackend::LogLevel;
+
+static string getLogPath()
+{
+	return "/tmp/xenbe_test_" + to_string(getpid()) + ".blog";
+}
+
+TEST_CASE("BinaryLog", "[binarylog]")
+{
+	SECTION("Check binary")
+	{
+		Log::setLogMask("BinaryLogTest:DEBUG:binary");
+
+		Log log("BinaryLogTest");
+
+		REQUIRE(log.isBinary());
+
+		BinaryLog::open(getLogPath());
+
+		REQUIRE(BinaryLog::isOpen());
+		REQUIRE_THROWS_AS(BinaryLog::open(getLogPath()), BinaryLogException);
+
+		string name = "abc";
+		int line = 0;
+
+		BLOG(log, DEBUG, "port: {}, prod: {}, name: {}", 5u, -3, name);
+		line = __LINE__ - 1;
+
+		uint32_t threadId = 0;
+
+		thread t([&log, &threadId] {
+			threadId = syscall(SYS_gettid);
+
+			BLOG(log, WARNING, "thread: {}, value: {}", "other", 1.5);
+		});
+
+		t.join();
+
+		BLOG(log, INFO, "no arguments");
+
+		// disabled level is never logged, as by LOG()
+		BLOG(log, DISABLE, "disabled");
+
+		BinaryLog::close();
+
+		REQUIRE_FALSE(BinaryLog::isOpen());
+
+		auto entries = BinaryLog::read(getLogPath());
+
+		REQUIRE(entries.size() == 3);
+
+		REQUIRE(entries[0].message == "port: 5, prod: -3, name: abc");
+		REQUIRE(entries[0].level == LogLevel::logDEBUG);
+		REQUIRE(entries[0].line == line);
+		REQUIRE(entries[0].file == "testBinaryLog.cpp");
+		REQUIRE(entries[0].threadId == syscall(SYS_gettid));
+
+		REQUIRE(entries[1].message == "thread: other, value: 1.5");
+		REQUIRE(entries[1].level == LogLevel::logWARNING);
+		REQUIRE(entries[1].threadId == threadId);
+
+		REQUIRE(entries[2].message == "no arguments");
+		REQUIRE(entries[2].timestamp >= entries[0].timestamp);
+
+		ostringstream stream;
+
+		BinaryLog::print(entries, stream);
+
+		REQUIRE(stream.str().find("| testBinaryLog.cpp " + to_string(line) +
+								  " | DBG - port: 5") != string::npos);
+
+		// sites are defined again in the new file
+
+		BinaryLog::open(getLogPath());
+
+		BLOG(log, DEBUG, "port: {}, prod: {}, name: {}", 6u, -4, name);
+
+		BinaryLog::close();
+
+		entries = BinaryLog::read(getLogPath());
+
+		REQUIRE(entries.size() == 1);
+		REQUIRE(entries[0].message == "port: 6, prod: -4, name: abc");
+
+		Log::setLogMask("BinaryLogTest:Disable");
+	}
+
+	SECTION("Check text")
+	{
+		// the log mask disables log instances in tests, so the name is used
+
+		const char* log = "BinaryLogTest";
+		auto fd = open(getLogPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+					   0644);
+
+		REQUIRE(fd >= 0);
+
+		AsyncLog::start(fd);
+
+		BLOG(log, INFO, "port: {}, char: {}, name: {}", 5u, 'a', "abc");
+
+		AsyncLog::stop();
+
+		close(fd);
+
+		ifstream file(getLogPath());
+		string line;
+
+		REQUIRE(getline(file, line));
+		REQUIRE(line.find("| BinaryLogTest") != string::npos);
+		REQUIRE(line.find("| INF - port: 5, char: 97, name: abc") !=
+				string::npos);
+	}
+
+	SECTION("Check invalid file")
+	{
+		ofstream(getLogPath()) << "invalid";
+
+		REQUIRE_THROWS_AS(BinaryLog::read(getLogPath()), BinaryLogException);
+		REQUIRE_THROWS_AS(BinaryLog::read(getLogPath() + ".none"),
+						  BinaryLogException);
+	}
+
+	remove(getLogPath().c_str());
+}
+
+TEST_CASE("BinaryLogBenchmark", "[.benchmark]")
+{
+	Log::setLogMask("BinaryLogBenchmark:DEBUG:binary");
+
+	Log binaryLog("BinaryLogBenchmark");
+	Log textLog("BinaryLogBenchmark");
+	filebuf devNull;
+
+	textLog.setBinary(false);
+
+	devNull.open("/dev/null", std::ios::out);
+
+	const int cNumLines = 200000;
+
+	streambuf* saved = std::cout.rdbuf();
+
+	Log::setStreamBuffer(&devNull);
+
+	auto start = steady_clock::now();
+
+	for(int i = 0; i < cNumLines; i++)
+	{
+		LOG(textLog, DEBUG) << "Benchmark line: " << i << ", name: " << "abc";
+	}
+
+	auto textTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count() / cNumLines;
+
+	BinaryLog::open("/dev/null");
+
+	start = steady_clock::now();
+
+	for(int i = 0; i < cNumLines; i++)
+	{
+		BLOG(binaryLog, DEBUG, "Benchmark line: {}, name: {}", i, "abc");
+	}
+
+	BinaryLog::close();
+
+	auto binaryTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count() / cNumLines;
+
+	Log::setStreamBuffer(saved);
+
+	Log::setLogMask("BinaryLogBenchmark:Disable");
+
+	cout << "Text log: " << textTime << " ns/line, binary log: "
+		 << binaryTime << " ns/line" << endl;
+}
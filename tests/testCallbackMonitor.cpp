@@ -0,0 +1,182 @@
+/*
+ *  Test CallbackMonitor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "CallbackMonitor.hpp"
+#include "Metrics.hpp"
+#include "Reactor.hpp"
+#include "Utils.hpp"
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::promise;
+using std::string;
+using std::this_thread::sleep_for;
+using std::vector;
+
+using XenBackend::AsyncContext;
+using XenBackend::CallbackMonitor;
+using XenBackend::CallbackSource;
+using XenBackend::Metrics;
+using XenBackend::Reactor;
+using XenBackend::SlowCallback;
+using XenBackend::Timer;
+
+static uint64_t getCount(const string& name)
+{
+	for(auto& snapshot : Metrics::getSnapshot("callbacks"))
+	{
+		for(auto& histogram : snapshot.histograms)
+		{
+			if (histogram.name == name)
+			{
+				return histogram.snapshot.count;
+			}
+		}
+	}
+
+	return 0;
+}
+
+TEST_CASE("CallbackMonitor", "[callbackmonitor]")
+{
+	mutex slowMutex;
+	vector<SlowCallback> slowCallbacks;
+
+	CallbackMonitor::setSlowCallbackHook(
+		[&slowMutex, &slowCallbacks](const SlowCallback& callback)
+		{
+			lock_guard<mutex> lock(slowMutex);
+
+			slowCallbacks.push_back(callback);
+		}, milliseconds(20));
+
+	SECTION("Check async context")
+	{
+		auto numCalls = getCount("async_duration");
+		promise<void> done;
+
+		{
+			AsyncContext context;
+
+			// the second call waits for the first one, so it is late
+
+			context.call([] { sleep_for(milliseconds(50)); });
+			context.call([&done] { done.set_value(); });
+
+			done.get_future().wait();
+		}
+
+		REQUIRE(getCount("async_duration") == numCalls + 2);
+		REQUIRE(getCount("async_lag") == numCalls + 2);
+
+		lock_guard<mutex> lock(slowMutex);
+
+		REQUIRE(slowCallbacks.size() == 2);
+
+		REQUIRE(slowCallbacks[0].source == CallbackSource::AsyncContext);
+		REQUIRE(slowCallbacks[0].duration >= milliseconds(50));
+		REQUIRE(slowCallbacks[0].port == -1);
+
+		REQUIRE(slowCallbacks[1].lag >= milliseconds(40));
+		REQUIRE(slowCallbacks[1].duration < milliseconds(20));
+	}
+
+	SECTION("Check timer")
+	{
+		auto numCalls = getCount("timer_duration");
+		promise<void> done;
+
+		Timer timer([&done] { sleep_for(milliseconds(30)); done.set_value(); });
+
+		timer.start(milliseconds(10));
+
+		done.get_future().wait();
+
+		timer.stop();
+
+		REQUIRE(getCount("timer_duration") == numCalls + 1);
+
+		lock_guard<mutex> lock(slowMutex);
+
+		REQUIRE(slowCallbacks.size() == 1);
+		REQUIRE(slowCallbacks[0].source == CallbackSource::Timer);
+		REQUIRE(slowCallbacks[0].duration >= milliseconds(30));
+	}
+
+	SECTION("Check reactor")
+	{
+		auto numCalls = getCount("reactor_task_duration");
+		auto reactor = make_shared<Reactor>("TestCallbackMonitor");
+
+		reactor->start();
+
+		// the second task waits for the first one, so it is late
+
+		reactor->post([] { sleep_for(milliseconds(50)); });
+		reactor->post([] {});
+
+		reactor->flush();
+		reactor->stop();
+
+		REQUIRE(getCount("reactor_task_duration") == numCalls + 3);
+
+		lock_guard<mutex> lock(slowMutex);
+
+		REQUIRE(slowCallbacks.size() >= 2);
+
+		REQUIRE(slowCallbacks[0].source == CallbackSource::ReactorTask);
+		REQUIRE(slowCallbacks[0].duration >= milliseconds(50));
+
+		REQUIRE(slowCallbacks[1].source == CallbackSource::ReactorTask);
+		REQUIRE(slowCallbacks[1].lag >= milliseconds(40));
+		REQUIRE(slowCallbacks[1].duration < milliseconds(20));
+	}
+
+	SECTION("Check hook removed")
+	{
+		CallbackMonitor::setSlowCallbackHook(nullptr, milliseconds(20));
+
+		promise<void> done;
+
+		{
+			AsyncContext context;
+
+			context.call([&done]
+						 { sleep_for(milliseconds(30)); done.set_value(); });
+
+			done.get_future().wait();
+		}
+
+		REQUIRE(slowCallbacks.empty());
+	}
+
+	CallbackMonitor::setSlowCallbackHook(nullptr, nanoseconds(0));
+}
@@ -0,0 +1,303 @@
+/*
+ *  Test coroutine API
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "Coroutine.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+#include "mocks/XenStoredMock.hpp"
+
+extern "C" {
+#include "testProtocol.h"
+}
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::make_shared;
+using std::promise;
+using std::runtime_error;
+using std::string;
+using std::this_thread::sleep_for;
+using std::to_string;
+
+using XenBackend::CoRingBufferIn;
+using XenBackend::CoTask;
+using XenBackend::CoXenStore;
+using XenBackend::Reactor;
+using XenBackend::XenStoreClient;
+using XenBackend::XenStoreException;
+
+typedef CoRingBufferIn<xen_test_back_ring, xen_test_sring, xentest_req,
+					   xentest_rsp> CoTestRingBuffer;
+
+static CoTask<int> getValue(int value)
+{
+	co_return value;
+}
+
+static CoTask<int> getSum(int a, int b)
+{
+	co_return co_await getValue(a) + co_await getValue(b);
+}
+
+static CoTask<int> throwError()
+{
+	throw runtime_error("coroutine error");
+
+	co_return 0;
+}
+
+static CoTask<void> accessStore(CoXenStore& store, promise<string>& result)
+{
+	co_await store.write("/local/domain/3/co/value", "42");
+
+	auto items = co_await store.readDirectory("/local/domain/3/co");
+	auto value = co_await store.read("/local/domain/3/co/value");
+
+	co_await store.remove("/local/domain/3/co/value");
+
+	try
+	{
+		co_await store.read("/local/domain/3/co/value");
+	}
+	catch(const XenStoreException& e)
+	{
+		value += " removed";
+	}
+
+	result.set_value(value + " " + to_string(items.size()));
+}
+
+TEST_CASE("CoTask", "[coroutine]")
+{
+	SECTION("Check nested tasks")
+	{
+		int result = 0;
+
+		[&result]() -> CoTask<void>
+		{
+			result = co_await getSum(2, 3);
+		}().detach();
+
+		REQUIRE(result == 5);
+	}
+
+	SECTION("Check exception")
+	{
+		bool caught = false;
+
+		[&caught]() -> CoTask<void>
+		{
+			try
+			{
+				co_await throwError();
+			}
+			catch(const runtime_error& e)
+			{
+				caught = true;
+			}
+		}().detach();
+
+		REQUIRE(caught);
+	}
+}
+
+TEST_CASE("CoXenStore", "[coroutine]")
+{
+	XenStoredMock xenStored("/tmp/xenbe_test_" + to_string(getpid()) +
+							".sock");
+	XenStoreClient client(xenStored.getPath());
+	auto reactor = make_shared<Reactor>("TestCoroutine");
+	CoXenStore store(client, reactor);
+
+	reactor->addFd(client.getFd(), [&client] { client.process(); });
+	reactor->start();
+
+	promise<string> result;
+	auto future = result.get_future();
+
+	reactor->post([&] { accessStore(store, result).detach(); });
+
+	REQUIRE(future.wait_for(milliseconds(1000)) ==
+			std::future_status::ready);
+	REQUIRE(future.get() == "42 removed 1");
+
+	reactor->removeFd(client.getFd());
+	reactor->stop();
+}
+
+static CoTask<void> writeLarge(CoXenStore& store, int index,
+							   atomic<int>& numWritten)
+{
+	co_await store.write("/local/domain/3/co/large",
+						 string(3000, 'a' + index % 26));
+
+	numWritten++;
+}
+
+TEST_CASE("CoXenStore pipelined", "[coroutine]")
+{
+	const int cNumRequests = 2000;
+
+	XenStoredMock xenStored("/tmp/xenbe_test_" + to_string(getpid()) +
+							".sock");
+	XenStoreClient client(xenStored.getPath());
+	auto reactor = make_shared<Reactor>("TestCoroutine");
+	CoXenStore store(client, reactor);
+
+	reactor->addFd(client.getFd(), [&client] { client.process(); });
+	reactor->start();
+
+	atomic<int> numWritten(0);
+
+	// requests don't fit the socket: the reactor which processes the client
+	// isn't blocked by sending
+
+	reactor->post([&]
+	{
+		for(int i = 0; i < cNumRequests; i++)
+		{
+			writeLarge(store, i, numWritten).detach();
+		}
+	});
+
+	for(int i = 0; i < 1000 && numWritten != cNumRequests; i++)
+	{
+		sleep_for(milliseconds(10));
+	}
+
+	REQUIRE(numWritten == cNumRequests);
+
+	reactor->removeFd(client.getFd());
+	reactor->stop();
+}
+
+TEST_CASE("CoRingBufferIn", "[coroutine]")
+{
+	const int cNumRequests = 16;
+
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	XenStoredMock xenStored("/tmp/xenbe_test_" + to_string(getpid()) +
+							".sock");
+	XenStoreClient client(xenStored.getPath());
+	auto reactor = make_shared<Reactor>("TestCoroutine");
+	CoXenStore store(client, reactor);
+
+	reactor->addFd(client.getFd(), [&client] { client.process(); });
+	reactor->start();
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		xenStored.writeValue("/local/domain/3/co/" + to_string(i),
+							 to_string(i * 10));
+	}
+
+	{
+		CoTestRingBuffer ringBuffer(3, 65, 23);
+
+		ringBuffer.start(reactor);
+
+		atomic<int> numHandled(0);
+
+		// each request reads its value from the store, requests are in
+		// flight together
+
+		reactor->post([&]
+		{
+			ringBuffer.serve([&](xentest_req req) -> CoTask<xentest_rsp>
+			{
+				xentest_rsp rsp {};
+
+				rsp.seq = req.seq;
+				rsp.u32data = std::stoul(co_await store.read(
+						"/local/domain/3/co/" + to_string(req.seq)));
+
+				numHandled++;
+
+				co_return rsp;
+			});
+		});
+
+		xen_test_front_ring ring;
+		auto sring = static_cast<xen_test_sring*>(
+				XenGnttabMock::getLastBuffer());
+
+		SHARED_RING_INIT(sring);
+		FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+		for(int i = 0; i < cNumRequests; i++)
+		{
+			xentest_req req {XENTEST_CMD1};
+
+			req.seq = i;
+
+			*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+			ring.req_prod_pvt++;
+		}
+
+		int notify;
+
+		RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+		REQUIRE(notify);
+
+		XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+		for(int i = 0; i < 100 && sring->rsp_prod != cNumRequests; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(sring->rsp_prod == cNumRequests);
+		REQUIRE(numHandled == cNumRequests);
+
+		uint32_t sum = 0;
+
+		for(int i = 0; i < cNumRequests; i++)
+		{
+			auto rsp = RING_GET_RESPONSE(&ring, i);
+
+			REQUIRE(rsp->u32data == rsp->seq * 10);
+
+			sum += rsp->seq;
+		}
+
+		REQUIRE(sum == cNumRequests * (cNumRequests - 1) / 2);
+
+		reactor->flush();
+	}
+
+	reactor->removeFd(client.getFd());
+	reactor->stop();
+}
@@ -0,0 +1,340 @@
+/*
+ *  Test Executor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Executor.hpp"
+#include "Utils.hpp"
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::promise;
+using std::runtime_error;
+using std::this_thread::sleep_for;
+using std::unique_ptr;
+using std::vector;
+
+using XenBackend::AsyncContext;
+using XenBackend::Executor;
+using XenBackend::ExecutorTask;
+using XenBackend::SerialExecutor;
+
+TEST_CASE("ExecutorTask", "[executor]")
+{
+	SECTION("Check inline")
+	{
+		int value = 0;
+
+		ExecutorTask task([&value] { value++; });
+
+		REQUIRE(task);
+
+		ExecutorTask moved(std::move(task));
+
+		REQUIRE_FALSE(task);
+
+		moved();
+
+		REQUIRE(value == 1);
+	}
+
+	SECTION("Check heap")
+	{
+		char big[ExecutorTask::cInlineSize * 2] = {};
+		int value = 0;
+
+		big[sizeof(big) - 1] = 5;
+
+		ExecutorTask task([big, &value] { value = big[sizeof(big) - 1]; });
+		ExecutorTask moved;
+
+		moved = std::move(task);
+
+		REQUIRE_FALSE(task);
+
+		moved();
+
+		REQUIRE(value == 5);
+	}
+
+	SECTION("Check move-only")
+	{
+		struct Func
+		{
+			unique_ptr<int> value;
+			int* result;
+
+			void operator()() { *result = *value; }
+		};
+
+		int result = 0;
+
+		ExecutorTask task(Func{ unique_ptr<int>(new int(7)), &result });
+
+		task();
+
+		REQUIRE(result == 7);
+
+		task.reset();
+
+		REQUIRE_FALSE(task);
+	}
+}
+
+TEST_CASE("Executor", "[executor]")
+{
+	SECTION("Check all tasks run")
+	{
+		const int cNumTasks = 1000;
+		atomic<int> count(0);
+
+		{
+			Executor executor(4);
+
+			REQUIRE(executor.getNumWorkers() == 4);
+
+			for(int i = 0; i < cNumTasks; i++)
+			{
+				executor.post([&count] { count++; });
+			}
+		}
+
+		REQUIRE(count == cNumTasks);
+	}
+
+	SECTION("Check stealing")
+	{
+		const int cNumTasks = 16;
+
+		promise<void> done;
+		auto future = done.get_future().share();
+		atomic<int> count(0);
+		Executor executor(4);
+
+		// tasks are posted to the deque of the blocked worker, so they are
+		// completed only if other workers steal them
+
+		executor.post([&]
+		{
+			for(int i = 0; i < cNumTasks; i++)
+			{
+				executor.post([&]
+				{
+					if (++count == cNumTasks)
+					{
+						done.set_value();
+					}
+				});
+			}
+
+			future.wait();
+		});
+
+		REQUIRE(future.wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+	}
+
+	SECTION("Check exception")
+	{
+		promise<void> done;
+		Executor executor(1);
+
+		executor.post([] { throw runtime_error("task error"); });
+		executor.post([&done] { done.set_value(); });
+
+		REQUIRE(done.get_future().wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+	}
+}
+
+TEST_CASE("SerialExecutor", "[executor]")
+{
+	SECTION("Check order")
+	{
+		const int cNumSerials = 8;
+		const int cNumTasks = 100;
+
+		Executor executor(4);
+		vector<vector<int>> results(cNumSerials);
+		vector<atomic<int>> running(cNumSerials);
+		atomic<bool> overlapped(false);
+
+		{
+			vector<unique_ptr<SerialExecutor>> serials;
+
+			for(int i = 0; i < cNumSerials; i++)
+			{
+				serials.emplace_back(new SerialExecutor(executor));
+				running[i] = 0;
+			}
+
+			for(int task = 0; task < cNumTasks; task++)
+			{
+				for(int i = 0; i < cNumSerials; i++)
+				{
+					serials[i]->post([&, i, task]
+					{
+						if (running[i]++ != 0)
+						{
+							overlapped = true;
+						}
+
+						results[i].push_back(task);
+
+						running[i]--;
+					});
+				}
+			}
+		}
+
+		REQUIRE_FALSE(overlapped);
+
+		for(auto& result : results)
+		{
+			REQUIRE(result.size() == cNumTasks);
+
+			for(int task = 0; task < cNumTasks; task++)
+			{
+				REQUIRE(result[task] == task);
+			}
+		}
+	}
+
+	SECTION("Check stop")
+	{
+		atomic<int> count(0);
+		Executor executor(2);
+		SerialExecutor serial(executor);
+
+		serial.post([&count] { sleep_for(milliseconds(20)); count++; });
+		serial.post([&count] { count++; });
+
+		serial.stop();
+
+		REQUIRE(count == 2);
+
+		serial.post([&count] { count++; });
+
+		sleep_for(milliseconds(20));
+
+		REQUIRE(count == 2);
+	}
+
+	SECTION("Check stop from task")
+	{
+		promise<void> done;
+		Executor executor(1);
+		SerialExecutor serial(executor);
+
+		serial.post([&] { serial.stop(); done.set_value(); });
+
+		REQUIRE(done.get_future().wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+	}
+
+	SECTION("Check stopped executor")
+	{
+		const int cNumTasks = 40;
+
+		atomic<int> count(0);
+		Executor executor(1);
+		SerialExecutor serial(executor);
+
+		for(int i = 0; i < cNumTasks; i++)
+		{
+			serial.post([&count] { sleep_for(milliseconds(1)); count++; });
+		}
+
+		// the drain task is not reposted to the stopped executor
+
+		executor.stop();
+
+		auto numRun = count.load();
+
+		REQUIRE(numRun < cNumTasks);
+
+		serial.post([&count] { count++; });
+		serial.stop();
+
+		REQUIRE(count == numRun);
+	}
+
+	SECTION("Check async context")
+	{
+		Executor executor(2);
+		vector<int> results;
+
+		{
+			AsyncContext context(executor);
+
+			for(int i = 0; i < 10; i++)
+			{
+				context.call([&results, i] { results.push_back(i); });
+			}
+		}
+
+		REQUIRE(results == vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }));
+	}
+}
+
+TEST_CASE("ExecutorBenchmark", "[.benchmark]")
+{
+	const int cNumContexts = 64;
+	const int cNumCalls = 2000;
+
+	auto start = steady_clock::now();
+
+	{
+		atomic<int> count(0);
+		vector<unique_ptr<AsyncContext>> contexts;
+
+		for(int i = 0; i < cNumContexts; i++)
+		{
+			contexts.emplace_back(new AsyncContext());
+		}
+
+		for(int j = 0; j < cNumCalls; j++)
+		{
+			for(auto& context : contexts)
+			{
+				context->call([&count] { count++; });
+			}
+		}
+	}
+
+	auto time = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+	cout << "Async contexts: " << cNumContexts << ", call: "
+		 << time / (cNumContexts * cNumCalls) << " ns" << endl;
+}
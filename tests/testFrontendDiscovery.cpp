@@ -0,0 +1,136 @@
+/*
+ *  Test FrontendDiscovery
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "catch.hpp"
+
+#include "FrontendDiscovery.hpp"
+
+using std::make_pair;
+using std::vector;
+
+using XenBackend::FrontendDiscovery;
+using XenBackend::FrontendId;
+
+TEST_CASE("FrontendDiscovery", "[frontenddiscovery]")
+{
+	FrontendDiscovery discovery;
+
+	auto changes = discovery.updateDomains({ 7, 3, 5 });
+
+	REQUIRE(changes.version == 1);
+	REQUIRE(changes.addedDomains == vector<domid_t>({ 3, 5, 7 }));
+	REQUIRE(changes.added.empty());
+
+	discovery.updateDevices(3, { 1, 0 });
+	discovery.updateDevices(5, { 0 });
+
+	SECTION("Check snapshot")
+	{
+		auto snapshot = discovery.getSnapshot();
+
+		REQUIRE(snapshot.version == 3);
+		REQUIRE(snapshot.frontends == vector<FrontendId>(
+				{ make_pair(3, 0), make_pair(3, 1), make_pair(5, 0) }));
+		REQUIRE(discovery.getDomains() == vector<domid_t>({ 3, 5, 7 }));
+	}
+
+	SECTION("Check device diff")
+	{
+		changes = discovery.updateDevices(3, { 2, 1, 2, 4 });
+
+		REQUIRE(changes.version == 4);
+		REQUIRE(changes.added == vector<FrontendId>(
+				{ make_pair(3, 2), make_pair(3, 4) }));
+		REQUIRE(changes.removed == vector<FrontendId>({ make_pair(3, 0) }));
+
+		changes = discovery.updateDevices(3, { 4, 1, 2 });
+
+		REQUIRE(changes.empty());
+		REQUIRE(changes.version == 4);
+
+		changes = discovery.updateDevices(9, { 0 });
+
+		REQUIRE(changes.addedDomains == vector<domid_t>({ 9 }));
+		REQUIRE(changes.added == vector<FrontendId>({ make_pair(9, 0) }));
+	}
+
+	SECTION("Check domain diff")
+	{
+		changes = discovery.updateDomains({ 5, 8 });
+
+		REQUIRE(changes.addedDomains == vector<domid_t>({ 8 }));
+		REQUIRE(changes.removedDomains == vector<domid_t>({ 3, 7 }));
+		REQUIRE(changes.removed == vector<FrontendId>(
+				{ make_pair(3, 0), make_pair(3, 1) }));
+
+		changes = discovery.retainDomains({ 1, 2, 3, 4, 8 });
+
+		REQUIRE(changes.addedDomains.empty());
+		REQUIRE(changes.removedDomains == vector<domid_t>({ 5 }));
+		REQUIRE(changes.removed == vector<FrontendId>({ make_pair(5, 0) }));
+
+		REQUIRE(discovery.retainDomains({ 8 }).empty());
+		REQUIRE(discovery.getDomains() == vector<domid_t>({ 8 }));
+	}
+
+	SECTION("Check add")
+	{
+		REQUIRE(discovery.hasDomain(7));
+		REQUIRE(!discovery.hasDomain(9));
+		REQUIRE(discovery.addDomain(7).empty());
+
+		changes = discovery.addDomain(9);
+
+		REQUIRE(changes.version == 4);
+		REQUIRE(changes.addedDomains == vector<domid_t>({ 9 }));
+		REQUIRE(discovery.hasDomain(9));
+
+		changes = discovery.addDevice(3, 2);
+
+		REQUIRE(changes.addedDomains.empty());
+		REQUIRE(changes.added == vector<FrontendId>({ make_pair(3, 2) }));
+		REQUIRE(discovery.addDevice(3, 2).empty());
+
+		changes = discovery.addDevice(11, 0);
+
+		REQUIRE(changes.addedDomains == vector<domid_t>({ 11 }));
+		REQUIRE(changes.added == vector<FrontendId>({ make_pair(11, 0) }));
+
+		REQUIRE(discovery.updateDevices(3, { 0, 1, 2 }).empty());
+	}
+
+	SECTION("Check remove")
+	{
+		changes = discovery.removeDevice(3, 1);
+
+		REQUIRE(changes.removed == vector<FrontendId>({ make_pair(3, 1) }));
+		REQUIRE(discovery.removeDevice(3, 1).empty());
+
+		changes = discovery.updateDevices(3, { 0, 1 });
+
+		REQUIRE(changes.added == vector<FrontendId>({ make_pair(3, 1) }));
+
+		changes = discovery.removeDomain(3);
+
+		REQUIRE(changes.removedDomains == vector<domid_t>({ 3 }));
+		REQUIRE(changes.removed.size() == 2);
+		REQUIRE(discovery.removeDomain(3).empty());
+	}
+}
@@ -34,6 +34,7 @@
 using std::bind;
 using std::chrono::milliseconds;
 using std::condition_variable;
+using std::make_shared;
 using std::mutex;
 using std::stoi;
 using std::string;
@@ -42,6 +43,7 @@ using std::to_string;
 using std::unique_lock;
 
 using XenBackend::FrontendHandlerBase;
+using XenBackend::Reactor;
 using XenBackend::RingBufferInBase;
 using XenBackend::RingBufferPtr;
 
@@ -54,6 +56,8 @@ static const char* gDevName = "test_device";
 
 static XenbusState gBeState = XenbusStateUnknown;
 static bool gOnBind = false;
+static grant_ref_t gRingRef = 165;
+static RingBufferPtr gRingBuffer;
 static std::list<XenbusState> gBeStates;
 
 TestFrontendHandler::~TestFrontendHandler()
@@ -91,9 +95,9 @@ void TestFrontendHandler::prepareXenStore(const string& devName,
 
 void TestFrontendHandler::onBind()
 {
-	RingBufferPtr ringBuffer(new TestRingBufferIn(gDomId, 12, 165));
+	gRingBuffer = createRingBuffer<TestRingBufferIn>(12, gRingRef);
 
-	addRingBuffer(ringBuffer);
+	addRingBuffer(gRingBuffer);
 
 	gOnBind = true;
 }
@@ -138,6 +142,8 @@ TEST_CASE("FrontendHandler", "[frontendhandler]")
 
 	gBeStates.clear();
 	gOnBind = false;
+	gRingRef = 165;
+	gRingBuffer.reset();
 
 	XenStoreMock storeMock;
 
@@ -239,6 +245,105 @@ TEST_CASE("FrontendHandler", "[frontendhandler]")
 		frontendHandler.stop();
 	}
 
+	SECTION("Check fast reconnect")
+	{
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateConnected));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateConnected);
+
+		auto ringBuffer = gRingBuffer;
+
+		// restart with same ring buffer
+
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateInitialising));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateClosing);
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateClosed);
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateInitWait);
+
+		REQUIRE(ringBuffer->isStarted());
+
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateInitialised));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateConnected);
+		REQUIRE(gRingBuffer == ringBuffer);
+		REQUIRE(ringBuffer->isStarted());
+
+		// restart with new ring buffer
+
+		gRingRef = 166;
+
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateInitialising));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateInitWait);
+
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateInitialised));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateConnected);
+		REQUIRE(gRingBuffer != ringBuffer);
+		REQUIRE_FALSE(ringBuffer->isStarted());
+		REQUIRE(gRingBuffer->isStarted());
+
+		frontendHandler.stop();
+	}
+
+	SECTION("Check reactor")
+	{
+		auto reactor1 = make_shared<Reactor>();
+		auto reactor2 = make_shared<Reactor>();
+
+		reactor1->start();
+		reactor2->start();
+
+		frontendHandler.setReactor(reactor1);
+
+		REQUIRE(frontendHandler.getReactor() == reactor1);
+
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateConnected));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateConnected);
+		REQUIRE(gRingBuffer->isStarted());
+
+		// ring buffer is moved to the new reactor
+
+		frontendHandler.setReactor(reactor2);
+
+		REQUIRE(frontendHandler.getReactor() == reactor2);
+		REQUIRE(gRingBuffer->isStarted());
+
+		auto numEvents = reactor2->getNumEvents();
+
+		XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+		for(int i = 0; i < 100 && frontendHandler.getNumEvents() == 0; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(frontendHandler.getNumEvents() == 1);
+		REQUIRE(reactor2->getNumEvents() > numEvents);
+
+		frontendHandler.stop();
+
+		REQUIRE_FALSE(gRingBuffer->isStarted());
+	}
+
 	SECTION("Check states 4")
 	{
 		// Initialize -> InitWait
@@ -297,4 +402,6 @@ TEST_CASE("FrontendHandler", "[frontendhandler]")
 
 		frontendHandler.stop();
 	}
+
+	gRingBuffer.reset();
 }
@@ -0,0 +1,133 @@
+/*
+ *  Test FrontendRegistry
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "FrontendRegistry.hpp"
+
+using std::atomic;
+using std::make_shared;
+using std::thread;
+using std::vector;
+
+using XenBackend::FrontendRegistry;
+
+struct TestFrontend
+{
+	domid_t domId;
+	uint16_t devId;
+};
+
+static const int cNumDomains = 64;
+static const int cNumDevices = 64;
+
+TEST_CASE("FrontendRegistry", "[frontendregistry]")
+{
+	FrontendRegistry<TestFrontend> registry;
+
+	for(int domId = cNumDomains; domId > 0; domId--)
+	{
+		for(int devId = 0; devId < cNumDevices; devId++)
+		{
+			REQUIRE(registry.add(domId, devId, make_shared<TestFrontend>(
+					TestFrontend { static_cast<domid_t>(domId),
+								   static_cast<uint16_t>(devId) })));
+		}
+	}
+
+	SECTION("Check find")
+	{
+		REQUIRE(registry.size() == cNumDomains * cNumDevices);
+
+		for(int domId = 1; domId <= cNumDomains; domId++)
+		{
+			for(int devId = 0; devId < cNumDevices; devId++)
+			{
+				auto frontend = registry.find(domId, devId);
+
+				REQUIRE(frontend);
+				REQUIRE(frontend->domId == domId);
+				REQUIRE(frontend->devId == devId);
+			}
+		}
+
+		REQUIRE_FALSE(registry.find(cNumDomains + 1, 0));
+		REQUIRE_FALSE(registry.find(1, cNumDevices));
+		REQUIRE_FALSE(registry.add(1, 0, make_shared<TestFrontend>()));
+	}
+
+	SECTION("Check remove and snapshot")
+	{
+		auto snapshot = registry.getFrontends();
+
+		for(int devId = 0; devId < cNumDevices; devId++)
+		{
+			REQUIRE(registry.remove(1, devId));
+		}
+
+		REQUIRE_FALSE(registry.remove(1, 0));
+		REQUIRE(snapshot.size() == cNumDomains * cNumDevices);
+		REQUIRE(registry.size() == (cNumDomains - 1) * cNumDevices);
+
+		auto removed = registry.clear();
+
+		REQUIRE(removed.size() == (cNumDomains - 1) * cNumDevices);
+		REQUIRE(registry.size() == 0);
+	}
+
+	SECTION("Check concurrent access")
+	{
+		atomic<int> numFound(0);
+		vector<thread> readers;
+
+		for(int i = 0; i < 4; i++)
+		{
+			readers.push_back(thread([&registry, &numFound]
+			{
+				for(int devId = 0; devId < cNumDevices; devId++)
+				{
+					if (registry.find(2, devId))
+					{
+						numFound++;
+					}
+
+					registry.getFrontends();
+				}
+			}));
+		}
+
+		for(int devId = cNumDevices; devId < 2 * cNumDevices; devId++)
+		{
+			registry.add(1, devId, make_shared<TestFrontend>());
+			registry.remove(1, devId);
+		}
+
+		for(auto& reader : readers)
+		{
+			reader.join();
+		}
+
+		REQUIRE(numFound == 4 * cNumDevices);
+		REQUIRE(registry.size() == cNumDomains * cNumDevices);
+	}
+}
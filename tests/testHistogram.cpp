@@ -0,0 +1,320 @@
+/*
+ *  Test Histogram
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "Histogram.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+#include "testRingBuffer.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::function;
+using std::this_thread::sleep_for;
+
+using XenBackend::LatencyHistogram;
+using XenBackend::LatencyTracker;
+
+TEST_CASE("LatencyHistogram", "[histogram]")
+{
+	LatencyHistogram histogram;
+
+	SECTION("Check empty")
+	{
+		auto snapshot = histogram.getSnapshot();
+
+		REQUIRE(snapshot.count == 0);
+		REQUIRE(snapshot.p99 == 0);
+	}
+
+	SECTION("Check small values")
+	{
+		// values below 64 are exact
+
+		for(uint64_t i = 1; i <= 50; i++)
+		{
+			histogram.record(i);
+		}
+
+		auto snapshot = histogram.getSnapshot();
+
+		REQUIRE(snapshot.count == 50);
+		REQUIRE(snapshot.min == 1);
+		REQUIRE(snapshot.max == 50);
+		REQUIRE(snapshot.mean == Approx(25.5));
+		REQUIRE(snapshot.p50 == 25);
+		REQUIRE(snapshot.p90 == 45);
+	}
+
+	SECTION("Check precision")
+	{
+		for(uint64_t i = 1; i <= 100000; i++)
+		{
+			histogram.record(i * 1000);
+		}
+
+		auto snapshot = histogram.getSnapshot();
+
+		REQUIRE(snapshot.count == 100000);
+		REQUIRE(snapshot.p50 == Approx(50000000).epsilon(0.04));
+		REQUIRE(snapshot.p99 == Approx(99000000).epsilon(0.04));
+		REQUIRE(snapshot.p999 == Approx(99900000).epsilon(0.04));
+		REQUIRE(snapshot.max >= 100000000);
+		REQUIRE(snapshot.max == Approx(100000000).epsilon(0.04));
+	}
+
+	SECTION("Check big values")
+	{
+		histogram.record(UINT64_MAX);
+
+		REQUIRE(histogram.getCount() == 1);
+		REQUIRE(histogram.getPercentile(100) >= (1ULL << 39));
+	}
+
+	SECTION("Check reset")
+	{
+		histogram.record(100);
+		histogram.reset();
+
+		REQUIRE(histogram.getCount() == 0);
+	}
+}
+
+TEST_CASE("LatencyTracker", "[histogram]")
+{
+	LatencyTracker tracker(4);
+
+	SECTION("Check latency")
+	{
+		tracker.onRequest(1, 2);
+		tracker.onRequest(2, 3);
+
+		sleep_for(milliseconds(10));
+
+		// out of order responses
+
+		tracker.onResponse(2);
+		tracker.onResponse(1);
+
+		// unknown response is ignored
+
+		tracker.onResponse(5);
+
+		auto snapshot = tracker.getSnapshot(2);
+
+		REQUIRE(snapshot.count == 1);
+		REQUIRE(snapshot.max >= 10000000);
+		REQUIRE(tracker.getSnapshot(3).count == 1);
+		REQUIRE(tracker.getSnapshot(4).count == 0);
+		REQUIRE(tracker.getSnapshot().size() == 2);
+
+		tracker.reset();
+
+		REQUIRE(tracker.getSnapshot(2).count == 0);
+	}
+
+	SECTION("Check dropped")
+	{
+		// the table has 8 entries
+
+		for(uint64_t i = 0; i < 9; i++)
+		{
+			tracker.onRequest(i, 0);
+		}
+
+		REQUIRE(tracker.getNumDropped() == 1);
+
+		for(uint64_t i = 0; i < 9; i++)
+		{
+			tracker.onResponse(i);
+		}
+
+		REQUIRE(tracker.getSnapshot(0).count == 8);
+	}
+
+	SECTION("Check colliding ids")
+	{
+		// ids share the first entry of the table with 8 entries, answered
+		// ones don't hide the following ones
+
+		tracker.onRequest(0, 0);
+		tracker.onRequest(8, 0);
+		tracker.onRequest(16, 0);
+
+		tracker.onResponse(0);
+		tracker.onResponse(16);
+
+		REQUIRE(tracker.getSnapshot(0).count == 2);
+
+		// the answered entry is reused
+
+		tracker.onRequest(24, 0);
+		tracker.onResponse(8);
+		tracker.onResponse(24);
+		tracker.onResponse(32);
+
+		REQUIRE(tracker.getSnapshot(0).count == 4);
+		REQUIRE(tracker.getNumDropped() == 0);
+
+		// all entries are freed and can be taken again
+
+		for(uint64_t i = 0; i < 8; i++)
+		{
+			tracker.onRequest(i * 8, 1);
+		}
+
+		REQUIRE(tracker.getNumDropped() == 0);
+	}
+
+	SECTION("Check reserved ids")
+	{
+		tracker.onRequest(LatencyTracker::cFree, 0);
+		tracker.onRequest(LatencyTracker::cRemoved, 0);
+		tracker.onResponse(LatencyTracker::cFree);
+		tracker.onResponse(LatencyTracker::cRemoved);
+
+		REQUIRE(tracker.getNumDropped() == 2);
+		REQUIRE(tracker.getSnapshot(0).count == 0);
+	}
+
+	SECTION("Check big type")
+	{
+		tracker.onRequest(1, 1000);
+		tracker.onResponse(1);
+
+		REQUIRE(tracker.getSnapshot(LatencyTracker::cMaxTypes - 1).count == 1);
+	}
+}
+
+TEST_CASE("RingBufferLatency", "[histogram]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	TestRingBufferIn ringBuffer(3, 81, 33);
+
+	ringBuffer.setLatencyTracking(
+		[](const xentest_req& req) { return req.seq; },
+		[](const xentest_rsp& rsp) { return rsp.seq; },
+		[](const xentest_req& req) { return req.id; });
+
+	ringBuffer.start();
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	const int cNumRequests = 6;
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		uint32_t command = i % 2 ? XENTEST_CMD1 : XENTEST_CMD3;
+		xentest_req req { command };
+
+		req.seq = i;
+
+		*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+		ring.req_prod_pvt++;
+	}
+
+	int notify;
+
+	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+	REQUIRE(notify);
+
+	XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+	for(int i = 0; i < 100 && sring->rsp_prod != cNumRequests; i++)
+	{
+		sleep_for(milliseconds(10));
+	}
+
+	ringBuffer.stop();
+
+	auto tracker = ringBuffer.getLatencyTracker();
+
+	REQUIRE(tracker);
+	REQUIRE(tracker->getSnapshot(XENTEST_CMD1).count == cNumRequests / 2);
+	REQUIRE(tracker->getSnapshot(XENTEST_CMD3).count == cNumRequests / 2);
+	REQUIRE(tracker->getSnapshot(XENTEST_CMD2).count == 0);
+}
+
+TEST_CASE("LatencyTrackerBenchmark", "[.benchmark]")
+{
+	const int cNumRequests = 1000000;
+	const int cBatchSize = 8;
+
+	LatencyTracker tracker(32);
+
+	// the ring buffer calls the tracker through the id functors
+
+	function<uint64_t(const xentest_req&)> requestId =
+		[](const xentest_req& req) { return req.seq; };
+	function<uint32_t(const xentest_req&)> requestType =
+		[](const xentest_req& req) { return req.id; };
+	function<uint64_t(const xentest_rsp&)> responseId =
+		[](const xentest_rsp& rsp) { return rsp.seq; };
+
+	xentest_req req { XENTEST_CMD1 };
+	xentest_rsp rsp { XENTEST_CMD1 };
+
+	auto start = steady_clock::now();
+
+	// the clock is read for each dequeued request
+
+	for(int i = 0; i < cNumRequests; i += cBatchSize)
+	{
+		for(int j = i; j < i + cBatchSize; j++)
+		{
+			req.seq = j;
+
+			tracker.onRequest(requestId(req), requestType(req));
+		}
+
+		for(int j = i; j < i + cBatchSize; j++)
+		{
+			rsp.seq = j;
+
+			tracker.onResponse(responseId(rsp));
+		}
+	}
+
+	auto time = duration_cast<nanoseconds>(steady_clock::now() - start);
+
+	cout << "Requests: " << cNumRequests
+		 << ", overhead: " << time.count() / cNumRequests << " ns/request"
+		 << endl;
+
+	REQUIRE(tracker.getSnapshot(XENTEST_CMD1).count == cNumRequests);
+}
@@ -0,0 +1,378 @@
+/*
+ *  Test LiveUpgrade
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "LiveUpgrade.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+#include "mocks/XenStoreMock.hpp"
+#include "testFrontendHandler.hpp"
+#include "testRingBuffer.hpp"
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::make_shared;
+using std::string;
+using std::this_thread::sleep_for;
+using std::vector;
+
+using XenBackend::FrontendHandlerBase;
+using XenBackend::FrontendState;
+using XenBackend::LiveUpgrade;
+using XenBackend::LiveUpgradeException;
+using XenBackend::RingBufferPtr;
+using XenBackend::RingBufferState;
+
+static domid_t gDomId = 5;
+static uint16_t gDevId = 1;
+static const char* gDevName = "upgrade_device";
+static evtchn_port_t gPort = 21;
+static grant_ref_t gRef = 37;
+
+class UpgradeFrontendHandler : public FrontendHandlerBase
+{
+public:
+
+	UpgradeFrontendHandler() :
+		FrontendHandlerBase("UpgradeFrontend", gDevName, gDomId, gDevId),
+		mDmaBufFd(-1)
+	{}
+
+	~UpgradeFrontendHandler() { stop(); }
+
+	RingBufferPtr getRingBuffer() const { return mRingBuffer; }
+
+	int mDmaBufFd;
+	string mData;
+
+private:
+
+	RingBufferPtr mRingBuffer;
+
+	void onBind() override
+	{
+		mRingBuffer = createRingBuffer<TestRingBufferIn>(gPort, gRef);
+
+		addRingBuffer(mRingBuffer);
+	}
+
+	void onSaveState(FrontendState& state) override
+	{
+		state.fds.push_back(mDmaBufFd);
+		state.data = mData;
+	}
+
+	void onRestoreState(const FrontendState& state) override
+	{
+		mDmaBufFd = state.fds.at(0);
+		mData = state.data;
+	}
+};
+
+static bool waitConnected(FrontendHandlerBase& frontendHandler)
+{
+	for(int i = 0; i < 100; i++)
+	{
+		if (frontendHandler.getBackendState() == XenbusStateConnected)
+		{
+			return true;
+		}
+
+		sleep_for(milliseconds(10));
+	}
+
+	return false;
+}
+
+// Runs the new backend process, returns non zero exit code on failure
+static int runNewBackend(int socket, const string& bePath,
+						 const RingBufferState& oldState)
+{
+	try
+	{
+		atomic<bool> stateWritten(false);
+
+		XenStoreMock::setWriteValueCbk(
+			[&stateWritten, bePath] (const string& path, const string& value)
+			{ if (path == bePath + "/state") { stateWritten = true; }});
+
+		LiveUpgrade::setInherited(LiveUpgrade::receive(socket));
+
+		UpgradeFrontendHandler frontendHandler;
+
+		frontendHandler.start();
+
+		if (frontendHandler.getBackendState() != XenbusStateConnected)
+		{
+			return 2;
+		}
+
+		auto ringBuffer = frontendHandler.getRingBuffer();
+
+		if (!ringBuffer || !ringBuffer->isStarted())
+		{
+			return 3;
+		}
+
+		auto state = ringBuffer->getState();
+
+		if (state.localPort != oldState.localPort ||
+			state.reqCons != oldState.reqCons ||
+			state.rspProdPvt != oldState.rspProdPvt)
+		{
+			return 4;
+		}
+
+		char data = 0;
+
+		if (frontendHandler.mData != "dma-buf" ||
+			read(frontendHandler.mDmaBufFd, &data, 1) != 1 || data != 'x')
+		{
+			return 5;
+		}
+
+		// let watches be processed
+		sleep_for(milliseconds(100));
+
+		if (stateWritten)
+		{
+			return 6;
+		}
+
+		close(frontendHandler.mDmaBufFd);
+
+		frontendHandler.handover();
+
+		XenStoreMock::setWriteValueCbk(nullptr);
+	}
+	catch(const std::exception& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
+
+TEST_CASE("LiveUpgrade", "[liveupgrade]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	SECTION("Check serialization")
+	{
+		FrontendState state;
+
+		state.devName = "vdispl";
+		state.domId = 3;
+		state.devId = 2;
+		state.backendState = XenbusStateConnected;
+		state.frontendState = XenbusStateInitialised;
+		state.ringBuffers.push_back({ 10, 100, 40, 0, 7, 5 });
+		state.ringBuffers.push_back({ 11, 101, 41, 0, 0, 0 });
+		state.fds = { 0, 0 };
+		state.data = string("opaque\0 data", 12);
+
+		vector<FrontendState> states = { state, FrontendState() };
+
+		states[1].devName = "vsnd";
+		states[1].backendState = XenbusStateInitWait;
+		states[1].frontendState = XenbusStateInitialising;
+
+		vector<int> fds;
+
+		auto data = LiveUpgrade::serialize(states, fds);
+
+		REQUIRE(fds.size() == 4);
+
+		fds = { 20, 21, 22, 23 };
+
+		auto result = LiveUpgrade::deserialize(data, fds);
+
+		REQUIRE(result.size() == 2);
+		REQUIRE(result[0].devName == "vdispl");
+		REQUIRE(result[0].domId == 3);
+		REQUIRE(result[0].devId == 2);
+		REQUIRE(result[0].backendState == XenbusStateConnected);
+		REQUIRE(result[0].frontendState == XenbusStateInitialised);
+		REQUIRE(result[0].ringBuffers.size() == 2);
+		REQUIRE(result[0].ringBuffers[0].port == 10);
+		REQUIRE(result[0].ringBuffers[0].ref == 100);
+		REQUIRE(result[0].ringBuffers[0].localPort == 40);
+		REQUIRE(result[0].ringBuffers[0].fd == 20);
+		REQUIRE(result[0].ringBuffers[0].reqCons == 7);
+		REQUIRE(result[0].ringBuffers[0].rspProdPvt == 5);
+		REQUIRE(result[0].ringBuffers[1].fd == 21);
+		REQUIRE(result[0].fds == vector<int>({ 22, 23 }));
+		REQUIRE(result[0].data == state.data);
+		REQUIRE(result[1].devName == "vsnd");
+		REQUIRE(result[1].ringBuffers.empty());
+		REQUIRE(result[1].data.empty());
+
+		fds.pop_back();
+
+		REQUIRE_THROWS_AS(LiveUpgrade::deserialize(data, fds),
+						  LiveUpgradeException);
+		REQUIRE_THROWS_AS(LiveUpgrade::deserialize("xenbe-upgrade 0 0", fds),
+						  LiveUpgradeException);
+	}
+
+	SECTION("Check file descriptors passing")
+	{
+		const int cNumPipes = 70;
+
+		int sockets[2];
+
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+		vector<int> readFds, writeFds;
+
+		for(int i = 0; i < cNumPipes; i++)
+		{
+			int fds[2];
+
+			REQUIRE(pipe(fds) == 0);
+
+			readFds.push_back(fds[0]);
+			writeFds.push_back(fds[1]);
+		}
+
+		LiveUpgrade::sendFds(sockets[0], "state", readFds);
+
+		string data;
+		vector<int> fds;
+
+		LiveUpgrade::receiveFds(sockets[1], data, fds);
+
+		REQUIRE(data == "state");
+		REQUIRE(fds.size() == cNumPipes);
+
+		for(int i = 0; i < cNumPipes; i++)
+		{
+			char value = i;
+
+			REQUIRE(write(writeFds[i], &value, 1) == 1);
+			REQUIRE(read(fds[i], &value, 1) == 1);
+			REQUIRE(value == i);
+
+			close(fds[i]);
+			close(readFds[i]);
+			close(writeFds[i]);
+		}
+
+		close(sockets[0]);
+		close(sockets[1]);
+	}
+
+	// the event channel can't be inherited without xenevtchn_fdopen
+
+#ifdef EVTCHN_HAS_FDOPEN
+	SECTION("Check handover to new process")
+	{
+		TestFrontendHandler::prepareXenStore(gDevName, 0, gDomId, gDevId);
+
+		XenStoreMock storeMock;
+
+		auto frontendHandler = make_shared<UpgradeFrontendHandler>();
+
+		auto fePath = frontendHandler->getXsFrontendPath();
+		auto bePath = frontendHandler->getXsBackendPath();
+
+		frontendHandler->start();
+
+		storeMock.writeValue(fePath + "/state",
+							 std::to_string(XenbusStateConnected));
+
+		REQUIRE(waitConnected(*frontendHandler));
+
+		auto ringBuffer = frontendHandler->getRingBuffer();
+
+		ringBuffer->setState({ gPort, gRef, 0, 0, 7, 7 });
+
+		int dmaBufFds[2];
+
+		REQUIRE(pipe(dmaBufFds) == 0);
+
+		frontendHandler->mDmaBufFd = dmaBufFds[0];
+		frontendHandler->mData = "dma-buf";
+
+		auto state = frontendHandler->handover();
+
+		REQUIRE(state.backendState == XenbusStateConnected);
+		REQUIRE(state.ringBuffers.size() == 1);
+		REQUIRE(state.ringBuffers[0].reqCons == 7);
+
+		int sockets[2];
+
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+		auto pid = fork();
+
+		REQUIRE(pid >= 0);
+
+		if (pid == 0)
+		{
+			close(sockets[0]);
+
+			_exit(runNewBackend(sockets[1], bePath, state.ringBuffers[0]));
+		}
+
+		close(sockets[1]);
+
+		bool stateWritten = false;
+
+		storeMock.setWriteValueCbk([&] (const string& path, const string& value)
+			{ if (path == bePath + "/state") { stateWritten = true; }});
+
+		LiveUpgrade::send(sockets[0], { state });
+
+		REQUIRE(write(dmaBufFds[1], "x", 1) == 1);
+
+		// the old process deletes the frontend handler without closing
+
+		frontendHandler.reset();
+
+		int status = 0;
+
+		REQUIRE(waitpid(pid, &status, 0) == pid);
+		REQUIRE(WIFEXITED(status));
+		REQUIRE(WEXITSTATUS(status) == 0);
+		REQUIRE_FALSE(stateWritten);
+
+		storeMock.setWriteValueCbk(nullptr);
+
+		close(sockets[0]);
+		close(dmaBufFds[0]);
+		close(dmaBufFds[1]);
+	}
+#endif
+}
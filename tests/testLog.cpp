@@ -0,0 +1,197 @@
+/*
+ *  Test Log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Log.hpp"
+
+using std::chrono::milliseconds;
+using std::istringstream;
+using std::string;
+using std::stringbuf;
+using std::this_thread::sleep_for;
+using std::thread;
+using std::vector;
+
+using XenBackend::Log;
+
+static vector<string> getLines(stringbuf& buffer, const string& pattern)
+{
+	istringstream stream(buffer.str());
+	vector<string> lines;
+	string line;
+
+	while (getline(stream, line))
+	{
+		if (line.find(pattern) != string::npos)
+		{
+			lines.push_back(line);
+		}
+	}
+
+	buffer.str("");
+
+	return lines;
+}
+
+TEST_CASE("LogMask", "[log]")
+{
+	REQUIRE(Log::setLogMask("LogMaskTest:DEBUG:binary:limit=3"));
+
+	Log log("LogMaskTest");
+
+	REQUIRE(log.isBinary());
+	REQUIRE(log.getRateLimit() == 3);
+
+	REQUIRE(Log::setLogMask("LogMaskOther:INFO"));
+
+	Log other("LogMaskOther");
+
+	REQUIRE_FALSE(other.isBinary());
+	REQUIRE(other.getRateLimit() == Log::getDefaultRateLimit());
+
+	REQUIRE_FALSE(Log::setLogMask("LogMaskTest:DEBUG:limit="));
+	REQUIRE_FALSE(Log::setLogMask("LogMaskTest:DEBUG:limit=a"));
+	REQUIRE_FALSE(Log::setLogMask("LogMaskTest:DEBUG:text"));
+
+	// the invalid mask clears mask items
+
+	REQUIRE(Log::setLogMask("*:Disable"));
+}
+
+TEST_CASE("LogRateLimit", "[log]")
+{
+	stringbuf buffer;
+	auto saved = std::cout.rdbuf();
+
+	Log::setStreamBuffer(&buffer);
+	Log::setLogMask("LogRateTest:DEBUG:limit=5");
+
+	Log log("LogRateTest");
+
+	SECTION("Check limit")
+	{
+		const int cNumThreads = 4;
+		const int cNumLines = 100;
+
+		vector<thread> threads;
+
+		auto logLines = [&log, cNumLines]
+		{
+			for(int i = 0; i < cNumLines; i++)
+			{
+				RLOG(log, ERROR) << "Repeated error: " << i;
+			}
+		};
+
+		// all lines are logged in one second unless the second starts while
+		// logging
+
+		for(int i = 0; i < cNumThreads; i++)
+		{
+			threads.emplace_back(logLines);
+		}
+
+		for(auto& t : threads)
+		{
+			t.join();
+		}
+
+		auto lines = getLines(buffer, "Repeated error");
+
+		REQUIRE(lines.size() >= 5);
+		REQUIRE(lines.size() <= 10);
+
+		sleep_for(milliseconds(1100));
+
+		logLines();
+
+		lines = getLines(buffer, "LogRateTest");
+
+		REQUIRE(lines.size() >= 6);
+		REQUIRE(lines[0].find("| ERR - suppressed ") != string::npos);
+		REQUIRE(lines[0].find(" similar messages") != string::npos);
+	}
+
+	SECTION("Check flush")
+	{
+		// summaries left by other sections
+		Log::flushSuppressed();
+		buffer.str("");
+
+		for(int i = 0; i < 100; i++)
+		{
+			RLOG(log, WARNING) << "Flushed warning";
+		}
+
+		REQUIRE(getLines(buffer, "Flushed warning").size() == 5);
+
+		// the statement doesn't fire again, the summary is flushed
+
+		Log::flushSuppressed();
+
+		auto lines = getLines(buffer, "LogRateTest");
+
+		REQUIRE(lines.size() == 1);
+		REQUIRE(lines[0].find("| WRN - suppressed 95 similar messages") !=
+				string::npos);
+
+		Log::flushSuppressed();
+
+		REQUIRE(getLines(buffer, "LogRateTest").empty());
+	}
+
+	SECTION("Check unlimited")
+	{
+		log.setRateLimit(0);
+
+		for(int i = 0; i < 100; i++)
+		{
+			RLOG(log, WARNING) << "Repeated warning";
+		}
+
+		REQUIRE(getLines(buffer, "Repeated warning").size() == 100);
+	}
+
+	SECTION("Check disabled")
+	{
+		int evaluated = 0;
+
+		RLOG(log, DEBUG) << "Debug: " << ++evaluated;
+
+		Log::setLogMask("LogRateTest:ERROR:limit=5");
+
+		Log errorLog("LogRateTest");
+
+		RLOG(errorLog, DEBUG) << "Debug: " << ++evaluated;
+
+		REQUIRE(evaluated == 1);
+	}
+
+	Log::setStreamBuffer(saved);
+	Log::setLogMask("LogRateTest:Disable");
+}
@@ -0,0 +1,276 @@
+/*
+ *  Test Metrics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Metrics.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+#include "testRingBuffer.hpp"
+
+using std::chrono::milliseconds;
+using std::string;
+using std::this_thread::sleep_for;
+using std::thread;
+using std::to_string;
+using std::vector;
+
+using XenBackend::Metrics;
+using XenBackend::MetricsCounter;
+using XenBackend::MetricsGroup;
+using XenBackend::MetricsSnapshot;
+using XenBackend::XenGnttabBuffer;
+
+static bool findSnapshot(const string& type, int port, MetricsSnapshot& result)
+{
+	for(auto& snapshot : Metrics::getSnapshot(type))
+	{
+		if (snapshot.port == port)
+		{
+			result = snapshot;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static uint64_t getGnttabValue(const string& name)
+{
+	auto snapshots = Metrics::getSnapshot("gnttab");
+
+	return snapshots.empty() ? 0 : snapshots[0].get(name);
+}
+
+TEST_CASE("MetricsCounter", "[metrics]")
+{
+	MetricsCounter counter;
+
+	const int cNumThreads = 4;
+	const int cNumAdds = 10000;
+
+	vector<thread> threads;
+
+	for(int i = 0; i < cNumThreads; i++)
+	{
+		threads.emplace_back([&counter, cNumAdds] {
+			for(int j = 0; j < cNumAdds; j++)
+			{
+				counter.add();
+			}
+		});
+	}
+
+	for(auto& t : threads)
+	{
+		t.join();
+	}
+
+	REQUIRE(counter.get() == cNumThreads * cNumAdds);
+
+	counter.add(10);
+
+	REQUIRE(counter.get() == cNumThreads * cNumAdds + 10);
+
+	// counters of the group are allocated on the heap
+
+	MetricsGroup group("test_align");
+
+	for(int i = 0; i < 4; i++)
+	{
+		auto address = reinterpret_cast<uintptr_t>(
+				&group.addCounter("counter_" + to_string(i)));
+
+		REQUIRE(address % 64 == 0);
+	}
+}
+
+TEST_CASE("MetricsGroup", "[metrics]")
+{
+	MetricsSnapshot snapshot;
+
+	{
+		MetricsGroup group("test", 3, -1, 17);
+
+		auto& counter1 = group.addCounter("counter1");
+		auto& counter2 = group.addCounter("counter2");
+
+		counter1.add();
+		counter2.add(5);
+
+		group.setDevId(2);
+
+		REQUIRE(findSnapshot("test", 17, snapshot));
+
+		REQUIRE(snapshot.domId == 3);
+		REQUIRE(snapshot.devId == 2);
+		REQUIRE(snapshot.values.size() == 2);
+		REQUIRE(snapshot.values[0].first == "counter1");
+		REQUIRE(snapshot.get("counter1") == 1);
+		REQUIRE(snapshot.get("counter2") == 5);
+		REQUIRE(snapshot.get("unknown") == 0);
+	}
+
+	// deleted group is unregistered
+
+	REQUIRE_FALSE(findSnapshot("test", 17, snapshot));
+
+	{
+		MetricsGroup group("test", 3, -1, 17);
+
+		auto& gauge = group.addGauge("gauge");
+		auto& histogram = group.addHistogram("latency");
+
+		gauge.add(3);
+		gauge.sub();
+		histogram.record(100);
+
+		group.setName("group");
+
+		REQUIRE(findSnapshot("test", 17, snapshot));
+
+		REQUIRE(snapshot.name == "group");
+		REQUIRE(snapshot.values.empty());
+		REQUIRE(snapshot.get("gauge") == 2);
+		REQUIRE(snapshot.histograms.size() == 1);
+		REQUIRE(snapshot.histograms[0].name == "latency");
+		REQUIRE(snapshot.histograms[0].requestType == -1);
+		REQUIRE(snapshot.histograms[0].snapshot.count == 1);
+	}
+
+	// deleted group is unregistered
+
+	REQUIRE_FALSE(findSnapshot("test", 17, snapshot));
+}
+
+TEST_CASE("RingBufferMetrics", "[metrics]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	MetricsSnapshot snapshot;
+
+	SECTION("Check in ring buffer")
+	{
+		auto numMapped = getGnttabValue("buffers_mapped");
+
+		TestRingBufferIn ringBuffer(5, 71, 28);
+
+		REQUIRE(getGnttabValue("buffers_mapped") == numMapped + 1);
+
+		ringBuffer.start();
+
+		xen_test_front_ring ring;
+		auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+		SHARED_RING_INIT(sring);
+		FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+		const int cNumRequests = 3;
+
+		for(int i = 0; i < cNumRequests; i++)
+		{
+			xentest_req req { XENTEST_CMD2 };
+
+			*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+			ring.req_prod_pvt++;
+		}
+
+		int notify;
+
+		RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+		REQUIRE(notify);
+
+		auto port = XenEvtchnMock::getLastBoundPort();
+
+		XenEvtchnMock::signalPort(port);
+
+		for(int i = 0; i < 100 && sring->rsp_prod != cNumRequests; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(sring->rsp_prod == cNumRequests);
+
+		// indication without requests
+
+		XenEvtchnMock::signalPort(port);
+
+		for(int i = 0; i < 100 && ringBuffer.getNumIndications() != 2; i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		ringBuffer.stop();
+
+		REQUIRE(findSnapshot("ring", 71, snapshot));
+
+		REQUIRE(snapshot.domId == 5);
+		REQUIRE(snapshot.get("requests_consumed") == cNumRequests);
+		REQUIRE(snapshot.get("responses_produced") == cNumRequests);
+		REQUIRE(snapshot.get("notifications_received") == 2);
+		REQUIRE(snapshot.get("spurious_wakeups") == 1);
+		REQUIRE(snapshot.get("ring_overflow") == 0);
+	}
+
+	SECTION("Check out ring buffer")
+	{
+		TestRingBufferOut ringBuffer(5, 72, 29);
+
+		ringBuffer.start();
+
+		const int cNumEvents = XENTEST_IN_RING_SIZE / sizeof(xentest_evt);
+
+		for(int i = 0; i < cNumEvents + 1; i++)
+		{
+			ringBuffer.sendEvent({ XENTEST_EVT1 });
+		}
+
+		REQUIRE(findSnapshot("ring", 72, snapshot));
+
+		REQUIRE(snapshot.get("events_produced") == cNumEvents);
+		REQUIRE(snapshot.get("notifications_sent") == cNumEvents);
+		REQUIRE(snapshot.get("ring_full") == 1);
+	}
+
+	SECTION("Check grant table")
+	{
+		auto numUnmapped = getGnttabValue("buffers_unmapped");
+		auto numPages = getGnttabValue("pages_unmapped");
+
+		{
+			grant_ref_t refs[] = { 1, 2, 3 };
+
+			XenGnttabBuffer buffer(5, refs, 3);
+		}
+
+		REQUIRE(getGnttabValue("buffers_unmapped") == numUnmapped + 1);
+		REQUIRE(getGnttabValue("pages_unmapped") == numPages + 3);
+		REQUIRE(getGnttabValue("pages_in_use") == 0);
+	}
+}
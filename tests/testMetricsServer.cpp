@@ -0,0 +1,202 @@
+/*
+ *  Test MetricsServer
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "MetricsServer.hpp"
+
+using std::make_pair;
+using std::string;
+using std::to_string;
+using std::vector;
+
+using XenBackend::MetricsGroup;
+using XenBackend::MetricsHistogram;
+using XenBackend::MetricsServer;
+using XenBackend::MetricsServerException;
+using XenBackend::MetricsSnapshot;
+
+static string getSocketPath()
+{
+	return "/tmp/xenbe_test_" + to_string(getpid()) + ".sock";
+}
+
+static string sendRequest(const string& request)
+{
+	sockaddr_un addr {};
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, getSocketPath().c_str());
+
+	auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	REQUIRE(fd >= 0);
+	REQUIRE(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+	REQUIRE(write(fd, request.data(), request.size()) ==
+			static_cast<ssize_t>(request.size()));
+
+	string response;
+	char buffer[1024];
+	ssize_t size;
+
+	// the server closes the connection after the response
+
+	while ((size = read(fd, buffer, sizeof(buffer))) > 0)
+	{
+		response.append(buffer, size);
+	}
+
+	close(fd);
+
+	return response;
+}
+
+static MetricsSnapshot getTestSnapshot()
+{
+	MetricsSnapshot snapshot {};
+
+	snapshot.type = "test";
+	snapshot.name = "dev\"1";
+	snapshot.domId = 3;
+	snapshot.devId = 1;
+	snapshot.port = -1;
+	snapshot.values.push_back(make_pair("requests", 5));
+	snapshot.gauges.push_back(make_pair("in_use", 2));
+
+	MetricsHistogram histogram {};
+
+	histogram.name = "latency";
+	histogram.requestType = 7;
+	histogram.snapshot.count = 10;
+	histogram.snapshot.mean = 100;
+	histogram.snapshot.p50 = 90;
+	histogram.snapshot.p999 = 200;
+
+	snapshot.histograms.push_back(histogram);
+
+	return snapshot;
+}
+
+static bool contains(const string& text, const string& pattern)
+{
+	return text.find(pattern) != string::npos;
+}
+
+TEST_CASE("MetricsServerFormat", "[metricsserver]")
+{
+	vector<MetricsSnapshot> snapshots = { getTestSnapshot(),
+										  getTestSnapshot() };
+
+	snapshots[1].domId = 4;
+	snapshots[1].devId = -1;
+	snapshots[1].name = "";
+
+	SECTION("Check Prometheus")
+	{
+		auto text = MetricsServer::formatPrometheus(snapshots);
+
+		REQUIRE(contains(text, "# TYPE xenbe_test_requests counter\n"
+				"xenbe_test_requests{domid=\"3\",devid=\"1\","
+				"name=\"dev\\\"1\"} 5\n"
+				"xenbe_test_requests{domid=\"4\"} 5\n"));
+		REQUIRE(contains(text, "# TYPE xenbe_test_in_use gauge\n"));
+		REQUIRE(contains(text, "# TYPE xenbe_test_latency_nanoseconds summary\n"));
+		REQUIRE(contains(text, "xenbe_test_latency_nanoseconds{domid=\"4\","
+				"request_type=\"7\",quantile=\"0.999\"} 200\n"));
+		REQUIRE(contains(text, "xenbe_test_latency_nanoseconds_sum{domid=\"4\","
+				"request_type=\"7\"} 1000\n"));
+		REQUIRE(contains(text, "xenbe_test_latency_nanoseconds_count{domid=\"4\","
+				"request_type=\"7\"} 10\n"));
+	}
+
+	SECTION("Check JSON")
+	{
+		auto text = MetricsServer::formatJson(snapshots);
+
+		REQUIRE(contains(text, "{\"type\":\"test\",\"name\":\"dev\\\"1\","
+				"\"domid\":3,\"devid\":1,\"port\":-1,"
+				"\"counters\":{\"requests\":5},\"gauges\":{\"in_use\":2},"));
+		REQUIRE(contains(text, "{\"name\":\"latency\",\"request_type\":7,"
+				"\"count\":10,"));
+		REQUIRE(text.front() == '[');
+		REQUIRE(text.substr(text.size() - 2) == "]\n");
+	}
+}
+
+TEST_CASE("MetricsServer", "[metricsserver]")
+{
+	MetricsServer server(getSocketPath());
+	MetricsGroup group("test", 6, 0, 11);
+
+	group.addCounter("requests").add(3);
+
+	SECTION("Check Prometheus")
+	{
+		auto response = sendRequest("GET /metrics HTTP/1.0\r\n\r\n");
+
+		REQUIRE(response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+		REQUIRE(contains(response, "version=0.0.4"));
+		REQUIRE(contains(response, "xenbe_test_requests{domid=\"6\","
+				"devid=\"0\",port=\"11\"} 3\n"));
+		REQUIRE(contains(response, "xenbe_reactor_loops{domid=\"0\","
+				"name=\"MetricsServer\"}"));
+		REQUIRE(contains(response, "xenbe_process_threads{domid=\"0\"}"));
+	}
+
+	SECTION("Check JSON")
+	{
+		auto response = sendRequest("GET /metrics.json HTTP/1.1\r\n"
+									"Host: localhost\r\n\r\n");
+
+		REQUIRE(response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+		REQUIRE(contains(response, "application/json"));
+		REQUIRE(contains(response, "\"counters\":{\"requests\":3}"));
+	}
+
+	SECTION("Check not found")
+	{
+		auto response = sendRequest("GET /unknown HTTP/1.0\r\n\r\n");
+
+		REQUIRE(response.compare(0, 22, "HTTP/1.0 404 Not Found") == 0);
+	}
+
+	SECTION("Check closed client")
+	{
+		// the client closed without request doesn't affect others
+
+		sendRequest("");
+
+		auto response = sendRequest("GET /metrics HTTP/1.0\r\n\r\n");
+
+		REQUIRE(response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+	}
+}
+
+TEST_CASE("MetricsServerInvalidPath", "[metricsserver]")
+{
+	REQUIRE_THROWS_AS(MetricsServer("/non/exist/dir/metrics.sock"),
+					  MetricsServerException);
+}
@@ -0,0 +1,444 @@
+/*
+ *  Test Reactor
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "Reactor.hpp"
+#include "XenEvtchn.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::make_shared;
+using std::string;
+using std::this_thread::sleep_for;
+using std::thread;
+using std::to_string;
+using std::vector;
+
+using XenBackend::Reactor;
+using XenBackend::ReactorBackend;
+using XenBackend::ReactorPtr;
+using XenBackend::XenEvtchn;
+
+static bool waitFor(const atomic<int>& value, int expected)
+{
+	for(int i = 0; i < 100 && value != expected; i++)
+	{
+		sleep_for(milliseconds(10));
+	}
+
+	return value == expected;
+}
+
+TEST_CASE("Reactor", "[reactor]")
+{
+	auto backend = GENERATE(ReactorBackend::Epoll, ReactorBackend::IoUring);
+	auto reactor = make_shared<Reactor>("TestReactor", backend);
+
+	reactor->start();
+
+	SECTION("Check posted tasks")
+	{
+		vector<int> order;
+		thread::id threadId;
+
+		for(int i = 0; i < 10; i++)
+		{
+			reactor->post([&order, &threadId, i, reactor]
+			{
+				order.push_back(i);
+				threadId = std::this_thread::get_id();
+			});
+		}
+
+		reactor->flush();
+
+		REQUIRE(order == vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }));
+		REQUIRE(threadId != std::this_thread::get_id());
+		REQUIRE_FALSE(reactor->isReactorThread());
+		REQUIRE(reactor->getNumEvents() >= 10);
+	}
+
+	SECTION("Check delayed tasks")
+	{
+		atomic<int> numCalls(0);
+		auto start = steady_clock::now();
+		steady_clock::time_point end;
+
+		reactor->postDelayed(milliseconds(50), [&numCalls, &end]
+		{
+			end = steady_clock::now();
+			numCalls++;
+		});
+
+		reactor->postDelayed(milliseconds(10), [&numCalls]
+		{
+			// the earlier deadline is called first
+			if (numCalls == 0)
+			{
+				numCalls++;
+			}
+		});
+
+		REQUIRE(waitFor(numCalls, 2));
+		REQUIRE(end - start >= milliseconds(50));
+	}
+
+	SECTION("Check file descriptor")
+	{
+		int fds[2];
+
+		REQUIRE(pipe(fds) == 0);
+
+		atomic<int> numCalls(0);
+
+		reactor->addFd(fds[0], [&numCalls, &fds]
+		{
+			char data;
+
+			if (read(fds[0], &data, sizeof(data)) == sizeof(data))
+			{
+				numCalls++;
+			}
+		});
+
+		REQUIRE(write(fds[1], "a", 1) == 1);
+		REQUIRE(waitFor(numCalls, 1));
+
+		REQUIRE(write(fds[1], "b", 1) == 1);
+		REQUIRE(waitFor(numCalls, 2));
+
+		REQUIRE_THROWS(reactor->addFd(fds[0], [] {}));
+
+		reactor->removeFd(fds[0]);
+
+		// the callback is not called after removing
+		REQUIRE(write(fds[1], "c", 1) == 1);
+
+		sleep_for(milliseconds(20));
+
+		REQUIRE(numCalls == 2);
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	SECTION("Check level-triggered")
+	{
+		int fds[2];
+
+		REQUIRE(pipe(fds) == 0);
+
+		atomic<int> numCalls(0);
+
+		// one byte is read per call: the callback is called while the
+		// descriptor is readable
+
+		reactor->addFd(fds[0], [&numCalls, &fds]
+		{
+			char data;
+
+			if (read(fds[0], &data, sizeof(data)) == sizeof(data))
+			{
+				numCalls++;
+			}
+		});
+
+		REQUIRE(write(fds[1], "abc", 3) == 3);
+		REQUIRE(waitFor(numCalls, 3));
+
+		reactor->removeFd(fds[0]);
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	SECTION("Check file I/O")
+	{
+		auto fileName = "/tmp/xenbe_test_reactor_" + to_string(getpid());
+		auto fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+		REQUIRE(fd >= 0);
+
+		char writeData[] = "reactor file I/O";
+		char readData[sizeof(writeData)] = {};
+		iovec writeIov = { writeData, sizeof(writeData) };
+		iovec readIov = { readData, sizeof(readData) };
+		atomic<int> numCalls(0);
+		ssize_t writeResult = 0, readResult = 0;
+
+		reactor->submitWrite(fd, &writeIov, 1, 16,
+							 [&, reactor] (ssize_t result)
+		{
+			writeResult = result;
+			numCalls++;
+
+			// submitted from the reactor thread
+			reactor->submitRead(fd, &readIov, 1, 16,
+								[&, reactor] (ssize_t result)
+			{
+				if (reactor->isReactorThread())
+				{
+					readResult = result;
+				}
+
+				numCalls++;
+			});
+		});
+
+		REQUIRE(waitFor(numCalls, 2));
+		REQUIRE(writeResult == sizeof(writeData));
+		REQUIRE(readResult == sizeof(readData));
+		REQUIRE(memcmp(writeData, readData, sizeof(writeData)) == 0);
+
+		// the error is returned as negative errno
+
+		reactor->submitRead(-1, &readIov, 1, 0, [&readResult, &numCalls]
+							(ssize_t result) { readResult = result; numCalls++; });
+
+		REQUIRE(waitFor(numCalls, 3));
+		REQUIRE(readResult == -EBADF);
+
+		close(fd);
+		unlink(fileName.c_str());
+	}
+
+	SECTION("Check removing from callback")
+	{
+		int fds[2];
+
+		REQUIRE(pipe(fds) == 0);
+
+		atomic<int> numCalls(0);
+
+		reactor->addFd(fds[0], [&numCalls, &fds, reactor]
+		{
+			numCalls++;
+
+			reactor->removeFd(fds[0]);
+		});
+
+		REQUIRE(write(fds[1], "ab", 2) == 2);
+		REQUIRE(waitFor(numCalls, 1));
+
+		reactor->flush();
+
+		REQUIRE(numCalls == 1);
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	SECTION("Check stop from callback")
+	{
+		reactor->post([reactor] { reactor->stop(); });
+
+		// the reactor thread is exited: the flush task is never run
+
+		sleep_for(milliseconds(50));
+
+		reactor->flush();
+	}
+
+	SECTION("Check deleting from callback")
+	{
+		atomic<int> done(0);
+		auto holder = make_shared<ReactorPtr>(
+				make_shared<Reactor>("TestReactor", backend));
+
+		(*holder)->start();
+
+		// the last reference to the reactor is dropped in its thread
+
+		(*holder)->post([holder, &done] { holder->reset(); done = 1; });
+
+		holder.reset();
+
+		REQUIRE(waitFor(done, 1));
+	}
+
+	SECTION("Check event channel")
+	{
+		XenEvtchnMock::setErrorMode(false);
+
+		atomic<int> numCalls(0);
+		atomic<int> numErrors(0);
+
+		XenEvtchn eventChannel(3, 25, [&numCalls, reactor]
+							   { if (reactor->isReactorThread()) numCalls++; },
+							   [&numErrors] (const std::exception& e)
+							   { numErrors++; });
+
+		eventChannel.start(reactor);
+
+		REQUIRE_THROWS(eventChannel.start(reactor));
+
+		XenEvtchnMock::signalPort(eventChannel.getPort());
+
+		REQUIRE(waitFor(numCalls, 1));
+
+		XenEvtchnMock::setErrorMode(true);
+
+		XenEvtchnMock::signalPort(eventChannel.getPort());
+
+		REQUIRE(waitFor(numErrors, 1));
+
+		XenEvtchnMock::setErrorMode(false);
+
+		eventChannel.stop();
+
+		REQUIRE(numCalls == 1);
+	}
+
+	reactor->stop();
+}
+
+TEST_CASE("ReactorBenchmark", "[.benchmark]")
+{
+	const int cNumPairs = 64;
+	const int cNumMessages = 200000;
+	const int cNumReads = 50000;
+	const size_t cBlockSize = 4096;
+
+	for(auto backend : { ReactorBackend::Epoll, ReactorBackend::IoUring })
+	{
+		auto reactor = make_shared<Reactor>("BenchReactor", backend);
+		string name = reactor->getBackend() == ReactorBackend::Epoll ?
+					  "epoll" : "io_uring";
+
+		reactor->start();
+
+		// loopback ping-pong: each socket pair passes one byte back and forth
+
+		vector<int> fds(cNumPairs * 2);
+		atomic<int> count(0);
+
+		for(int i = 0; i < cNumPairs; i++)
+		{
+			REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]) == 0);
+		}
+
+		auto start = steady_clock::now();
+
+		for(auto fd : fds)
+		{
+			reactor->addFd(fd, [fd, &count]
+			{
+				char data;
+
+				if (read(fd, &data, sizeof(data)) == sizeof(data) &&
+					++count < cNumMessages)
+				{
+					if (write(fd, &data, sizeof(data)) < 0) {}
+				}
+			});
+		}
+
+		for(int i = 0; i < cNumPairs; i++)
+		{
+			REQUIRE(write(fds[i * 2], "x", 1) == 1);
+		}
+
+		while (count < cNumMessages)
+		{
+			sleep_for(milliseconds(1));
+		}
+
+		auto pollTime = duration_cast<nanoseconds>(
+				steady_clock::now() - start).count();
+
+		for(auto fd : fds)
+		{
+			reactor->removeFd(fd);
+			close(fd);
+		}
+
+		// reads of 4 KB blocks, each completion submits the next read
+
+		auto fileName = "/tmp/xenbe_test_reactor_" + to_string(getpid());
+		auto fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+		REQUIRE(fd >= 0);
+		REQUIRE(ftruncate(fd, cBlockSize * 256) == 0);
+
+		vector<char> buffer(cBlockSize * cNumPairs);
+		vector<iovec> iovs(cNumPairs);
+		atomic<int> numReads(0);
+		std::function<void(int)> read;
+
+		read = [&](int i)
+		{
+			reactor->submitRead(fd, &iovs[i], 1,
+								(numReads * cBlockSize) % (cBlockSize * 256),
+								[&, i] (ssize_t result)
+			{
+				if (++numReads + cNumPairs <= cNumReads)
+				{
+					read(i);
+				}
+			});
+		};
+
+		start = steady_clock::now();
+
+		for(int i = 0; i < cNumPairs; i++)
+		{
+			iovs[i] = { &buffer[i * cBlockSize], cBlockSize };
+
+			read(i);
+		}
+
+		while (numReads < cNumReads)
+		{
+			sleep_for(milliseconds(1));
+		}
+
+		auto readTime = duration_cast<nanoseconds>(
+				steady_clock::now() - start).count();
+
+		reactor->stop();
+
+		close(fd);
+		unlink(fileName.c_str());
+
+		cout << "Reactor " << name << ", loopback message: "
+			 << pollTime / cNumMessages << " ns, " << cNumPairs
+			 << " reads in flight: " << readTime / cNumReads << " ns"
+			 << endl;
+	}
+}
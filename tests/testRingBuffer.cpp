@@ -22,6 +22,7 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <iostream>
 #include <mutex>
 
 #include "catch.hpp"
@@ -29,12 +30,19 @@
 #include "mocks/XenEvtchnMock.hpp"
 #include "mocks/XenGnttabMock.hpp"
 
+using std::chrono::duration_cast;
 using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
 using std::condition_variable;
+using std::cout;
+using std::endl;
 using std::mutex;
 using std::this_thread::sleep_for;
 using std::unique_lock;
 
+using XenBackend::Log;
+using XenBackend::LogLevel;
 using XenBackend::RingBufferInBase;
 using XenBackend::RingBufferOutBase;
 
@@ -258,6 +266,35 @@ TEST_CASE("RingBufferIn", "[ringbuffer]")
 		}
 	}
 
+	SECTION("Check resume")
+	{
+		// the request posted while suspended is processed when the resumed
+		// ring buffer is connected
+
+		ringBuffer.suspend();
+
+		req[0].seq = seqNumber++;
+
+		sendReq(req[0], ring);
+
+		sleep_for(milliseconds(20));
+
+		REQUIRE(sring->rsp_prod == 0);
+		REQUIRE(ringBuffer.resume());
+
+		sleep_for(milliseconds(20));
+
+		REQUIRE(sring->rsp_prod == 0);
+
+		ringBuffer.processPending();
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+		REQUIRE(req[0].seq == rsp.seq);
+		REQUIRE_FALSE(gError);
+	}
+
 	SECTION("Check overflow")
 	{
 		sring->req_prod = ring.nr_ents + 1;
@@ -334,3 +371,72 @@ TEST_CASE("RingBufferOut", "[ringbuffer]")
 		ringBuffer.stop();
 	}
 }
+
+TEST_CASE("RingBufferOutBenchmark", "[.benchmark]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	const int cNumEvents = 1000000;
+
+	TestRingBufferOut ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.start();
+
+	auto eventPage = static_cast<xentest_event_page*>(
+			XenGnttabMock::getLastBuffer());
+
+	eventPage->in_cons = 0;
+	eventPage->in_prod = 0;
+
+	xentest_evt event {XENTEST_EVT1};
+
+	// the frontend consumes the event right away, so the ring is not full
+
+	auto start = steady_clock::now();
+
+	for(int i = 0; i < cNumEvents; i++)
+	{
+		ringBuffer.sendEvent(event);
+
+		eventPage->in_cons = eventPage->in_prod;
+	}
+
+	auto sendTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count() / cNumEvents;
+
+	ringBuffer.stop();
+
+	// the disabled debug log of sendEvent() with and without the level check
+	// before the log line is created
+
+	Log log("Benchmark", LogLevel::logINFO);
+
+	start = steady_clock::now();
+
+	for(int i = 0; i < cNumEvents; i++)
+	{
+		XENBE_LOG_STREAM(log, DEBUG) << "Send event, port: " << gPort
+									 << ", prod: " << eventPage->in_prod
+									 << ", cons: " << eventPage->in_cons;
+	}
+
+	auto uncheckedTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count() / cNumEvents;
+
+	start = steady_clock::now();
+
+	for(int i = 0; i < cNumEvents; i++)
+	{
+		LOG(log, DEBUG) << "Send event, port: " << gPort
+						<< ", prod: " << eventPage->in_prod
+						<< ", cons: " << eventPage->in_cons;
+	}
+
+	auto checkedTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count() / cNumEvents;
+
+	cout << "sendEvent: " << sendTime << " ns/event, disabled log: "
+		 << uncheckedTime << " ns unchecked, " << checkedTime
+		 << " ns checked" << endl;
+}
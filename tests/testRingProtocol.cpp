@@ -0,0 +1,222 @@
+/*
+ *  Test RingProtocol
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include "catch.hpp"
+
+#include "RingProtocol.hpp"
+
+extern "C" {
+#include "testProtocol.h"
+}
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+
+using XenBackend::MetricsGroup;
+
+typedef decltype(xentest_req::op) xentest_op;
+
+class TestProtocolBackend
+{
+public:
+
+	explicit TestProtocolBackend(MetricsGroup& metrics) :
+		mProtocol(metrics), mSparseProtocol(metrics) {}
+
+	bool dispatch(const xentest_req& req, xentest_rsp& rsp)
+	{
+		return mProtocol.dispatch(*this, req, rsp);
+	}
+
+	bool dispatchSparse(const xentest_req& req, xentest_rsp& rsp)
+	{
+		return mSparseProtocol.dispatch(*this, req, rsp);
+	}
+
+private:
+
+	void onCommand1(const xentest_command1_req& cmd, xentest_rsp& rsp)
+	{
+		rsp.u32data = cmd.u32data1 + cmd.u32data2;
+	}
+
+	void onCommand2(const xentest_command2_req& cmd, xentest_rsp& rsp)
+	{
+		rsp.u32data = static_cast<uint32_t>(cmd.u64data1 >> 32);
+	}
+
+	void onCommand3(const xentest_command3_req& cmd, xentest_rsp& rsp)
+	{
+		rsp.u32data = cmd.u16data1 * cmd.u16data2 + cmd.u32data3;
+	}
+
+	// commands are not sorted by id
+
+	typedef XENBE_RING_PROTOCOL(xen_test_sring,
+		&xentest_req::id, &xentest_req::op,
+		XENBE_RING_COMMAND(XENTEST_CMD2, &xentest_op::command2,
+						   &TestProtocolBackend::onCommand2),
+		XENBE_RING_COMMAND(XENTEST_CMD1, &xentest_op::command1,
+						   &TestProtocolBackend::onCommand1),
+		XENBE_RING_COMMAND(XENTEST_CMD3, &xentest_op::command3,
+						   &TestProtocolBackend::onCommand3)) Protocol;
+
+	// CMD2 is a hole of the dispatch table
+
+	typedef XENBE_RING_PROTOCOL(xen_test_sring,
+		&xentest_req::id, &xentest_req::op,
+		XENBE_RING_COMMAND(XENTEST_CMD1, &xentest_op::command1,
+						   &TestProtocolBackend::onCommand1),
+		XENBE_RING_COMMAND(XENTEST_CMD3, &xentest_op::command3,
+						   &TestProtocolBackend::onCommand3)) SparseProtocol;
+
+	static_assert(Protocol::cMinId == XENTEST_CMD1, "Wrong min id");
+	static_assert(Protocol::cTableSize == 3, "Wrong table size");
+	static_assert(SparseProtocol::cTableSize == 3, "Wrong table size");
+
+	Protocol mProtocol;
+	SparseProtocol mSparseProtocol;
+};
+
+TEST_CASE("RingProtocol", "[ringprotocol]")
+{
+	MetricsGroup metrics("test_protocol");
+	TestProtocolBackend backend(metrics);
+
+	xentest_req req {};
+	xentest_rsp rsp {};
+
+	SECTION("Check dispatch")
+	{
+		req.id = XENTEST_CMD1;
+		req.op.command1.u32data1 = 3;
+		req.op.command1.u32data2 = 4;
+
+		REQUIRE(backend.dispatch(req, rsp));
+		REQUIRE(rsp.u32data == 7);
+
+		req = {};
+		req.id = XENTEST_CMD2;
+		req.op.command2.u64data1 = 0x1234567800000000;
+
+		REQUIRE(backend.dispatch(req, rsp));
+		REQUIRE(rsp.u32data == 0x12345678);
+
+		req = {};
+		req.id = XENTEST_CMD3;
+		req.op.command3.u16data1 = 5;
+		req.op.command3.u16data2 = 6;
+		req.op.command3.u32data3 = 1;
+
+		REQUIRE(backend.dispatch(req, rsp));
+		REQUIRE(rsp.u32data == 31);
+	}
+
+	SECTION("Check unknown id")
+	{
+		rsp.u32data = 0xDEAD;
+
+		for(uint32_t id : { 0u, XENTEST_CMD1 - 1u, XENTEST_CMD3 + 1u,
+							0xFFFFFFFFu })
+		{
+			req.id = id;
+
+			REQUIRE_FALSE(backend.dispatch(req, rsp));
+		}
+
+		req.id = XENTEST_CMD2;
+
+		REQUIRE_FALSE(backend.dispatchSparse(req, rsp));
+
+		req.id = XENTEST_CMD3;
+
+		REQUIRE(backend.dispatchSparse(req, rsp));
+		REQUIRE(rsp.u32data == 0);
+	}
+
+	SECTION("Check metrics")
+	{
+		for(int i = 0; i < 3; i++)
+		{
+			req.id = XENTEST_CMD1;
+
+			backend.dispatch(req, rsp);
+		}
+
+		req.id = XENTEST_CMD3;
+
+		backend.dispatch(req, rsp);
+
+		req.id = 0;
+
+		backend.dispatch(req, rsp);
+
+		auto snapshot = metrics.getSnapshot();
+
+		REQUIRE(snapshot.get("requests_" +
+							 std::to_string(XENTEST_CMD1)) == 3);
+		REQUIRE(snapshot.get("requests_" +
+							 std::to_string(XENTEST_CMD2)) == 0);
+		REQUIRE(snapshot.get("requests_" +
+							 std::to_string(XENTEST_CMD3)) == 1);
+		REQUIRE(snapshot.get("requests_unknown") == 1);
+	}
+}
+
+TEST_CASE("RingProtocolBenchmark", "[.benchmark]")
+{
+	const int cNumRequests = 10000000;
+
+	MetricsGroup metrics("test_protocol");
+	TestProtocolBackend backend(metrics);
+
+	xentest_req reqs[4] {};
+	xentest_rsp rsp {};
+	uint64_t sum = 0;
+
+	reqs[0].id = XENTEST_CMD1;
+	reqs[1].id = XENTEST_CMD3;
+	reqs[2].id = XENTEST_CMD2;
+	reqs[3].id = XENTEST_CMD1;
+
+	auto start = steady_clock::now();
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		reqs[i % 4].op.command1.u32data1 = i;
+
+		backend.dispatch(reqs[i % 4], rsp);
+
+		sum += rsp.u32data;
+	}
+
+	auto time = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+	REQUIRE(sum != 0);
+
+	cout << "Requests: " << cNumRequests << ", dispatch: "
+		 << static_cast<double>(time) / cNumRequests << " ns" << endl;
+}
@@ -0,0 +1,343 @@
+/*
+ *  Test Scheduler
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Scheduler.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+#include "testRingBuffer.hpp"
+
+using std::atomic;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::make_shared;
+using std::this_thread::sleep_for;
+using std::vector;
+
+using XenBackend::Reactor;
+using XenBackend::Schedulable;
+using XenBackend::Scheduler;
+using XenBackend::SchedulerBudget;
+using XenBackend::SchedulerException;
+using XenBackend::TokenBucket;
+
+class TestClient : public Schedulable
+{
+public:
+
+	TestClient(domid_t domId, size_t numRequests, vector<domid_t>& slices) :
+		mDomId(domId),
+		mNumRequests(numRequests),
+		mSlices(slices)
+	{}
+
+	bool processRequests(SchedulerBudget& budget) override
+	{
+		while (mNumRequests && budget.isAvailable())
+		{
+			mNumRequests--;
+
+			budget.consume(100);
+		}
+
+		mSlices.push_back(mDomId);
+
+		return mNumRequests != 0;
+	}
+
+	size_t getNumRequests() const { return mNumRequests; }
+
+private:
+
+	domid_t mDomId;
+	atomic<size_t> mNumRequests;
+	vector<domid_t>& mSlices;
+};
+
+static bool waitProcessed(const TestClient& client, int timeoutMs = 1000)
+{
+	for(int i = 0; i < timeoutMs / 10 && client.getNumRequests(); i++)
+	{
+		sleep_for(milliseconds(10));
+	}
+
+	return client.getNumRequests() == 0;
+}
+
+TEST_CASE("TokenBucket", "[scheduler]")
+{
+	TokenBucket bucket(100, 10);
+
+	auto now = steady_clock::now();
+
+	REQUIRE(bucket.isLimited());
+	REQUIRE_FALSE(TokenBucket().isLimited());
+
+	REQUIRE(bucket.getAvailable(now) == Approx(10));
+
+	bucket.take(15);
+
+	REQUIRE(bucket.getAvailable(now) == Approx(-5));
+	REQUIRE(bucket.getWaitTime(now) == microseconds(60000));
+
+	// refilled by 100 tokens per second up to the burst
+
+	REQUIRE(bucket.getAvailable(now + milliseconds(100)) == Approx(5));
+	REQUIRE(bucket.getAvailable(now + milliseconds(1000)) == Approx(10));
+	REQUIRE(bucket.getWaitTime(now + milliseconds(1000)) == microseconds(0));
+}
+
+TEST_CASE("Scheduler", "[scheduler]")
+{
+	vector<domid_t> slices;
+
+	SECTION("Check budget")
+	{
+		Scheduler scheduler;
+
+		TestClient client(1, 100, slices);
+
+		scheduler.setBudget(10);
+		scheduler.add(&client, 1);
+		scheduler.activate(&client);
+
+		REQUIRE(waitProcessed(client));
+
+		scheduler.remove(&client);
+
+		auto stats = scheduler.getStats(1);
+
+		REQUIRE(slices.size() == 10);
+		REQUIRE(stats.numRequests == 100);
+		REQUIRE(stats.numBytes == 10000);
+		REQUIRE(stats.numBudgetExhausted == 9);
+		REQUIRE(stats.numThrottled == 0);
+
+		REQUIRE_THROWS_AS(scheduler.setBudget(0), SchedulerException);
+		REQUIRE_THROWS_AS(scheduler.setWeight(1, 0), SchedulerException);
+	}
+
+	SECTION("Check weighted fair queuing")
+	{
+		// slices are queued before the reactor is started
+		auto reactor = make_shared<Reactor>();
+
+		Scheduler scheduler("", reactor);
+
+		TestClient client1(1, 1000, slices);
+		TestClient client2(2, 1000, slices);
+
+		scheduler.setBudget(10);
+		scheduler.setWeight(2, 3);
+		scheduler.add(&client1, 1);
+		scheduler.add(&client2, 2);
+		scheduler.activate(&client1);
+		scheduler.activate(&client2);
+
+		reactor->start();
+
+		REQUIRE(waitProcessed(client1));
+		REQUIRE(waitProcessed(client2));
+
+		reactor->flush();
+
+		scheduler.remove(&client1);
+		scheduler.remove(&client2);
+
+		// while both are active, domain 2 gets three slices per slice of
+		// domain 1
+
+		int numSlices1 = 0, numSlices2 = 0;
+
+		for(size_t i = 0; i < 40; i++)
+		{
+			slices[i] == 1 ? numSlices1++ : numSlices2++;
+		}
+
+		REQUIRE(numSlices1 >= 9);
+		REQUIRE(numSlices1 <= 11);
+		REQUIRE(numSlices2 == 40 - numSlices1);
+	}
+
+	SECTION("Check round robin inside domain")
+	{
+		auto reactor = make_shared<Reactor>();
+
+		Scheduler scheduler("", reactor);
+
+		vector<domid_t> slices1, slices2;
+
+		TestClient client1(1, 50, slices1);
+		TestClient client2(1, 50, slices2);
+
+		scheduler.setBudget(10);
+		scheduler.add(&client1, 1);
+		scheduler.add(&client2, 1);
+		scheduler.activate(&client1);
+		scheduler.activate(&client2);
+
+		reactor->start();
+
+		REQUIRE(waitProcessed(client1));
+		REQUIRE(waitProcessed(client2));
+
+		reactor->flush();
+
+		scheduler.remove(&client1);
+		scheduler.remove(&client2);
+
+		REQUIRE(slices1.size() == 5);
+		REQUIRE(slices2.size() == 5);
+	}
+
+	SECTION("Check rate limit")
+	{
+		Scheduler scheduler;
+
+		TestClient client(1, 30, slices);
+
+		// burst is 10 requests, the rest takes 200 ms
+		scheduler.setRateLimit(1, 100);
+		scheduler.add(&client, 1);
+
+		auto start = steady_clock::now();
+
+		scheduler.activate(&client);
+
+		REQUIRE(waitProcessed(client));
+
+		auto time = steady_clock::now() - start;
+
+		scheduler.remove(&client);
+
+		auto stats = scheduler.getStats(1);
+
+		REQUIRE(stats.numRequests == 30);
+		REQUIRE(stats.numThrottled > 0);
+		REQUIRE(stats.throttledTime > milliseconds(100));
+		REQUIRE(time > milliseconds(150));
+
+		// other domains are not limited
+
+		REQUIRE(scheduler.getStats(2).numThrottled == 0);
+	}
+
+	SECTION("Check byte rate limit")
+	{
+		Scheduler scheduler;
+
+		TestClient client(1, 20, slices);
+
+		// 100 bytes per request, burst is 10 requests
+		scheduler.setRateLimit(1, 0, 10000);
+		scheduler.add(&client, 1);
+		scheduler.activate(&client);
+
+		REQUIRE(waitProcessed(client));
+
+		scheduler.remove(&client);
+
+		auto stats = scheduler.getStats(1);
+
+		REQUIRE(stats.numBytes == 2000);
+		REQUIRE(stats.numThrottled > 0);
+	}
+
+	SECTION("Check remove")
+	{
+		Scheduler scheduler;
+
+		TestClient client(1, 10, slices);
+
+		scheduler.add(&client, 1);
+		scheduler.remove(&client);
+		scheduler.activate(&client);
+
+		sleep_for(milliseconds(20));
+
+		REQUIRE(client.getNumRequests() == 10);
+		REQUIRE(slices.empty());
+	}
+}
+
+TEST_CASE("SchedulerRingBuffer", "[scheduler]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	auto scheduler = make_shared<Scheduler>();
+
+	scheduler->setBudget(4);
+
+	TestRingBufferIn ringBuffer(7, 66, 24);
+
+	ringBuffer.setScheduler(scheduler);
+	ringBuffer.start();
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	const int cNumRequests = 20;
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		xentest_req req { XENTEST_CMD2 };
+
+		req.seq = i;
+
+		*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+		ring.req_prod_pvt++;
+	}
+
+	int notify;
+
+	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+	REQUIRE(notify);
+
+	XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+	for(int i = 0; i < 100 && sring->rsp_prod != cNumRequests; i++)
+	{
+		sleep_for(milliseconds(10));
+	}
+
+	REQUIRE(sring->rsp_prod == cNumRequests);
+
+	auto stats = scheduler->getStats(7);
+
+	REQUIRE(stats.numRequests == cNumRequests);
+	REQUIRE(stats.numBytes == cNumRequests * sizeof(xentest_req));
+	// the last slice empties the ring
+	REQUIRE(stats.numBudgetExhausted == cNumRequests / 4 - 1);
+
+	ringBuffer.stop();
+}
@@ -0,0 +1,328 @@
+/*
+ *  Test TimerWheel
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Exception.hpp"
+#include "TimerWheel.hpp"
+#include "Utils.hpp"
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::promise;
+using std::this_thread::sleep_for;
+using std::unique_ptr;
+using std::vector;
+
+using XenBackend::Exception;
+using XenBackend::Timer;
+using XenBackend::TimerWheel;
+
+TEST_CASE("TimerWheel", "[timer]")
+{
+	TimerWheel wheel;
+
+	SECTION("Check one shot")
+	{
+		promise<void> done;
+		auto future = done.get_future();
+		auto start = steady_clock::now();
+
+		Timer timer([&done] { done.set_value(); }, false, wheel);
+
+		timer.start(milliseconds(20));
+
+		REQUIRE(wheel.getNumTimers() == 1);
+		REQUIRE(future.wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+		REQUIRE(steady_clock::now() - start >= milliseconds(20));
+
+		timer.stop();
+
+		REQUIRE(wheel.getNumTimers() == 0);
+	}
+
+	SECTION("Check periodic")
+	{
+		atomic<int> count(0);
+
+		{
+			Timer timer([&count] { count++; }, true, wheel);
+
+			timer.start(milliseconds(10));
+
+			sleep_for(milliseconds(105));
+		}
+
+		REQUIRE(count >= 5);
+		REQUIRE(count <= 11);
+		REQUIRE(wheel.getNumTimers() == 0);
+	}
+
+	SECTION("Check stop before expiration")
+	{
+		atomic<int> count(0);
+		Timer timer([&count] { count++; }, false, wheel);
+
+		timer.start(milliseconds(20));
+		timer.stop();
+
+		REQUIRE(wheel.getNumTimers() == 0);
+
+		sleep_for(milliseconds(40));
+
+		REQUIRE(count == 0);
+	}
+
+	SECTION("Check restart")
+	{
+		atomic<int> count(0);
+		Timer timer([&count] { count++; }, false, wheel);
+
+		timer.start(milliseconds(5));
+
+		REQUIRE_THROWS_AS(timer.start(milliseconds(5)), Exception);
+
+		sleep_for(milliseconds(30));
+
+		REQUIRE(count == 1);
+
+		timer.start(milliseconds(5));
+
+		sleep_for(milliseconds(30));
+
+		REQUIRE(count == 2);
+	}
+
+	SECTION("Check cascade")
+	{
+		// the timer goes to the second level and is moved to the first one
+		// when the first level turns over
+
+		promise<void> done;
+		auto future = done.get_future();
+		auto start = steady_clock::now();
+
+		Timer timer([&done] { done.set_value(); }, false, wheel);
+
+		timer.start(milliseconds(300));
+
+		REQUIRE(future.wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+
+		auto time = steady_clock::now() - start;
+
+		REQUIRE(time >= milliseconds(300));
+		REQUIRE(time < milliseconds(400));
+	}
+
+	SECTION("Check order")
+	{
+		vector<int> results;
+		promise<void> done;
+		auto future = done.get_future();
+		vector<unique_ptr<Timer>> timers;
+
+		for(int i = 0; i < 5; i++)
+		{
+			timers.emplace_back(new Timer([&, i]
+			{
+				results.push_back(i);
+
+				if (results.size() == 5)
+				{
+					done.set_value();
+				}
+			}, false, wheel));
+		}
+
+		for(int i = 4; i >= 0; i--)
+		{
+			timers[i]->start(milliseconds(10 + i * 7));
+		}
+
+		REQUIRE(future.wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+		REQUIRE(results == vector<int>({ 0, 1, 2, 3, 4 }));
+	}
+
+	SECTION("Check stop from callback")
+	{
+		atomic<int> count(0);
+		promise<void> done;
+		auto future = done.get_future();
+		unique_ptr<Timer> timer;
+
+		timer.reset(new Timer([&]
+		{
+			if (++count == 3)
+			{
+				timer->stop();
+				done.set_value();
+			}
+		}, true, wheel));
+
+		timer->start(milliseconds(5));
+
+		REQUIRE(future.wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+
+		sleep_for(milliseconds(30));
+
+		REQUIRE(count == 3);
+		REQUIRE(wheel.getNumTimers() == 0);
+	}
+
+	SECTION("Check stop waits callback")
+	{
+		promise<void> started;
+		auto future = started.get_future();
+		atomic<bool> completed(false);
+
+		Timer timer([&]
+		{
+			started.set_value();
+			sleep_for(milliseconds(30));
+			completed = true;
+		}, false, wheel);
+
+		timer.start(milliseconds(1));
+
+		REQUIRE(future.wait_for(milliseconds(1000)) ==
+				std::future_status::ready);
+
+		timer.stop();
+
+		REQUIRE(completed);
+	}
+
+	SECTION("Check stop waits periodic callback")
+	{
+		promise<void> started;
+		auto future = started.get_future();
+		atomic<int> count(0);
+
+		{
+			Timer timer([&]
+			{
+				if (++count == 1)
+				{
+					started.set_value();
+				}
+
+				sleep_for(milliseconds(30));
+			}, true, wheel);
+
+			timer.start(milliseconds(1));
+
+			REQUIRE(future.wait_for(milliseconds(1000)) ==
+					std::future_status::ready);
+
+			timer.stop();
+
+			REQUIRE(wheel.getNumTimers() == 0);
+		}
+
+		// the deleted timer isn't restarted
+
+		sleep_for(milliseconds(20));
+
+		REQUIRE(count == 1);
+		REQUIRE(wheel.getNumTimers() == 0);
+	}
+}
+
+TEST_CASE("TimerWheelBenchmark", "[.benchmark]")
+{
+	const int cNumTimers = 100000;
+
+	TimerWheel wheel;
+	atomic<int> count(0);
+	vector<unique_ptr<Timer>> timers;
+
+	for(int i = 0; i < cNumTimers; i++)
+	{
+		timers.emplace_back(new Timer([&count] { count++; }, false, wheel));
+	}
+
+	// timeouts are spread over all levels of the wheel
+
+	auto start = steady_clock::now();
+
+	for(int i = 0; i < cNumTimers; i++)
+	{
+		timers[i]->start(milliseconds(1000 + (i * 7919) % 100000000));
+	}
+
+	auto startTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count();
+
+	REQUIRE(wheel.getNumTimers() == cNumTimers);
+
+	start = steady_clock::now();
+
+	for(auto& timer : timers)
+	{
+		timer->stop();
+	}
+
+	auto stopTime = duration_cast<nanoseconds>(
+			steady_clock::now() - start).count();
+
+	REQUIRE(wheel.getNumTimers() == 0);
+
+	// all timers expire within 200 ms
+
+	start = steady_clock::now();
+
+	for(int i = 0; i < cNumTimers; i++)
+	{
+		timers[i]->start(milliseconds(10 + i % 200));
+	}
+
+	while (count != cNumTimers &&
+		   steady_clock::now() - start < milliseconds(5000))
+	{
+		sleep_for(milliseconds(1));
+	}
+
+	auto fireTime = duration_cast<milliseconds>(
+			steady_clock::now() - start).count();
+
+	REQUIRE(count == cNumTimers);
+
+	cout << "Timers: " << cNumTimers << ", start: "
+		 << startTime / cNumTimers << " ns, stop: "
+		 << stopTime / cNumTimers << " ns, fire all: "
+		 << fireTime << " ms" << endl;
+}
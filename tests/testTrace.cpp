@@ -0,0 +1,276 @@
+/*
+ *  Test Trace
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "Trace.hpp"
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+#include "testRingBuffer.hpp"
+
+using std::chrono::milliseconds;
+using std::string;
+using std::stringstream;
+using std::this_thread::sleep_for;
+using std::thread;
+using std::to_string;
+using std::vector;
+
+using XenBackend::Trace;
+using XenBackend::TraceEntry;
+using XenBackend::TraceEvent;
+using XenBackend::TraceException;
+
+static string getDumpPath()
+{
+	return "/tmp/xenbe_test_" + to_string(getpid()) + ".trace";
+}
+
+static vector<TraceEntry> getEntries(uint32_t port)
+{
+	vector<TraceEntry> result;
+
+	Trace::dump(getDumpPath());
+
+	for(auto& entry : Trace::read(getDumpPath()))
+	{
+		if (entry.record.port == port)
+		{
+			result.push_back(entry);
+		}
+	}
+
+	return result;
+}
+
+static size_t countEvents(const vector<TraceEntry>& entries, TraceEvent event)
+{
+	size_t count = 0;
+
+	for(auto& entry : entries)
+	{
+		if (entry.record.event == static_cast<uint16_t>(event))
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+TEST_CASE("Trace", "[trace]")
+{
+	Trace::clear();
+
+	SECTION("Check disabled")
+	{
+		Trace::setEnabled(false);
+
+		XENBE_TRACE(Notify, 1, 1001, 0, 0);
+
+		REQUIRE(getEntries(1001).empty());
+	}
+
+	SECTION("Check threads")
+	{
+		Trace::setEnabled(true);
+
+		XENBE_TRACE(Request, 1, 1002, 1, 0);
+
+		thread t([] { XENBE_TRACE(Response, 1, 1002, 1, 1); });
+
+		t.join();
+
+		XENBE_TRACE(Notify, 1, 1002, 1, 1);
+
+		auto entries = getEntries(1002);
+
+		REQUIRE(entries.size() == 3);
+
+		// sorted by time across threads
+
+		REQUIRE(entries[0].record.event ==
+				static_cast<uint16_t>(TraceEvent::Request));
+		REQUIRE(entries[1].record.event ==
+				static_cast<uint16_t>(TraceEvent::Response));
+		REQUIRE(entries[2].record.event ==
+				static_cast<uint16_t>(TraceEvent::Notify));
+		REQUIRE(entries[0].threadId == entries[2].threadId);
+		REQUIRE(entries[0].threadId != entries[1].threadId);
+		REQUIRE(entries[1].record.cons == 1);
+
+		stringstream stream;
+
+		Trace::printTimeline(entries, stream);
+
+		REQUIRE(stream.str().find("response") != string::npos);
+	}
+
+	SECTION("Check wrap")
+	{
+		Trace::setEnabled(true);
+
+		for(uint32_t i = 0; i < Trace::cNumRecords + 10; i++)
+		{
+			XENBE_TRACE(Request, 1, 1003, i, 0);
+		}
+
+		auto entries = getEntries(1003);
+
+		REQUIRE(entries.size() == Trace::cNumRecords);
+		REQUIRE(entries[0].record.prod == 10);
+		REQUIRE(entries.back().record.prod == Trace::cNumRecords + 9);
+	}
+
+	SECTION("Check signal")
+	{
+		Trace::setEnabled(true);
+		Trace::setDumpPath(getDumpPath());
+		Trace::installSignalHandler(SIGUSR2);
+
+		remove(getDumpPath().c_str());
+
+		XENBE_TRACE(Indication, 1, 1004, 0, 0);
+
+		raise(SIGUSR2);
+
+		auto entries = Trace::read(getDumpPath());
+
+		REQUIRE(entries.size() >= 1);
+
+		signal(SIGUSR2, SIG_DFL);
+		Trace::setDumpPath("");
+	}
+
+	SECTION("Check invalid dump")
+	{
+		REQUIRE_THROWS_AS(Trace::read("/non/exist/file"), TraceException);
+	}
+
+	Trace::setEnabled(false);
+
+	remove(getDumpPath().c_str());
+}
+
+TEST_CASE("RingBufferTrace", "[trace]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	Trace::clear();
+	Trace::setEnabled(true);
+
+	TestRingBufferIn ringBuffer(4, 1010, 34);
+
+	ringBuffer.start();
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	const int cNumRequests = 4;
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		xentest_req req { XENTEST_CMD1 };
+
+		*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+		ring.req_prod_pvt++;
+	}
+
+	int notify;
+
+	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+	REQUIRE(notify);
+
+	XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+	for(int i = 0; i < 100 && sring->rsp_prod != cNumRequests; i++)
+	{
+		sleep_for(milliseconds(10));
+	}
+
+	ringBuffer.stop();
+
+	SECTION("Check events")
+	{
+		auto entries = getEntries(1010);
+
+		REQUIRE(countEvents(entries, TraceEvent::Indication) == 1);
+		REQUIRE(countEvents(entries, TraceEvent::Request) == cNumRequests);
+		REQUIRE(countEvents(entries, TraceEvent::Response) == cNumRequests);
+		REQUIRE(countEvents(entries, TraceEvent::Notify) >= 1);
+		REQUIRE(entries[0].record.domId == 4);
+	}
+
+	SECTION("Check dump on error")
+	{
+		Trace::setDumpPath(getDumpPath());
+
+		remove(getDumpPath().c_str());
+
+		ringBuffer.setErrorCallback([](const std::exception&) {});
+		ringBuffer.start();
+
+		sring->req_prod = ring.nr_ents + 10;
+
+		XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+		vector<TraceEntry> entries;
+
+		for(int i = 0; i < 100; i++)
+		{
+			sleep_for(milliseconds(10));
+
+			try
+			{
+				entries = Trace::read(getDumpPath());
+
+				break;
+			}
+			catch(const TraceException&)
+			{
+			}
+		}
+
+		ringBuffer.stop();
+
+		Trace::setDumpPath("");
+
+		REQUIRE(countEvents(entries, TraceEvent::Overflow) == 1);
+		REQUIRE(countEvents(entries, TraceEvent::Error) == 1);
+	}
+
+	Trace::setEnabled(false);
+
+	remove(getDumpPath().c_str());
+}
@@ -0,0 +1,257 @@
+/*
+ *  Test Utils
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Utils.hpp"
+#include "mocks/Pipe.hpp"
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::lock_guard;
+using std::mutex;
+using std::promise;
+using std::runtime_error;
+using std::this_thread::sleep_for;
+using std::thread;
+using std::vector;
+
+using XenBackend::PollFd;
+using XenBackend::WorkerPool;
+
+TEST_CASE("WorkerPool", "[utils]")
+{
+	const int cNumKeys = 8;
+	const int cNumTasks = 32;
+
+	SECTION("Check ordering per key")
+	{
+		WorkerPool pool(4);
+		mutex taskMutex;
+		vector<vector<int>> results(cNumKeys);
+		atomic<bool> overlapped(false);
+		vector<atomic<int>> running(cNumKeys);
+
+		for(int task = 0; task < cNumTasks; task++)
+		{
+			for(int key = 0; key < cNumKeys; key++)
+			{
+				pool.post(key, [&, key, task]
+				{
+					if (running[key]++)
+					{
+						overlapped = true;
+					}
+
+					sleep_for(milliseconds(0));
+
+					{
+						lock_guard<mutex> lock(taskMutex);
+
+						results[key].push_back(task);
+					}
+
+					running[key]--;
+				});
+			}
+		}
+
+		pool.wait();
+
+		REQUIRE_FALSE(overlapped);
+
+		for(auto& result : results)
+		{
+			REQUIRE(result.size() == cNumTasks);
+
+			for(int task = 0; task < cNumTasks; task++)
+			{
+				REQUIRE(result[task] == task);
+			}
+		}
+	}
+
+	SECTION("Check concurrency")
+	{
+		WorkerPool pool(cNumKeys);
+		atomic<int> numRunning(0);
+		atomic<int> maxRunning(0);
+
+		for(int key = 0; key < cNumKeys; key++)
+		{
+			pool.post(key, [&]
+			{
+				int running = ++numRunning;
+
+				for(int current = maxRunning;
+					running > current &&
+					!maxRunning.compare_exchange_weak(current, running);) {}
+
+				sleep_for(milliseconds(20));
+
+				numRunning--;
+			});
+		}
+
+		pool.wait();
+
+		REQUIRE(maxRunning > 1);
+	}
+
+	SECTION("Check synchronous mode and errors")
+	{
+		WorkerPool pool(0);
+		int numCalls = 0;
+
+		REQUIRE(pool.getNumWorkers() == 0);
+
+		pool.post(0, [&numCalls] { numCalls++; });
+		pool.post(0, [] { throw runtime_error("Task error"); });
+		pool.post(0, [&numCalls] { numCalls++; });
+
+		REQUIRE(numCalls == 2);
+	}
+
+	SECTION("Check stop completes tasks")
+	{
+		atomic<int> numCalls(0);
+
+		{
+			WorkerPool pool(2);
+
+			for(int task = 0; task < cNumTasks; task++)
+			{
+				pool.post(task % 3, [&numCalls] { numCalls++; });
+			}
+		}
+
+		REQUIRE(numCalls == cNumTasks);
+	}
+}
+
+TEST_CASE("PollFd", "[utils]")
+{
+	SECTION("Check single fd")
+	{
+		Pipe pipe;
+		PollFd pollFd(pipe.getFd(), POLLIN);
+
+		pipe.write();
+
+		REQUIRE(pollFd.poll());
+
+		pipe.read();
+		pollFd.stop();
+
+		REQUIRE_FALSE(pollFd.poll());
+	}
+
+	SECTION("Check callbacks")
+	{
+		Pipe pipe1, pipe2;
+		PollFd pollFd;
+		vector<int> results;
+
+		pollFd.addFd(pipe1.getFd(), POLLIN, [&](short int revents)
+					 { pipe1.read(); results.push_back(1); });
+		pollFd.addFd(pipe2.getFd(), POLLIN, [&](short int revents)
+					 { pipe2.read(); results.push_back(2); });
+
+		pipe2.write();
+
+		REQUIRE(pollFd.poll());
+		REQUIRE(results == vector<int>({ 2 }));
+
+		pipe1.write();
+		pipe2.write();
+
+		REQUIRE(pollFd.poll());
+		REQUIRE(results == vector<int>({ 2, 1, 2 }));
+	}
+
+	SECTION("Check remove in callback")
+	{
+		Pipe pipe1, pipe2;
+		PollFd pollFd;
+		int count = 0;
+
+		pollFd.addFd(pipe1.getFd(), POLLIN, [&](short int revents)
+		{
+			pipe1.read();
+			pollFd.removeFd(pipe2.getFd());
+			count++;
+		});
+		pollFd.addFd(pipe2.getFd(), POLLIN, [&](short int revents)
+					 { count += 10; });
+
+		pipe1.write();
+		pipe2.write();
+
+		REQUIRE(pollFd.poll());
+		REQUIRE(count == 1);
+
+		pollFd.stop();
+
+		REQUIRE_FALSE(pollFd.poll());
+		REQUIRE(count == 1);
+	}
+
+	SECTION("Check add while polling")
+	{
+		Pipe pipe;
+		atomic<bool> called(false);
+		PollFd pollFd;
+		promise<void> done;
+		auto future = done.get_future();
+
+		thread pollThread([&]
+		{
+			while (pollFd.poll()) {}
+
+			done.set_value();
+		});
+
+		sleep_for(milliseconds(10));
+
+		pollFd.addFd(pipe.getFd(), POLLIN, [&](short int revents)
+					 { pipe.read(); called = true; });
+
+		pipe.write();
+
+		sleep_for(milliseconds(20));
+
+		pollFd.stop();
+
+		auto status = future.wait_for(milliseconds(1000));
+
+		pollThread.join();
+
+		REQUIRE(status == std::future_status::ready);
+		REQUIRE(called);
+	}
+}
@@ -39,6 +39,7 @@ using std::vector;
 
 using XenBackend::XenStore;
 using XenBackend::XenStoreException;
+using XenBackend::XenStoreTree;
 
 static mutex gMutex;
 static condition_variable gCondVar;
@@ -182,6 +183,52 @@ TEST_CASE("XenStore", "[xenstore]")
 		REQUIRE(result.size() == 0);
 	}
 
+	SECTION("Check read tree")
+	{
+		string path = "/local/domain/3/tree";
+
+		xenStore.writeString(path + "/5/0/state", "4");
+		xenStore.writeString(path + "/5/0/frontend", "/local/domain/5/dev/0");
+		xenStore.writeString(path + "/5/1/state", "1");
+		xenStore.writeString(path + "/12/0/state", "6");
+
+		auto tree = xenStore.readTree(path + "/");
+
+		REQUIRE(tree.getRootPath() == path);
+		REQUIRE(tree.size() == 10);
+
+		REQUIRE(tree.getPath(0) == string(""));
+		REQUIRE(tree.getDepth(0) == 0);
+
+		for(size_t i = 1; i < tree.size(); i++)
+		{
+			REQUIRE(tree.find(tree.getPath(i)) == i);
+		}
+
+		auto index = tree.find("5/0/frontend");
+
+		REQUIRE(index != XenStoreTree::npos);
+		REQUIRE(tree.getValue(index) == string("/local/domain/5/dev/0"));
+		REQUIRE(tree.getDepth(index) == 3);
+
+		REQUIRE(string(tree.getValue(tree.find("12/0/state"))) == "6");
+		REQUIRE(tree.find("5/2") == XenStoreTree::npos);
+
+		tree = xenStore.readTree(path, 2);
+
+		REQUIRE(tree.size() == 6);
+		REQUIRE(tree.find("5/0/state") == XenStoreTree::npos);
+		REQUIRE(tree.find("5/1") != XenStoreTree::npos);
+
+		REQUIRE_THROWS(xenStore.readTree("/non/exist/tree"));
+
+		tree = xenStore.readTree("/", 3);
+
+		REQUIRE(tree.getRootPath() == "/");
+		REQUIRE(tree.find("local/domain/3") != XenStoreTree::npos);
+		REQUIRE(tree.find("local/domain/3/tree") == XenStoreTree::npos);
+	}
+
 	SECTION("Check watches")
 	{
 		string path = "/local/domain/3/watch1";
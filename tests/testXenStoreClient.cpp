@@ -0,0 +1,287 @@
+/*
+ *  Test XenStoreClient
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "mocks/XenStoredMock.hpp"
+#include "Utils.hpp"
+#include "XenStoreClient.hpp"
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::future;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::vector;
+
+using XenBackend::PollFd;
+using XenBackend::XenStoreClient;
+using XenBackend::XenStoreException;
+
+static string getSocketPath()
+{
+	return "/tmp/xenbe_test_" + to_string(getpid()) + ".sock";
+}
+
+class ClientLoop
+{
+public:
+
+	explicit ClientLoop(XenStoreClient& client) :
+		mClient(client),
+		mPollFd(client.getFd(), POLLIN),
+		mThread([this] { while(mPollFd.poll()) { mClient.process(); } }) {}
+
+	~ClientLoop()
+	{
+		mPollFd.stop();
+		mThread.join();
+	}
+
+private:
+
+	XenStoreClient& mClient;
+	PollFd mPollFd;
+	thread mThread;
+};
+
+TEST_CASE("XenStoreClient", "[xenstoreclient]")
+{
+	XenStoredMock xenStored(getSocketPath());
+	XenStoreClient client(xenStored.getPath());
+	ClientLoop loop(client);
+
+	SECTION("Check pipelined write/read")
+	{
+		const int cNumEntries = 256;
+		atomic<int> numWritten(0);
+		atomic<int> numErrors(0);
+
+		for(int i = 0; i < cNumEntries; i++)
+		{
+			client.write("/local/domain/3/pipeline/" + to_string(i),
+						 "Value " + to_string(i),
+						 [&](int error) { error ? numErrors++ : numWritten++; });
+		}
+
+		vector<future<string>> results;
+
+		for(int i = 0; i < cNumEntries; i++)
+		{
+			results.push_back(client.read("/local/domain/3/pipeline/" +
+										  to_string(i)));
+		}
+
+		for(int i = 0; i < cNumEntries; i++)
+		{
+			REQUIRE(results[i].get() == "Value " + to_string(i));
+		}
+
+		REQUIRE(numWritten == cNumEntries);
+		REQUIRE(numErrors == 0);
+		REQUIRE(client.getNumPending() == 0);
+
+		auto items = client.readDirectory("/local/domain/3/pipeline").get();
+
+		REQUIRE(items.size() == cNumEntries);
+	}
+
+	SECTION("Check pipelined large replies")
+	{
+		// replies fill the socket while requests are being sent
+
+		const int cNumRequests = 20000;
+		string path = "/local/domain/3/large";
+		string value(3000, 'x');
+		atomic<int> numRead(0);
+		std::promise<void> done;
+
+		xenStored.writeValue(path, value);
+
+		for(int i = 0; i < cNumRequests; i++)
+		{
+			client.read(path, [&](int error, const string& result)
+						{
+							if (!error && result == value &&
+								++numRead == cNumRequests)
+							{
+								done.set_value();
+							}
+						});
+		}
+
+		REQUIRE(done.get_future().wait_for(std::chrono::seconds(30)) ==
+				std::future_status::ready);
+		REQUIRE(client.getNumPending() == 0);
+	}
+
+	SECTION("Check remove and errors")
+	{
+		string path = "/local/domain/3/remove";
+
+		client.write(path, "Value").get();
+		client.remove(path).get();
+
+		auto result = client.read(path);
+
+		REQUIRE_THROWS_AS(result.get(), XenStoreException);
+		REQUIRE_THROWS_AS(client.remove(path).get(), XenStoreException);
+	}
+
+	SECTION("Check getting domain path")
+	{
+		std::promise<string> result;
+
+		client.getDomainPath(3, [&result](int error, const string& path)
+							 { result.set_value(path); });
+
+		REQUIRE(result.get_future().get() == "/local/domain/3");
+	}
+
+	SECTION("Check watches")
+	{
+		string path = "/local/domain/3/watch";
+		atomic<int> numEvents(0);
+		std::promise<int> done;
+
+		client.setWatch(path, [&numEvents](const string&) { numEvents++; },
+						[&done](int error) { done.set_value(error); });
+
+		REQUIRE(done.get_future().get() == 0);
+
+		xenStored.writeValue(path + "/state", "1");
+
+		// initial event and the change event
+		for(int i = 0; i < 100 && numEvents < 2; i++)
+		{
+			std::this_thread::sleep_for(milliseconds(1));
+		}
+
+		REQUIRE(numEvents == 2);
+
+		client.clearWatch(path);
+		client.write(path, "Changed").get();
+
+		REQUIRE(numEvents == 2);
+	}
+}
+
+TEST_CASE("XenStoreClientError", "[xenstoreclient]")
+{
+	REQUIRE_THROWS_AS(XenStoreClient("/non/exist/socket"), XenStoreException);
+}
+
+TEST_CASE("XenStoreClientClosed", "[xenstoreclient]")
+{
+	auto path = getSocketPath();
+
+	// the listening socket accepts connections to its queue but never
+	// replies, closing it resets queued connections
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	REQUIRE(fd >= 0);
+
+	sockaddr_un addr {};
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	unlink(path.c_str());
+
+	REQUIRE(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+	REQUIRE(listen(fd, 1) == 0);
+
+	XenStoreClient client(path);
+
+	auto result = client.read("/local/domain/3/closed");
+	std::promise<int> done;
+
+	client.write("/local/domain/3/closed", "Value",
+				 [&done](int error) { done.set_value(error); });
+
+	REQUIRE(client.getNumPending() == 2);
+
+	close(fd);
+	unlink(path.c_str());
+
+	REQUIRE_THROWS_AS(client.process(), XenStoreException);
+	REQUIRE_THROWS_AS(result.get(), XenStoreException);
+	REQUIRE(done.get_future().get() != 0);
+	REQUIRE(client.getNumPending() == 0);
+}
+
+TEST_CASE("XenStoreClientBenchmark", "[.benchmark]")
+{
+	const int cNumRequests = 10000;
+
+	XenStoredMock xenStored(getSocketPath());
+	XenStoreClient client(xenStored.getPath());
+	ClientLoop loop(client);
+
+	client.write("/local/domain/3/bench", "Value").get();
+
+	auto start = steady_clock::now();
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		client.read("/local/domain/3/bench").get();
+	}
+
+	auto serial = duration_cast<microseconds>(steady_clock::now() - start);
+
+	start = steady_clock::now();
+
+	vector<future<string>> results;
+
+	results.reserve(cNumRequests);
+
+	for(int i = 0; i < cNumRequests; i++)
+	{
+		results.push_back(client.read("/local/domain/3/bench"));
+	}
+
+	for(auto& result : results)
+	{
+		result.get();
+	}
+
+	auto pipelined = duration_cast<microseconds>(steady_clock::now() - start);
+
+	cout << "Reads: " << cNumRequests
+		 << ", serial: " << serial.count() << " us"
+		 << ", pipelined: " << pipelined.count() << " us" << endl;
+}
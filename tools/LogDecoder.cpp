@@ -0,0 +1,67 @@
+/*
+ *  Binary log decoder
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <iostream>
+#include <string>
+
+#include <xen/be/BinaryLog.hpp>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+
+using XenBackend::BinaryLog;
+
+/*
+ * Prints the binary log written by libxenbe in the text log format:
+ *
+ *     xenbe-logdecode log_file...
+ */
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		cerr << "Usage: " << argv[0] << " log_file..." << endl;
+
+		return 1;
+	}
+
+	try
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			if (argc > 2)
+			{
+				cout << argv[i] << ":" << endl;
+			}
+
+			BinaryLog::print(BinaryLog::read(argv[i]), cout);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		cerr << e.what() << endl;
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ *  Trace dump decoder
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <xen/be/Trace.hpp>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::stoul;
+using std::string;
+using std::vector;
+
+using XenBackend::Trace;
+using XenBackend::TraceEntry;
+
+/*
+ * Prints the trace dumped by libxenbe as a timeline of all threads:
+ *
+ *     xenbe-trace [-p port] dump_file...
+ */
+int main(int argc, char *argv[])
+{
+	vector<string> files;
+	bool filterPort = false;
+	uint32_t port = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-p" && i + 1 < argc)
+		{
+			filterPort = true;
+			port = stoul(argv[++i]);
+		}
+		else
+		{
+			files.push_back(arg);
+		}
+	}
+
+	if (files.empty())
+	{
+		cerr << "Usage: " << argv[0] << " [-p port] dump_file..." << endl;
+
+		return 1;
+	}
+
+	try
+	{
+		for(auto& file : files)
+		{
+			auto entries = Trace::read(file);
+
+			if (filterPort)
+			{
+				vector<TraceEntry> filtered;
+
+				for(auto& entry : entries)
+				{
+					if (entry.record.port == port)
+					{
+						filtered.push_back(entry);
+					}
+				}
+
+				entries.swap(filtered);
+			}
+
+			if (files.size() > 1)
+			{
+				cout << file << ":" << endl;
+			}
+
+			Trace::printTimeline(entries, cout);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		cerr << e.what() << endl;
+
+		return 1;
+	}
+
+	return 0;
+}